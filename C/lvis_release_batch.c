@@ -0,0 +1,604 @@
+// lvis_release_batch.c
+//
+// Multi-file conversion on the work-stealing pool (see lvis_release_batch.h).
+//
+// The inputs are identified in parallel first, then split into tasks of at
+// most chunkRecords records.  Tasks are run in waves of a few per thread:
+// while the pool renders wave N+1 into memory the calling thread writes
+// wave N, so output stays in file / record order and memory stays bounded
+// no matter how many or how large the inputs are.
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_shard.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_proj.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_dem.h"
+
+struct lvis_batch_task
+{
+   int      file;     // index into the input list
+   int64_t  first;    // first record of the chunk
+   int64_t  count;    // records in the chunk
+   char   * text;     // rendered output
+   size_t   length;
+};
+
+struct lvis_batch_job
+{
+   struct lvis_release_options * opt;
+   char                       ** inputs;
+   struct lvis_release_file    * files;
+   int                         * status;   // lvis_file_open result per input
+   struct lvis_batch_task      * tasks;
+   unsigned char              ** scratch;  // one record buffer per worker
+   struct lvis_proj              proj;     // -proj
+   double                     ** xy;       // per worker lon, lat, x, y of a chunk (-proj, -poly)
+   long                          xySize;   // positions each xy buffer holds
+   unsigned char              ** inside;   // per worker, the records of a chunk inside -poly
+   double                     ** dem;      // per worker x, y, z and DEM height of a chunk (-dem)
+   // the join of the waves: where the output goes and how far it is
+   struct lvis_batch_options   * b;
+   int64_t                     * lo,* hi;   // the records of each input converted
+   int                         * header;
+   FILE                        * out,* shardOut,* manifest;
+   int64_t                       offset,segmentStart;
+   int                           failed;
+};
+
+// a lvis_batch_waves run: the wave on the pool starts at task base
+struct lvis_batch_wave
+{
+   lvis_pool_task   run;
+   void           * context;
+   long             base;
+};
+
+void lvis_batch_defaults(struct lvis_batch_options * b)
+{
+   memset(b,0,sizeof(struct lvis_batch_options));
+   b->nthreads = -1;
+   b->chunkRecords = 0;
+   strcpy(b->suffix,".txt");
+   strcpy(b->prefix,"lvis_release");
+}
+
+void lvis_batch_add_input(char *** inputs, int * ninputs, char * name)
+{
+   // grow in powers of two
+   if((*ninputs & (*ninputs - 1)) == 0)
+     {
+	*inputs = (char **) realloc(*inputs,sizeof(char *) * (*ninputs ? *ninputs * 2 : 1));
+	if(*inputs == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the input list\n");
+	     exit(-1);
+	  }
+     }
+   (*inputs)[(*ninputs)++] = strdup(name);
+}
+
+int lvis_batch_add_list(char *** inputs, int * ninputs, char * listfile)
+{
+   FILE * fp;
+   char   line[4096];
+   int    added=0;
+   size_t n;
+
+   if((fp = fopen(listfile,"r"))==NULL)
+     {
+	fprintf(stderr,"Error opening the input list: %s\n",listfile);
+	exit(-1);
+     }
+   while(fgets(line,sizeof(line),fp)!=NULL)
+     {
+	// strip the line ending and trailing blanks, skip empty lines and comments
+	n = strlen(line);
+	while(n>0 && (line[n-1]=='\n' || line[n-1]=='\r' || line[n-1]==' ' || line[n-1]=='\t')) line[--n] = 0;
+	if(n==0 || line[0]=='#') continue;
+	lvis_batch_add_input(inputs,ninputs,line);
+	added++;
+     }
+   fclose(fp);
+   return added;
+}
+
+int lvis_batch_parse_option(int argc, char * argv[], int i, struct lvis_batch_options * b,
+			    char *** inputs, int * ninputs)
+{
+   if(strcmp(argv[i],"-threads")==0 && i+1<argc)
+     {
+	b->nthreads = atoi(argv[i+1]);
+	if(b->nthreads < 0) b->nthreads = 0;
+	return 2;
+     }
+   if(strcmp(argv[i],"-chunk")==0 && i+1<argc)
+     {
+	b->chunkRecords = atol(argv[i+1]);
+	if(b->chunkRecords < 0) b->chunkRecords = 0;
+	return 2;
+     }
+   if(strcmp(argv[i],"-list")==0 && i+1<argc)
+     {
+	lvis_batch_add_list(inputs,ninputs,argv[i+1]);
+	return 2;
+     }
+   if(strcmp(argv[i],"-odir")==0 && i+1<argc)
+     {
+	strncpy(b->outdir,argv[i+1],sizeof(b->outdir)-1);
+	return 2;
+     }
+   if((strcmp(argv[i],"--shard")==0 || strcmp(argv[i],"-shard")==0) && i+1<argc)
+     {
+	if(sscanf(argv[i+1],"%d/%d",&b->shardIndex,&b->shardCount)!=2 ||
+	   b->shardCount < 1 || b->shardIndex < 0 || b->shardIndex >= b->shardCount)
+	  {
+	     fprintf(stderr,"Invalid argument to %s (expected i/N with 0 <= i < N)\n",argv[i]);
+	     exit(-1);
+	  }
+	return 2;
+     }
+   if(strcmp(argv[i],"-prefix")==0 && i+1<argc)
+     {
+	strncpy(b->prefix,argv[i+1],sizeof(b->prefix)-1);
+	return 2;
+     }
+   if(strcmp(argv[i],"-suffix")==0 && i+1<argc)
+     {
+	strncpy(b->suffix,argv[i+1],sizeof(b->suffix)-1);
+	return 2;
+     }
+   return 0;
+}
+
+// identify one input (runs on the pool, one task per file)
+static void lvis_batch_probe(void * context, long t, int worker)
+{
+   struct lvis_batch_job * job = (struct lvis_batch_job *) context;
+
+   job->status[t] = lvis_file_open(&job->files[t],job->inputs[t],job->opt->filetype,
+				   job->opt->dataReleaseVersion,job->opt->myendian);
+   // keep the descriptor count down, files are re-opened a wave at a time
+   lvis_file_close(&job->files[t]);
+}
+
+// render one chunk of records to text (runs on the pool)
+static void lvis_batch_render(void * context, long t, int worker)
+{
+   struct lvis_batch_job       * job  = (struct lvis_batch_job *) context;
+   struct lvis_batch_task      * task = &job->tasks[t];
+   struct lvis_release_file    * f    = &job->files[task->file];
+   struct lvis_release_options * opt  = job->opt;
+   unsigned char               * buf  = job->scratch[worker];
+   double                      * lon,* lat,* x=NULL,* y=NULL,* dx,* dy,* z=NULL,* h=NULL;
+   FILE                        * out;
+   int64_t                       i,got;
+   long                          before,n;
+   int                           k=0;
+
+   task->text = NULL; task->length = 0;
+   if((out = open_memstream(&task->text,&task->length))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate output for %s\n",f->filename);
+	exit(-1);
+     }
+
+   got = lvis_file_read(f,task->first,task->count,buf);
+   if(got != task->count)
+     fprintf(stderr,"Short read in %s at record %lld\n",f->filename,(long long) (task->first+got));
+
+   // swap each item of this block if necessary
+   for(i=0;i<got;i++) swap_release_data(buf+i*f->recordSize,f->fileType,f->fileVersion,f->myendian);
+
+   // -poly: which records of the chunk are inside, in one go
+   if(opt->poly != NULL)
+     {
+	lon = job->xy[worker];
+	lat = lon + job->xySize;
+	for(i=0;i<got;i++) release_data_position(buf+i*f->recordSize,f->fileType,f->fileVersion,lon+i,lat+i);
+	lvis_poly_contains_n(opt->poly,lon,lat,got,job->inside[worker]);
+     }
+
+   // -proj: the x / y of every position of the chunk in one go
+   if(opt->proj != 0)
+     {
+	lon = job->xy[worker];
+	lat = lon + job->xySize; x = lat + job->xySize; y = x + job->xySize;
+	for(i=0,n=0;i<got;i++)
+	  n += lvis_proj_positions(buf+i*f->recordSize,f->fileType,f->fileVersion,lon+n,lat+n);
+	lvis_proj_forward(&job->proj,lon,lat,x,y,n);
+	k = (got > 0) ? (int) (n / got) : 0;
+     }
+
+   // -dem: the DEM under the shots of the chunk that will be written, in
+   // the -proj x / y of their (last) position or in lon / lat
+   if(opt->dem != NULL)
+     {
+	dx = job->dem[worker];
+	dy = dx + job->xySize; z = dy + job->xySize; h = z + job->xySize;
+	for(i=0;i<got;i++)
+	  {
+	     lvis_dem_elevation(buf+i*f->recordSize,f->fileType,f->fileVersion,dx+i,dy+i,z+i);
+	     if(!(dy[i]>opt->minlat && dy[i]<opt->maxlat && dx[i]>opt->minlon && dx[i]<opt->maxlon) ||
+		(opt->poly != NULL && !job->inside[worker][i]))
+	       dx[i] = dy[i] = NAN;
+	     else if(opt->proj != 0)
+	       {
+		  dx[i] = x[i*k+k-1];
+		  dy[i] = y[i*k+k-1];
+	       }
+	  }
+	lvis_dem_sample_n(opt->dem,worker,dx,dy,got,h);
+     }
+
+   for(i=0;i<got;i++)
+     {
+	if(opt->poly != NULL && !job->inside[worker][i]) continue;
+	before = (opt->proj != 0 || opt->dem != NULL) ? ftell(out) : 0;
+	print_release_data(out,buf+i*f->recordSize,f->fileType,f->fileVersion,opt->indexcol,
+			   (unsigned int) (task->first+i+1),opt->delim,
+			   opt->minlat,opt->maxlat,opt->minlon,opt->maxlon);
+	// a row was written (inside -lat / -lon): put x / y and the DEM in front of its end of line
+	if((opt->proj != 0 || opt->dem != NULL) && ftell(out) > before)
+	  {
+	     fseek(out,-1,SEEK_CUR);
+	     if(opt->proj != 0) lvis_proj_print(out,x+i*k,y+i*k,k,opt->delim);
+	     if(opt->dem != NULL) lvis_dem_print(out,z[i],h[i],opt->delim);
+	     fputc('\n',out);
+	  }
+     }
+   fclose(out);
+}
+
+// records of a file that will be converted (honours -n)
+static int64_t lvis_batch_records(struct lvis_release_file * f, struct lvis_release_options * opt)
+{
+   if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < f->recordCount) return opt->maxSampleNumber;
+   return f->recordCount;
+}
+
+static long lvis_batch_chunk(struct lvis_release_file * f, struct lvis_batch_options * b)
+{
+   long chunk = b->chunkRecords;
+   if(chunk <= 0) chunk = LVIS_BATCH_CHUNK_BYTES / f->recordSize;
+   return (chunk < 1) ? 1 : chunk;
+}
+
+// column headers of a file to the merged stream, returns the bytes written
+static int64_t lvis_batch_headers(FILE * out, struct lvis_release_file * f, struct lvis_release_options * opt)
+{
+   char   * text=NULL;
+   size_t   length=0;
+   FILE   * fp;
+
+   if((fp = open_memstream(&text,&length))==NULL) return 0;
+   print_release_column_headers(fp,f->fileType,f->fileVersion,opt->indexcol,opt->delim);
+   if(opt->proj != 0 || opt->dem != NULL)
+     {
+	fseek(fp,-1,SEEK_CUR);
+	if(opt->proj != 0) lvis_proj_print_headers(fp,f->fileType,f->fileVersion,opt->delim);
+	if(opt->dem != NULL) lvis_dem_print_headers(fp,opt->delim);
+	fputc('\n',fp);
+     }
+   fclose(fp);
+   fwrite(text,1,length,out);
+   free(text);
+   return (int64_t) length;
+}
+
+static FILE * lvis_batch_open_output(char * input, struct lvis_batch_options * b)
+{
+   char   name[4096];
+   char * base;
+   FILE * fp;
+
+   base = strrchr(input,'/');
+   base = (base == NULL) ? input : base+1;
+   snprintf(name,sizeof(name),"%s/%s%s",b->outdir,base,b->suffix);
+   if((fp = fopen(name,"w"))==NULL)
+     fprintf(stderr,"Error opening the output file: %s (%s)\n",name,strerror(errno));
+   return fp;
+}
+
+static void lvis_batch_wave_run(void * context, long t, int worker)
+{
+   struct lvis_batch_wave * w = (struct lvis_batch_wave *) context;
+
+   w->run(w->context,w->base + t,worker);
+}
+
+void lvis_batch_waves(struct lvis_pool * pool, long first, long last, struct lvis_release_file * files,
+		      lvis_batch_input input, lvis_pool_task run, lvis_batch_join join, void * context)
+{
+   struct lvis_batch_wave w;
+   long                   t,wave,base,next,count;
+
+   w.run = run;
+   w.context = context;
+   wave  = 2 * lvis_pool_threads(pool);
+   base  = first;
+   count = (last - first < wave) ? last - first : wave;
+   for(t=base;t<base+count;t++) lvis_file_reopen(&files[input(context,t)]);
+   w.base = base;
+   lvis_pool_run(pool,count,lvis_batch_wave_run,&w);
+   while(base < last)
+     {
+	// start wave N+1 and join wave N while it runs
+	next = base + count;
+	count = (last - next < wave) ? last - next : wave;
+	if(count > 0)
+	  {
+	     for(t=next;t<next+count;t++) lvis_file_reopen(&files[input(context,t)]);
+	     w.base = next;
+	     lvis_pool_start(pool,count,lvis_batch_wave_run,&w);
+	  }
+	for(t=base;t<next;t++)
+	  {
+	     if(join != NULL) join(context,t);
+	     if(t+1 == last || input(context,t+1) != input(context,t)) lvis_file_close(&files[input(context,t)]);
+	  }
+	lvis_pool_wait(pool);
+	base = next;
+     }
+}
+
+void lvis_batch_buffers(int threads, long records, size_t size, unsigned char *** raw, unsigned char *** canon)
+{
+   int k;
+
+   *raw = (unsigned char **) calloc(threads,sizeof(unsigned char *));
+   *canon = (unsigned char **) calloc(threads,sizeof(unsigned char *));
+   if(*raw == NULL || *canon == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the read buffers\n");
+	exit(-1);
+     }
+   for(k=0;k<threads;k++)
+     {
+	(*raw)[k] = (unsigned char *) malloc(records * LVIS_MAX_RECORD_SIZE);
+	(*canon)[k] = (unsigned char *) malloc(records * size);
+	if((*raw)[k] == NULL || (*canon)[k] == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the read buffers\n");
+	     exit(-1);
+	  }
+     }
+}
+
+void lvis_batch_free_buffers(int threads, unsigned char ** raw, unsigned char ** canon)
+{
+   int k;
+
+   if(raw == NULL) return;
+   for(k=0;k<threads;k++) { free(raw[k]); free(canon[k]); }
+   free(raw);
+   free(canon);
+}
+
+static int lvis_batch_task_input(void * context, long t)
+{
+   return ((struct lvis_batch_job *) context)->tasks[t].file;
+}
+
+// write one rendered chunk, in order, to its output
+static void lvis_batch_join_task(void * context, long t)
+{
+   struct lvis_batch_job       * job = (struct lvis_batch_job *) context;
+   struct lvis_release_options * opt = job->opt;
+   struct lvis_batch_task      * task = &job->tasks[t];
+   struct lvis_release_file    * f = &job->files[task->file];
+
+   if(task->first == job->lo[task->file])
+     {
+	// start of a file (or of this shard's piece of it)
+	job->segmentStart = job->offset;
+	if(job->b->outdir[0] != 0 && job->shardOut == NULL)
+	  {
+	     // a job whose output cannot be made is a failed job
+	     if((job->out = lvis_batch_open_output(f->filename,job->b)) == NULL) job->failed++;
+	     if(job->out != NULL && opt->topcol == 1) lvis_batch_headers(job->out,f,opt);
+	  }
+	else
+	  {
+	     job->out = (job->shardOut != NULL) ? job->shardOut : stdout;
+	     if(job->header[task->file] && task->first == 0) job->offset += lvis_batch_headers(job->out,f,opt);
+	  }
+     }
+   if(job->out != NULL && task->length > 0) fwrite(task->text,1,task->length,job->out);
+   job->offset += task->length;
+   free(task->text);
+   task->text = NULL;
+
+   if(task->first + task->count >= job->hi[task->file])
+     {
+	// end of a file, nothing renders from it any more
+	if(job->manifest != NULL)
+	  lvis_shard_manifest_segment(job->manifest,task->file,job->lo[task->file],
+				      job->hi[task->file]-job->lo[task->file],job->segmentStart,
+				      job->offset-job->segmentStart,f->filename);
+	if(job->out != NULL && job->out != stdout && job->out != job->shardOut && fclose(job->out) != 0)
+	  {
+	     fprintf(stderr,"Error closing the output of %s (%s)\n",f->filename,strerror(errno));
+	     job->failed++;
+	  }
+	if(job->out == stdout) fflush(stdout);
+	job->out = NULL;
+     }
+}
+
+int lvis_batch_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		       struct lvis_batch_options * b)
+{
+   struct lvis_batch_job   job;
+   struct lvis_pool      * pool;
+   FILE                  * shardOut=NULL,* manifest=NULL;
+   long                    ntasks=0,maxtasks,chunk;
+   int64_t                 first,* nrecords,* lo,* hi;
+   int                     i,failed=0,threads,lastType=-1,* header;
+   float                   lastVersion=-1.0;
+   size_t                  scratchSize=0;
+   char                    shardName[2048],manifestName[2048];
+
+   memset(&job,0,sizeof(job));
+   job.opt    = opt;
+   job.inputs = inputs;
+   job.files  = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file));
+   job.status = (int *) calloc(ninputs,sizeof(int));
+   nrecords   = (int64_t *) calloc(ninputs,sizeof(int64_t));
+   lo         = (int64_t *) calloc(ninputs,sizeof(int64_t));
+   hi         = (int64_t *) calloc(ninputs,sizeof(int64_t));
+   header     = (int *) calloc(ninputs,sizeof(int));
+   if(job.files == NULL || job.status == NULL || nrecords == NULL || lo == NULL || hi == NULL || header == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+
+   pool = lvis_pool_create(b->nthreads);
+   threads = lvis_pool_threads(pool);
+
+   // identify every input, in parallel
+   lvis_pool_run(pool,ninputs,lvis_batch_probe,&job);
+
+   // the records of each input to convert: all of them, or this shard's piece
+   for(i=0;i<ninputs;i++)
+     {
+	if(job.status[i] != 0) { failed++; continue; }
+	nrecords[i] = lvis_batch_records(&job.files[i],opt);
+	lo[i] = 0;
+	hi[i] = nrecords[i];
+	// in a merged stream the column headers are repeated whenever the layout changes
+	if(opt->topcol == 1 && (job.files[i].fileType != lastType || job.files[i].fileVersion != lastVersion))
+	  header[i] = 1;
+	lastType = job.files[i].fileType;
+	lastVersion = job.files[i].fileVersion;
+     }
+   if(b->shardCount > 0)
+     {
+	lvis_shard_ranges(job.files,job.status,nrecords,ninputs,b->shardIndex,b->shardCount,lo,hi);
+	lvis_shard_names(b->prefix,b->shardIndex,b->shardCount,shardName,manifestName,sizeof(shardName));
+	if((shardOut = fopen(shardName,"w"))==NULL)
+	  {
+	     fprintf(stderr,"Error opening the output file: %s (%s)\n",shardName,strerror(errno));
+	     exit(-1);
+	  }
+	manifest = lvis_shard_manifest_open(manifestName,shardName,b->shardIndex,b->shardCount,ninputs,
+					    inputs,job.status,nrecords);
+     }
+
+   // split each piece into chunks (an empty file still gets one task so it
+   // gets its header / output file)
+   maxtasks = 0;
+   for(i=0;i<ninputs;i++)
+     {
+	if(job.status[i] != 0 || lo[i] < 0) continue;
+	chunk = lvis_batch_chunk(&job.files[i],b);
+	maxtasks += (long) ((hi[i] - lo[i] + chunk - 1) / chunk) + 1;
+	if((size_t) chunk * job.files[i].recordSize > scratchSize)
+	  scratchSize = (size_t) chunk * job.files[i].recordSize;
+     }
+   job.tasks = (struct lvis_batch_task *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_batch_task));
+   job.scratch = (unsigned char **) calloc(threads,sizeof(unsigned char *));
+   if(job.tasks == NULL || job.scratch == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the task table\n");
+	exit(-1);
+     }
+   for(i=0;i<threads;i++)
+     if((job.scratch[i] = (unsigned char *) malloc(scratchSize > 0 ? scratchSize : 1))==NULL)
+       {
+	  fprintf(stderr,"Unable to allocate %lu bytes of read buffer\n",(unsigned long) scratchSize);
+	  exit(-1);
+       }
+   if(opt->proj != 0 && lvis_proj_init(&job.proj,opt->proj,opt->scalar) != 0)
+     {
+	fprintf(stderr,"Unknown projection EPSG:%d\n",opt->proj);
+	exit(-1);
+     }
+   if(opt->proj != 0 || opt->poly != NULL || opt->dem != NULL)
+     {
+	for(i=0;i<ninputs;i++)
+	  if(job.status[i] == 0 && lo[i] >= 0 && lvis_batch_chunk(&job.files[i],b) > job.xySize)
+	    job.xySize = lvis_batch_chunk(&job.files[i],b);
+	job.xy = (double **) calloc(threads,sizeof(double *));
+	job.inside = (unsigned char **) calloc(threads,sizeof(unsigned char *));
+	job.dem = (double **) calloc(threads,sizeof(double *));
+	if(job.xy == NULL || job.inside == NULL || job.dem == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the position buffers\n");
+	     exit(-1);
+	  }
+	for(i=0;i<threads;i++)
+	  {
+	     job.xy[i] = (double *) malloc(4 * LVIS_PROJ_MAX_PAIRS * job.xySize * sizeof(double));
+	     job.inside[i] = (unsigned char *) malloc(job.xySize > 0 ? job.xySize : 1);
+	     if(opt->dem != NULL) job.dem[i] = (double *) malloc(4 * LVIS_PROJ_MAX_PAIRS * job.xySize * sizeof(double));
+	     if(job.xy[i] == NULL || job.inside[i] == NULL || (opt->dem != NULL && job.dem[i] == NULL))
+	       {
+		  fprintf(stderr,"Unable to allocate the position buffers\n");
+		  exit(-1);
+	       }
+	  }
+	job.xySize *= LVIS_PROJ_MAX_PAIRS;
+     }
+   for(i=0;i<ninputs;i++)
+     {
+	if(job.status[i] != 0 || lo[i] < 0) continue;
+	chunk = lvis_batch_chunk(&job.files[i],b);
+	first = lo[i];
+	do
+	  {
+	     job.tasks[ntasks].file  = i;
+	     job.tasks[ntasks].first = first;
+	     job.tasks[ntasks].count = (hi[i] - first < chunk) ? hi[i] - first : chunk;
+	     first += job.tasks[ntasks].count;
+	     ntasks++;
+	  }
+	while(first < hi[i]);
+     }
+
+   if(opt->dem != NULL) lvis_dem_start(opt->dem,threads);
+
+   // run the waves, writing wave N while wave N+1 renders
+   job.b = b;
+   job.lo = lo;
+   job.hi = hi;
+   job.header = header;
+   job.shardOut = shardOut;
+   job.manifest = manifest;
+   lvis_batch_waves(pool,0,ntasks,job.files,lvis_batch_task_input,lvis_batch_render,lvis_batch_join_task,&job);
+   failed += job.failed;
+
+   if(shardOut != NULL)
+     {
+	fclose(shardOut);
+	lvis_shard_manifest_close(manifest,job.offset);
+     }
+
+   lvis_pool_destroy(pool);
+   if(opt->dem != NULL) lvis_dem_stop(opt->dem);
+   for(i=0;i<threads;i++) free(job.scratch[i]);
+   free(job.scratch);
+   if(job.xy != NULL)
+     {
+	for(i=0;i<threads;i++) { free(job.xy[i]); free(job.inside[i]); free(job.dem[i]); }
+	free(job.xy);
+	free(job.inside);
+	free(job.dem);
+     }
+   free(job.tasks);
+   free(job.files);
+   free(job.status);
+   free(nrecords);
+   free(lo);
+   free(hi);
+   free(header);
+   return failed;
+}
@@ -0,0 +1,66 @@
+#ifndef __LVIS_RELEASE_BATCH_H
+#define __LVIS_RELEASE_BATCH_H
+
+// lvis_release_batch.h
+//
+// Multi-file (batch) conversion.  Every input is split into chunks of
+// records and all chunks of all files are rendered to text on the
+// work-stealing pool, then written in file / record order either to one
+// merged stream (stdout) or to one output file per input (-odir).
+
+#include <stddef.h>
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+
+#ifndef  LVIS_BATCH_CHUNK_BYTES
+#define  LVIS_BATCH_CHUNK_BYTES (1024 * 1024) // input bytes per chunk when -chunk is not given
+#endif
+
+struct lvis_batch_options
+{
+   int   nthreads;       // -threads N (0 = every cpu, -1 = not given)
+   long  chunkRecords;   // -chunk N records per task (0 = about LVIS_BATCH_CHUNK_BYTES of input)
+   char  outdir[1024];   // -odir DIR, one output per input (empty = merged stdout)
+   char  suffix[64];     // -suffix .txt, appended to the input name in -odir
+   int   shardIndex;     // --shard i/N, this process converts piece i of N
+   int   shardCount;     // (0 = not sharded)
+   char  prefix[1024];   // -prefix P, shard outputs are P.shard-i-of-N.{txt,manifest}
+};
+
+void lvis_batch_defaults(struct lvis_batch_options * b);
+
+// append an input file name to a growing list
+void lvis_batch_add_input(char *** inputs, int * ninputs, char * name);
+// append every name listed in a file (one per line, '#' comments)
+int  lvis_batch_add_list(char *** inputs, int * ninputs, char * listfile);
+
+// handle the batch options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a batch option)
+int  lvis_batch_parse_option(int argc, char * argv[], int i, struct lvis_batch_options * b,
+			     char *** inputs, int * ninputs);
+
+// convert every input to text, returns the number of inputs that failed
+int  lvis_batch_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			struct lvis_batch_options * b);
+
+// the input (index into files) a task of lvis_batch_waves reads
+typedef int  (*lvis_batch_input)(void * context, long task);
+// the calling thread's part of a task of lvis_batch_waves
+typedef void (*lvis_batch_join)(void * context, long task);
+
+// run tasks first .. last-1 as the converter does: on the pool in waves of
+// two per thread, the inputs of a wave's tasks re-opened before it starts.
+// run gets the task number itself (not its place in the wave).  join (or
+// NULL) takes the tasks of wave N in order on the calling thread while wave
+// N+1 runs, and an input is closed after the join of its last task (the
+// tasks of an input have to be consecutive)
+void lvis_batch_waves(struct lvis_pool * pool, long first, long last, struct lvis_release_file * files,
+		      lvis_batch_input input, lvis_pool_task run, lvis_batch_join join, void * context);
+
+// per worker read buffers of records release records (raw) and as many
+// canonical records of size bytes (canon), for lvis_canon_read
+void lvis_batch_buffers(int threads, long records, size_t size, unsigned char *** raw, unsigned char *** canon);
+void lvis_batch_free_buffers(int threads, unsigned char ** raw, unsigned char ** canon);
+
+#endif
@@ -0,0 +1,537 @@
+// lvis_release_canon.c
+//
+// Canonical (native-endian v1.04) records and the upgrade mode, see
+// lvis_release_canon.h.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_canon.h"
+
+#ifndef  LVIS_CANON_CHUNK_BYTES
+#define  LVIS_CANON_CHUNK_BYTES (4 * 1024 * 1024) // input bytes per upgrade task
+#endif
+
+#define LVIS_CANON_COLUMN(s,field,type,kind,format) \
+  { #field, type, kind, format, offsetof(struct s,field), sizeof(((struct s *) 0)->field), \
+    sizeof(((struct s *) 0)->field) / lvis_canon_kind_size(kind) }
+#define lvis_canon_kind_size(kind) ((kind) == LVIS_CANON_UINT16 ? 2 : (kind) == LVIS_CANON_FLOAT64 ? 8 : 4)
+
+static struct lvis_canon_column lvis_canon_lce_columns[] =
+{
+   LVIS_CANON_COLUMN(lvis_lce_v1_04,lfid,"uint32",LVIS_CANON_UINT32,"%u"),
+   LVIS_CANON_COLUMN(lvis_lce_v1_04,shotnumber,"uint32",LVIS_CANON_UINT32,"%u"),
+   LVIS_CANON_COLUMN(lvis_lce_v1_04,azimuth,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lce_v1_04,incidentangle,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lce_v1_04,range,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lce_v1_04,lvistime,"float64",LVIS_CANON_FLOAT64,"%12.6f"),
+   LVIS_CANON_COLUMN(lvis_lce_v1_04,tlon,"float64",LVIS_CANON_FLOAT64,"%14.10f"),
+   LVIS_CANON_COLUMN(lvis_lce_v1_04,tlat,"float64",LVIS_CANON_FLOAT64,"%14.10f"),
+   LVIS_CANON_COLUMN(lvis_lce_v1_04,zt,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   { NULL, NULL, 0, NULL, 0, 0, 0 }
+};
+
+static struct lvis_canon_column lvis_canon_lge_columns[] =
+{
+   LVIS_CANON_COLUMN(lvis_lge_v1_04,lfid,"uint32",LVIS_CANON_UINT32,"%u"),
+   LVIS_CANON_COLUMN(lvis_lge_v1_04,shotnumber,"uint32",LVIS_CANON_UINT32,"%u"),
+   LVIS_CANON_COLUMN(lvis_lge_v1_04,azimuth,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lge_v1_04,incidentangle,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lge_v1_04,range,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lge_v1_04,lvistime,"float64",LVIS_CANON_FLOAT64,"%12.6f"),
+   LVIS_CANON_COLUMN(lvis_lge_v1_04,glon,"float64",LVIS_CANON_FLOAT64,"%14.10f"),
+   LVIS_CANON_COLUMN(lvis_lge_v1_04,glat,"float64",LVIS_CANON_FLOAT64,"%14.10f"),
+   LVIS_CANON_COLUMN(lvis_lge_v1_04,zg,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lge_v1_04,rh25,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lge_v1_04,rh50,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lge_v1_04,rh75,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lge_v1_04,rh100,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   { NULL, NULL, 0, NULL, 0, 0, 0 }
+};
+
+static struct lvis_canon_column lvis_canon_lgw_columns[] =
+{
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,lfid,"uint32",LVIS_CANON_UINT32,"%u"),
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,shotnumber,"uint32",LVIS_CANON_UINT32,"%u"),
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,azimuth,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,incidentangle,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,range,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,lvistime,"float64",LVIS_CANON_FLOAT64,"%12.6f"),
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,lon0,"float64",LVIS_CANON_FLOAT64,"%14.10f"),
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,lat0,"float64",LVIS_CANON_FLOAT64,"%14.10f"),
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,z0,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,lon527,"float64",LVIS_CANON_FLOAT64,"%14.10f"),
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,lat527,"float64",LVIS_CANON_FLOAT64,"%14.10f"),
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,z527,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,sigmean,"float32",LVIS_CANON_FLOAT32,"%9.4f"),
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,txwave,"uint16[120]",LVIS_CANON_UINT16,"%04d"),
+   LVIS_CANON_COLUMN(lvis_lgw_v1_04,rxwave,"uint16[528]",LVIS_CANON_UINT16,"%04d"),
+   { NULL, NULL, 0, NULL, 0, 0, 0 }
+};
+
+struct lvis_canon_column * lvis_canon_columns(int fileType)
+{
+   if(fileType == LVIS_RELEASE_FILETYPE_LCE) return lvis_canon_lce_columns;
+   if(fileType == LVIS_RELEASE_FILETYPE_LGE) return lvis_canon_lge_columns;
+   if(fileType == LVIS_RELEASE_FILETYPE_LGW) return lvis_canon_lgw_columns;
+   return NULL;
+}
+
+void lvis_canon_print_column(FILE * out, unsigned char * record, struct lvis_canon_column * c, char * delim)
+{
+   unsigned char * v = record + c->offset;
+   int             j;
+
+   for(j=0;j<c->count;j++)
+     {
+	if(j > 0) fprintf(out,"%s",delim);
+	if(c->kind == LVIS_CANON_UINT16)  fprintf(out,c->format,((uint16_t *) v)[j]);
+	if(c->kind == LVIS_CANON_UINT32)  fprintf(out,c->format,((uint32_t *) v)[j]);
+	if(c->kind == LVIS_CANON_FLOAT32) fprintf(out,c->format,((float *) v)[j]);
+	if(c->kind == LVIS_CANON_FLOAT64) fprintf(out,c->format,((double *) v)[j]);
+     }
+}
+
+struct lvis_canon_column * lvis_canon_find_column(int fileType, char * name)
+{
+   struct lvis_canon_column * c;
+
+   for(c=lvis_canon_columns(fileType);c->name!=NULL;c++)
+     if(strcmp(c->name,name)==0 && c->count == 1 && c->kind != LVIS_CANON_UINT16) return c;
+   return NULL;
+}
+
+double lvis_canon_value(unsigned char * record, struct lvis_canon_column * c)
+{
+   uint32_t u;
+   float    f;
+   double   d;
+
+   if(c->kind == LVIS_CANON_UINT32)  { memcpy(&u,record + c->offset,sizeof(u)); return (double) u; }
+   if(c->kind == LVIS_CANON_FLOAT32) { memcpy(&f,record + c->offset,sizeof(f)); return (double) f; }
+   memcpy(&d,record + c->offset,sizeof(d));
+   return d;
+}
+
+// every field but the magic and the byteorder mark to the other byte order
+static void lvis_canon_swap_header(struct lvis_canon_header * hdr)
+{
+   hdr->headerSize  = host_dword(hdr->headerSize,GENLIB_LITTLE_ENDIAN);
+   hdr->fileType    = host_dword(hdr->fileType,GENLIB_LITTLE_ENDIAN);
+   hdr->recordSize  = host_dword(hdr->recordSize,GENLIB_LITTLE_ENDIAN);
+   hdr->sourceVersion = host_float(hdr->sourceVersion,GENLIB_LITTLE_ENDIAN);
+   hdr->txSamples   = host_dword(hdr->txSamples,GENLIB_LITTLE_ENDIAN);
+   hdr->rxSamples   = host_dword(hdr->rxSamples,GENLIB_LITTLE_ENDIAN);
+   hdr->flags       = host_dword(hdr->flags,GENLIB_LITTLE_ENDIAN);
+   hdr->recordCount = ((uint64_t) host_dword((dword) (hdr->recordCount & 0xFFFFFFFFu),GENLIB_LITTLE_ENDIAN) << 32) |
+     host_dword((dword) (hdr->recordCount >> 32),GENLIB_LITTLE_ENDIAN);
+}
+
+int lvis_canon_read_header(char * filename, struct lvis_canon_header * hdr)
+{
+   FILE * fp;
+   int    status=-1;
+
+   if((fp = fopen(filename,"rb"))==NULL) return -1;
+   if(fread(hdr,sizeof(struct lvis_canon_header),1,fp)==1 &&
+      memcmp(hdr->magic,LVIS_CANON_MAGIC,sizeof(hdr->magic))==0)
+     {
+	// written on a host of the other byte order?  then the header is swapped too
+	if(hdr->byteorder != LVIS_CANON_BYTEORDER) lvis_canon_swap_header(hdr);
+	status = 0;
+     }
+   fclose(fp);
+   return status;
+}
+
+int lvis_canon_endian(struct lvis_canon_header * hdr)
+{
+   // host_xxx(value,GENLIB_BIG_ENDIAN) leaves the value alone, LITTLE swaps it
+   return (hdr->byteorder == LVIS_CANON_BYTEORDER) ? GENLIB_BIG_ENDIAN : GENLIB_LITTLE_ENDIAN;
+}
+
+void lvis_canon_order_header(struct lvis_canon_header * hdr, int endian, struct lvis_canon_header * out)
+{
+   *out = *hdr;
+   if(endian == GENLIB_BIG_ENDIAN) return;
+   lvis_canon_swap_header(out);
+   out->byteorder = host_dword(out->byteorder,GENLIB_LITTLE_ENDIAN);
+}
+
+int lvis_canon_check_header(char * filename, struct lvis_canon_header * hdr, int endian)
+{
+   struct lvis_canon_header back;
+
+   if(lvis_canon_read_header(filename,&back)!=0 || lvis_canon_endian(&back) != endian ||
+      back.headerSize != hdr->headerSize || back.fileType != hdr->fileType ||
+      back.recordSize != hdr->recordSize || back.sourceVersion != hdr->sourceVersion ||
+      back.txSamples != hdr->txSamples || back.rxSamples != hdr->rxSamples ||
+      back.flags != hdr->flags || back.recordCount != hdr->recordCount)
+     {
+	fprintf(stderr,"The canonical header of %s does not read back as written\n",filename);
+	return -1;
+     }
+   return 0;
+}
+
+void lvis_canon_make_header(struct lvis_canon_header * hdr, int fileType, float sourceVersion, uint64_t recordCount)
+{
+   memset(hdr,0,sizeof(struct lvis_canon_header));
+   memcpy(hdr->magic,LVIS_CANON_MAGIC,sizeof(hdr->magic));
+   hdr->byteorder     = LVIS_CANON_BYTEORDER;
+   hdr->headerSize    = LVIS_CANON_HEADER_SIZE;
+   hdr->fileType      = fileType;
+   hdr->recordSize    = lvis_record_size(fileType,(float)1.04);
+   hdr->sourceVersion = sourceVersion;
+   hdr->recordCount   = recordCount;
+   if(fileType == LVIS_RELEASE_FILETYPE_LGW)
+     {
+	hdr->rxSamples = (sourceVersion == ((float)1.04)) ? 528 : 432;
+	hdr->txSamples = 0;
+	if(sourceVersion == ((float)1.03)) hdr->txSamples = 80;
+	if(sourceVersion == ((float)1.04)) hdr->txSamples = 120;
+     }
+}
+
+// the fields every version 1.00 record lacks
+static void lvis_canon_missing(uint32_t * lfid, uint32_t * shotnumber, float * azimuth,
+			       float * incidentangle, float * range, double * lvistime)
+{
+   *lfid = LVIS_CANON_NO_ID;
+   *shotnumber = LVIS_CANON_NO_ID;
+   *azimuth = *incidentangle = *range = LVIS_CANON_NO_VALUE;
+   *lvistime = LVIS_CANON_NO_VALUE;
+}
+
+static void lvis_canon_lce(unsigned char * data, float v, struct lvis_lce_v1_04 * c)
+{
+   lvis_canon_missing(&c->lfid,&c->shotnumber,&c->azimuth,&c->incidentangle,&c->range,&c->lvistime);
+   if(v == ((float)1.00))
+     {
+	struct lvis_lce_v1_00 * r = (struct lvis_lce_v1_00 *) data;
+	c->tlon = r->tlon; c->tlat = r->tlat; c->zt = r->zt;
+     }
+   if(v == ((float)1.01))
+     {
+	struct lvis_lce_v1_01 * r = (struct lvis_lce_v1_01 *) data;
+	c->lfid = r->lfid; c->shotnumber = r->shotnumber;
+	c->tlon = r->tlon; c->tlat = r->tlat; c->zt = r->zt;
+     }
+   if(v == ((float)1.02))
+     {
+	struct lvis_lce_v1_02 * r = (struct lvis_lce_v1_02 *) data;
+	c->lfid = r->lfid; c->shotnumber = r->shotnumber; c->lvistime = r->lvistime;
+	c->tlon = r->tlon; c->tlat = r->tlat; c->zt = r->zt;
+     }
+   if(v == ((float)1.03) || v == ((float)1.04))
+     memcpy(c,data,sizeof(struct lvis_lce_v1_04));  // same layout
+}
+
+static void lvis_canon_lge(unsigned char * data, float v, struct lvis_lge_v1_04 * c)
+{
+   lvis_canon_missing(&c->lfid,&c->shotnumber,&c->azimuth,&c->incidentangle,&c->range,&c->lvistime);
+   if(v == ((float)1.00))
+     {
+	struct lvis_lge_v1_00 * r = (struct lvis_lge_v1_00 *) data;
+	c->glon = r->glon; c->glat = r->glat; c->zg = r->zg;
+	c->rh25 = r->rh25; c->rh50 = r->rh50; c->rh75 = r->rh75; c->rh100 = r->rh100;
+     }
+   if(v == ((float)1.01))
+     {
+	struct lvis_lge_v1_01 * r = (struct lvis_lge_v1_01 *) data;
+	c->lfid = r->lfid; c->shotnumber = r->shotnumber;
+	c->glon = r->glon; c->glat = r->glat; c->zg = r->zg;
+	c->rh25 = r->rh25; c->rh50 = r->rh50; c->rh75 = r->rh75; c->rh100 = r->rh100;
+     }
+   if(v == ((float)1.02))
+     {
+	struct lvis_lge_v1_02 * r = (struct lvis_lge_v1_02 *) data;
+	c->lfid = r->lfid; c->shotnumber = r->shotnumber; c->lvistime = r->lvistime;
+	c->glon = r->glon; c->glat = r->glat; c->zg = r->zg;
+	c->rh25 = r->rh25; c->rh50 = r->rh50; c->rh75 = r->rh75; c->rh100 = r->rh100;
+     }
+   if(v == ((float)1.03) || v == ((float)1.04))
+     memcpy(c,data,sizeof(struct lvis_lge_v1_04));  // same layout
+}
+
+static void lvis_canon_lgw(unsigned char * data, float v, struct lvis_lgw_v1_04 * c)
+{
+   int j;
+
+   lvis_canon_missing(&c->lfid,&c->shotnumber,&c->azimuth,&c->incidentangle,&c->range,&c->lvistime);
+   memset(c->txwave,0,sizeof(c->txwave));
+   memset(c->rxwave,0,sizeof(c->rxwave));
+   if(v == ((float)1.00))
+     {
+	struct lvis_lgw_v1_00 * r = (struct lvis_lgw_v1_00 *) data;
+	c->lon0 = r->lon0; c->lat0 = r->lat0; c->z0 = r->z0;
+	c->lon527 = r->lon431; c->lat527 = r->lat431; c->z527 = r->z431;
+	c->sigmean = r->sigmean;
+	for(j=0;j<sizeof(r->wave);j++) c->rxwave[j] = r->wave[j];
+     }
+   if(v == ((float)1.01))
+     {
+	struct lvis_lgw_v1_01 * r = (struct lvis_lgw_v1_01 *) data;
+	c->lfid = r->lfid; c->shotnumber = r->shotnumber;
+	c->lon0 = r->lon0; c->lat0 = r->lat0; c->z0 = r->z0;
+	c->lon527 = r->lon431; c->lat527 = r->lat431; c->z527 = r->z431;
+	c->sigmean = r->sigmean;
+	for(j=0;j<sizeof(r->wave);j++) c->rxwave[j] = r->wave[j];
+     }
+   if(v == ((float)1.02))
+     {
+	struct lvis_lgw_v1_02 * r = (struct lvis_lgw_v1_02 *) data;
+	c->lfid = r->lfid; c->shotnumber = r->shotnumber; c->lvistime = r->lvistime;
+	c->lon0 = r->lon0; c->lat0 = r->lat0; c->z0 = r->z0;
+	c->lon527 = r->lon431; c->lat527 = r->lat431; c->z527 = r->z431;
+	c->sigmean = r->sigmean;
+	for(j=0;j<sizeof(r->wave);j++) c->rxwave[j] = r->wave[j];
+     }
+   if(v == ((float)1.03))
+     {
+	struct lvis_lgw_v1_03 * r = (struct lvis_lgw_v1_03 *) data;
+	c->lfid = r->lfid; c->shotnumber = r->shotnumber;
+	c->azimuth = r->azimuth; c->incidentangle = r->incidentangle; c->range = r->range;
+	c->lvistime = r->lvistime;
+	c->lon0 = r->lon0; c->lat0 = r->lat0; c->z0 = r->z0;
+	c->lon527 = r->lon431; c->lat527 = r->lat431; c->z527 = r->z431;
+	c->sigmean = r->sigmean;
+	for(j=0;j<sizeof(r->txwave);j++) c->txwave[j] = r->txwave[j];
+	for(j=0;j<sizeof(r->rxwave);j++) c->rxwave[j] = r->rxwave[j];
+     }
+   if(v == ((float)1.04))
+     memcpy(c,data,sizeof(struct lvis_lgw_v1_04));
+}
+
+void lvis_canon_from_release(unsigned char * data, int fileType, float dataVersion, union lvis_canon_record * canon)
+{
+   if(fileType == LVIS_RELEASE_FILETYPE_LCE) lvis_canon_lce(data,dataVersion,&canon->lce);
+   if(fileType == LVIS_RELEASE_FILETYPE_LGE) lvis_canon_lge(data,dataVersion,&canon->lge);
+   if(fileType == LVIS_RELEASE_FILETYPE_LGW) lvis_canon_lgw(data,dataVersion,&canon->lgw);
+}
+
+int lvis_canon_native(struct lvis_release_file * f)
+{
+   return (f->canonical && f->myendian == GENLIB_BIG_ENDIAN);
+}
+
+int64_t lvis_canon_read(struct lvis_release_file * f, int64_t first, int64_t count,
+			unsigned char * raw, unsigned char * canon)
+{
+   union lvis_canon_record rec;
+   int64_t                 i,got;
+   int                     csize;
+
+   // the fast path: the file already holds what we want
+   if(lvis_canon_native(f)) return lvis_file_read(f,first,count,canon);
+
+   csize = lvis_record_size(f->fileType,(float)1.04);
+   got = lvis_file_read(f,first,count,raw);
+   for(i=0;i<got;i++)
+     {
+	swap_release_data(raw+i*f->recordSize,f->fileType,f->fileVersion,f->myendian);
+	lvis_canon_from_release(raw+i*f->recordSize,f->fileType,f->fileVersion,&rec);
+	memcpy(canon+i*csize,&rec,csize);
+     }
+   return got;
+}
+
+// -------------------------------------------------------------------------
+// upgrade mode
+
+struct lvis_canon_task
+{
+   int      file;
+   int64_t  first,count;
+};
+
+struct lvis_canon_job
+{
+   struct lvis_release_options * opt;
+   char                       ** inputs;
+   char                       ** outputs;
+   struct lvis_release_file    * files;
+   int                         * status;
+   struct lvis_canon_task      * tasks;
+   unsigned char              ** raw;     // per worker
+   unsigned char              ** canon;   // per worker
+};
+
+static void lvis_canon_probe(void * context, long t, int worker)
+{
+   struct lvis_canon_job * job = (struct lvis_canon_job *) context;
+
+   job->status[t] = lvis_file_open(&job->files[t],job->inputs[t],job->opt->filetype,
+				   job->opt->dataReleaseVersion,job->opt->myendian);
+   lvis_file_close(&job->files[t]);
+}
+
+// convert one chunk and write it in place in the (pre-sized) output
+static void lvis_canon_convert(void * context, long t, int worker)
+{
+   struct lvis_canon_job    * job  = (struct lvis_canon_job *) context;
+   struct lvis_canon_task   * task = &job->tasks[t];
+   struct lvis_release_file   f    = job->files[task->file];   // private copy, own descriptor
+   int64_t                    got,csize,want,done=0;
+   ssize_t                    status;
+   int                        out;
+
+   f.fd = -1;
+   if(lvis_file_reopen(&f)!=0) { job->status[task->file] = -1; return; }
+   if((out = open(job->outputs[task->file],O_WRONLY))<0)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",job->outputs[task->file],strerror(errno));
+	job->status[task->file] = -1;
+	lvis_file_close(&f);
+	return;
+     }
+
+   csize = lvis_record_size(f.fileType,(float)1.04);
+   got = lvis_canon_read(&f,task->first,task->count,job->raw[worker],job->canon[worker]);
+   want = got * csize;
+   while(done < want)
+     {
+	status = pwrite(out,job->canon[worker]+done,(size_t) (want-done),
+			(off_t) (LVIS_CANON_HEADER_SIZE + task->first * csize + done));
+	if(status < 0 && errno == EINTR) continue;
+	if(status <= 0) break;
+	done += status;
+     }
+   if(got != task->count || done != want)
+     {
+	fprintf(stderr,"Error upgrading %s at record %lld\n",f.filename,(long long) task->first);
+	job->status[task->file] = -1;
+     }
+   close(out);
+   lvis_file_close(&f);
+}
+
+int lvis_canon_upgrade(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		       struct lvis_batch_options * b)
+{
+   struct lvis_canon_job     job;
+   struct lvis_canon_header  hdr;
+   struct lvis_pool        * pool;
+   char                      name[4096],* base;
+   long                      ntasks=0,maxtasks=0,chunk;
+   int64_t                   first,n,canonBytes=1;
+   int                       i,threads,out,failed=0;
+
+   memset(&job,0,sizeof(job));
+   job.opt     = opt;
+   job.inputs  = inputs;
+   job.files   = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file));
+   job.status  = (int *) calloc(ninputs,sizeof(int));
+   job.outputs = (char **) calloc(ninputs,sizeof(char *));
+   if(job.files == NULL || job.status == NULL || job.outputs == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+
+   pool = lvis_pool_create(b->nthreads);
+   threads = lvis_pool_threads(pool);
+   lvis_pool_run(pool,ninputs,lvis_canon_probe,&job);
+
+   // create every output at its final size with its header, the chunks are
+   // then written in place by whichever thread gets them
+   for(i=0;i<ninputs;i++)
+     {
+	if(job.status[i] != 0) continue;
+	n = job.files[i].recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+	job.files[i].recordCount = n;
+
+	if(b->outdir[0] != 0)
+	  {
+	     base = strrchr(inputs[i],'/');
+	     base = (base == NULL) ? inputs[i] : base+1;
+	     snprintf(name,sizeof(name),"%s/%s%s",b->outdir,base,b->suffix);
+	  }
+	else
+	  snprintf(name,sizeof(name),"%s%s",inputs[i],b->suffix);
+	job.outputs[i] = strdup(name);
+
+	lvis_canon_make_header(&hdr,job.files[i].fileType,
+			       job.files[i].canonical ? job.files[i].sourceVersion : job.files[i].fileVersion,n);
+	if((out = open(name,O_WRONLY|O_CREAT|O_TRUNC,0644))<0 ||
+	   write(out,&hdr,sizeof(hdr)) != sizeof(hdr) ||
+	   ftruncate(out,(off_t) (LVIS_CANON_HEADER_SIZE + n * (int64_t) hdr.recordSize))!=0)
+	  {
+	     fprintf(stderr,"Error creating the output file: %s (%s)\n",name,strerror(errno));
+	     job.status[i] = -1;
+	  }
+	if(out >= 0) close(out);
+
+	chunk = LVIS_CANON_CHUNK_BYTES / job.files[i].recordSize;
+	if(chunk < 1) chunk = 1;
+	maxtasks += (long) ((n + chunk - 1) / chunk);
+     }
+
+   job.tasks = (struct lvis_canon_task *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_canon_task));
+   job.raw   = (unsigned char **) calloc(threads,sizeof(unsigned char *));
+   job.canon = (unsigned char **) calloc(threads,sizeof(unsigned char *));
+   if(job.tasks == NULL || job.raw == NULL || job.canon == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the task table\n");
+	exit(-1);
+     }
+   for(i=0;i<ninputs;i++)
+     {
+	if(job.status[i] != 0) continue;
+	chunk = LVIS_CANON_CHUNK_BYTES / job.files[i].recordSize;
+	if(chunk < 1) chunk = 1;
+	for(first=0;first<job.files[i].recordCount;first+=chunk)
+	  {
+	     job.tasks[ntasks].file  = i;
+	     job.tasks[ntasks].first = first;
+	     job.tasks[ntasks].count = (job.files[i].recordCount - first < chunk) ? job.files[i].recordCount - first : chunk;
+	     // the largest chunk as v1.04 records of its type
+	     n = job.tasks[ntasks].count * (int64_t) lvis_record_size(job.files[i].fileType,(float)1.04);
+	     if(n > canonBytes) canonBytes = n;
+	     ntasks++;
+	  }
+     }
+   // a chunk is at most LVIS_CANON_CHUNK_BYTES of input (or one record)
+   for(i=0;i<threads;i++)
+     {
+	job.raw[i]   = (unsigned char *) malloc(LVIS_CANON_CHUNK_BYTES + LVIS_MAX_RECORD_SIZE);
+	job.canon[i] = (unsigned char *) malloc((size_t) canonBytes);
+	if(job.raw[i] == NULL || job.canon[i] == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the upgrade buffers\n");
+	     exit(-1);
+	  }
+     }
+
+   lvis_pool_run(pool,ntasks,lvis_canon_convert,&job);
+   lvis_pool_destroy(pool);
+
+   for(i=0;i<ninputs;i++)
+     {
+	if(job.status[i] != 0)
+	  {
+	     failed++;
+	     if(job.outputs[i] != NULL) unlink(job.outputs[i]);  // do not leave half a file behind
+	  }
+	free(job.outputs[i]);
+     }
+   for(i=0;i<threads;i++) { free(job.raw[i]); free(job.canon[i]); }
+   free(job.raw);
+   free(job.canon);
+   free(job.tasks);
+   free(job.outputs);
+   free(job.files);
+   free(job.status);
+   return failed;
+}
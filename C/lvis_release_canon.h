@@ -0,0 +1,114 @@
+#ifndef __LVIS_RELEASE_CANON_H
+#define __LVIS_RELEASE_CANON_H
+
+// lvis_release_canon.h
+//
+// The canonical layout: any LCE / LGE / LGW release (1.00 -> 1.04) rewritten
+// as native-endian v1.04 records behind a small header.  Fields the source
+// version did not have are filled with sentinels, the 8 bit wave[432] of the
+// old LGW versions is widened into the 16 bit rxwave and the header records
+// how many waveform samples are real.
+//
+// Canonical files are recognised by their header, need no detection, no
+// swapping and no version dispatch, and can be mapped straight into memory.
+// The processing modes read every input through lvis_canon_read(), which
+// hands them canonical records whatever the input was.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+
+#define LVIS_CANON_MAGIC       "LVISC104"
+#define LVIS_CANON_BYTEORDER   0x01020304
+#define LVIS_CANON_HEADER_SIZE 64
+#define LVIS_CANON_SUFFIX      ".canonical"   // default upgrade output suffix
+
+// sentinels for the fields a source version did not carry
+#define LVIS_CANON_NO_ID    0xFFFFFFFFu   // lfid, shotnumber
+#define LVIS_CANON_NO_VALUE NAN           // azimuth, incidentangle, range, lvistime
+
+#pragma pack(1)
+struct lvis_canon_header
+{
+   char     magic[8];       // LVIS_CANON_MAGIC
+   uint32_t byteorder;      // LVIS_CANON_BYTEORDER as written by the host that made the file
+   uint32_t headerSize;     // bytes before the first record
+   uint32_t fileType;       // LVIS_RELEASE_FILETYPE_xxx
+   uint32_t recordSize;     // sizeof the v1.04 structure of fileType
+   float    sourceVersion;  // release version of the file this was upgraded from
+   uint32_t txSamples;      // valid samples in txwave (lgw: 0, 80 or 120)
+   uint32_t rxSamples;      // valid samples in rxwave (lgw: 432 or 528)
+   uint32_t flags;          // reserved, 0
+   uint64_t recordCount;
+   char     reserved[16];
+};
+#pragma pack(0)
+
+// a canonical record of any type, large enough for the biggest (lgw)
+union lvis_canon_record
+{
+   struct lvis_lce_v1_04 lce;
+   struct lvis_lge_v1_04 lge;
+   struct lvis_lgw_v1_04 lgw;
+};
+
+// the fields of the canonical records, for column wise output
+#define LVIS_CANON_UINT16  0
+#define LVIS_CANON_UINT32  1
+#define LVIS_CANON_FLOAT32 2
+#define LVIS_CANON_FLOAT64 3
+
+struct lvis_canon_column
+{
+   char * name;     // as in the structure (txwave, rxwave are arrays)
+   char * type;     // for the reader of the columns: uint32, float64, uint16[528] ...
+   int    kind;     // LVIS_CANON_xxx of one element
+   char * format;   // printf format of one element, as the reader prints it
+   int    offset;   // in the record
+   int    size;     // bytes of the whole field
+   int    count;    // elements (1 for scalars)
+};
+
+// the columns of fileType, ends with a NULL name
+struct lvis_canon_column * lvis_canon_columns(int fileType);
+// print one field (array elements separated by delim)
+void lvis_canon_print_column(FILE * out, unsigned char * record, struct lvis_canon_column * c, char * delim);
+// the scalar numeric column name of fileType (not a uint16 sample), NULL if there is none
+struct lvis_canon_column * lvis_canon_find_column(int fileType, char * name);
+// the value of such a column of a canonical record
+double lvis_canon_value(unsigned char * record, struct lvis_canon_column * c);
+
+// read the header of a canonical file, returns 0 if filename is one
+int  lvis_canon_read_header(char * filename, struct lvis_canon_header * hdr);
+// the myendian value that makes the host_xxx routines read this file right
+int  lvis_canon_endian(struct lvis_canon_header * hdr);
+// fill in a header for records of fileType upgraded from sourceVersion
+void lvis_canon_make_header(struct lvis_canon_header * hdr, int fileType, float sourceVersion, uint64_t recordCount);
+// hdr (host order) as written by a host of the byte order endian
+// (lvis_canon_endian's: GENLIB_BIG_ENDIAN = this host's), into out
+void lvis_canon_order_header(struct lvis_canon_header * hdr, int endian, struct lvis_canon_header * out);
+// 0 if the header of filename reads back as hdr (host order) in the byte order endian
+int  lvis_canon_check_header(char * filename, struct lvis_canon_header * hdr, int endian);
+
+// convert one host order release record into its canonical form
+void lvis_canon_from_release(unsigned char * data, int fileType, float dataVersion, union lvis_canon_record * canon);
+
+// read count records of any input as canonical records (canon[] must hold
+// count records of the file's canonical size).  raw is scratch space for
+// count records of the input and is not needed (may be NULL) when f is
+// already canonical.  returns the number of records read
+int64_t lvis_canon_read(struct lvis_release_file * f, int64_t first, int64_t count,
+			unsigned char * raw, unsigned char * canon);
+
+// is f already canonical and in host order (no conversion needed)?
+int  lvis_canon_native(struct lvis_release_file * f);
+
+// upgrade mode: rewrite every input as a canonical file, returns the number of failures
+struct lvis_batch_options;
+int  lvis_canon_upgrade(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			struct lvis_batch_options * b);
+
+#endif
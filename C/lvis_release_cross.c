@@ -0,0 +1,837 @@
+// lvis_release_cross.c
+//
+// Crossover detection and elevation differencing (crossovers mode), see
+// lvis_release_cross.h.
+//
+// Three passes, the first and last on the pool in waves as in the other
+// modes:
+//   1. the inputs are read in chunks of whole -linestep windows; a chunk
+//      also reads the record before it, so each one knows by itself where
+//      its lines start, and averages its windows into vertices (the mean
+//      of the shots' unit vectors, so neither the 0 / 360 seam nor the
+//      poles upset it).  Only the vertices are kept: a window is a few
+//      dozen bytes for a few hundred shots.
+//   2. the vertices are projected, the centre line segments put into the
+//      cells their box covers and each cell's segments swept in order of
+//      their lowest x.  A crossing is reported by the one cell it falls
+//      in, and every segment owns its start but not its end, so each
+//      crossing comes out once.
+//   3. the shots of the two segments of every crossing are read again,
+//      the elevations interpolated and the rows rendered a block at a
+//      time, written in the order of the lines.
+// Nothing depends on the number of threads, the output is the same on any.
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_proj.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_cross.h"
+
+#define LVIS_CROSS_DEG  0.017453292519943295
+#define LVIS_CROSS_MAX_CELLS (1 << 22)
+
+// a window of shots, the vertex of a centre line
+struct lvis_cross_vertex
+{
+   double  v[3];        // the sum of the shots' unit vectors, then lon, lat
+   double  t;           // mean lvistime (NAN without)
+   double  x,y;         // projected
+   int64_t first,last;  // records of the first and last shot
+   int32_t file;
+   int32_t count;       // shots
+   int32_t start;       // a line starts here
+   int32_t line;
+};
+
+struct lvis_cross_read
+{
+   int                        file;
+   int64_t                    first,count;
+   struct lvis_cross_vertex * vertex;
+   long                       nvertex,maxvertex;
+   int                        status;    // 0, -1 on a read error
+};
+
+// segment a (vertex a to a + 1) crosses segment b at a + s, b + u
+struct lvis_cross_hit
+{
+   long   a,b;
+   double s,u;
+};
+
+// the crossings found in a range of cells
+struct lvis_cross_cells
+{
+   long                    first,count;
+   struct lvis_cross_hit * hit;
+   long                    n,max;
+};
+
+struct lvis_cross_sweep
+{
+   double xmin;
+   long   seg;
+};
+
+struct lvis_cross_block
+{
+   long   first,count;    // crossings
+   char * text;
+   size_t length;
+   long   written;        // rows (the others had no shots near enough)
+   int    status;         // 0, -1 on a read or render error
+};
+
+struct lvis_cross_job
+{
+   struct lvis_release_options * opt;
+   struct lvis_cross_options   * x;
+   struct lvis_release_file    * files;
+   struct lvis_canon_column   ** column;     // the elevation, per input
+   struct lvis_canon_column   ** ids;        // lfid, shotnumber, lvistime, per input
+   struct lvis_cross_read      * reads;
+   long                          base;       // first block of the running wave (pass 3)
+   unsigned char              ** raw;        // per worker
+   unsigned char              ** canon;      // per worker
+   struct lvis_cross_sweep    ** sweep;      // per worker
+   long                          maxsweep;
+   // the centre lines
+   struct lvis_cross_vertex    * vertex;
+   long                          nvertex;
+   // the cells
+   double                        minx,miny,size;
+   long                          ncols,nrows;
+   long                        * cellStart;  // ncols * nrows + 1
+   long                        * cellSeg;
+   struct lvis_cross_cells     * cells;
+   // the crossings
+   struct lvis_cross_hit       * hit;
+   long                          nhit;
+   struct lvis_cross_block     * blocks;
+   int                           errors;     // short reads of pass 1
+};
+
+void lvis_cross_defaults(struct lvis_cross_options * x)
+{
+   memset(x,0,sizeof(struct lvis_cross_options));
+   x->step = LVIS_CROSS_STEP;
+   x->timegap = LVIS_CROSS_TIME_GAP;
+   x->shotgap = LVIS_CROSS_SHOT_GAP;
+   x->maxDistance = LVIS_CROSS_MAX_DISTANCE;
+}
+
+int lvis_cross_parse_option(int argc, char * argv[], int i, struct lvis_cross_options * x)
+{
+   if(strcmp(argv[i],"-linestep")==0 && i+1<argc)
+     {
+	x->step = atol(argv[i+1]);
+	if(x->step < 2) x->step = 2;
+	return 2;
+     }
+   if(strcmp(argv[i],"-timegap")==0 && i+1<argc)
+     {
+	x->timegap = atof(argv[i+1]);
+	return 2;
+     }
+   if(strcmp(argv[i],"-shotgap")==0 && i+1<argc)
+     {
+	x->shotgap = atol(argv[i+1]);
+	if(x->shotgap < 1) x->shotgap = 1;
+	return 2;
+     }
+   if(strcmp(argv[i],"-crossmax")==0 && i+1<argc)
+     {
+	x->maxDistance = atof(argv[i+1]);
+	return 2;
+     }
+   return 0;
+}
+
+// is the shot at rec part of a line (a position inside -lat / -lon / -poly)?
+static int lvis_cross_inside(struct lvis_cross_job * job, unsigned char * rec, int fileType, double * lon, double * lat)
+{
+   struct lvis_release_options * opt = job->opt;
+
+   release_data_position(rec,fileType,(float)1.04,lon,lat);
+   if(!(*lon == *lon && *lat == *lat)) return 0;
+   return lvis_release_keep(opt,*lon,*lat);
+}
+
+// does a new line start at cur (prev the record before it)?
+static int lvis_cross_break(struct lvis_cross_job * job, int file, unsigned char * prev, unsigned char * cur)
+{
+   struct lvis_canon_column ** c = job->ids + 3 * file;
+   double                      a,b;
+
+   a = lvis_canon_value(prev,c[0]); b = lvis_canon_value(cur,c[0]);
+   if(a != (double) LVIS_CANON_NO_ID && b != (double) LVIS_CANON_NO_ID && a != b) return 1;
+   a = lvis_canon_value(prev,c[1]); b = lvis_canon_value(cur,c[1]);
+   if(a != (double) LVIS_CANON_NO_ID && b != (double) LVIS_CANON_NO_ID && (b - a < 1.0 || b - a > job->x->shotgap)) return 1;
+   a = lvis_canon_value(prev,c[2]); b = lvis_canon_value(cur,c[2]);
+   if(a == a && b == b && (b - a <= 0.0 || b - a > job->x->timegap)) return 1;
+   return 0;
+}
+
+// -------------------------------------------------------------------------
+// pass 1: the vertices
+
+static void lvis_cross_close(struct lvis_cross_read * task, struct lvis_cross_vertex * w, double tsum, long tcount)
+{
+   if(w->count == 0) return;
+   w->t = (tcount > 0) ? tsum / tcount : NAN;
+   if(task->nvertex == task->maxvertex)
+     {
+	task->maxvertex = 2 * task->maxvertex + 16;
+	if((task->vertex = (struct lvis_cross_vertex *) realloc(task->vertex,task->maxvertex * sizeof(struct lvis_cross_vertex)))==NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the line vertices\n");
+	     exit(-1);
+	  }
+     }
+   task->vertex[task->nvertex++] = *w;
+}
+
+static void lvis_cross_read_run(void * context, long t, int worker)
+{
+   struct lvis_cross_job    * job = (struct lvis_cross_job *) context;
+   struct lvis_cross_read   * task = &job->reads[t];
+   struct lvis_release_file * f = &job->files[task->file];
+   struct lvis_cross_vertex   w;
+   unsigned char            * rec,* prev;
+   double                     lon,lat,time,tsum=0.0,plon,plat;
+   int64_t                    i,got,first = task->first,count = task->count;
+   long                       tcount=0;
+   int                        size = lvis_record_size(f->fileType,(float)1.04),inside,previnside;
+
+   // the record before the chunk tells whether its first shot starts a line
+   if(first > 0) { first--; count++; }
+   got = lvis_canon_read(f,first,count,job->raw[worker],job->canon[worker]);
+   if(got != count) task->status = -1;
+
+   memset(&w,0,sizeof(w));
+   w.file = task->file;
+   previnside = 0;
+   prev = NULL;
+   for(i=0;i<got;i++)
+     {
+	rec = job->canon[worker] + i * size;
+	inside = lvis_cross_inside(job,rec,f->fileType,&lon,&lat);
+	if(first + i < task->first) { prev = rec; previnside = inside; continue; }
+	if(!inside)
+	  {
+	     lvis_cross_close(task,&w,tsum,tcount);
+	     memset(&w,0,sizeof(w)); w.file = task->file; tsum = 0.0; tcount = 0;
+	     prev = rec; previnside = 0;
+	     continue;
+	  }
+	if(prev == NULL || !previnside || lvis_cross_break(job,task->file,prev,rec))
+	  {
+	     lvis_cross_close(task,&w,tsum,tcount);
+	     memset(&w,0,sizeof(w)); w.file = task->file; tsum = 0.0; tcount = 0;
+	     w.start = 1;
+	  }
+	if(w.count == 0) w.first = first + i;
+	w.last = first + i;
+	plon = lon * LVIS_CROSS_DEG;
+	plat = lat * LVIS_CROSS_DEG;
+	w.v[0] += cos(plat) * cos(plon);
+	w.v[1] += cos(plat) * sin(plon);
+	w.v[2] += sin(plat);
+	time = lvis_canon_value(rec,job->ids[3 * task->file + 2]);
+	if(time == time) { tsum += time; tcount++; }
+	w.count++;
+	if(w.count == job->x->step)
+	  {
+	     lvis_cross_close(task,&w,tsum,tcount);
+	     memset(&w,0,sizeof(w)); w.file = task->file; tsum = 0.0; tcount = 0;
+	  }
+	prev = rec;
+	previnside = 1;
+     }
+   lvis_cross_close(task,&w,tsum,tcount);
+}
+
+// -------------------------------------------------------------------------
+// pass 2: the crossings
+
+static int lvis_cross_sweep_compare(const void * a, const void * b)
+{
+   const struct lvis_cross_sweep * x = (const struct lvis_cross_sweep *) a;
+   const struct lvis_cross_sweep * y = (const struct lvis_cross_sweep *) b;
+
+   if(x->xmin < y->xmin) return -1;
+   if(x->xmin > y->xmin) return 1;
+   return (x->seg < y->seg) ? -1 : (x->seg > y->seg);
+}
+
+static void lvis_cross_cell_of(struct lvis_cross_job * job, double x, double y, long * col, long * row)
+{
+   *col = (long) floor((x - job->minx) / job->size);
+   *row = (long) floor((y - job->miny) / job->size);
+   if(*col < 0) *col = 0;
+   if(*row < 0) *row = 0;
+   if(*col >= job->ncols) *col = job->ncols - 1;
+   if(*row >= job->nrows) *row = job->nrows - 1;
+}
+
+// do segments a and b cross?  s, u where along each (start in, end out)
+static int lvis_cross_intersect(struct lvis_cross_job * job, long a, long b, double * s, double * u)
+{
+   struct lvis_cross_vertex * v = job->vertex;
+   double rx = v[a+1].x - v[a].x,ry = v[a+1].y - v[a].y;
+   double qx = v[b+1].x - v[b].x,qy = v[b+1].y - v[b].y;
+   double wx = v[b].x - v[a].x,wy = v[b].y - v[a].y;
+   double d = rx * qy - ry * qx;
+
+   if(d == 0.0) return 0;   // parallel
+   *s = (wx * qy - wy * qx) / d;
+   *u = (wx * ry - wy * rx) / d;
+   return (*s >= 0.0 && *s < 1.0 && *u >= 0.0 && *u < 1.0);
+}
+
+static void lvis_cross_cells_run(void * context, long t, int worker)
+{
+   struct lvis_cross_job    * job = (struct lvis_cross_job *) context;
+   struct lvis_cross_cells  * cells = &job->cells[t];
+   struct lvis_cross_sweep  * sw = job->sweep[worker];
+   struct lvis_cross_vertex * v = job->vertex;
+   struct lvis_cross_hit    * h;
+   double                     s,u,xmax,ymin,ymax,px,py;
+   long                       cell,n,i,j,a,b,a0,b0,col,row;
+
+   for(cell=cells->first;cell<cells->first+cells->count;cell++)
+     {
+	n = job->cellStart[cell+1] - job->cellStart[cell];
+	if(n < 2) continue;
+	for(i=0;i<n;i++)
+	  {
+	     a = job->cellSeg[job->cellStart[cell] + i];
+	     sw[i].seg = a;
+	     sw[i].xmin = (v[a].x < v[a+1].x) ? v[a].x : v[a+1].x;
+	  }
+	qsort(sw,n,sizeof(struct lvis_cross_sweep),lvis_cross_sweep_compare);
+	for(i=0;i<n;i++)
+	  {
+	     a0 = sw[i].seg;
+	     xmax = (v[a0].x > v[a0+1].x) ? v[a0].x : v[a0+1].x;
+	     ymin = (v[a0].y < v[a0+1].y) ? v[a0].y : v[a0+1].y;
+	     ymax = (v[a0].y > v[a0+1].y) ? v[a0].y : v[a0+1].y;
+	     for(j=i+1;j<n && sw[j].xmin <= xmax;j++)
+	       {
+		  b0 = sw[j].seg;
+		  if((v[b0].y < ymin && v[b0+1].y < ymin) || (v[b0].y > ymax && v[b0+1].y > ymax)) continue;
+		  // neighbours on a line only meet at their shared vertex
+		  if(a0 - b0 <= 1 && b0 - a0 <= 1 && v[a0].line == v[b0].line) continue;
+		  a = (a0 < b0) ? a0 : b0;
+		  b = (a0 < b0) ? b0 : a0;
+		  if(!lvis_cross_intersect(job,a,b,&s,&u)) continue;
+		  // only the cell the crossing is in reports it
+		  px = v[a].x + s * (v[a+1].x - v[a].x);
+		  py = v[a].y + s * (v[a+1].y - v[a].y);
+		  lvis_cross_cell_of(job,px,py,&col,&row);
+		  if(row * job->ncols + col != cell) continue;
+		  if(cells->n == cells->max)
+		    {
+		       cells->max = 2 * cells->max + 64;
+		       if((cells->hit = (struct lvis_cross_hit *) realloc(cells->hit,cells->max * sizeof(struct lvis_cross_hit)))==NULL)
+			 {
+			    fprintf(stderr,"Unable to allocate the crossings\n");
+			    exit(-1);
+			 }
+		    }
+		  h = &cells->hit[cells->n++];
+		  h->a = a; h->b = b; h->s = s; h->u = u;
+	       }
+	  }
+     }
+}
+
+static int lvis_cross_hit_compare(const void * a, const void * b)
+{
+   const struct lvis_cross_hit * x = (const struct lvis_cross_hit *) a;
+   const struct lvis_cross_hit * y = (const struct lvis_cross_hit *) b;
+
+   if(x->a != y->a) return (x->a < y->a) ? -1 : 1;
+   if(x->b != y->b) return (x->b < y->b) ? -1 : 1;
+   return 0;
+}
+
+// -------------------------------------------------------------------------
+// pass 3: the elevations
+
+struct lvis_cross_side
+{
+   double  z,t,d;       // elevation, time, distance of the nearest shot
+   double  id[2];       // lfid, shotnumber of the nearest shot
+};
+
+// the elevation of the line of segment seg at lon / lat
+static int lvis_cross_side(struct lvis_cross_job * job, int worker, long seg, double s, double lon, double lat,
+			   struct lvis_cross_side * side)
+{
+   struct lvis_cross_vertex * v = job->vertex;
+   struct lvis_release_file * f = &job->files[v[seg].file];
+   unsigned char            * rec,* near[LVIS_CROSS_NEAREST];
+   double                     dist[LVIS_CROSS_NEAREST],slon,slat,z,dx,dy,d,w,wsum=0.0,zsum=0.0;
+   double                     rn,rm;
+   int64_t                    i,got,count = v[seg+1].last - v[seg].first + 1;
+   int                        size = lvis_record_size(f->fileType,(float)1.04),k,n=0;
+
+   lvis_proj_radii(lat,&rm,&rn);
+   got = lvis_canon_read(f,v[seg].first,count,job->raw[worker],job->canon[worker]);
+   if(got != count) return -1;
+   for(i=0;i<got;i++)
+     {
+	rec = job->canon[worker] + i * size;
+	if(!lvis_cross_inside(job,rec,f->fileType,&slon,&slat)) continue;
+	z = lvis_canon_value(rec,job->column[v[seg].file]);
+	if(!(z == z)) continue;
+	dx = slon - lon;
+	if(dx > 180.0) dx -= 360.0;
+	if(dx < -180.0) dx += 360.0;
+	dx *= LVIS_CROSS_DEG * rn * cos(lat * LVIS_CROSS_DEG);
+	dy = (slat - lat) * LVIS_CROSS_DEG * rm;
+	d = sqrt(dx * dx + dy * dy);
+	// keep the nearest few, in order
+	if(n == LVIS_CROSS_NEAREST && d >= dist[n-1]) continue;
+	if(n < LVIS_CROSS_NEAREST) n++;
+	for(k=n-1;k>0 && dist[k-1] > d;k--) { dist[k] = dist[k-1]; near[k] = near[k-1]; }
+	dist[k] = d;
+	near[k] = rec;
+     }
+   if(n == 0 || dist[0] > job->x->maxDistance) return 1;
+   for(k=0;k<n;k++)
+     {
+	w = 1.0 / (dist[k] * dist[k] + 1e-6);
+	zsum += w * lvis_canon_value(near[k],job->column[v[seg].file]);
+	wsum += w;
+     }
+   side->z = zsum / wsum;
+   side->d = dist[0];
+   side->t = v[seg].t + s * (v[seg+1].t - v[seg].t);
+   side->id[0] = lvis_canon_value(near[0],job->ids[3 * v[seg].file]);
+   side->id[1] = lvis_canon_value(near[0],job->ids[3 * v[seg].file + 1]);
+   return 0;
+}
+
+static void lvis_cross_render_run(void * context, long t, int worker)
+{
+   struct lvis_cross_job    * job = (struct lvis_cross_job *) context;
+   struct lvis_cross_block  * block = &job->blocks[job->base + t];
+   struct lvis_cross_vertex * v = job->vertex;
+   struct lvis_cross_hit    * h;
+   struct lvis_cross_side     side[2],tmp;
+   char                     * delim = job->opt->delim;
+   double                     lon,lat,dlon;
+   long                       k;
+   int                        j,status;
+   FILE                     * out;
+
+   if((out = open_memstream(&block->text,&block->length))==NULL)
+     {
+	block->status = -1;
+	return;
+     }
+   for(k=block->first;k<block->first+block->count;k++)
+     {
+	h = &job->hit[k];
+	dlon = v[h->a+1].v[0] - v[h->a].v[0];
+	if(dlon > 180.0) dlon -= 360.0;
+	if(dlon < -180.0) dlon += 360.0;
+	lon = v[h->a].v[0] + h->s * dlon;
+	if(lon < 0.0) lon += 360.0;
+	if(lon >= 360.0) lon -= 360.0;
+	lat = v[h->a].v[1] + h->s * (v[h->a+1].v[1] - v[h->a].v[1]);
+	for(j=0;j<2;j++)
+	  {
+	     status = lvis_cross_side(job,worker,j ? h->b : h->a,j ? h->u : h->s,lon,lat,&side[j]);
+	     if(status < 0) block->status = -1;
+	     if(status != 0) break;
+	  }
+	if(j < 2) continue;
+	// the earlier line first
+	if(side[1].t < side[0].t) { tmp = side[0]; side[0] = side[1]; side[1] = tmp; }
+	fprintf(out,"%14.10f%s%14.10f",lon,delim,lat);
+	for(j=0;j<2;j++)
+	  fprintf(out,"%s%u%s%u%s%12.6f%s%9.4f%s%8.3f",delim,(uint32_t) side[j].id[0],delim,(uint32_t) side[j].id[1],
+		  delim,side[j].t,delim,side[j].z,delim,side[j].d);
+	fprintf(out,"%s%12.6f%s%9.4f\n",delim,side[1].t - side[0].t,delim,side[1].z - side[0].z);
+	block->written++;
+     }
+   if(fclose(out)!=0) block->status = -1;
+}
+
+// -------------------------------------------------------------------------
+
+static int lvis_cross_input(void * context, long t)
+{
+   return ((struct lvis_cross_job *) context)->reads[t].file;
+}
+
+static void lvis_cross_join(void * context, long t)
+{
+   struct lvis_cross_job  * job = (struct lvis_cross_job *) context;
+   struct lvis_cross_read * task = &job->reads[t];
+
+   if(task->status != 0)
+     {
+	fprintf(stderr,"Short read in %s at record %lld\n",job->files[task->file].filename,(long long) task->first);
+	job->errors++;
+     }
+}
+
+int lvis_cross_find(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		    struct lvis_batch_options * b, struct lvis_cross_options * x)
+{
+   struct lvis_cross_job      job;
+   struct lvis_cross_vertex * v;
+   struct lvis_proj           proj;
+   struct lvis_pool         * pool;
+   unsigned char            * used;
+   char                     * field;
+   double                    * lon,* lat,* px,* py,maxx,maxy,r,zsum=0.0;
+   FILE                     * out;
+   long                       t,k,n,maxtasks=0,nreads=0,chunk,nseg=0,ncells,line=-1,pending=0;
+   long                       col0,col1,row0,row1,col,row,base,count,wave,ntasks,nblocks,written=0;
+   int64_t                    records,first;
+   int                        i,threads,epsg,errors=0;
+
+   if(!(x->timegap > 0.0) || !(x->maxDistance > 0.0))
+     {
+	fprintf(stderr,"-timegap and -crossmax must be more than 0\n");
+	return 1;
+     }
+   memset(&job,0,sizeof(job));
+   job.opt = opt;
+   job.x = x;
+   job.files = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file));
+   job.column = (struct lvis_canon_column **) calloc(ninputs,sizeof(struct lvis_canon_column *));
+   job.ids = (struct lvis_canon_column **) calloc(3 * ninputs,sizeof(struct lvis_canon_column *));
+   if(job.files == NULL || job.column == NULL || job.ids == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+   // whole windows a chunk
+   chunk = (LVIS_CROSS_CHUNK / x->step) * x->step;
+   if(chunk < x->step) chunk = x->step;
+   for(i=0;i<ninputs;i++)
+     {
+	if(lvis_file_open(&job.files[i],inputs[i],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	lvis_file_close(&job.files[i]);
+	field = x->field;
+	if(field[0] == 0 && job.files[i].fileType == LVIS_RELEASE_FILETYPE_LGE) field = "zg";
+	if(field[0] == 0 && job.files[i].fileType == LVIS_RELEASE_FILETYPE_LCE) field = "zt";
+	if(field[0] == 0 && job.files[i].fileType == LVIS_RELEASE_FILETYPE_LGW) field = "z0";
+	if((job.column[i] = lvis_canon_find_column(job.files[i].fileType,field)) == NULL)
+	  {
+	     fprintf(stderr,"%s (%s) has no numeric field '%s' to difference, see -field\n",inputs[i],
+		     lvis_file_type_name(job.files[i].fileType),field);
+	     errors++;
+	     continue;
+	  }
+	job.ids[3*i]   = lvis_canon_find_column(job.files[i].fileType,"lfid");
+	job.ids[3*i+1] = lvis_canon_find_column(job.files[i].fileType,"shotnumber");
+	job.ids[3*i+2] = lvis_canon_find_column(job.files[i].fileType,"lvistime");
+	records = job.files[i].recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < records) records = opt->maxSampleNumber;
+	job.files[i].recordCount = records;
+	maxtasks += (long) ((records + chunk - 1) / chunk);
+     }
+   if(errors > 0)
+     {
+	free(job.files);
+	free(job.column);
+	free(job.ids);
+	return errors;
+     }
+
+   job.reads = (struct lvis_cross_read *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_cross_read));
+   if(job.reads == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the task table\n");
+	exit(-1);
+     }
+   for(i=0;i<ninputs;i++)
+     for(first=0;first<job.files[i].recordCount;first+=chunk)
+       {
+	  job.reads[nreads].file  = i;
+	  job.reads[nreads].first = first;
+	  job.reads[nreads].count = (job.files[i].recordCount - first < chunk) ? job.files[i].recordCount - first : chunk;
+	  nreads++;
+       }
+
+   pool = lvis_pool_create(b->nthreads);
+   threads = lvis_pool_threads(pool);
+   wave = 2 * threads;
+   // the buffers hold a chunk (and the record before it) or the shots of a segment
+   n = (chunk + 1 > 3 * x->step) ? chunk + 1 : 3 * x->step;
+   lvis_batch_buffers(threads,n,sizeof(union lvis_canon_record),&job.raw,&job.canon);
+   job.sweep = (struct lvis_cross_sweep **) calloc(threads,sizeof(struct lvis_cross_sweep *));
+   if(job.sweep == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the crossover buffers\n");
+	exit(-1);
+     }
+
+   // pass 1: the windows of every chunk, then the lines in input order.  a
+   // window of less than half -linestep (cut short by a line break or the
+   // end of a chunk) is too lopsided across the swath to be a vertex
+   lvis_batch_waves(pool,0,nreads,job.files,lvis_cross_input,lvis_cross_read_run,lvis_cross_join,&job);
+   errors += job.errors;
+   for(t=0;t<nreads;t++) job.nvertex += job.reads[t].nvertex;
+   job.vertex = (struct lvis_cross_vertex *) malloc((job.nvertex > 0 ? job.nvertex : 1) * sizeof(struct lvis_cross_vertex));
+   lon = (double *) malloc((job.nvertex > 0 ? job.nvertex : 1) * sizeof(double));
+   lat = (double *) malloc((job.nvertex > 0 ? job.nvertex : 1) * sizeof(double));
+   if(job.vertex == NULL || lon == NULL || lat == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the line vertices\n");
+	exit(-1);
+     }
+   job.nvertex = 0;
+   for(t=0;t<nreads;t++)
+     {
+	for(k=0;k<job.reads[t].nvertex;k++)
+	  {
+	     v = &job.reads[t].vertex[k];
+	     if(v->start) pending = 1;
+	     if(2 * v->count < x->step) continue;
+	     if(pending) line++;
+	     pending = 0;
+	     v->line = line;
+	     r = sqrt(v->v[0] * v->v[0] + v->v[1] * v->v[1]);
+	     lon[job.nvertex] = atan2(v->v[1],v->v[0]) / LVIS_CROSS_DEG;
+	     lat[job.nvertex] = atan2(v->v[2],r) / LVIS_CROSS_DEG;
+	     if(lon[job.nvertex] < 0.0) lon[job.nvertex] += 360.0;
+	     zsum += lat[job.nvertex];
+	     job.vertex[job.nvertex++] = *v;
+	  }
+	free(job.reads[t].vertex);
+     }
+   free(job.reads);
+
+   // on the polar stereographic grid of -proj or of the data's hemisphere
+   epsg = opt->proj;
+   if(epsg == 0) epsg = (zsum >= 0.0) ? LVIS_PROJ_NORTH : LVIS_PROJ_SOUTH;
+   lvis_proj_init(&proj,epsg,opt->scalar);
+   px = (double *) malloc((job.nvertex > 0 ? job.nvertex : 1) * sizeof(double));
+   py = (double *) malloc((job.nvertex > 0 ? job.nvertex : 1) * sizeof(double));
+   if(px == NULL || py == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the line vertices\n");
+	exit(-1);
+     }
+   lvis_proj_forward(&proj,lon,lat,px,py,job.nvertex);
+   for(k=0;k<job.nvertex;k++)
+     {
+	job.vertex[k].x = px[k];
+	job.vertex[k].y = py[k];
+	job.vertex[k].v[0] = lon[k];
+	job.vertex[k].v[1] = lat[k];
+     }
+   free(lon);
+   free(lat);
+   free(px);
+   free(py);
+
+   // pass 2: the segments into the cells, about one a cell on average
+   job.minx = job.miny = HUGE_VAL;
+   maxx = maxy = -HUGE_VAL;
+   for(k=0;k+1<job.nvertex;k++)
+     {
+	if(job.vertex[k].line != job.vertex[k+1].line) continue;
+	nseg++;
+	for(t=k;t<=k+1;t++)
+	  {
+	     if(job.vertex[t].x < job.minx) job.minx = job.vertex[t].x;
+	     if(job.vertex[t].x > maxx) maxx = job.vertex[t].x;
+	     if(job.vertex[t].y < job.miny) job.miny = job.vertex[t].y;
+	     if(job.vertex[t].y > maxy) maxy = job.vertex[t].y;
+	  }
+     }
+   if(nseg > 0)
+     {
+	ncells = (nseg < LVIS_CROSS_MAX_CELLS) ? nseg : LVIS_CROSS_MAX_CELLS;
+	job.size = sqrt((maxx - job.minx) * (maxy - job.miny) / ncells);
+	if(!(job.size > 1.0)) job.size = 1.0;
+	job.ncols = (long) ((maxx - job.minx) / job.size) + 1;
+	job.nrows = (long) ((maxy - job.miny) / job.size) + 1;
+	while(job.ncols * job.nrows > 4 * LVIS_CROSS_MAX_CELLS)
+	  {
+	     job.size *= 2.0;
+	     job.ncols = (long) ((maxx - job.minx) / job.size) + 1;
+	     job.nrows = (long) ((maxy - job.miny) / job.size) + 1;
+	  }
+	ncells = job.ncols * job.nrows;
+	job.cellStart = (long *) calloc(ncells + 1,sizeof(long));
+	if(job.cellStart == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the cells\n");
+	     exit(-1);
+	  }
+	// count, offsets, fill
+	for(i=0;i<2;i++)
+	  {
+	     for(k=0;k+1<job.nvertex;k++)
+	       {
+		  if(job.vertex[k].line != job.vertex[k+1].line) continue;
+		  lvis_cross_cell_of(&job,job.vertex[k].x,job.vertex[k].y,&col0,&row0);
+		  lvis_cross_cell_of(&job,job.vertex[k+1].x,job.vertex[k+1].y,&col1,&row1);
+		  if(col1 < col0) { col = col0; col0 = col1; col1 = col; }
+		  if(row1 < row0) { row = row0; row0 = row1; row1 = row; }
+		  for(row=row0;row<=row1;row++)
+		    for(col=col0;col<=col1;col++)
+		      {
+			 if(i == 0) job.cellStart[row * job.ncols + col + 1]++;
+			 else job.cellSeg[job.cellStart[row * job.ncols + col]++] = k;
+		      }
+	       }
+	     if(i == 0)
+	       {
+		  for(k=0;k<ncells;k++)
+		    {
+		       if(job.cellStart[k+1] > job.maxsweep) job.maxsweep = job.cellStart[k+1];
+		       job.cellStart[k+1] += job.cellStart[k];
+		    }
+		  if((job.cellSeg = (long *) malloc((job.cellStart[ncells] > 0 ? job.cellStart[ncells] : 1) * sizeof(long)))==NULL)
+		    {
+		       fprintf(stderr,"Unable to allocate the cells\n");
+		       exit(-1);
+		    }
+	       }
+	     else
+	       {
+		  // the fill moved every start on to the next cell's
+		  for(k=ncells;k>0;k--) job.cellStart[k] = job.cellStart[k-1];
+		  job.cellStart[0] = 0;
+	       }
+	  }
+	for(i=0;i<threads;i++)
+	  if((job.sweep[i] = (struct lvis_cross_sweep *) malloc((job.maxsweep > 0 ? job.maxsweep : 1) * sizeof(struct lvis_cross_sweep)))==NULL)
+	    {
+	       fprintf(stderr,"Unable to allocate the crossover buffers\n");
+	       exit(-1);
+	    }
+	ntasks = 16 * threads;
+	if(ntasks > ncells) ntasks = ncells;
+	if((job.cells = (struct lvis_cross_cells *) calloc(ntasks,sizeof(struct lvis_cross_cells)))==NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the crossover buffers\n");
+	     exit(-1);
+	  }
+	for(t=0;t<ntasks;t++)
+	  {
+	     job.cells[t].first = ncells * t / ntasks;
+	     job.cells[t].count = ncells * (t + 1) / ntasks - job.cells[t].first;
+	  }
+	lvis_pool_run(pool,ntasks,lvis_cross_cells_run,&job);
+	for(t=0;t<ntasks;t++) job.nhit += job.cells[t].n;
+	if((job.hit = (struct lvis_cross_hit *) malloc((job.nhit > 0 ? job.nhit : 1) * sizeof(struct lvis_cross_hit)))==NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the crossings\n");
+	     exit(-1);
+	  }
+	for(n=t=0;t<ntasks;t++)
+	  {
+	     if(job.cells[t].n > 0) memcpy(job.hit + n,job.cells[t].hit,job.cells[t].n * sizeof(struct lvis_cross_hit));
+	     n += job.cells[t].n;
+	     free(job.cells[t].hit);
+	  }
+	free(job.cells);
+	free(job.cellSeg);
+	free(job.cellStart);
+	qsort(job.hit,job.nhit,sizeof(struct lvis_cross_hit),lvis_cross_hit_compare);
+     }
+
+   // pass 3: the elevations at the crossings, a wave of blocks at a time
+   if(opt->outfile[0] == 0) out = stdout;
+   else if((out = fopen(opt->outfile,"w"))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	exit(-1);
+     }
+   if(opt->topcol)
+     {
+	char * d = opt->delim;
+
+	fprintf(out,"lon%slat%slfid1%sshotnumber1%stime1%sz1%sdistance1%s",d,d,d,d,d,d,d);
+	fprintf(out,"lfid2%sshotnumber2%stime2%sz2%sdistance2%sdt%sdz\n",d,d,d,d,d,d);
+     }
+   nblocks = (job.nhit + LVIS_CROSS_BLOCK - 1) / LVIS_CROSS_BLOCK;
+   job.blocks = (struct lvis_cross_block *) calloc(nblocks > 0 ? nblocks : 1,sizeof(struct lvis_cross_block));
+   used = (unsigned char *) calloc(ninputs,1);
+   if(job.blocks == NULL || used == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the crossover blocks\n");
+	exit(-1);
+     }
+   for(t=0;t<nblocks;t++)
+     {
+	job.blocks[t].first = t * LVIS_CROSS_BLOCK;
+	job.blocks[t].count = (job.nhit - job.blocks[t].first < LVIS_CROSS_BLOCK) ? job.nhit - job.blocks[t].first : LVIS_CROSS_BLOCK;
+     }
+   for(base=0;base<nblocks;base+=count)
+     {
+	count = (nblocks - base < wave) ? nblocks - base : wave;
+	for(t=base;t<base+count;t++)
+	  for(k=job.blocks[t].first;k<job.blocks[t].first+job.blocks[t].count;k++)
+	    used[job.vertex[job.hit[k].a].file] = used[job.vertex[job.hit[k].b].file] = 1;
+	for(i=0;i<ninputs;i++)
+	  if(used[i] && lvis_file_reopen(&job.files[i])!=0) errors++;
+	job.base = base;
+	lvis_pool_run(pool,count,lvis_cross_render_run,&job);
+	for(t=base;t<base+count;t++)
+	  {
+	     struct lvis_cross_block * block = &job.blocks[t];
+
+	     if(block->status != 0)
+	       {
+		  fprintf(stderr,"Error reading the shots of crossings %ld .. %ld\n",block->first + 1,
+			  block->first + block->count);
+		  errors++;
+	       }
+	     if(block->length > 0 && fwrite(block->text,1,block->length,out) != block->length)
+	       {
+		  fprintf(stderr,"Error writing the output file: %s (%s)\n",opt->outfile[0] ? opt->outfile : "stdout",
+			  strerror(errno));
+		  exit(-1);
+	       }
+	     written += block->written;
+	     free(block->text);
+	  }
+	for(i=0;i<ninputs;i++)
+	  if(used[i]) { lvis_file_close(&job.files[i]); used[i] = 0; }
+     }
+   lvis_pool_destroy(pool);
+
+   if(out != stdout && fclose(out)!=0)
+     {
+	fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	errors++;
+     }
+   fprintf(stderr,"crossovers: %ld lines, %ld segments, %ld crossings, %ld with shots within %g m\n",line + 1,nseg,
+	   job.nhit,written,x->maxDistance);
+
+   lvis_batch_free_buffers(threads,job.raw,job.canon);
+   for(i=0;i<threads;i++) free(job.sweep[i]);
+   free(job.sweep);
+   free(job.blocks);
+   free(used);
+   free(job.hit);
+   free(job.vertex);
+   free(job.files);
+   free(job.column);
+   free(job.ids);
+   return errors;
+}
@@ -0,0 +1,66 @@
+#ifndef __LVIS_RELEASE_CROSS_H
+#define __LVIS_RELEASE_CROSS_H
+
+// lvis_release_cross.h
+//
+// crossovers mode: where two flight lines (or two passes of one) cross,
+// the elevation (-field: zg for LGE, zt for LCE, z0 for LGW) of each at
+// the crossing and their difference: a text row of lon, lat, then for
+// each line the lfid, shotnumber of its shot nearest the crossing, the
+// time it passed (lvistime), the elevation there and how far that
+// nearest shot is (m), then dt and dz (the later line minus the earlier
+// one).  The inputs are the files of a campaign, at full resolution.
+//
+// The shots of each input are cut into lines where lfid changes, the
+// shotnumber or lvistime jumps (-shotgap, -timegap) or the line leaves
+// -lat / -lon / -poly, and every -linestep shots of a line are averaged
+// into a vertex of its centre line (the mean of the scan across the
+// swath), so a crossing less than half a -linestep from the end of a line
+// is not seen.  The vertices are put on a polar stereographic grid (-proj,
+// else the hemisphere of the data) and the centre line segments into a
+// uniform grid of cells; each cell is swept along x for the pairs of
+// segments that cross inside it, on the pool.  At each crossing the
+// elevation of a line is the inverse distance weighted mean of its
+// LVIS_CROSS_NEAREST shots nearest the crossing, read again from the
+// inputs; crossings whose nearest shot is more than -crossmax metres away
+// (a gap in the data) are left out.
+
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_CROSS_STEP
+#define  LVIS_CROSS_STEP 200          // default -linestep (shots)
+#endif
+
+#ifndef  LVIS_CROSS_CHUNK
+#define  LVIS_CROSS_CHUNK 4096        // shots read per task (rounded to whole -linestep)
+#endif
+
+#define  LVIS_CROSS_TIME_GAP   5.0    // default -timegap (s)
+#define  LVIS_CROSS_SHOT_GAP   1000   // default -shotgap (shots)
+#define  LVIS_CROSS_MAX_DISTANCE 50.0 // default -crossmax (m)
+#define  LVIS_CROSS_NEAREST    4      // shots an elevation is interpolated from
+#define  LVIS_CROSS_BLOCK      64     // crossings per task
+
+struct lvis_cross_options
+{
+   long   step;          // -linestep N
+   double timegap;       // -timegap S
+   long   shotgap;       // -shotgap N
+   double maxDistance;   // -crossmax M
+   char   field[64];     // the elevation field (-field, empty = the type's default)
+};
+
+void lvis_cross_defaults(struct lvis_cross_options * x);
+
+// handle the crossover options at argv[i], returns the number of
+// arguments consumed (0 if argv[i] is not a crossover option)
+int  lvis_cross_parse_option(int argc, char * argv[], int i, struct lvis_cross_options * x);
+
+// find the crossovers of the inputs, to stdout (or opt->outfile), returns
+// 0 on success
+struct lvis_batch_options;
+int  lvis_cross_find(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		     struct lvis_batch_options * b, struct lvis_cross_options * x);
+
+#endif
@@ -0,0 +1,618 @@
+// lvis_release_decomp.c
+//
+// Gaussian decomposition of LGW waveforms (decompose mode), see
+// lvis_release_decomp.h.
+//
+// A fit of m modes has 3m parameters (amplitude, center, sigma of each).
+// Rather than keep the Jacobian (samples x 3m) the solver adds each sample's
+// row straight into J'J and J'r, which for at most LVIS_DECOMP_MAX_MODES
+// modes fit in a few tens of KB, and solves the damped system by Cholesky.
+// A step that lowers the sum of squares is kept and the damping reduced,
+// otherwise the damping grows and the step is tried again.
+//
+// The shots are split into tasks of LVIS_DECOMP_CHUNK that the pool works
+// on in waves (as in the metrics mode); each worker has its own workspace
+// and each task its own output buffer, written in input order.
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_features.h"
+#include "lvis_release_metrics.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_decomp.h"
+
+#define LVIS_DECOMP_PARAMS (3*LVIS_DECOMP_MAX_MODES)
+#define LVIS_DECOMP_MIN_SIGMA 0.25    // narrowest mode (samples)
+
+struct lvis_decomp_work
+{
+   double jtj[LVIS_DECOMP_PARAMS*LVIS_DECOMP_PARAMS];
+   double a[LVIS_DECOMP_PARAMS*LVIS_DECOMP_PARAMS];
+   double jtr[LVIS_DECOMP_PARAMS];
+   double delta[LVIS_DECOMP_PARAMS];
+   double trial[LVIS_DECOMP_PARAMS];
+   double p[LVIS_DECOMP_PARAMS];
+   float  y[528];          // return less the noise
+   float  s[528];          // ... smoothed
+   float  tx[120];         // transmit less its noise
+   int    seed[528];
+};
+
+struct lvis_decomp_task
+{
+   int             file;
+   int64_t         first,count;
+   unsigned char * buf;      // shots and their modes, as in the side file
+   size_t          length;
+   int64_t         shots,modes;
+   int             status;   // 0, -1 on a read error
+};
+
+struct lvis_decomp_job
+{
+   struct lvis_release_options * opt;
+   struct lvis_metrics_options * m;
+   struct lvis_decomp_options  * d;
+   struct lvis_release_file    * files;
+   int                         * rxSamples;   // valid samples per input
+   int                         * txSamples;
+   struct lvis_decomp_task     * tasks;
+   unsigned char              ** raw;         // per worker
+   unsigned char              ** canon;       // per worker
+   struct lvis_decomp_work    ** work;        // per worker
+   float                         kernel[2*LVIS_METRICS_MAX_RADIUS+1];
+   int                           radius;
+   // the join: the shots of the tasks, in order, to the output
+   FILE                        * out;
+   int                           binary;
+   unsigned int                  colnum;
+   int64_t                       shots,modes;
+   int                           errors;
+};
+
+void lvis_decomp_defaults(struct lvis_decomp_options * d)
+{
+   d->maxModes = LVIS_DECOMP_MODES;
+   d->txsigma = LVIS_DECOMP_TX_SIGMA;
+}
+
+int lvis_decomp_parse_option(int argc, char * argv[], int i, struct lvis_decomp_options * d)
+{
+   if(strcmp(argv[i],"-maxmodes")==0 && i+1<argc)
+     {
+	d->maxModes = atoi(argv[i+1]);
+	if(d->maxModes < 1) d->maxModes = 1;
+	if(d->maxModes > LVIS_DECOMP_MAX_MODES) d->maxModes = LVIS_DECOMP_MAX_MODES;
+	return 2;
+     }
+   if(strcmp(argv[i],"-txsigma")==0 && i+1<argc)
+     {
+	d->txsigma = atof(argv[i+1]);
+	if(d->txsigma < LVIS_DECOMP_MIN_SIGMA) d->txsigma = LVIS_DECOMP_MIN_SIGMA;
+	return 2;
+     }
+   return 0;
+}
+
+// -------------------------------------------------------------------------
+// the solver
+
+static double lvis_decomp_sse(const float * y, int lo, int hi, const double * p, int m)
+{
+   double sse=0.0,model,t;
+   int    x,k;
+
+   for(x=lo;x<=hi;x++)
+     {
+	model = 0.0;
+	for(k=0;k<m;k++)
+	  {
+	     t = (x - p[3*k+1]) / p[3*k+2];
+	     if(t > -8.0 && t < 8.0) model += p[3*k] * exp(-0.5*t*t);
+	  }
+	sse += (y[x] - model) * (y[x] - model);
+     }
+   return sse;
+}
+
+// J'J (upper triangle) and J'r at p, returns the sum of squares
+static double lvis_decomp_normal(struct lvis_decomp_work * w, const float * y, int lo, int hi,
+				 const double * p, int m)
+{
+   double g[LVIS_DECOMP_PARAMS],sse=0.0,model,r,d,t,e,f,s2;
+   int    x,k,i,j,np=3*m;
+
+   memset(w->jtj,0,sizeof(double)*np*np);
+   memset(w->jtr,0,sizeof(double)*np);
+   for(x=lo;x<=hi;x++)
+     {
+	model = 0.0;
+	for(k=0;k<m;k++)
+	  {
+	     d = x - p[3*k+1];
+	     t = d / p[3*k+2];
+	     if(t <= -8.0 || t >= 8.0) { g[3*k] = g[3*k+1] = g[3*k+2] = 0.0; continue; }
+	     e = exp(-0.5*t*t);
+	     f = p[3*k] * e;
+	     s2 = p[3*k+2] * p[3*k+2];
+	     model += f;
+	     g[3*k]   = e;
+	     g[3*k+1] = f * d / s2;
+	     g[3*k+2] = f * d * d / (s2 * p[3*k+2]);
+	  }
+	r = y[x] - model;
+	sse += r*r;
+	for(i=0;i<np;i++)
+	  {
+	     if(g[i] == 0.0) continue;
+	     w->jtr[i] += g[i] * r;
+	     for(j=i;j<np;j++) w->jtj[i*np+j] += g[i] * g[j];
+	  }
+     }
+   return sse;
+}
+
+// solve a x = b (a symmetric, full) by Cholesky in place, -1 if a is not
+// positive definite
+static int lvis_decomp_solve(double * a, double * b, double * x, int n)
+{
+   double sum;
+   int    i,j,k;
+
+   for(i=0;i<n;i++)
+     for(j=0;j<=i;j++)
+       {
+	  sum = a[i*n+j];
+	  for(k=0;k<j;k++) sum -= a[i*n+k] * a[j*n+k];
+	  if(i == j)
+	    {
+	       if(!(sum > 0.0)) return -1;
+	       a[i*n+i] = sqrt(sum);
+	    }
+	  else a[i*n+j] = sum / a[j*n+j];
+       }
+   for(i=0;i<n;i++)
+     {
+	sum = b[i];
+	for(k=0;k<i;k++) sum -= a[i*n+k] * x[k];
+	x[i] = sum / a[i*n+i];
+     }
+   for(i=n-1;i>=0;i--)
+     {
+	sum = x[i];
+	for(k=i+1;k<n;k++) sum -= a[k*n+i] * x[k];
+	x[i] = sum / a[i*n+i];
+     }
+   return 0;
+}
+
+// fit the m modes in p to y[lo..hi], returns 1 if the fit converged
+static int lvis_decomp_fit(struct lvis_decomp_work * w, const float * y, int lo, int hi, double * p, int m)
+{
+   double lambda=1e-3,sse,tsse;
+   int    it,i,j,np=3*m;
+
+   sse = lvis_decomp_normal(w,y,lo,hi,p,m);
+   for(it=0;it<LVIS_DECOMP_ITERATIONS;it++)
+     {
+	// Marquardt's damping: scale the diagonal of J'J
+	for(i=0;i<np;i++)
+	  for(j=0;j<np;j++)
+	    w->a[i*np+j] = (j >= i) ? w->jtj[i*np+j] : w->jtj[j*np+i];
+	for(i=0;i<np;i++) w->a[i*np+i] = w->a[i*np+i] * (1.0 + lambda) + 1e-12;
+	if(lvis_decomp_solve(w->a,w->jtr,w->delta,np) != 0)
+	  {
+	     lambda *= 10.0;
+	     if(lambda > 1e10) return 0;
+	     continue;
+	  }
+
+	for(i=0;i<m;i++)
+	  {
+	     w->trial[3*i]   = p[3*i] + w->delta[3*i];
+	     w->trial[3*i+1] = p[3*i+1] + w->delta[3*i+1];
+	     w->trial[3*i+2] = p[3*i+2] + w->delta[3*i+2];
+	     if(w->trial[3*i] < 0.0) w->trial[3*i] = 0.0;
+	     if(w->trial[3*i+1] < lo) w->trial[3*i+1] = lo;
+	     if(w->trial[3*i+1] > hi) w->trial[3*i+1] = hi;
+	     if(w->trial[3*i+2] < LVIS_DECOMP_MIN_SIGMA) w->trial[3*i+2] = LVIS_DECOMP_MIN_SIGMA;
+	  }
+	tsse = lvis_decomp_sse(y,lo,hi,w->trial,m);
+	if(tsse < sse)
+	  {
+	     memcpy(p,w->trial,sizeof(double)*np);
+	     if((sse - tsse) <= 1e-6 * sse) return 1;
+	     sse = lvis_decomp_normal(w,y,lo,hi,p,m);
+	     lambda /= 10.0;
+	     if(lambda < 1e-9) lambda = 1e-9;
+	  }
+	else
+	  {
+	     lambda *= 10.0;
+	     if(lambda > 1e10) return 1;   // nothing left to gain
+	  }
+     }
+   return 0;
+}
+
+// -------------------------------------------------------------------------
+// one shot
+
+// width of the transmit pulse, 0 if it has none to fit
+static double lvis_decomp_txsigma(struct lvis_decomp_work * w, struct lvis_lgw_v1_04 * lgw, int n)
+{
+   uint16_t * tx = (uint16_t *) ((unsigned char *) lgw + offsetof(struct lvis_lgw_v1_04,txwave));
+   double     noise=0.0,p[3];
+   int        i,k,left,right;
+
+   if(n <= 3) return 0.0;
+   for(k=0;k<n && k<LVIS_FEATURES_TX_NOISE;k++) noise += tx[k];
+   noise /= k;
+   for(i=0,k=0;i<n;i++)
+     {
+	w->tx[i] = tx[i] - noise;
+	if(w->tx[i] > w->tx[k]) k = i;
+     }
+   if(!(w->tx[k] > 0.0)) return 0.0;
+
+   // start from the half maximum width
+   for(left=k;left>0 && w->tx[left-1] > 0.5*w->tx[k];left--);
+   for(right=k;right<n-1 && w->tx[right+1] > 0.5*w->tx[k];right++);
+   p[0] = w->tx[k];
+   p[1] = k;
+   p[2] = (right - left + 1) / 2.3548;
+   if(p[2] < LVIS_DECOMP_MIN_SIGMA) p[2] = LVIS_DECOMP_MIN_SIGMA;
+   lvis_decomp_fit(w,w->tx,0,n-1,p,1);
+   if(!(p[2] > LVIS_DECOMP_MIN_SIGMA && p[2] < n)) return 0.0;
+   return p[2];
+}
+
+// decompose one canonical shot into buf, returns the bytes written
+static size_t lvis_decomp_shot(struct lvis_decomp_job * job, struct lvis_decomp_work * w,
+			       struct lvis_lgw_v1_04 * lgw, int n, int ntx, unsigned char * buf)
+{
+   uint16_t                * rx = (uint16_t *) ((unsigned char *) lgw + offsetof(struct lvis_lgw_v1_04,rxwave));
+   struct lvis_decomp_shot   shot;
+   struct lvis_decomp_mode   mode;
+   double                    txsigma,lon,lat,z,t;
+   float                     noise;
+   int                       i,j,k,m,lo,hi,top,bottom,nseed,threshold,maxModes,converged=0,pruned;
+
+   threshold = job->m->threshold;
+   maxModes = job->d->maxModes;
+   noise = (lgw->sigmean == lgw->sigmean) ? lgw->sigmean : 0.0;
+   if(n > 528) n = 528;
+
+   memset(&shot,0,sizeof(shot));
+   shot.lfid = lgw->lfid;
+   shot.shotnumber = lgw->shotnumber;
+   shot.lvistime = lgw->lvistime;
+   shot.noise = noise;
+   txsigma = lvis_decomp_txsigma(w,lgw,ntx);
+   if(txsigma > 0.0) shot.flags |= LVIS_DECOMP_TX_FITTED;
+   else txsigma = job->d->txsigma;
+   shot.txsigma = txsigma;
+
+   lvis_metrics_smooth(rx,n,job->kernel,job->radius,w->s);
+   for(i=0;i<n;i++)
+     {
+	w->y[i] = rx[i] - noise;
+	w->s[i] -= noise;
+     }
+   for(top=0;top<n && !(w->s[top] > threshold);top++);
+   if(top == n)
+     {
+	memcpy(buf,&shot,sizeof(shot));
+	return sizeof(shot);
+     }
+   for(bottom=n-1;!(w->s[bottom] > threshold);bottom--);
+
+   // seed a mode on every local maximum of the smoothed signal, the
+   // largest ones if there are more than -maxmodes
+   nseed = 0;
+   for(i=top;i<=bottom;i++)
+     if(w->s[i] > threshold && (i == 0 || w->s[i] > w->s[i-1]) && (i == n-1 || w->s[i] >= w->s[i+1]))
+       w->seed[nseed++] = i;
+   if(nseed == 0)
+     {
+	// a signal that only rises (to an edge of the waveform), seed its maximum
+	w->seed[nseed++] = top;
+	for(i=top;i<=bottom;i++) if(w->s[i] > w->s[w->seed[0]]) w->seed[0] = i;
+     }
+   while(nseed > maxModes)
+     {
+	for(k=0,i=1;i<nseed;i++) if(w->s[w->seed[i]] < w->s[w->seed[k]]) k = i;
+	memmove(&w->seed[k],&w->seed[k+1],(nseed-k-1)*sizeof(int));
+	nseed--;
+     }
+   m = nseed;
+   for(k=0;k<m;k++)
+     {
+	w->p[3*k]   = w->s[w->seed[k]];
+	w->p[3*k+1] = w->seed[k];
+	w->p[3*k+2] = txsigma;
+     }
+   lo = (int) floor(top - 3.0*txsigma);
+   hi = (int) ceil(bottom + 3.0*txsigma);
+   if(lo < 0) lo = 0;
+   if(hi > n-1) hi = n-1;
+
+   // fit; modes that die away (no amplitude, wider than the signal) are
+   // dropped and the rest fitted once more
+   for(pruned=1;pruned && m > 0;)
+     {
+	converged = lvis_decomp_fit(w,w->y,lo,hi,w->p,m);
+	for(pruned=0,k=0;k<m;k++)
+	  if(!(w->p[3*k] > 0.5*threshold) || w->p[3*k+2] > (hi - lo + 1))
+	    {
+	       memmove(&w->p[3*k],&w->p[3*k+3],(m-k-1)*3*sizeof(double));
+	       m--; k--;
+	       pruned = 1;
+	    }
+     }
+
+   // in order of center, top of the waveform first
+   for(i=1;i<m;i++)
+     for(k=i;k>0 && w->p[3*k+1] < w->p[3*(k-1)+1];k--)
+       for(j=0;j<3;j++) { t = w->p[3*k+j]; w->p[3*k+j] = w->p[3*(k-1)+j]; w->p[3*(k-1)+j] = t; }
+
+   shot.nmodes = m;
+   if(converged) shot.flags |= LVIS_DECOMP_CONVERGED;
+   memcpy(buf,&shot,sizeof(shot));
+   for(k=0;k<m;k++)
+     {
+	mode.amplitude = w->p[3*k];
+	mode.center = w->p[3*k+1];
+	mode.sigma = w->p[3*k+2];
+	lvis_metrics_sample_position(lgw,n,w->p[3*k+1],&lon,&lat,&z);
+	mode.z = z;
+	memcpy(buf + sizeof(shot) + k*sizeof(mode),&mode,sizeof(mode));
+     }
+   return sizeof(shot) + m*sizeof(mode);
+}
+
+static void lvis_decomp_run(void * context, long t, int worker)
+{
+   struct lvis_decomp_job    * job = (struct lvis_decomp_job *) context;
+   struct lvis_decomp_task   * task = &job->tasks[t];
+   struct lvis_release_options * opt = job->opt;
+   struct lvis_lgw_v1_04     * lgw;
+   double                      lon,lat;
+   int64_t                     i,got;
+   size_t                      size;
+
+   size = task->count * (sizeof(struct lvis_decomp_shot) + job->d->maxModes * sizeof(struct lvis_decomp_mode));
+   if((task->buf = (unsigned char *) malloc(size > 0 ? size : 1))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the decomposition output\n");
+	exit(-1);
+     }
+   task->length = 0;
+   task->shots = task->modes = 0;
+   got = lvis_canon_read(&job->files[task->file],task->first,task->count,job->raw[worker],job->canon[worker]);
+   if(got != task->count) task->status = -1;
+   for(i=0;i<got;i++)
+     {
+	lgw = ((struct lvis_lgw_v1_04 *) job->canon[worker]) + i;
+	release_data_position((unsigned char *) lgw,LVIS_RELEASE_FILETYPE_LGW,(float)1.04,&lon,&lat);
+	if(!lvis_release_keep(opt,lon,lat)) continue;
+	size = lvis_decomp_shot(job,job->work[worker],lgw,job->rxSamples[task->file],job->txSamples[task->file],
+				task->buf + task->length);
+	task->modes += (size - sizeof(struct lvis_decomp_shot)) / sizeof(struct lvis_decomp_mode);
+	task->length += size;
+	task->shots++;
+     }
+}
+
+// -------------------------------------------------------------------------
+// decompose mode
+
+static void lvis_decomp_text(FILE * out, struct lvis_decomp_task * task, struct lvis_release_options * opt,
+			     unsigned int * colnum)
+{
+   struct lvis_decomp_shot shot;
+   struct lvis_decomp_mode mode;
+   size_t                  at=0;
+   int                     k;
+
+   while(at < task->length)
+     {
+	memcpy(&shot,task->buf + at,sizeof(shot));
+	at += sizeof(shot);
+	if(opt->indexcol==1) fprintf(out,"%10i%s",(*colnum)++,opt->delim);
+	fprintf(out,"%u%s%u%s%12.6f%s%9.4f%s%9.4f%s%u",shot.lfid,opt->delim,shot.shotnumber,opt->delim,
+		shot.lvistime,opt->delim,shot.noise,opt->delim,shot.txsigma,opt->delim,shot.nmodes);
+	for(k=0;k<shot.nmodes;k++)
+	  {
+	     memcpy(&mode,task->buf + at,sizeof(mode));
+	     at += sizeof(mode);
+	     fprintf(out,"%s%9.4f%s%9.4f%s%9.4f%s%9.4f",opt->delim,mode.amplitude,opt->delim,mode.center,
+		     opt->delim,mode.sigma,opt->delim,mode.z);
+	  }
+	fprintf(out,"\n");
+     }
+}
+
+static int lvis_decomp_input(void * context, long t)
+{
+   return ((struct lvis_decomp_job *) context)->tasks[t].file;
+}
+
+// the shots of a task to the output, in input order
+static void lvis_decomp_join(void * context, long t)
+{
+   struct lvis_decomp_job  * job = (struct lvis_decomp_job *) context;
+   struct lvis_decomp_task * task = &job->tasks[t];
+
+   if(task->status != 0)
+     {
+	fprintf(stderr,"Short read in %s at record %lld\n",job->files[task->file].filename,(long long) task->first);
+	job->errors++;
+     }
+   if(job->binary)
+     {
+	if(task->length > 0 && fwrite(task->buf,task->length,1,job->out)!=1)
+	  {
+	     fprintf(stderr,"Error writing the output file: %s (%s)\n",job->opt->outfile,strerror(errno));
+	     exit(-1);
+	  }
+     }
+   else lvis_decomp_text(job->out,task,job->opt,&job->colnum);
+   job->shots += task->shots;
+   job->modes += task->modes;
+   free(task->buf);
+   task->buf = NULL;
+}
+
+int lvis_decomp_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			struct lvis_batch_options * b, struct lvis_metrics_options * m,
+			struct lvis_decomp_options * d)
+{
+   struct lvis_decomp_job    job;
+   struct lvis_decomp_header hdr;
+   struct lvis_pool        * pool;
+   FILE                    * out;
+   long                      ntasks=0,maxtasks=0;
+   int64_t                   n,first;
+   float                     version;
+   int                       k,threads,binary,errors=0;
+
+   memset(&job,0,sizeof(job));
+   job.opt = opt;
+   job.m = m;
+   job.d = d;
+   job.radius = lvis_metrics_kernel(m->smooth,job.kernel);
+   job.files = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file));
+   job.rxSamples = (int *) calloc(ninputs,sizeof(int));
+   job.txSamples = (int *) calloc(ninputs,sizeof(int));
+   if(job.files == NULL || job.rxSamples == NULL || job.txSamples == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     {
+	if(lvis_file_open(&job.files[k],inputs[k],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	lvis_file_close(&job.files[k]);
+	if(job.files[k].fileType != LVIS_RELEASE_FILETYPE_LGW)
+	  {
+	     fprintf(stderr,"%s is not an LGW file, there are no waveforms to decompose\n",inputs[k]);
+	     errors++;
+	     continue;
+	  }
+	version = job.files[k].canonical ? job.files[k].sourceVersion : job.files[k].fileVersion;
+	job.rxSamples[k] = (version == ((float)1.04)) ? 528 : 432;
+	job.txSamples[k] = 0;
+	if(version == ((float)1.03)) job.txSamples[k] = 80;
+	if(version == ((float)1.04)) job.txSamples[k] = 120;
+	if(job.files[k].canonical) { job.rxSamples[k] = job.files[k].rxSamples; job.txSamples[k] = job.files[k].txSamples; }
+	n = job.files[k].recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+	job.files[k].recordCount = n;
+	maxtasks += (long) ((n + LVIS_DECOMP_CHUNK - 1) / LVIS_DECOMP_CHUNK);
+     }
+   if(errors > 0)
+     {
+	free(job.files);
+	free(job.rxSamples);
+	free(job.txSamples);
+	return errors;
+     }
+
+   job.tasks = (struct lvis_decomp_task *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_decomp_task));
+   if(job.tasks == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the task table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     for(first=0;first<job.files[k].recordCount;first+=LVIS_DECOMP_CHUNK)
+       {
+	  job.tasks[ntasks].file  = k;
+	  job.tasks[ntasks].first = first;
+	  job.tasks[ntasks].count = (job.files[k].recordCount - first < LVIS_DECOMP_CHUNK) ?
+	    job.files[k].recordCount - first : LVIS_DECOMP_CHUNK;
+	  ntasks++;
+       }
+
+   pool = lvis_pool_create(b->nthreads);
+   threads = lvis_pool_threads(pool);
+   lvis_batch_buffers(threads,LVIS_DECOMP_CHUNK,sizeof(struct lvis_lgw_v1_04),&job.raw,&job.canon);
+   job.work = (struct lvis_decomp_work **) calloc(threads,sizeof(struct lvis_decomp_work *));
+   if(job.work == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the decomposition workspace\n");
+	exit(-1);
+     }
+   for(k=0;k<threads;k++)
+     {
+	job.work[k] = (struct lvis_decomp_work *) malloc(sizeof(struct lvis_decomp_work));
+	if(job.work[k] == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the decomposition workspace\n");
+	     exit(-1);
+	  }
+     }
+
+   // the side file header is written again with the counts at the end
+   binary = (opt->outfile[0] != 0);
+   memset(&hdr,0,sizeof(hdr));
+   memcpy(hdr.magic,LVIS_DECOMP_MAGIC,sizeof(hdr.magic));
+   hdr.byteorder = LVIS_DECOMP_BYTEORDER;
+   hdr.headerSize = LVIS_DECOMP_HEADER_SIZE;
+   hdr.maxModes = d->maxModes;
+   out = stdout;
+   if(binary && ((out = fopen(opt->outfile,"wb"))==NULL || fwrite(&hdr,sizeof(hdr),1,out)!=1))
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	exit(-1);
+     }
+   if(!binary && opt->topcol == 1)
+     {
+	if(opt->indexcol==1) fprintf(out,"index%s",opt->delim);
+	fprintf(out,"lfid%sshotnumber%slvistime%snoise%stxsigma%snmodes%samplitude%scenter%ssigma%sz%s...\n",
+		opt->delim,opt->delim,opt->delim,opt->delim,opt->delim,opt->delim,opt->delim,opt->delim,
+		opt->delim,opt->delim);
+     }
+
+   // run the waves, writing wave N while wave N+1 is worked on
+   job.binary = binary;
+   job.out = out;
+   job.colnum = 1;
+   lvis_batch_waves(pool,0,ntasks,job.files,lvis_decomp_input,lvis_decomp_run,lvis_decomp_join,&job);
+   errors += job.errors;
+   lvis_pool_destroy(pool);
+
+   if(binary)
+     {
+	hdr.shotCount = job.shots;
+	hdr.modeCount = job.modes;
+	if(fseek(out,0,SEEK_SET)!=0 || fwrite(&hdr,sizeof(hdr),1,out)!=1 || fclose(out)!=0)
+	  {
+	     fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	     errors++;
+	  }
+     }
+   fflush(stdout);
+   fprintf(stderr,"decompose: %lld shots, %lld modes\n",(long long) job.shots,(long long) job.modes);
+
+   lvis_batch_free_buffers(threads,job.raw,job.canon);
+   for(k=0;k<threads;k++) free(job.work[k]);
+   free(job.work);
+   free(job.tasks);
+   free(job.files);
+   free(job.rxSamples);
+   free(job.txSamples);
+   return errors;
+}
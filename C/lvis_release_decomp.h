@@ -0,0 +1,104 @@
+#ifndef __LVIS_RELEASE_DECOMP_H
+#define __LVIS_RELEASE_DECOMP_H
+
+// lvis_release_decomp.h
+//
+// decompose mode: every LGW return waveform written as a sum of gaussian
+// modes (amplitude, center, width).  The transmit pulse of the shot is
+// characterised first, by fitting one gaussian to txwave; its width starts
+// every return mode (releases without txwave use -txsigma).  The modes are
+// seeded at the local maxima of the smoothed return (-smooth, -featthresh
+// as in the metrics mode) and fitted together to the noise subtracted
+// return by Levenberg-Marquardt.  The solver works on the normal equations
+// only, in a fixed workspace per thread, so fitting allocates nothing.
+//
+// The output is text, or with -o a side file: a lvis_decomp_header, then
+// per shot a lvis_decomp_shot followed by its nmodes lvis_decomp_mode
+// (native endian, the header byteorder mark tells which).
+
+#include <stdint.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#define LVIS_DECOMP_MAGIC       "LVISGDC1"
+#define LVIS_DECOMP_BYTEORDER   0x01020304
+#define LVIS_DECOMP_HEADER_SIZE 64
+
+#ifndef  LVIS_DECOMP_MAX_MODES
+#define  LVIS_DECOMP_MAX_MODES 16     // modes the workspace is sized for
+#endif
+
+#ifndef  LVIS_DECOMP_MODES
+#define  LVIS_DECOMP_MODES 8          // default -maxmodes
+#endif
+
+#ifndef  LVIS_DECOMP_TX_SIGMA
+#define  LVIS_DECOMP_TX_SIGMA 3.0     // default -txsigma (samples), for shots without txwave
+#endif
+
+#ifndef  LVIS_DECOMP_ITERATIONS
+#define  LVIS_DECOMP_ITERATIONS 50    // Levenberg-Marquardt steps per fit
+#endif
+
+#ifndef  LVIS_DECOMP_CHUNK
+#define  LVIS_DECOMP_CHUNK 256        // shots per task
+#endif
+
+// lvis_decomp_shot flags
+#define LVIS_DECOMP_CONVERGED 0x01    // the fit converged within LVIS_DECOMP_ITERATIONS
+#define LVIS_DECOMP_TX_FITTED 0x02    // txsigma comes from this shot's txwave
+
+#pragma pack(1)
+struct lvis_decomp_header
+{
+   char     magic[8];       // LVIS_DECOMP_MAGIC
+   uint32_t byteorder;      // LVIS_DECOMP_BYTEORDER as written by the host that made the file
+   uint32_t headerSize;     // bytes before the first shot
+   uint32_t maxModes;       // -maxmodes the file was made with
+   uint32_t flags;          // reserved, 0
+   uint64_t shotCount;
+   uint64_t modeCount;
+   char     reserved[24];
+};
+
+struct lvis_decomp_shot
+{
+   uint32_t lfid;
+   uint32_t shotnumber;
+   double   lvistime;
+   float    noise;          // sigmean, taken off the return before fitting
+   float    txsigma;        // width of the transmit pulse (samples)
+   uint16_t nmodes;
+   uint16_t flags;          // LVIS_DECOMP_xxx
+};
+
+struct lvis_decomp_mode
+{
+   float    amplitude;      // counts above the noise
+   float    center;         // sample index
+   float    sigma;          // samples
+   float    z;              // elevation of the center (m)
+};
+#pragma pack(0)
+
+struct lvis_decomp_options
+{
+   int    maxModes;         // -maxmodes N
+   double txsigma;          // -txsigma S
+};
+
+void lvis_decomp_defaults(struct lvis_decomp_options * d);
+
+// handle the decompose options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a decompose option)
+int  lvis_decomp_parse_option(int argc, char * argv[], int i, struct lvis_decomp_options * d);
+
+// decompose the LGW inputs to stdout (text) or opt->outfile (side file),
+// returns 0 on success
+struct lvis_batch_options;
+struct lvis_metrics_options;
+int  lvis_decomp_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			 struct lvis_batch_options * b, struct lvis_metrics_options * m,
+			 struct lvis_decomp_options * d);
+
+#endif
@@ -0,0 +1,388 @@
+// lvis_release_deconv.c
+//
+// Transmit pulse deconvolution of LGW waveforms (deconvolve mode), see
+// lvis_release_deconv.h.
+//
+// The FFT plans are made once per return length (528 for 1.04, 432 before)
+// and shared by the workers, which each have a workspace holding a shot's
+// signals and spectra (a few tens of KB, so it stays in cache from shot to
+// shot).  The shots are split into tasks of LVIS_DECONV_CHUNK that the pool
+// works on in waves, as in the metrics mode; each task keeps its
+// deconvolved records until the calling thread writes them, in input order.
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_features.h"
+#include "lvis_release_fft.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_deconv.h"
+
+struct lvis_deconv_work
+{
+   double y[528];          // return less the noise, then the deconvolved return
+   double h[528];          // the transmit pulse, peak at 0
+   double Y[530];          // spectra, 265 bins
+   double H[530];
+   double scratch[2*528];
+};
+
+struct lvis_deconv_task
+{
+   int                     file;
+   int64_t                 first,count;
+   struct lvis_lgw_v1_04 * lgw;      // the shots inside -lat / -lon, deconvolved
+   int64_t                 kept;
+   int64_t                 nopulse;  // shots left as they were, their txwave is flat
+   int                     status;   // 0, -1 on a read error
+};
+
+struct lvis_deconv_job
+{
+   struct lvis_release_options * opt;
+   struct lvis_deconv_options  * d;
+   struct lvis_release_file    * files;
+   int                         * rxSamples;   // valid samples per input
+   int                         * txSamples;
+   struct lvis_fft_plan       ** plan;        // per input, shared by inputs of one length
+   struct lvis_deconv_task     * tasks;
+   unsigned char              ** raw;         // per worker
+   unsigned char              ** canon;       // per worker
+   struct lvis_deconv_work    ** work;        // per worker
+   // the join: the shots of the tasks, in order, to the output
+   FILE                        * out;
+   int                           binary;
+   unsigned int                  colnum;
+   int64_t                       shots,records,nopulse;
+   int                           errors;
+};
+
+void lvis_deconv_defaults(struct lvis_deconv_options * d)
+{
+   d->regularization = LVIS_DECONV_REGULARIZATION;
+}
+
+int lvis_deconv_parse_option(int argc, char * argv[], int i, struct lvis_deconv_options * d)
+{
+   if(strcmp(argv[i],"-deconreg")==0 && i+1<argc)
+     {
+	d->regularization = atof(argv[i+1]);
+	if(d->regularization < 1e-9) d->regularization = 1e-9;
+	return 2;
+     }
+   return 0;
+}
+
+// deconvolve the return of one canonical shot in place, returns 0 (and
+// leaves the shot alone) if its transmit pulse is flat
+static int lvis_deconv_shot(struct lvis_deconv_job * job, struct lvis_deconv_work * w, struct lvis_fft_plan * plan,
+			    struct lvis_lgw_v1_04 * lgw, int n, int ntx)
+{
+   uint16_t * rx = (uint16_t *) ((unsigned char *) lgw + offsetof(struct lvis_lgw_v1_04,rxwave));
+   uint16_t * tx = (uint16_t *) ((unsigned char *) lgw + offsetof(struct lvis_lgw_v1_04,txwave));
+   double     noise,txnoise=0.0,sum=0.0,v,re,im,d,mag,maxmag=0.0,eps;
+   int        i,k,peak=0;
+
+   noise = (lgw->sigmean == lgw->sigmean) ? lgw->sigmean : 0.0;
+   for(i=0;i<LVIS_FEATURES_TX_NOISE && i<ntx;i++) txnoise += tx[i];
+   txnoise /= (i > 0) ? i : 1;
+
+   // the pulse above its noise, unit sum, centered on its peak so the
+   // deconvolved return keeps the timing of the original
+   for(i=0;i<ntx;i++)
+     {
+	if(tx[i] > tx[peak]) peak = i;
+	if(tx[i] > txnoise) sum += tx[i] - txnoise;
+     }
+   if(sum <= 0.0) return 0;
+   memset(w->h,0,n * sizeof(double));
+   for(i=0;i<ntx;i++)
+     if(tx[i] > txnoise) w->h[(i - peak + n) % n] = (tx[i] - txnoise) / sum;
+   for(i=0;i<n;i++) w->y[i] = rx[i] - noise;
+
+   lvis_fft_forward(plan,w->y,w->Y,w->scratch);
+   lvis_fft_forward(plan,w->h,w->H,w->scratch);
+   for(k=0;k<=n/2;k++)
+     {
+	mag = w->H[2*k]*w->H[2*k] + w->H[2*k+1]*w->H[2*k+1];
+	if(mag > maxmag) maxmag = mag;
+     }
+   eps = job->d->regularization * maxmag;
+   for(k=0;k<=n/2;k++)
+     {
+	// Y H* / (|H|^2 + eps)
+	re = w->Y[2*k]*w->H[2*k] + w->Y[2*k+1]*w->H[2*k+1];
+	im = w->Y[2*k+1]*w->H[2*k] - w->Y[2*k]*w->H[2*k+1];
+	d  = w->H[2*k]*w->H[2*k] + w->H[2*k+1]*w->H[2*k+1] + eps;
+	w->Y[2*k]   = re / d;
+	w->Y[2*k+1] = im / d;
+     }
+   lvis_fft_inverse(plan,w->Y,w->y,w->scratch);
+
+   for(i=0;i<n;i++)
+     {
+	v = floor(w->y[i] + noise + 0.5);
+	if(v < 0.0) v = 0.0;
+	if(v > 65535.0) v = 65535.0;
+	rx[i] = (uint16_t) v;
+     }
+   return 1;
+}
+
+static void lvis_deconv_run(void * context, long t, int worker)
+{
+   struct lvis_deconv_job     * job = (struct lvis_deconv_job *) context;
+   struct lvis_deconv_task    * task = &job->tasks[t];
+   struct lvis_release_options * opt = job->opt;
+   struct lvis_lgw_v1_04      * lgw;
+   double                       lon,lat;
+   int64_t                      i,got;
+
+   task->kept = task->nopulse = 0;
+   if((task->lgw = (struct lvis_lgw_v1_04 *) malloc(task->count * sizeof(struct lvis_lgw_v1_04)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the deconvolution output\n");
+	exit(-1);
+     }
+   got = lvis_canon_read(&job->files[task->file],task->first,task->count,job->raw[worker],job->canon[worker]);
+   if(got != task->count) task->status = -1;
+   for(i=0;i<got;i++)
+     {
+	lgw = ((struct lvis_lgw_v1_04 *) job->canon[worker]) + i;
+	release_data_position((unsigned char *) lgw,LVIS_RELEASE_FILETYPE_LGW,(float)1.04,&lon,&lat);
+	if(!lvis_release_keep(opt,lon,lat)) continue;
+	if(!lvis_deconv_shot(job,job->work[worker],job->plan[task->file],lgw,job->rxSamples[task->file],
+			     job->txSamples[task->file]))
+	  task->nopulse++;
+	memcpy(&task->lgw[task->kept++],lgw,sizeof(struct lvis_lgw_v1_04));
+     }
+}
+
+static int lvis_deconv_input(void * context, long t)
+{
+   return ((struct lvis_deconv_job *) context)->tasks[t].file;
+}
+
+// the shots of a task to the output, in input order
+static void lvis_deconv_join(void * context, long t)
+{
+   struct lvis_deconv_job      * job = (struct lvis_deconv_job *) context;
+   struct lvis_release_options * opt = job->opt;
+   struct lvis_deconv_task     * task = &job->tasks[t];
+   int64_t                       i;
+
+   if(task->status != 0)
+     {
+	fprintf(stderr,"Short read in %s at record %lld\n",job->files[task->file].filename,(long long) task->first);
+	job->errors++;
+     }
+   if(job->binary)
+     {
+	if(task->kept > 0 && fwrite(task->lgw,sizeof(struct lvis_lgw_v1_04),task->kept,job->out) != (size_t) task->kept)
+	  {
+	     fprintf(stderr,"Error writing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	     exit(-1);
+	  }
+     }
+   else
+     for(i=0;i<task->kept;i++)
+       print_release_data(job->out,(unsigned char *) &task->lgw[i],LVIS_RELEASE_FILETYPE_LGW,(float)1.04,
+			  opt->indexcol,job->colnum++,opt->delim,opt->minlat,opt->maxlat,opt->minlon,opt->maxlon);
+   job->records += task->kept;
+   job->nopulse += task->nopulse;
+   job->shots += task->count;
+   free(task->lgw);
+   task->lgw = NULL;
+}
+
+int lvis_deconv_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			struct lvis_batch_options * b, struct lvis_deconv_options * d)
+{
+   struct lvis_deconv_job     job;
+   struct lvis_canon_header   hdr;
+   struct lvis_pool         * pool;
+   FILE                     * out;
+   long                       ntasks=0,maxtasks=0;
+   int64_t                    n,first;
+   float                      version;
+   int                        j,k,threads,binary,errors=0;
+
+   memset(&job,0,sizeof(job));
+   job.opt = opt;
+   job.d = d;
+   job.files = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file));
+   job.rxSamples = (int *) calloc(ninputs,sizeof(int));
+   job.txSamples = (int *) calloc(ninputs,sizeof(int));
+   job.plan = (struct lvis_fft_plan **) calloc(ninputs,sizeof(struct lvis_fft_plan *));
+   if(job.files == NULL || job.rxSamples == NULL || job.txSamples == NULL || job.plan == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     {
+	if(lvis_file_open(&job.files[k],inputs[k],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	lvis_file_close(&job.files[k]);
+	if(job.files[k].fileType != LVIS_RELEASE_FILETYPE_LGW)
+	  {
+	     fprintf(stderr,"%s is not an LGW file, there are no waveforms to deconvolve\n",inputs[k]);
+	     errors++;
+	     continue;
+	  }
+	version = job.files[k].canonical ? job.files[k].sourceVersion : job.files[k].fileVersion;
+	job.rxSamples[k] = (version == ((float)1.04)) ? 528 : 432;
+	job.txSamples[k] = 0;
+	if(version == ((float)1.03)) job.txSamples[k] = 80;
+	if(version == ((float)1.04)) job.txSamples[k] = 120;
+	if(job.files[k].canonical) { job.rxSamples[k] = job.files[k].rxSamples; job.txSamples[k] = job.files[k].txSamples; }
+	if(job.txSamples[k] == 0)
+	  {
+	     fprintf(stderr,"%s has no transmit waveform (release %4.2f), deconvolve needs 1.03 or later\n",
+		     inputs[k],version);
+	     errors++;
+	     continue;
+	  }
+	if(opt->outfile[0] != 0 && (job.rxSamples[k] != job.rxSamples[0] || job.txSamples[k] != job.txSamples[0]))
+	  {
+	     fprintf(stderr,"%s has other waveform lengths than %s, they cannot share one output file\n",
+		     inputs[k],inputs[0]);
+	     errors++;
+	     continue;
+	  }
+	// one plan per return length
+	for(j=0;j<k && (job.plan[j] == NULL || job.rxSamples[j] != job.rxSamples[k]);j++);
+	job.plan[k] = (j < k) ? job.plan[j] : lvis_fft_plan_create(job.rxSamples[k]);
+	if(job.plan[k] == NULL)
+	  {
+	     fprintf(stderr,"Unable to plan a transform of %d samples for %s\n",job.rxSamples[k],inputs[k]);
+	     exit(-1);
+	  }
+	n = job.files[k].recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+	job.files[k].recordCount = n;
+	maxtasks += (long) ((n + LVIS_DECONV_CHUNK - 1) / LVIS_DECONV_CHUNK);
+     }
+   if(errors > 0)
+     {
+	for(k=0;k<ninputs;k++)
+	  {
+	     for(j=0;j<k && job.plan[j] != job.plan[k];j++);
+	     if(j == k) lvis_fft_plan_destroy(job.plan[k]);
+	  }
+	free(job.plan);
+	free(job.files);
+	free(job.rxSamples);
+	free(job.txSamples);
+	return errors;
+     }
+
+   job.tasks = (struct lvis_deconv_task *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_deconv_task));
+   if(job.tasks == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the task table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     for(first=0;first<job.files[k].recordCount;first+=LVIS_DECONV_CHUNK)
+       {
+	  job.tasks[ntasks].file  = k;
+	  job.tasks[ntasks].first = first;
+	  job.tasks[ntasks].count = (job.files[k].recordCount - first < LVIS_DECONV_CHUNK) ?
+	    job.files[k].recordCount - first : LVIS_DECONV_CHUNK;
+	  ntasks++;
+       }
+
+   pool = lvis_pool_create(b->nthreads);
+   threads = lvis_pool_threads(pool);
+   lvis_batch_buffers(threads,LVIS_DECONV_CHUNK,sizeof(struct lvis_lgw_v1_04),&job.raw,&job.canon);
+   job.work = (struct lvis_deconv_work **) calloc(threads,sizeof(struct lvis_deconv_work *));
+   if(job.work == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the deconvolution buffers\n");
+	exit(-1);
+     }
+   for(k=0;k<threads;k++)
+     {
+	job.work[k] = (struct lvis_deconv_work *) malloc(sizeof(struct lvis_deconv_work));
+	if(job.work[k] == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the deconvolution buffers\n");
+	     exit(-1);
+	  }
+     }
+
+   // text like the reader prints LGW v1.04, or a canonical LGW file whose
+   // record count is filled in at the end
+   binary = (opt->outfile[0] != 0);
+   out = stdout;
+   if(binary)
+     {
+	if((out = fopen(opt->outfile,"wb"))==NULL)
+	  {
+	     fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	     exit(-1);
+	  }
+	version = job.files[0].canonical ? job.files[0].sourceVersion : job.files[0].fileVersion;
+	lvis_canon_make_header(&hdr,LVIS_RELEASE_FILETYPE_LGW,version,0);
+	hdr.rxSamples = job.rxSamples[0];
+	hdr.txSamples = job.txSamples[0];
+	if(fwrite(&hdr,sizeof(hdr),1,out)!=1)
+	  {
+	     fprintf(stderr,"Error writing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	     exit(-1);
+	  }
+     }
+   else if(opt->topcol == 1)
+     print_release_column_headers(out,LVIS_RELEASE_FILETYPE_LGW,(float)1.04,opt->indexcol,opt->delim);
+
+   // run the waves, writing wave N while wave N+1 is worked on
+   job.binary = binary;
+   job.out = out;
+   job.colnum = 1;
+   lvis_batch_waves(pool,0,ntasks,job.files,lvis_deconv_input,lvis_deconv_run,lvis_deconv_join,&job);
+   errors += job.errors;
+   lvis_pool_destroy(pool);
+
+   if(binary)
+     {
+	hdr.recordCount = (uint64_t) job.records;
+	if(fseek(out,0,SEEK_SET)!=0 || fwrite(&hdr,sizeof(hdr),1,out)!=1)
+	  {
+	     fprintf(stderr,"Error writing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	     errors++;
+	  }
+	if(fclose(out)!=0)
+	  {
+	     fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	     errors++;
+	  }
+     }
+   fflush(stdout);
+   fprintf(stderr,"deconvolve: %lld shots, %lld written, %lld without a transmit pulse left as they were\n",
+	   (long long) job.shots,(long long) job.records,(long long) job.nopulse);
+
+   lvis_batch_free_buffers(threads,job.raw,job.canon);
+   for(k=0;k<threads;k++) free(job.work[k]);
+   for(k=0;k<ninputs;k++)
+     {
+	for(j=0;j<k && job.plan[j] != job.plan[k];j++);
+	if(j == k) lvis_fft_plan_destroy(job.plan[k]);
+     }
+   free(job.plan);
+   free(job.work);
+   free(job.tasks);
+   free(job.files);
+   free(job.rxSamples);
+   free(job.txSamples);
+   return errors;
+}
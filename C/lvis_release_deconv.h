@@ -0,0 +1,47 @@
+#ifndef __LVIS_RELEASE_DECONV_H
+#define __LVIS_RELEASE_DECONV_H
+
+// lvis_release_deconv.h
+//
+// deconvolve mode: every LGW return waveform deconvolved by the transmit
+// pulse of its own shot, for sharper returns to find surfaces in.  The
+// pulse (txwave less its noise, unit sum, its peak moved to sample 0) and
+// the return (rxwave less sigmean) go through the in-tree real FFT
+// (lvis_release_fft.h) and are divided in the frequency domain with a
+// regularization term, X = Y H* / (|H|^2 + -deconreg * max |H|^2), which
+// keeps the frequencies the pulse carries little of from blowing up.  The
+// result has the noise put back and replaces rxwave; the rest of the
+// record is left alone.  Needs txwave, so release 1.03 or later.
+//
+// The output is LGW v1.04 text like the reader prints, or with -o one
+// canonical LGW file (lvis_release_canon.h).
+
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_DECONV_REGULARIZATION
+#define  LVIS_DECONV_REGULARIZATION 0.01   // default -deconreg
+#endif
+
+#ifndef  LVIS_DECONV_CHUNK
+#define  LVIS_DECONV_CHUNK 256             // shots per task
+#endif
+
+struct lvis_deconv_options
+{
+   double regularization;   // -deconreg R, as a fraction of the largest |H|^2
+};
+
+void lvis_deconv_defaults(struct lvis_deconv_options * d);
+
+// handle the deconvolve options at argv[i], returns the number of
+// arguments consumed (0 if argv[i] is not a deconvolve option)
+int  lvis_deconv_parse_option(int argc, char * argv[], int i, struct lvis_deconv_options * d);
+
+// deconvolve the LGW inputs to stdout (text) or opt->outfile (canonical
+// LGW), returns 0 on success
+struct lvis_batch_options;
+int  lvis_deconv_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			 struct lvis_batch_options * b, struct lvis_deconv_options * d);
+
+#endif
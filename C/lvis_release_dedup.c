@@ -0,0 +1,472 @@
+// lvis_release_dedup.c
+//
+// Cross-file deduplication by (lfid, shotnumber), see lvis_release_dedup.h.
+//
+// The inputs are read in blocks, in order.  When the hash set for every
+// shot of the inputs fits in the budget, one pass keeps the first copy of
+// each key and writes it straight out.  Otherwise it takes three passes:
+//   1. every (key, ordinal) is appended to one of P partition files, chosen
+//      by the key hash, so each partition's set fits in the budget
+//   2. each partition is read back through a set; an ordinal whose key was
+//      already there is a duplicate and goes, in increasing order, to the
+//      partition's drop list
+//   3. the inputs are read again and a record is written unless its ordinal
+//      is the next one on the drop list of its partition
+// The ordinal is the position of a record in the concatenated inputs, so
+// "first in input order" wins in both cases and the output is identical.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_dedup.h"
+
+#define LVIS_DEDUP_EMPTY      UINT64_MAX  // free slot (no v1.01+ shot has both ids all ones)
+#define LVIS_DEDUP_MAX_PARTS  1024        // partition files open at once
+#define LVIS_DEDUP_SPILL_BUF  (64 * 1024) // stdio buffer of each partition file, at most
+#define LVIS_DEDUP_SPILL_MIN  4096        // and at least
+
+#define LVIS_DEDUP_PASS_MEMORY 0   // one pass, set in memory
+#define LVIS_DEDUP_PASS_SPILL  1   // write the keys to the partitions
+#define LVIS_DEDUP_PASS_EMIT   2   // write what is not on a drop list
+
+struct lvis_dedup_set
+{
+   uint64_t * slots;
+   uint64_t   mask;   // slots - 1 (a power of two)
+   uint64_t   used;
+};
+
+struct lvis_dedup_job
+{
+   struct lvis_release_options * opt;
+   struct lvis_dedup_options   * d;
+   struct lvis_release_file    * files;
+   int                           ninputs;
+   struct lvis_dedup_set         set;
+   int                           nparts;
+   long                          spillBuf; // stdio buffer of each partition file
+   FILE                       ** parts;   // pass 1: keys, pass 3: drop lists
+   uint64_t                    * heads;   // pass 3: next ordinal to drop per partition
+   FILE                        * text;    // text output (stdout)
+   int                           out;     // binary output (-o), -1 = none
+   int                           lastType;
+   float                         lastVersion;
+   unsigned int                  colnum;
+   int64_t                       kept,dropped;
+};
+
+// splitmix64 finaliser, spreads consecutive shot numbers over the table
+static uint64_t lvis_dedup_hash(uint64_t key)
+{
+   key ^= key >> 30; key *= 0xbf58476d1ce4e5b9ULL;
+   key ^= key >> 27; key *= 0x94d049bb133111ebULL;
+   key ^= key >> 31;
+   return key;
+}
+
+static void lvis_dedup_set_init(struct lvis_dedup_set * s, uint64_t expected)
+{
+   uint64_t size = 1024;
+
+   while(size < 2*expected) size <<= 1;   // keep the load under one half
+   if((s->slots = (uint64_t *) malloc(size * sizeof(uint64_t)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the dedup key set (%llu MB)\n",
+		(unsigned long long) (size * sizeof(uint64_t) >> 20));
+	exit(-1);
+     }
+   memset(s->slots,0xFF,size * sizeof(uint64_t));
+   s->mask = size - 1;
+   s->used = 0;
+}
+
+static void lvis_dedup_set_free(struct lvis_dedup_set * s)
+{
+   free(s->slots);
+   s->slots = NULL;
+}
+
+static int lvis_dedup_set_insert(struct lvis_dedup_set * s, uint64_t key);
+
+// double the table (only when the estimate was wrong)
+static void lvis_dedup_set_grow(struct lvis_dedup_set * s)
+{
+   struct lvis_dedup_set bigger;
+   uint64_t              i;
+
+   lvis_dedup_set_init(&bigger,s->mask+1);
+   for(i=0;i<=s->mask;i++)
+     if(s->slots[i] != LVIS_DEDUP_EMPTY) lvis_dedup_set_insert(&bigger,s->slots[i]);
+   lvis_dedup_set_free(s);
+   *s = bigger;
+}
+
+// returns 1 if key is new, 0 if it was already in the set
+static int lvis_dedup_set_insert(struct lvis_dedup_set * s, uint64_t key)
+{
+   uint64_t i;
+
+   if(4*(s->used+1) > 3*(s->mask+1)) lvis_dedup_set_grow(s);
+   for(i=lvis_dedup_hash(key) & s->mask; s->slots[i] != LVIS_DEDUP_EMPTY; i=(i+1) & s->mask)
+     if(s->slots[i] == key) return 0;
+   s->slots[i] = key;
+   s->used++;
+   return 1;
+}
+
+// the partition of a key uses the high hash bits, the set the low ones
+static int lvis_dedup_partition(struct lvis_dedup_job * job, uint64_t key)
+{
+   return (int) ((lvis_dedup_hash(key) >> 40) % (uint64_t) job->nparts);
+}
+
+static void lvis_dedup_part_name(struct lvis_dedup_job * job, int p, char * kind, char * name, int size)
+{
+   snprintf(name,size,"%s/lvis_dedup.%d.%04d.%s",job->opt->tmpdir,(int) getpid(),p,kind);
+}
+
+static FILE * lvis_dedup_part_open(struct lvis_dedup_job * job, int p, char * kind, char * mode)
+{
+   char   name[2048];
+   FILE * fp;
+
+   lvis_dedup_part_name(job,p,kind,name,sizeof(name));
+   if((fp = fopen(name,mode))==NULL)
+     {
+	fprintf(stderr,"Error opening the dedup spill file: %s (%s)\n",name,strerror(errno));
+	exit(-1);
+     }
+   setvbuf(fp,NULL,_IOFBF,job->spillBuf);
+   return fp;
+}
+
+static void lvis_dedup_part_write(FILE * fp, uint64_t * values, int n)
+{
+   if(fwrite(values,sizeof(uint64_t),n,fp) != n)
+     {
+	fprintf(stderr,"Error writing a dedup spill file (%s)\n",strerror(errno));
+	exit(-1);
+     }
+}
+
+static void lvis_dedup_emit(struct lvis_dedup_job * job, struct lvis_release_file * f,
+			    unsigned char * raw, unsigned char * host)
+{
+   struct lvis_release_options * opt = job->opt;
+   int64_t                       done=0;
+   ssize_t                       status;
+
+   job->kept++;
+   if(job->out < 0)
+     {
+	print_release_data(job->text,host,f->fileType,f->fileVersion,opt->indexcol,job->colnum++,opt->delim,
+			   opt->minlat,opt->maxlat,opt->minlon,opt->maxlon);
+	return;
+     }
+   while(done < f->recordSize)
+     {
+	status = write(job->out,raw+done,f->recordSize-done);
+	if(status < 0 && errno == EINTR) continue;
+	if(status <= 0)
+	  {
+	     fprintf(stderr,"Error writing the dedup output: %s\n",strerror(errno));
+	     exit(-1);
+	  }
+	done += status;
+     }
+}
+
+// one pass over every input, ordinal counts records across the inputs
+static void lvis_dedup_pass(struct lvis_dedup_job * job, int pass)
+{
+   struct lvis_release_options * opt = job->opt;
+   struct lvis_release_file    * f;
+   union lvis_canon_record       canon;
+   unsigned char               * block,host[LVIS_MAX_RECORD_SIZE];
+   uint64_t                      key,ordinal=0,entry[2];
+   int64_t                       n,first,count,got,i;
+   long                          perBlock;
+   double                        lon,lat;
+   int                           k,p,inside;
+
+   if((block = (unsigned char *) malloc(LVIS_DEDUP_CHUNK_BYTES + LVIS_MAX_RECORD_SIZE))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the dedup read buffer\n");
+	exit(-1);
+     }
+
+   for(k=0;k<job->ninputs;k++)
+     {
+	f = &job->files[k];
+	if(lvis_file_reopen(f)!=0) exit(-1);
+	n = f->recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+
+	// a header above each run of one type / version, like the batch output
+	if(pass != LVIS_DEDUP_PASS_SPILL && job->out < 0 && opt->topcol == 1 &&
+	   (f->fileType != job->lastType || f->fileVersion != job->lastVersion))
+	  print_release_column_headers(job->text,f->fileType,f->fileVersion,opt->indexcol,opt->delim);
+	job->lastType = f->fileType;
+	job->lastVersion = f->fileVersion;
+
+	perBlock = LVIS_DEDUP_CHUNK_BYTES / f->recordSize;
+	if(perBlock < 1) perBlock = 1;
+	for(first=0;first<n;first+=count)
+	  {
+	     count = (n - first < perBlock) ? n - first : perBlock;
+	     if((got = lvis_file_read(f,first,count,block)) != count)
+	       {
+		  fprintf(stderr,"Short read in %s at record %lld\n",f->filename,(long long) (first+got));
+		  exit(-1);
+	       }
+	     for(i=0;i<count;i++,ordinal++)
+	       {
+		  unsigned char * raw = block + i*f->recordSize;
+
+		  memcpy(host,raw,f->recordSize);
+		  swap_release_data(host,f->fileType,f->fileVersion,f->myendian);
+		  release_data_position(host,f->fileType,f->fileVersion,&lon,&lat);
+		  inside = lvis_release_keep(opt,lon,lat);
+		  if(!inside) continue;  // never written, so it does not take part
+
+		  // lfid and shotnumber lead every v1.04 record
+		  lvis_canon_from_release(host,f->fileType,f->fileVersion,&canon);
+		  key = ((uint64_t) canon.lce.lfid << 32) | canon.lce.shotnumber;
+
+		  if(pass == LVIS_DEDUP_PASS_MEMORY)
+		    {
+		       if(lvis_dedup_set_insert(&job->set,key)) lvis_dedup_emit(job,f,raw,host);
+		       else job->dropped++;
+		    }
+		  if(pass == LVIS_DEDUP_PASS_SPILL)
+		    {
+		       entry[0] = key;
+		       entry[1] = ordinal;
+		       lvis_dedup_part_write(job->parts[lvis_dedup_partition(job,key)],entry,2);
+		    }
+		  if(pass == LVIS_DEDUP_PASS_EMIT)
+		    {
+		       p = lvis_dedup_partition(job,key);
+		       if(job->heads[p] == ordinal)
+			 {
+			    job->dropped++;
+			    if(fread(&job->heads[p],sizeof(uint64_t),1,job->parts[p])!=1) job->heads[p] = UINT64_MAX;
+			 }
+		       else lvis_dedup_emit(job,f,raw,host);
+		    }
+	       }
+	  }
+	lvis_file_close(f);
+     }
+   free(block);
+}
+
+// pass 2: find the duplicates of every partition
+static void lvis_dedup_partitions(struct lvis_dedup_job * job)
+{
+   char     name[2048];
+   uint64_t entry[2];
+   long     size;
+   FILE   * keys,* drops;
+   int      p;
+
+   for(p=0;p<job->nparts;p++)
+     {
+	keys = job->parts[p];
+	fflush(keys);
+	size = ftell(keys);
+	rewind(keys);
+	drops = lvis_dedup_part_open(job,p,"drop","wb");
+	lvis_dedup_set_init(&job->set,(uint64_t) (size / sizeof(entry)));
+	// entries were appended in ordinal order, so the first one of a key wins
+	while(fread(entry,sizeof(entry),1,keys)==1)
+	  if(!lvis_dedup_set_insert(&job->set,entry[0])) lvis_dedup_part_write(drops,&entry[1],1);
+	lvis_dedup_set_free(&job->set);
+	fclose(keys);
+	lvis_dedup_part_name(job,p,"keys",name,sizeof(name));
+	unlink(name);
+	if(fclose(drops)!=0)
+	  {
+	     fprintf(stderr,"Error writing a dedup spill file (%s)\n",strerror(errno));
+	     exit(-1);
+	  }
+     }
+}
+
+void lvis_dedup_defaults(struct lvis_dedup_options * d)
+{
+   memset(d,0,sizeof(struct lvis_dedup_options));
+   d->memoryMB = LVIS_DEDUP_MEMORY_MB;
+}
+
+int lvis_dedup_parse_option(int argc, char * argv[], int i, struct lvis_dedup_options * d)
+{
+   if(strcmp(argv[i],"-dedup")==0)
+     {
+	d->enabled = 1;
+	return 1;
+     }
+   if(strcmp(argv[i],"-dedupmem")==0 && i+1<argc)
+     {
+	d->memoryMB = atol(argv[i+1]);
+	if(d->memoryMB < 1) d->memoryMB = 1;
+	return 2;
+     }
+   return 0;
+}
+
+int lvis_dedup_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		       struct lvis_dedup_options * d)
+{
+   struct lvis_dedup_job    job;
+   struct lvis_canon_header hdr,ordered;
+   char                     name[2048];
+   uint64_t                 total=0,budget,slots,need,used;
+   float                    version;
+   int                      i,p,errors=0;
+
+   memset(&job,0,sizeof(job));
+   job.opt = opt;
+   job.d = d;
+   job.ninputs = ninputs;
+   job.out = -1;
+   job.lastType = -1;
+   job.colnum = 1;
+   job.text = stdout;
+   if((job.files = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+
+   for(i=0;i<ninputs;i++)
+     {
+	if(lvis_file_open(&job.files[i],inputs[i],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	version = job.files[i].canonical ? job.files[i].sourceVersion : job.files[i].fileVersion;
+	if(version < (float)1.01)
+	  {
+	     fprintf(stderr,"%s (release %4.2f) has no lfid / shotnumber to deduplicate on\n",inputs[i],version);
+	     errors++;
+	  }
+	// binary output is one release file, it can only hold one layout
+	if(opt->outfile[0] != 0 && i > 0 &&
+	   (job.files[i].fileType != job.files[0].fileType || job.files[i].fileVersion != job.files[0].fileVersion ||
+	    job.files[i].canonical != job.files[0].canonical || job.files[i].myendian != job.files[0].myendian))
+	  {
+	     fprintf(stderr,"%s does not have the record layout of %s, they cannot share one binary output\n",
+		     inputs[i],inputs[0]);
+	     errors++;
+	  }
+	total += (opt->maxSampleNumber > 0 && opt->maxSampleNumber < job.files[i].recordCount) ?
+	  opt->maxSampleNumber : job.files[i].recordCount;
+	lvis_file_close(&job.files[i]);
+     }
+   if(errors > 0)
+     {
+	free(job.files);
+	return errors;
+     }
+
+   if(opt->outfile[0] != 0)
+     {
+	if((job.out = open(opt->outfile,O_WRONLY|O_CREAT|O_TRUNC,0644))<0)
+	  {
+	     fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	     exit(-1);
+	  }
+	if(job.files[0].canonical)
+	  {
+	     lvis_canon_make_header(&hdr,job.files[0].fileType,job.files[0].sourceVersion,0);
+	     hdr.txSamples = job.files[0].txSamples;
+	     hdr.rxSamples = job.files[0].rxSamples;
+	     // the records are copied as they are, the header must be in their byte order
+	     lvis_canon_order_header(&hdr,job.files[0].myendian,&ordered);
+	     if(write(job.out,&ordered,sizeof(ordered)) != sizeof(ordered))
+	       {
+		  fprintf(stderr,"Error writing the dedup output: %s\n",strerror(errno));
+		  exit(-1);
+	       }
+	  }
+     }
+
+   // does a set for every shot fit?  (at most half full, 8 bytes a slot)
+   budget = (uint64_t) d->memoryMB << 20;
+   for(slots=1024;slots<2*total;slots<<=1);
+   if(slots * sizeof(uint64_t) <= budget)
+     {
+	lvis_dedup_set_init(&job.set,total);
+	lvis_dedup_pass(&job,LVIS_DEDUP_PASS_MEMORY);
+	lvis_dedup_set_free(&job.set);
+     }
+   else
+     {
+	// every partition file stays open through passes 1 to 3, so their
+	// buffers take up to a quarter of the budget and one partition's set
+	// has to fit in the rest
+	need = slots * sizeof(uint64_t);
+	job.nparts = (int) ((need + (budget - budget / 4) - 1) / (budget - budget / 4)) * 2;
+	if(job.nparts > LVIS_DEDUP_MAX_PARTS) job.nparts = LVIS_DEDUP_MAX_PARTS;
+	job.spillBuf = (long) (budget / 4 / job.nparts);
+	if(job.spillBuf > LVIS_DEDUP_SPILL_BUF) job.spillBuf = LVIS_DEDUP_SPILL_BUF;
+	if(job.spillBuf < LVIS_DEDUP_SPILL_MIN) job.spillBuf = LVIS_DEDUP_SPILL_MIN;
+	// a partition's set (up to twice its share, rounded to a power of
+	// two) and the buffers of all the open files is the most it takes
+	used = need * 2 / job.nparts + (uint64_t) job.nparts * job.spillBuf;
+	if(used > budget)
+	  fprintf(stderr,"dedup: -dedupmem %ld MB is too small for the inputs in %d partitions, "
+		  "the run will take up to %.0f MB\n",d->memoryMB,job.nparts,(double) used / (1 << 20));
+	job.parts = (FILE **) calloc(job.nparts,sizeof(FILE *));
+	job.heads = (uint64_t *) calloc(job.nparts,sizeof(uint64_t));
+	if(job.parts == NULL || job.heads == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the dedup partitions\n");
+	     exit(-1);
+	  }
+	for(p=0;p<job.nparts;p++) job.parts[p] = lvis_dedup_part_open(&job,p,"keys","w+b");
+	lvis_dedup_pass(&job,LVIS_DEDUP_PASS_SPILL);
+	lvis_dedup_partitions(&job);
+
+	for(p=0;p<job.nparts;p++)
+	  {
+	     job.parts[p] = lvis_dedup_part_open(&job,p,"drop","rb");
+	     if(fread(&job.heads[p],sizeof(uint64_t),1,job.parts[p])!=1) job.heads[p] = UINT64_MAX;
+	  }
+	job.lastType = -1;
+	lvis_dedup_pass(&job,LVIS_DEDUP_PASS_EMIT);
+	for(p=0;p<job.nparts;p++)
+	  {
+	     fclose(job.parts[p]);
+	     lvis_dedup_part_name(&job,p,"drop",name,sizeof(name));
+	     unlink(name);
+	  }
+	free(job.parts);
+	free(job.heads);
+     }
+
+   if(job.out >= 0)
+     {
+	if(job.files[0].canonical)
+	  {
+	     hdr.recordCount = (uint64_t) job.kept;
+	     lvis_canon_order_header(&hdr,job.files[0].myendian,&ordered);
+	     if(pwrite(job.out,&ordered,sizeof(ordered),0) != sizeof(ordered)) errors++;
+	  }
+	if(close(job.out)!=0) errors++;
+	if(errors > 0) fprintf(stderr,"Error writing the dedup output: %s\n",opt->outfile);
+	else if(job.files[0].canonical && lvis_canon_check_header(opt->outfile,&hdr,job.files[0].myendian)!=0) errors++;
+     }
+   fflush(stdout);
+   fprintf(stderr,"dedup: %lld records kept, %lld duplicates dropped%s\n",(long long) job.kept,
+	   (long long) job.dropped,job.nparts > 0 ? " (keys spilled to disk)" : "");
+   free(job.files);
+   return errors;
+}
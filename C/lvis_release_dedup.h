@@ -0,0 +1,41 @@
+#ifndef __LVIS_RELEASE_DEDUP_H
+#define __LVIS_RELEASE_DEDUP_H
+
+// lvis_release_dedup.h
+//
+// Cross-file deduplication (-dedup): every (lfid, shotnumber) is written
+// once, the first time it is met in input order, as text or (with -o) as
+// binary records.  The keys are kept in an open addressing hash set; when
+// the inputs hold more shots than fit in the memory budget (-dedupmem) the
+// keys are spilled to hash partitions on local disk (-tmpdir) and the
+// duplicates are found one partition at a time.
+
+#include <stdint.h>
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_DEDUP_MEMORY_MB
+#define  LVIS_DEDUP_MEMORY_MB 1024   // default -dedupmem
+#endif
+
+#ifndef  LVIS_DEDUP_CHUNK_BYTES
+#define  LVIS_DEDUP_CHUNK_BYTES (4 * 1024 * 1024) // bytes read per block
+#endif
+
+struct lvis_dedup_options
+{
+   int   enabled;        // -dedup
+   long  memoryMB;       // -dedupmem MB, budget of the key set and spill buffers
+};
+
+void lvis_dedup_defaults(struct lvis_dedup_options * d);
+
+// handle the dedup options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a dedup option)
+int  lvis_dedup_parse_option(int argc, char * argv[], int i, struct lvis_dedup_options * d);
+
+// write the inputs without repeated shots to stdout (text) or opt->outfile
+// (binary), returns 0 on success
+int  lvis_dedup_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			struct lvis_dedup_options * d);
+
+#endif
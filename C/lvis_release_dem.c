@@ -0,0 +1,727 @@
+// lvis_release_dem.c
+//
+// DEM sampling and differencing (-dem), see lvis_release_dem.h.
+//
+// A cached block is found through a hash of (raster, block row, block
+// column) and kept on a list in the order it was last used; when the
+// cache is full the least recently used block no thread holds is decoded
+// over.  A block is put in the cache before it is read, marked as
+// loading, so a second thread asking for it waits for the first one's
+// read rather than reading it again, and the lock is never held over a
+// read.  The prefetch thread goes through the same path, it only does not
+// keep what it loads.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_dem.h"
+
+struct lvis_dem_raster
+{
+   char   name[1024];
+   int    fd;
+   long   nrows,ncols;
+   double ulx,uly;       // centre of the upper left pixel
+   double xdim,ydim;
+   double nodata;
+   int    hasNodata;
+   int    swap;          // not in host byte order
+   off_t  skip;          // bytes before the first row
+   off_t  stride;        // bytes from a row of the first band to the next
+};
+
+struct lvis_dem_block
+{
+   int                     raster;
+   long                    brow,bcol;
+   float                 * data;         // LVIS_DEM_BLOCK rows of LVIS_DEM_BLOCK
+   int                     ready;        // decoded, else being read
+   int                     pins;         // threads holding it
+   struct lvis_dem_block * prev,* next;  // most recently used first
+   struct lvis_dem_block * chain;        // in its hash bucket
+};
+
+struct lvis_dem_key
+{
+   int  raster;
+   long brow,bcol;
+};
+
+struct lvis_dem_worker
+{
+   struct lvis_dem_block * held[LVIS_DEM_HELD];
+   int                     replace;      // the held block to give up next
+   int                     raster;       // the last raster a shot was in
+   long                    samples,missing;
+   long                    hits;         // pixels found in a held block, no lookup
+};
+
+struct lvis_dem
+{
+   struct lvis_dem_raster  * raster;
+   int                       nrasters;
+   int                       proj;       // EPSG of x / y, 0 lon / lat
+   // the cache
+   pthread_mutex_t           lock;
+   pthread_cond_t            loaded;
+   struct lvis_dem_block  ** bucket;
+   long                      nbuckets;
+   struct lvis_dem_block   * head,* tail;
+   long                      nblocks,maxblocks;
+   // the prefetch queue
+   pthread_t                 thread;
+   pthread_cond_t            wake;
+   struct lvis_dem_key       queue[LVIS_DEM_QUEUE];
+   int                       qhead,qcount;
+   int                       running,stop;
+   // the samplers
+   struct lvis_dem_worker  * worker;
+   int                       nworkers;
+   // counts
+   long                      hits,misses,reads,ahead,evicted,errors;
+   double                    bytes;
+};
+
+void lvis_dem_defaults(struct lvis_dem_options * d)
+{
+   memset(d,0,sizeof(struct lvis_dem_options));
+   d->memoryMB = LVIS_DEM_MEMORY_MB;
+}
+
+int lvis_dem_parse_option(int argc, char * argv[], int i, struct lvis_dem_options * d)
+{
+   if(strcmp(argv[i],"-dem")==0 && i+1<argc)
+     {
+	lvis_batch_add_input(&d->files,&d->nfiles,argv[i+1]);
+	return 2;
+     }
+   if(strcmp(argv[i],"-demlist")==0 && i+1<argc)
+     {
+	lvis_batch_add_list(&d->files,&d->nfiles,argv[i+1]);
+	return 2;
+     }
+   if(strcmp(argv[i],"-demmem")==0 && i+1<argc)
+     {
+	d->memoryMB = atol(argv[i+1]);
+	if(d->memoryMB < 1) d->memoryMB = 1;
+	return 2;
+     }
+   return 0;
+}
+
+// -------------------------------------------------------------------------
+// the rasters
+
+// name.bil / name.flt -> name.hdr
+static void lvis_dem_header_name(char * name, char * hdr, size_t size)
+{
+   char * dot = strrchr(name,'.'),* slash = strrchr(name,'/');
+   size_t n = strlen(name);
+
+   if(dot != NULL && (slash == NULL || dot > slash)) n = (size_t) (dot - name);
+   snprintf(hdr,size,"%.*s.hdr",(int) n,name);
+}
+
+static int lvis_dem_raster_open(struct lvis_dem_raster * r, char * name)
+{
+   char        hdr[2048],line[1024],key[256],value[256],layout[256]="BIL";
+   double      xll=NAN,yll=NAN,cell=NAN;
+   long        nbands=1,nbits=32,rowbytes=0;
+   int         centre=0,little=-1;
+   struct stat st;
+   FILE      * fp;
+
+   memset(r,0,sizeof(struct lvis_dem_raster));
+   strncpy(r->name,name,sizeof(r->name)-1);
+   r->ulx = r->uly = r->xdim = r->ydim = NAN;
+   lvis_dem_header_name(name,hdr,sizeof(hdr));
+   if((fp = fopen(hdr,"r"))==NULL)
+     {
+	fprintf(stderr,"Error opening the DEM header: %s (%s)\n",hdr,strerror(errno));
+	return -1;
+     }
+   while(fgets(line,sizeof(line),fp)!=NULL)
+     {
+	if(sscanf(line,"%255s %255s",key,value)!=2) continue;
+	if(strcasecmp(key,"NROWS")==0) r->nrows = atol(value);
+	else if(strcasecmp(key,"NCOLS")==0) r->ncols = atol(value);
+	else if(strcasecmp(key,"NBANDS")==0) nbands = atol(value);
+	else if(strcasecmp(key,"NBITS")==0) nbits = atol(value);
+	else if(strcasecmp(key,"PIXELTYPE")==0 && strcasecmp(value,"FLOAT")!=0) nbits = -1;
+	else if(strcasecmp(key,"LAYOUT")==0) snprintf(layout,sizeof(layout),"%s",value);
+	else if(strcasecmp(key,"SKIPBYTES")==0) r->skip = (off_t) atol(value);
+	else if(strcasecmp(key,"TOTALROWBYTES")==0) rowbytes = atol(value);
+	else if(strcasecmp(key,"ULXMAP")==0) r->ulx = atof(value);
+	else if(strcasecmp(key,"ULYMAP")==0) r->uly = atof(value);
+	else if(strcasecmp(key,"XDIM")==0) r->xdim = atof(value);
+	else if(strcasecmp(key,"YDIM")==0) r->ydim = atof(value);
+	else if(strcasecmp(key,"XLLCORNER")==0 || strcasecmp(key,"XLLCENTER")==0)
+	  { xll = atof(value); centre = (strcasecmp(key,"XLLCENTER")==0); }
+	else if(strcasecmp(key,"YLLCORNER")==0 || strcasecmp(key,"YLLCENTER")==0) yll = atof(value);
+	else if(strcasecmp(key,"CELLSIZE")==0) cell = atof(value);
+	else if(strcasecmp(key,"NODATA")==0 || strcasecmp(key,"NODATA_VALUE")==0)
+	  { r->nodata = atof(value); r->hasNodata = 1; }
+	else if(strcasecmp(key,"BYTEORDER")==0)
+	  little = (strcasecmp(value,"I")==0 || strcasecmp(value,"LSBFIRST")==0);
+     }
+   fclose(fp);
+
+   // the .flt keys: the lower left corner (or centre) and one cell size
+   if(cell == cell)
+     {
+	if(!(r->xdim == r->xdim)) r->xdim = cell;
+	if(!(r->ydim == r->ydim)) r->ydim = cell;
+     }
+   if(!(r->ulx == r->ulx) && xll == xll) r->ulx = centre ? xll : xll + 0.5 * r->xdim;
+   if(!(r->uly == r->uly) && yll == yll)
+     r->uly = centre ? yll + (r->nrows - 1) * r->ydim : yll + (r->nrows - 0.5) * r->ydim;
+   if(r->nrows < 1 || r->ncols < 1 || !(r->xdim > 0.0) || !(r->ydim > 0.0) || !(r->ulx == r->ulx) ||
+      !(r->uly == r->uly))
+     {
+	fprintf(stderr,"%s does not give the size and place of the DEM (NROWS, NCOLS, ULXMAP, ULYMAP, XDIM, YDIM)\n",hdr);
+	return -1;
+     }
+   if(nbits != 32 || (nbands > 1 && strcasecmp(layout,"BIP")==0))
+     {
+	fprintf(stderr,"%s: the DEM has to be 32 bit float, one band or BIL / BSQ\n",hdr);
+	return -1;
+     }
+   if(little < 0) little = (host_endian() == GENLIB_LITTLE_ENDIAN);
+   r->swap = (little != (host_endian() == GENLIB_LITTLE_ENDIAN));
+   if(strcasecmp(layout,"BSQ")==0) r->stride = (off_t) r->ncols * 4;
+   else r->stride = (rowbytes > 0) ? (off_t) rowbytes : (off_t) (nbands * r->ncols * 4);
+
+   if((r->fd = open(name,O_RDONLY))<0 || fstat(r->fd,&st)!=0)
+     {
+	fprintf(stderr,"Error opening the DEM: %s (%s)\n",name,strerror(errno));
+	return -1;
+     }
+   if(st.st_size < r->skip + (r->nrows - 1) * r->stride + r->ncols * 4)
+     {
+	fprintf(stderr,"%s is shorter than its header says\n",name);
+	close(r->fd);
+	return -1;
+     }
+   return 0;
+}
+
+// is x / y on the raster's pixels?
+static int lvis_dem_inside(struct lvis_dem_raster * r, double x, double y)
+{
+   return (x >= r->ulx - 0.5 * r->xdim && x < r->ulx + (r->ncols - 0.5) * r->xdim &&
+	   y <= r->uly + 0.5 * r->ydim && y > r->uly - (r->nrows - 0.5) * r->ydim);
+}
+
+// the raster x / y is on (the one of *hint first), -1 if none
+static int lvis_dem_find(struct lvis_dem * dem, int * hint, double x, double y)
+{
+   int k;
+
+   if(*hint >= 0 && lvis_dem_inside(&dem->raster[*hint],x,y)) return *hint;
+   for(k=0;k<dem->nrasters;k++)
+     if(lvis_dem_inside(&dem->raster[k],x,y))
+       {
+	  *hint = k;
+	  return k;
+       }
+   return -1;
+}
+
+// as lvis_dem_find, a lon / lat DEM in -180 .. 180 as well as 0 .. 360
+static int lvis_dem_locate(struct lvis_dem * dem, int * hint, double * x, double y)
+{
+   int k;
+
+   if((k = lvis_dem_find(dem,hint,*x,y)) >= 0 || dem->proj != 0) return k;
+   if((k = lvis_dem_find(dem,hint,*x - 360.0,y)) >= 0) { *x -= 360.0; return k; }
+   if((k = lvis_dem_find(dem,hint,*x + 360.0,y)) >= 0) { *x += 360.0; return k; }
+   return -1;
+}
+
+// -------------------------------------------------------------------------
+// the cache
+
+static long lvis_dem_bucket(struct lvis_dem * dem, int raster, long brow, long bcol)
+{
+   uint64_t h = (uint64_t) raster * 0x9E3779B97F4A7C15ULL ^ (uint64_t) brow * 0xC2B2AE3D27D4EB4FULL ^
+		(uint64_t) bcol * 0x165667B19E3779F9ULL;
+
+   h ^= h >> 31;
+   return (long) (h & (uint64_t) (dem->nbuckets - 1));
+}
+
+static void lvis_dem_unlink(struct lvis_dem * dem, struct lvis_dem_block * b)
+{
+   if(b->prev != NULL) b->prev->next = b->next; else dem->head = b->next;
+   if(b->next != NULL) b->next->prev = b->prev; else dem->tail = b->prev;
+   b->prev = b->next = NULL;
+}
+
+static void lvis_dem_front(struct lvis_dem * dem, struct lvis_dem_block * b)
+{
+   b->next = dem->head;
+   b->prev = NULL;
+   if(dem->head != NULL) dem->head->prev = b;
+   dem->head = b;
+   if(dem->tail == NULL) dem->tail = b;
+}
+
+// a block to load into: a new one while there is room, else the least
+// recently used one nobody holds (under the lock)
+static struct lvis_dem_block * lvis_dem_take(struct lvis_dem * dem)
+{
+   struct lvis_dem_block * b,** p;
+
+   if(dem->nblocks >= dem->maxblocks)
+     for(b=dem->tail;b!=NULL;b=b->prev)
+       {
+	  if(b->pins > 0 || !b->ready) continue;
+	  for(p=&dem->bucket[lvis_dem_bucket(dem,b->raster,b->brow,b->bcol)];*p!=b;p=&(*p)->chain);
+	  *p = b->chain;
+	  lvis_dem_unlink(dem,b);
+	  dem->evicted++;
+	  return b;
+       }
+   // room left, or every block is held: go over -demmem rather than wait
+   if((b = (struct lvis_dem_block *) calloc(1,sizeof(struct lvis_dem_block)))==NULL ||
+      (b->data = (float *) malloc(LVIS_DEM_BLOCK * LVIS_DEM_BLOCK * sizeof(float)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the DEM cache\n");
+	exit(-1);
+     }
+   dem->nblocks++;
+   return b;
+}
+
+// read and decode a block (without the lock), returns the bytes read
+static long lvis_dem_load(struct lvis_dem * dem, struct lvis_dem_block * b, int * error)
+{
+   struct lvis_dem_raster * r = &dem->raster[b->raster];
+   long                     row0 = b->brow * LVIS_DEM_BLOCK,col0 = b->bcol * LVIS_DEM_BLOCK;
+   long                     nr = r->nrows - row0,nc = r->ncols - col0,i,j;
+   float                  * p;
+   unsigned char          * c,t;
+   ssize_t                  got,status;
+   off_t                    offset;
+
+   if(nr > LVIS_DEM_BLOCK) nr = LVIS_DEM_BLOCK;
+   if(nc > LVIS_DEM_BLOCK) nc = LVIS_DEM_BLOCK;
+   for(i=0;i<LVIS_DEM_BLOCK*LVIS_DEM_BLOCK;i++) b->data[i] = NAN;
+   for(i=0;i<nr;i++)
+     {
+	p = b->data + i * LVIS_DEM_BLOCK;
+	offset = r->skip + (off_t) (row0 + i) * r->stride + (off_t) col0 * 4;
+	for(got=0;got<nc*4;got+=status)
+	  if((status = pread(r->fd,(unsigned char *) p + got,(size_t) (nc * 4 - got),offset + got)) <= 0) break;
+	if(got < nc * 4)
+	  {
+	     *error = 1;
+	     for(j=0;j<nc;j++) p[j] = NAN;
+	     continue;
+	  }
+	for(j=0;j<nc;j++)
+	  {
+	     if(r->swap)
+	       {
+		  c = (unsigned char *) &p[j];
+		  t = c[0]; c[0] = c[3]; c[3] = t;
+		  t = c[1]; c[1] = c[2]; c[2] = t;
+	       }
+	     if(r->hasNodata && p[j] == (float) r->nodata) p[j] = NAN;
+	  }
+     }
+   return nr * nc * 4;
+}
+
+// the block, held (pins) by the caller; the prefetch thread (ahead) only
+// loads it if it is not cached and does not hold it, NULL
+static struct lvis_dem_block * lvis_dem_get(struct lvis_dem * dem, int raster, long brow, long bcol, int ahead)
+{
+   struct lvis_dem_block * b;
+   long                    h,bytes;
+   int                     error=0;
+
+   pthread_mutex_lock(&dem->lock);
+   h = lvis_dem_bucket(dem,raster,brow,bcol);
+   for(b=dem->bucket[h];b!=NULL;b=b->chain)
+     if(b->raster == raster && b->brow == brow && b->bcol == bcol) break;
+   if(b != NULL)
+     {
+	if(ahead)
+	  {
+	     pthread_mutex_unlock(&dem->lock);
+	     return NULL;
+	  }
+	dem->hits++;
+	b->pins++;
+	lvis_dem_unlink(dem,b);
+	lvis_dem_front(dem,b);
+	while(!b->ready) pthread_cond_wait(&dem->loaded,&dem->lock);
+	pthread_mutex_unlock(&dem->lock);
+	return b;
+     }
+   if(!ahead) dem->misses++;
+   b = lvis_dem_take(dem);
+   b->raster = raster;
+   b->brow = brow;
+   b->bcol = bcol;
+   b->ready = 0;
+   b->pins = 1;
+   b->chain = dem->bucket[h];
+   dem->bucket[h] = b;
+   lvis_dem_front(dem,b);
+   pthread_mutex_unlock(&dem->lock);
+
+   bytes = lvis_dem_load(dem,b,&error);
+
+   pthread_mutex_lock(&dem->lock);
+   b->ready = 1;
+   dem->reads++;
+   dem->bytes += (double) bytes;
+   dem->errors += error;
+   if(ahead)
+     {
+	dem->ahead++;
+	b->pins--;
+     }
+   pthread_cond_broadcast(&dem->loaded);
+   pthread_mutex_unlock(&dem->lock);
+   return ahead ? NULL : b;
+}
+
+static void lvis_dem_release(struct lvis_dem * dem, struct lvis_dem_worker * w)
+{
+   int j;
+
+   pthread_mutex_lock(&dem->lock);
+   for(j=0;j<LVIS_DEM_HELD;j++)
+     if(w->held[j] != NULL)
+       {
+	  w->held[j]->pins--;
+	  w->held[j] = NULL;
+       }
+   pthread_mutex_unlock(&dem->lock);
+}
+
+static void * lvis_dem_prefetcher(void * context)
+{
+   struct lvis_dem   * dem = (struct lvis_dem *) context;
+   struct lvis_dem_key key;
+
+   pthread_mutex_lock(&dem->lock);
+   for(;;)
+     {
+	while(dem->qcount == 0 && !dem->stop) pthread_cond_wait(&dem->wake,&dem->lock);
+	if(dem->stop) break;
+	key = dem->queue[dem->qhead];
+	dem->qhead = (dem->qhead + 1) % LVIS_DEM_QUEUE;
+	dem->qcount--;
+	pthread_mutex_unlock(&dem->lock);
+	lvis_dem_get(dem,key.raster,key.brow,key.bcol,1);
+	pthread_mutex_lock(&dem->lock);
+     }
+   pthread_mutex_unlock(&dem->lock);
+   return NULL;
+}
+
+// -------------------------------------------------------------------------
+// sampling
+
+// pixel row / col of raster k, from a neighbouring raster past its edge
+static double lvis_dem_pixel(struct lvis_dem * dem, struct lvis_dem_worker * w, int k, long row, long col)
+{
+   struct lvis_dem_raster * r = &dem->raster[k];
+   struct lvis_dem_block  * b;
+   long                     brow,bcol;
+   double                   x,y;
+   int                      j,hint=-1;
+
+   if(row < 0 || col < 0 || row >= r->nrows || col >= r->ncols)
+     {
+	x = r->ulx + col * r->xdim;
+	y = r->uly - row * r->ydim;
+	if((k = lvis_dem_locate(dem,&hint,&x,y)) < 0) return NAN;
+	r = &dem->raster[k];
+	row = lround((r->uly - y) / r->ydim);
+	col = lround((x - r->ulx) / r->xdim);
+     }
+   brow = row / LVIS_DEM_BLOCK;
+   bcol = col / LVIS_DEM_BLOCK;
+   for(j=0;j<LVIS_DEM_HELD;j++)
+     {
+	b = w->held[j];
+	if(b != NULL && b->raster == k && b->brow == brow && b->bcol == bcol) break;
+     }
+   if(j < LVIS_DEM_HELD) w->hits++;
+   else
+     {
+	b = lvis_dem_get(dem,k,brow,bcol,0);
+	if(w->held[w->replace] != NULL)
+	  {
+	     pthread_mutex_lock(&dem->lock);
+	     w->held[w->replace]->pins--;
+	     pthread_mutex_unlock(&dem->lock);
+	  }
+	w->held[w->replace] = b;
+	w->replace = (w->replace + 1) % LVIS_DEM_HELD;
+     }
+   return b->data[(row % LVIS_DEM_BLOCK) * LVIS_DEM_BLOCK + col % LVIS_DEM_BLOCK];
+}
+
+// bilinear between the four pixel centres around x / y; nan if one of
+// them that counts is NODATA or off the DEM
+static double lvis_dem_height(struct lvis_dem * dem, struct lvis_dem_worker * w, double x, double y)
+{
+   struct lvis_dem_raster * r;
+   double                   c,v,fx,fy,weight,sum=0.0;
+   long                     row0,col0;
+   int                      k,i;
+
+   if((k = lvis_dem_locate(dem,&w->raster,&x,y)) < 0) return NAN;
+   r = &dem->raster[k];
+   c = (x - r->ulx) / r->xdim;
+   v = (r->uly - y) / r->ydim;
+   col0 = (long) floor(c);
+   row0 = (long) floor(v);
+   fx = c - col0;
+   fy = v - row0;
+   for(i=0;i<4;i++)
+     {
+	weight = ((i & 1) ? fx : 1.0 - fx) * ((i & 2) ? fy : 1.0 - fy);
+	if(weight == 0.0) continue;
+	v = lvis_dem_pixel(dem,w,k,row0 + (i >> 1),col0 + (i & 1));
+	if(!(v == v)) return NAN;
+	sum += weight * v;
+     }
+   return sum;
+}
+
+// queue the blocks on the line from x0 / y0 through x1 / y1, as far past
+// x1 / y1 again
+static void lvis_dem_ahead(struct lvis_dem * dem, double x0, double y0, double x1, double y1)
+{
+   struct lvis_dem_raster * r;
+   struct lvis_dem_key      key,last;
+   double                   dx,dy,length,step,reach,x,y,s;
+   int                      k,hint=-1,queued=0;
+
+   if((k = lvis_dem_locate(dem,&hint,&x1,y1)) < 0) return;
+   if(dem->proj == 0 && x0 - x1 > 180.0) x0 -= 360.0;
+   if(dem->proj == 0 && x1 - x0 > 180.0) x0 += 360.0;
+   dx = x1 - x0;
+   dy = y1 - y0;
+   length = sqrt(dx * dx + dy * dy);
+   if(!(length > 0.0)) return;
+   r = &dem->raster[k];
+   step = 0.5 * LVIS_DEM_BLOCK * ((r->xdim < r->ydim) ? r->xdim : r->ydim);
+   // a chunk shorter than a block still gets the block after its last shot
+   reach = (length > 2.0 * step) ? length : 2.0 * step;
+   last.raster = -1;
+   last.brow = last.bcol = -1;
+   pthread_mutex_lock(&dem->lock);
+   for(s=step;s<=reach && queued<LVIS_DEM_AHEAD && dem->qcount<LVIS_DEM_QUEUE;s+=step)
+     {
+	x = x1 + dx * s / length;
+	y = y1 + dy * s / length;
+	if((k = lvis_dem_find(dem,&hint,x,y)) < 0) break;
+	r = &dem->raster[k];
+	key.raster = k;
+	key.brow = lround((r->uly - y) / r->ydim) / LVIS_DEM_BLOCK;
+	key.bcol = lround((x - r->ulx) / r->xdim) / LVIS_DEM_BLOCK;
+	if(key.raster == last.raster && key.brow == last.brow && key.bcol == last.bcol) continue;
+	dem->queue[(dem->qhead + dem->qcount) % LVIS_DEM_QUEUE] = key;
+	dem->qcount++;
+	queued++;
+	last = key;
+     }
+   if(queued > 0) pthread_cond_signal(&dem->wake);
+   pthread_mutex_unlock(&dem->lock);
+}
+
+void lvis_dem_sample_n(struct lvis_dem * dem, int worker, const double * x, const double * y, long n, double * h)
+{
+   struct lvis_dem_worker * w = &dem->worker[worker];
+   long                     i,first=-1,last=-1;
+
+   for(i=0;i<n;i++)
+     if(x[i] == x[i] && y[i] == y[i])
+       {
+	  if(first < 0) first = i;
+	  last = i;
+       }
+   if(first >= 0 && last > first && dem->running) lvis_dem_ahead(dem,x[first],y[first],x[last],y[last]);
+   for(i=0;i<n;i++)
+     {
+	h[i] = NAN;
+	if(!(x[i] == x[i] && y[i] == y[i])) continue;
+	h[i] = lvis_dem_height(dem,w,x[i],y[i]);
+	w->samples++;
+	if(!(h[i] == h[i])) w->missing++;
+     }
+   // let the blocks go, the next chunk may be anywhere
+   lvis_dem_release(dem,w);
+}
+
+// -------------------------------------------------------------------------
+
+struct lvis_dem * lvis_dem_open(struct lvis_dem_options * d, int proj)
+{
+   struct lvis_dem * dem;
+   int               k;
+
+   if((dem = (struct lvis_dem *) calloc(1,sizeof(struct lvis_dem)))==NULL ||
+      (dem->raster = (struct lvis_dem_raster *) calloc(d->nfiles,sizeof(struct lvis_dem_raster)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the DEM\n");
+	exit(-1);
+     }
+   dem->proj = proj;
+   for(k=0;k<d->nfiles;k++)
+     {
+	if(lvis_dem_raster_open(&dem->raster[k],d->files[k]) != 0)
+	  {
+	     dem->nrasters = k;
+	     lvis_dem_destroy(dem);
+	     return NULL;
+	  }
+	dem->nrasters++;
+     }
+   dem->maxblocks = (long) ((d->memoryMB << 20) / (LVIS_DEM_BLOCK * LVIS_DEM_BLOCK * sizeof(float)));
+   if(dem->maxblocks < 1) dem->maxblocks = 1;
+   for(dem->nbuckets=64;dem->nbuckets<2*dem->maxblocks;dem->nbuckets*=2);
+   if((dem->bucket = (struct lvis_dem_block **) calloc(dem->nbuckets,sizeof(struct lvis_dem_block *)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the DEM cache\n");
+	exit(-1);
+     }
+   pthread_mutex_init(&dem->lock,NULL);
+   pthread_cond_init(&dem->loaded,NULL);
+   pthread_cond_init(&dem->wake,NULL);
+   return dem;
+}
+
+void lvis_dem_start(struct lvis_dem * dem, int nworkers)
+{
+   int i;
+
+   if((dem->worker = (struct lvis_dem_worker *) calloc(nworkers,sizeof(struct lvis_dem_worker)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the DEM samplers\n");
+	exit(-1);
+     }
+   for(i=0;i<nworkers;i++) dem->worker[i].raster = -1;
+   dem->nworkers = nworkers;
+   dem->stop = 0;
+   dem->qhead = dem->qcount = 0;
+   dem->running = (pthread_create(&dem->thread,NULL,lvis_dem_prefetcher,dem) == 0);
+}
+
+void lvis_dem_stop(struct lvis_dem * dem)
+{
+   long samples=0,missing=0,hits=dem->hits;
+   int  i;
+
+   if(dem->running)
+     {
+	pthread_mutex_lock(&dem->lock);
+	dem->stop = 1;
+	pthread_cond_signal(&dem->wake);
+	pthread_mutex_unlock(&dem->lock);
+	pthread_join(dem->thread,NULL);
+	dem->running = 0;
+     }
+   for(i=0;i<dem->nworkers;i++)
+     {
+	samples += dem->worker[i].samples;
+	missing += dem->worker[i].missing;
+	hits += dem->worker[i].hits;
+     }
+   if(dem->errors > 0) fprintf(stderr,"dem: %ld blocks could not be read in full, their pixels are nan\n",dem->errors);
+   // a hit is a pixel found in a held or cached block, a miss one that had to be read
+   fprintf(stderr,"dem: %ld shots, %ld without a height; cache %.1f%% hits (%ld of %ld pixels), %ld blocks read (%ld ahead), "
+	   "%ld evicted, %.1f MB read\n",samples,missing,
+	   (hits + dem->misses > 0) ? 100.0 * hits / (hits + dem->misses) : 0.0,
+	   hits,hits + dem->misses,dem->reads,dem->ahead,dem->evicted,dem->bytes / 1048576.0);
+   free(dem->worker);
+   dem->worker = NULL;
+   dem->nworkers = 0;
+}
+
+void lvis_dem_destroy(struct lvis_dem * dem)
+{
+   struct lvis_dem_block * b,* next;
+   int                     k;
+
+   if(dem == NULL) return;
+   if(dem->running) lvis_dem_stop(dem);
+   for(b=dem->head;b!=NULL;b=next)
+     {
+	next = b->next;
+	free(b->data);
+	free(b);
+     }
+   for(k=0;k<dem->nrasters;k++) close(dem->raster[k].fd);
+   if(dem->bucket != NULL)
+     {
+	pthread_mutex_destroy(&dem->lock);
+	pthread_cond_destroy(&dem->loaded);
+	pthread_cond_destroy(&dem->wake);
+     }
+   free(dem->bucket);
+   free(dem->raster);
+   free(dem);
+}
+
+int lvis_dem_elevation(unsigned char * data, int fileType, float dataVersion, double * lon, double * lat, double * z)
+{
+   *z = NAN;
+   release_data_position(data,fileType,dataVersion,lon,lat);
+   if(fileType == LVIS_RELEASE_FILETYPE_LCE)
+     {
+	if(dataVersion == ((float)1.00)) *z = ((struct lvis_lce_v1_00 *) data)->zt;
+	if(dataVersion == ((float)1.01)) *z = ((struct lvis_lce_v1_01 *) data)->zt;
+	if(dataVersion == ((float)1.02)) *z = ((struct lvis_lce_v1_02 *) data)->zt;
+	if(dataVersion == ((float)1.03)) *z = ((struct lvis_lce_v1_03 *) data)->zt;
+	if(dataVersion == ((float)1.04)) *z = ((struct lvis_lce_v1_04 *) data)->zt;
+	return 1;
+     }
+   if(fileType == LVIS_RELEASE_FILETYPE_LGE)
+     {
+	if(dataVersion == ((float)1.00)) *z = ((struct lvis_lge_v1_00 *) data)->zg;
+	if(dataVersion == ((float)1.01)) *z = ((struct lvis_lge_v1_01 *) data)->zg;
+	if(dataVersion == ((float)1.02)) *z = ((struct lvis_lge_v1_02 *) data)->zg;
+	if(dataVersion == ((float)1.03)) *z = ((struct lvis_lge_v1_03 *) data)->zg;
+	if(dataVersion == ((float)1.04)) *z = ((struct lvis_lge_v1_04 *) data)->zg;
+	return 1;
+     }
+   if(fileType == LVIS_RELEASE_FILETYPE_LGW)
+     {
+	if(dataVersion == ((float)1.00)) *z = ((struct lvis_lgw_v1_00 *) data)->z431;
+	if(dataVersion == ((float)1.01)) *z = ((struct lvis_lgw_v1_01 *) data)->z431;
+	if(dataVersion == ((float)1.02)) *z = ((struct lvis_lgw_v1_02 *) data)->z431;
+	if(dataVersion == ((float)1.03)) *z = ((struct lvis_lgw_v1_03 *) data)->z431;
+	if(dataVersion == ((float)1.04)) *z = ((struct lvis_lgw_v1_04 *) data)->z527;
+	return 1;
+     }
+   return 0;
+}
+
+void lvis_dem_print_headers(FILE * out, char * delim)
+{
+   fprintf(out,"%szdem%sdzdem",delim,delim);
+}
+
+void lvis_dem_print(FILE * out, double z, double h, char * delim)
+{
+   fprintf(out,"%s%9.4f%s%9.4f",delim,h,delim,z - h);
+}
@@ -0,0 +1,78 @@
+#ifndef __LVIS_RELEASE_DEM_H
+#define __LVIS_RELEASE_DEM_H
+
+// lvis_release_dem.h
+//
+// -dem: sample a reference DEM under every shot of the text conversion
+// and append its height and the shot's elevation minus it (zdem, dzdem;
+// the elevation is zt for LCE, zg for LGE and the lowest sample, z431 /
+// z527, for LGW, each at its own position).  The DEM is one float raster
+// or a set of tiles of one (-dem, repeated, or -demlist): ESRI .bil / .flt
+// files with a .hdr (NROWS, NCOLS, ULXMAP / ULYMAP, XDIM / YDIM,
+// BYTEORDER, NODATA as grid mode writes them, or the .flt keys ncols,
+// xllcorner, cellsize ...), in lon / lat degrees or, with -proj, in that
+// polar stereographic grid's x / y (m).  The height is bilinear between
+// the four pixel centres around the shot, taken from the next tile where
+// they straddle a seam; a shot off the DEM or next to NODATA gets nan.
+//
+// The rasters are read in blocks of LVIS_DEM_BLOCK x LVIS_DEM_BLOCK
+// pixels, decoded once (host byte order, NODATA as nan) into an LRU cache
+// of at most -demmem MB shared by the threads, and each thread keeps the
+// last few blocks it used without taking the lock.  The shots come in
+// track order, so before a chunk is sampled the blocks on its line ahead
+// (its heading carried on for as far again) are queued to a thread that
+// loads them while the chunk is worked on.  The cache hit ratio and the
+// bytes read are reported at the end.
+
+#include <stdio.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_DEM_MEMORY_MB
+#define  LVIS_DEM_MEMORY_MB 256       // default -demmem
+#endif
+
+#define  LVIS_DEM_BLOCK     256       // pixels a side of a cached block
+#define  LVIS_DEM_HELD      4         // blocks a thread keeps without the lock
+#define  LVIS_DEM_AHEAD     8         // blocks queued ahead of a chunk at most
+#define  LVIS_DEM_QUEUE     256       // prefetch queue
+
+struct lvis_dem_options
+{
+   char ** files;         // -dem file (repeated) / -demlist list
+   int     nfiles;
+   long    memoryMB;      // -demmem MB of decoded blocks
+};
+
+void lvis_dem_defaults(struct lvis_dem_options * d);
+
+// handle the dem options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a dem option)
+int  lvis_dem_parse_option(int argc, char * argv[], int i, struct lvis_dem_options * d);
+
+struct lvis_dem;
+
+// open the rasters (in the x / y of EPSG proj, lon / lat when 0), NULL
+// (with a message) if one cannot be used
+struct lvis_dem * lvis_dem_open(struct lvis_dem_options * d, int proj);
+void              lvis_dem_destroy(struct lvis_dem * dem);
+
+// start the prefetch thread for nworkers samplers, stop it (and report
+// the cache) when they are done
+void lvis_dem_start(struct lvis_dem * dem, int nworkers);
+void lvis_dem_stop(struct lvis_dem * dem);
+
+// the elevation a record is differenced with and its position, 0 if the
+// type has none
+int  lvis_dem_elevation(unsigned char * data, int fileType, float dataVersion, double * lon, double * lat,
+			double * z);
+
+// the DEM height at n positions in track order (nan to skip one), by
+// worker (0 .. nworkers-1)
+void lvis_dem_sample_n(struct lvis_dem * dem, int worker, const double * x, const double * y, long n, double * h);
+
+// the column headers and the values the text conversion appends to a row
+void lvis_dem_print_headers(FILE * out, char * delim);
+void lvis_dem_print(FILE * out, double z, double h, char * delim);
+
+#endif
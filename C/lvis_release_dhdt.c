@@ -0,0 +1,881 @@
+// lvis_release_dhdt.c
+//
+// Repeat campaign elevation change (dhdt mode), see lvis_release_dhdt.h.
+//
+// The chunks of the inputs are read on the pool in waves, as in the other
+// modes, into compact shots (position, time, elevation and ids, also the
+// record of the partition files); the main thread then adds them to the
+// reference index or writes them to their partitions in task order, so
+// the partition files, and with them the pairs, are the same on any
+// number of threads.  The index puts every reference shot in the cell of
+// its x / y / z, hashes the cells with open addressing and chains the
+// shots of a cell.  Of several reference shots at the same distance the
+// one read first wins, so neither the chains nor the partitions decide a
+// pair: in memory or spilled, the pairs are the same.
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_proj.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_dhdt.h"
+
+#define LVIS_DHDT_FILE_SHIFT 40                   // ref = file << 40 | record
+#define LVIS_DHDT_MIN_CELL   0.01                 // keeps the cell numbers in 32 bits
+#define LVIS_DHDT_SHOT_BYTES 160                  // a reference shot indexed: shot, x / y / z, chain, slots
+
+// a shot as it is indexed, matched and spilled
+struct lvis_dhdt_shot
+{
+   double   lon,lat;
+   double   t;          // lvistime (NAN without)
+   int64_t  ref;        // input (of its campaign) and record
+   float    z;
+   uint32_t lfid,shot;
+   uint32_t part;       // the partition it is written to
+};
+
+struct lvis_dhdt_slot
+{
+   int32_t k[3];        // the cell
+   int32_t used;
+   long    head;        // its first shot, -1 without
+};
+
+struct lvis_dhdt_index
+{
+   struct lvis_dhdt_shot * shot;
+   long                    n;
+   double                * p;      // x / y / z of every shot
+   long                  * next;   // the next shot of its cell, -1 at the end
+   struct lvis_dhdt_slot * slot;
+   long                    mask;
+   double                  size;   // of a cell (m)
+};
+
+// a chunk of an input
+struct lvis_dhdt_read
+{
+   int                     file;
+   int64_t                 first,count;
+   struct lvis_dhdt_shot * shot;   // once for every partition it goes to
+   long                    nshot,maxshot;
+   long                    kept;   // shots
+   char                  * text;   // the pairs, matched in memory
+   size_t                  length;
+   long                    written;
+   int                     status; // 0, -1 on a read or render error
+};
+
+// a partition, spilled
+struct lvis_dhdt_part
+{
+   int    part;
+   long   written;
+   int    status;                  // 0, -1 on a spill or render error
+};
+
+struct lvis_dhdt_job
+{
+   struct lvis_release_options * opt;
+   struct lvis_dhdt_options    * d;
+   struct lvis_release_file    * files;     // the reference campaign, then the inputs
+   int                           nref;      // files of the reference campaign
+   struct lvis_canon_column   ** column;    // elevation, lfid, shotnumber, lvistime per file
+   struct lvis_dhdt_read       * reads;
+   long                          base;      // first partition of the running round
+   unsigned char              ** raw;       // per worker
+   unsigned char              ** canon;     // per worker
+   double                        tile;      // partition tiles (m)
+   int                           nparts;    // 0: the reference index is in memory
+   struct lvis_dhdt_index        index;     // in memory
+   struct lvis_dhdt_part       * parts;
+   // the join of a read pass
+   FILE                       ** spill;     // the partition files, or NULL
+   FILE                        * out;
+   char                        * name;      // of out
+   long                          maxshot;   // index shots allocated
+   long                          kept,written;
+   int                           errors;
+};
+
+void lvis_dhdt_defaults(struct lvis_dhdt_options * d)
+{
+   memset(d,0,sizeof(struct lvis_dhdt_options));
+   d->radius = LVIS_DHDT_RADIUS;
+   d->memoryMB = LVIS_DHDT_MEMORY_MB;
+}
+
+void lvis_dhdt_free(struct lvis_dhdt_options * d)
+{
+   int i;
+
+   for(i=0;i<d->nrefs;i++) free(d->refs[i]);
+   free(d->refs);
+   d->refs = NULL;
+   d->nrefs = 0;
+}
+
+// days since 1970-01-01 of YYYY-MM-DD, LONG_MIN if it is not a date
+static long lvis_dhdt_day(char * date)
+{
+   int  y,m,d;
+   long era,yoe,doy,doe;
+
+   if(sscanf(date,"%d-%d-%d",&y,&m,&d)!=3 || m < 1 || m > 12 || d < 1 || d > 31) return LONG_MIN;
+   y -= (m <= 2);
+   era = (y >= 0 ? y : y - 399) / 400;
+   yoe = y - era * 400;
+   doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+   doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+   return era * 146097 + doe - 719468;
+}
+
+int lvis_dhdt_parse_option(int argc, char * argv[], int i, struct lvis_dhdt_options * d)
+{
+   long day;
+
+   if(strcmp(argv[i],"-ref")==0 && i+1<argc)
+     {
+	lvis_batch_add_input(&d->refs,&d->nrefs,argv[i+1]);
+	return 2;
+     }
+   if(strcmp(argv[i],"-reflist")==0 && i+1<argc)
+     {
+	lvis_batch_add_list(&d->refs,&d->nrefs,argv[i+1]);
+	return 2;
+     }
+   if(strcmp(argv[i],"-dhdtmem")==0 && i+1<argc)
+     {
+	d->memoryMB = atol(argv[i+1]);
+	if(d->memoryMB < 1) d->memoryMB = 1;
+	return 2;
+     }
+   if((strcmp(argv[i],"-refdate")==0 || strcmp(argv[i],"-date")==0) && i+1<argc)
+     {
+	if((day = lvis_dhdt_day(argv[i+1])) == LONG_MIN)
+	  {
+	     fprintf(stderr,"%s wants a date as YYYY-MM-DD, not '%s'\n",argv[i],argv[i+1]);
+	     exit(-1);
+	  }
+	if(strcmp(argv[i],"-refdate")==0) { d->refday = day; d->dates |= 1; }
+	else { d->day = day; d->dates |= 2; }
+	return 2;
+     }
+   return 0;
+}
+
+static uint64_t lvis_dhdt_hash(int64_t i, int64_t j, int64_t k)
+{
+   uint64_t h = (uint64_t) i * 0x9E3779B97F4A7C15ULL ^ (uint64_t) j * 0xC2B2AE3D27D4EB4FULL ^
+		(uint64_t) k * 0x165667B19E3779F9ULL;
+
+   h ^= h >> 31;
+   h *= 0xBF58476D1CE4E5B9ULL;
+   h ^= h >> 29;
+   return h;
+}
+
+// -------------------------------------------------------------------------
+// the index
+
+static struct lvis_dhdt_slot * lvis_dhdt_cell(struct lvis_dhdt_index * x, int64_t i, int64_t j, int64_t k, int add)
+{
+   long h = (long) (lvis_dhdt_hash(i,j,k) & (uint64_t) x->mask);
+
+   while(x->slot[h].used)
+     {
+	if(x->slot[h].k[0] == i && x->slot[h].k[1] == j && x->slot[h].k[2] == k) return &x->slot[h];
+	h = (h + 1) & x->mask;
+     }
+   if(!add) return NULL;
+   x->slot[h].k[0] = (int32_t) i;
+   x->slot[h].k[1] = (int32_t) j;
+   x->slot[h].k[2] = (int32_t) k;
+   x->slot[h].used = 1;
+   x->slot[h].head = -1;
+   return &x->slot[h];
+}
+
+static void lvis_dhdt_index_build(struct lvis_dhdt_index * x, double size)
+{
+   struct lvis_dhdt_slot * s;
+   double                * p;
+   long                    i,nslots=16;
+
+   while(nslots < 2 * x->n) nslots *= 2;
+   x->size = size;
+   x->mask = nslots - 1;
+   x->p = (double *) malloc((x->n > 0 ? x->n : 1) * 3 * sizeof(double));
+   x->next = (long *) malloc((x->n > 0 ? x->n : 1) * sizeof(long));
+   x->slot = (struct lvis_dhdt_slot *) calloc(nslots,sizeof(struct lvis_dhdt_slot));
+   if(x->p == NULL || x->next == NULL || x->slot == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the reference index\n");
+	exit(-1);
+     }
+   for(i=0;i<x->n;i++)
+     {
+	p = x->p + 3 * i;
+	lvis_proj_ecef(x->shot[i].lon,x->shot[i].lat,p);
+	s = lvis_dhdt_cell(x,(int64_t) floor(p[0] / size),(int64_t) floor(p[1] / size),(int64_t) floor(p[2] / size),1);
+	x->next[i] = s->head;
+	s->head = i;
+     }
+}
+
+static void lvis_dhdt_index_free(struct lvis_dhdt_index * x)
+{
+   free(x->shot);
+   free(x->p);
+   free(x->next);
+   free(x->slot);
+   memset(x,0,sizeof(struct lvis_dhdt_index));
+}
+
+// the reference shot nearest p within sqrt(r2), -1 without; the cells are
+// at least the radius wide, so it is in p's cell or one next to it
+static long lvis_dhdt_nearest(struct lvis_dhdt_index * x, const double * p, double r2, double * d2)
+{
+   struct lvis_dhdt_slot * s;
+   int64_t                 c[3];
+   double                  dx,dy,dz,dd,best=r2;
+   long                    i,found=-1;
+   int                     a,di,dj,dk;
+
+   if(x->n == 0) return -1;
+   for(a=0;a<3;a++) c[a] = (int64_t) floor(p[a] / x->size);
+   for(di=-1;di<=1;di++)
+     for(dj=-1;dj<=1;dj++)
+       for(dk=-1;dk<=1;dk++)
+	 {
+	    if((s = lvis_dhdt_cell(x,c[0] + di,c[1] + dj,c[2] + dk,0)) == NULL) continue;
+	    for(i=s->head;i>=0;i=x->next[i])
+	      {
+		 dx = x->p[3*i] - p[0]; dy = x->p[3*i+1] - p[1]; dz = x->p[3*i+2] - p[2];
+		 dd = dx * dx + dy * dy + dz * dz;
+		 if(dd < best || (dd == best && (found < 0 || x->shot[i].ref < x->shot[found].ref)))
+		   {
+		      best = dd;
+		      found = i;
+		   }
+	      }
+	 }
+   *d2 = best;
+   return found;
+}
+
+// pair n shots with the index, the rows to out (keyed: each after the
+// ref of its shot, to be merged back into input order); returns the pairs
+static long lvis_dhdt_match(struct lvis_dhdt_job * job, struct lvis_dhdt_index * x, struct lvis_dhdt_shot * shot,
+			    long n, FILE * out, int keyed)
+{
+   struct lvis_dhdt_options * d = job->d;
+   struct lvis_dhdt_shot    * r;
+   char                     * delim = job->opt->delim;
+   double                     p[3],d2,dt,dh;
+   long                       k,j,written=0;
+
+   for(k=0;k<n;k++)
+     {
+	lvis_proj_ecef(shot[k].lon,shot[k].lat,p);
+	if((j = lvis_dhdt_nearest(x,p,d->radius * d->radius,&d2)) < 0) continue;
+	r = &x->shot[j];
+	dt = (double) (d->day - d->refday) + (shot[k].t - r->t) / 86400.0;
+	dh = (double) shot[k].z - (double) r->z;
+	if(keyed) fwrite(&shot[k].ref,sizeof(shot[k].ref),1,out);
+	fprintf(out,"%14.10f%s%14.10f",shot[k].lon,delim,shot[k].lat);
+	fprintf(out,"%s%u%s%u%s%12.6f%s%9.4f",delim,r->lfid,delim,r->shot,delim,r->t,delim,r->z);
+	fprintf(out,"%s%u%s%u%s%12.6f%s%9.4f",delim,shot[k].lfid,delim,shot[k].shot,delim,shot[k].t,delim,shot[k].z);
+	fprintf(out,"%s%8.3f%s%12.6f%s%9.4f%s%9.4f\n",delim,sqrt(d2),delim,dt,delim,dh,delim,
+		(dt != 0.0) ? dh / (dt / 365.25) : NAN);
+	written++;
+     }
+   return written;
+}
+
+// -------------------------------------------------------------------------
+// reading
+
+static void lvis_dhdt_add(struct lvis_dhdt_read * task, struct lvis_dhdt_shot * s)
+{
+   if(task->nshot == task->maxshot)
+     {
+	task->maxshot = 2 * task->maxshot + 256;
+	if((task->shot = (struct lvis_dhdt_shot *) realloc(task->shot,task->maxshot * sizeof(struct lvis_dhdt_shot)))==NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the shots\n");
+	     exit(-1);
+	  }
+     }
+   task->shot[task->nshot++] = *s;
+}
+
+static uint32_t lvis_dhdt_part_of(struct lvis_dhdt_job * job, int64_t i, int64_t j, int64_t k)
+{
+   return (uint32_t) ((lvis_dhdt_hash(i,j,k) >> 32) % (uint64_t) job->nparts);
+}
+
+static void lvis_dhdt_read_run(void * context, long t, int worker)
+{
+   struct lvis_dhdt_job       * job = (struct lvis_dhdt_job *) context;
+   struct lvis_dhdt_read      * task = &job->reads[t];
+   struct lvis_release_file   * f = &job->files[task->file];
+   struct lvis_release_options * opt = job->opt;
+   struct lvis_canon_column  ** c = job->column + 4 * task->file;
+   struct lvis_dhdt_shot        s;
+   unsigned char              * rec;
+   uint32_t                     parts[8];
+   double                       lon,lat,z,p[3],r = job->d->radius;
+   int64_t                      i,got,lo[3],hi[3],a,b,e;
+   int                          size = lvis_record_size(f->fileType,(float)1.04);
+   int                          reference = (task->file < job->nref),n,m,q;
+   FILE                       * out;
+
+   memset(&s,0,sizeof(s));
+   got = lvis_canon_read(f,task->first,task->count,job->raw[worker],job->canon[worker]);
+   if(got != task->count) task->status = -1;
+   for(i=0;i<got;i++)
+     {
+	rec = job->canon[worker] + i * size;
+	release_data_position(rec,f->fileType,(float)1.04,&lon,&lat);
+	if(!(lon == lon && lat == lat)) continue;
+	if(!lvis_release_keep(opt,lon,lat)) continue;
+	z = lvis_canon_value(rec,c[0]);
+	if(!(z == z)) continue;
+	s.lon = lon;
+	s.lat = lat;
+	s.z = (float) z;
+	s.lfid = (uint32_t) lvis_canon_value(rec,c[1]);
+	s.shot = (uint32_t) lvis_canon_value(rec,c[2]);
+	s.t = lvis_canon_value(rec,c[3]);
+	s.ref = ((int64_t) (reference ? task->file : task->file - job->nref) << LVIS_DHDT_FILE_SHIFT) | (task->first + i);
+	task->kept++;
+	if(job->nparts == 0)
+	  {
+	     lvis_dhdt_add(task,&s);
+	     continue;
+	  }
+	// its own tile, and for a reference shot every tile within the radius
+	lvis_proj_ecef(lon,lat,p);
+	for(q=0;q<3;q++)
+	  {
+	     lo[q] = (int64_t) floor((p[q] - (reference ? r : 0.0)) / job->tile);
+	     hi[q] = (int64_t) floor((p[q] + (reference ? r : 0.0)) / job->tile);
+	  }
+	n = 0;
+	for(a=lo[0];a<=hi[0];a++)
+	  for(b=lo[1];b<=hi[1];b++)
+	    for(e=lo[2];e<=hi[2];e++)
+	      {
+		 parts[n] = lvis_dhdt_part_of(job,a,b,e);
+		 for(m=0;m<n && parts[m]!=parts[n];m++);
+		 if(m == n) n++;
+	      }
+	for(m=0;m<n;m++)
+	  {
+	     s.part = parts[m];
+	     lvis_dhdt_add(task,&s);
+	  }
+     }
+
+   // the inputs against the reference index in memory
+   if(!reference && job->nparts == 0)
+     {
+	if((out = open_memstream(&task->text,&task->length))==NULL)
+	  {
+	     task->status = -1;
+	     return;
+	  }
+	task->written = lvis_dhdt_match(job,&job->index,task->shot,task->nshot,out,0);
+	if(fclose(out)!=0) task->status = -1;
+     }
+}
+
+// -------------------------------------------------------------------------
+// the partitions
+
+// reference 1: the reference shots of partition p, 0: the shots, -1: their pairs
+static void lvis_dhdt_part_name(struct lvis_dhdt_job * job, int reference, int p, char * name, int size)
+{
+   snprintf(name,size,"%s/lvis_dhdt.%d.%s.%04d",job->opt->tmpdir,(int) getpid(),
+	    reference > 0 ? "ref" : (reference == 0 ? "new" : "pairs"),p);
+}
+
+// read a partition file back (and remove it)
+static int lvis_dhdt_load(struct lvis_dhdt_job * job, int reference, int p, struct lvis_dhdt_shot ** shot, long * n)
+{
+   char   name[2048];
+   long   size;
+   FILE * fp;
+
+   lvis_dhdt_part_name(job,reference,p,name,sizeof(name));
+   *shot = NULL;
+   *n = 0;
+   if((fp = fopen(name,"rb"))==NULL) return -1;
+   fseek(fp,0,SEEK_END);
+   size = ftell(fp);
+   rewind(fp);
+   *n = size / (long) sizeof(struct lvis_dhdt_shot);
+   if((*shot = (struct lvis_dhdt_shot *) malloc((*n > 0 ? *n : 1) * sizeof(struct lvis_dhdt_shot)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the shots of a partition\n");
+	exit(-1);
+     }
+   if(*n > 0 && fread(*shot,sizeof(struct lvis_dhdt_shot),*n,fp) != (size_t) *n)
+     {
+	fclose(fp);
+	return -1;
+     }
+   fclose(fp);
+   unlink(name);
+   return 0;
+}
+
+static void lvis_dhdt_part_run(void * context, long t, int worker)
+{
+   struct lvis_dhdt_job   * job = (struct lvis_dhdt_job *) context;
+   struct lvis_dhdt_part  * part = &job->parts[job->base + t];
+   struct lvis_dhdt_index   x;
+   struct lvis_dhdt_shot  * shot;
+   char                     name[2048];
+   size_t                   n;
+   FILE                   * in,* out;
+
+   memset(&x,0,sizeof(x));
+   if(lvis_dhdt_load(job,1,part->part,&x.shot,&x.n) != 0) part->status = -1;
+   lvis_dhdt_index_build(&x,job->index.size);
+
+   // the shots were spilled in input order (a shot to one partition only),
+   // so they are streamed past the index a chunk at a time and never held
+   // whole; the pairs of all the partitions are then merged by ref
+   if((shot = (struct lvis_dhdt_shot *) malloc(LVIS_DHDT_CHUNK * sizeof(struct lvis_dhdt_shot)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the shots of a partition\n");
+	exit(-1);
+     }
+   lvis_dhdt_part_name(job,0,part->part,name,sizeof(name));
+   if((in = fopen(name,"rb"))==NULL)
+     {
+	fprintf(stderr,"Error opening the dhdt spill file: %s (%s)\n",name,strerror(errno));
+	part->status = -1;
+     }
+   else unlink(name);
+   lvis_dhdt_part_name(job,-1,part->part,name,sizeof(name));
+   if(in != NULL && (out = fopen(name,"wb"))==NULL)
+     {
+	fprintf(stderr,"Error opening the dhdt spill file: %s (%s)\n",name,strerror(errno));
+	part->status = -1;
+     }
+   else if(in != NULL)
+     {
+	while((n = fread(shot,sizeof(struct lvis_dhdt_shot),LVIS_DHDT_CHUNK,in)) > 0)
+	  part->written += lvis_dhdt_match(job,&x,shot,(long) n,out,1);
+	if(ferror(in)) part->status = -1;
+	if(fclose(out)!=0) part->status = -1;
+     }
+   if(in != NULL) fclose(in);
+   free(shot);
+   lvis_dhdt_index_free(&x);
+}
+
+// -------------------------------------------------------------------------
+
+static void lvis_dhdt_write(FILE * fp, void * data, size_t size, char * what, char * name)
+{
+   if(size > 0 && fwrite(data,1,size,fp) != size)
+     {
+	fprintf(stderr,"Error writing the %s: %s (%s)\n",what,name,strerror(errno));
+	exit(-1);
+     }
+}
+
+struct lvis_dhdt_pairs
+{
+   FILE    * fp;
+   int64_t   ref;
+   char    * row;
+   size_t    size;
+   ssize_t   length;
+};
+
+// next pair of a partition, 0 at its end
+static int lvis_dhdt_pairs_next(struct lvis_dhdt_pairs * q)
+{
+   if(fread(&q->ref,sizeof(q->ref),1,q->fp)!=1) return 0;
+   if((q->length = getline(&q->row,&q->size,q->fp)) <= 0)
+     {
+	fprintf(stderr,"Short read in a dhdt spill file\n");
+	exit(-1);
+     }
+   return 1;
+}
+
+// sift heap[i] down the min heap of partitions by ref
+static void lvis_dhdt_pairs_sift(struct lvis_dhdt_pairs * q, int * heap, int n, int i)
+{
+   int c,t;
+
+   while((c = 2*i+1) < n)
+     {
+	if(c+1 < n && q[heap[c+1]].ref < q[heap[c]].ref) c++;
+	if(q[heap[i]].ref <= q[heap[c]].ref) break;
+	t = heap[i]; heap[i] = heap[c]; heap[c] = t;
+	i = c;
+     }
+}
+
+// the pairs of each partition are in input order (a shot is in one
+// partition only): merge them into out in input order, as in memory
+static int lvis_dhdt_pairs_merge(struct lvis_dhdt_job * job, FILE * out, char * outname)
+{
+   struct lvis_dhdt_pairs * q;
+   char                     name[2048];
+   int                    * heap,n=0,p,errors=0;
+
+   q = (struct lvis_dhdt_pairs *) calloc(job->nparts,sizeof(struct lvis_dhdt_pairs));
+   heap = (int *) calloc(job->nparts,sizeof(int));
+   if(q == NULL || heap == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the dhdt merge\n");
+	exit(-1);
+     }
+   for(p=0;p<job->nparts;p++)
+     {
+	lvis_dhdt_part_name(job,-1,p,name,sizeof(name));
+	if((q[p].fp = fopen(name,"rb"))==NULL)
+	  {
+	     fprintf(stderr,"Error opening the dhdt spill file: %s (%s)\n",name,strerror(errno));
+	     errors++;
+	     continue;
+	  }
+	unlink(name);
+	if(lvis_dhdt_pairs_next(&q[p])) heap[n++] = p;
+     }
+   for(p=n/2-1;p>=0;p--) lvis_dhdt_pairs_sift(q,heap,n,p);
+   while(n > 0)
+     {
+	p = heap[0];
+	lvis_dhdt_write(out,q[p].row,(size_t) q[p].length,"output file",outname);
+	if(!lvis_dhdt_pairs_next(&q[p])) heap[0] = heap[--n];
+	lvis_dhdt_pairs_sift(q,heap,n,0);
+     }
+   for(p=0;p<job->nparts;p++)
+     {
+	if(q[p].fp != NULL) fclose(q[p].fp);
+	free(q[p].row);
+     }
+   free(q);
+   free(heap);
+   return errors;
+}
+
+static int lvis_dhdt_input(void * context, long t)
+{
+   return ((struct lvis_dhdt_job *) context)->reads[t].file;
+}
+
+// a task's shots to the index or the partition files, its pairs to out
+static void lvis_dhdt_join(void * context, long t)
+{
+   struct lvis_dhdt_job   * job = (struct lvis_dhdt_job *) context;
+   struct lvis_dhdt_read  * task = &job->reads[t];
+   struct lvis_dhdt_index * x = &job->index;
+   long                     k;
+
+   if(task->status != 0)
+     {
+	fprintf(stderr,"Short read in %s at record %lld\n",job->files[task->file].filename,(long long) task->first);
+	job->errors++;
+     }
+   if(job->spill != NULL)
+     {
+	for(k=0;k<task->nshot;k++)
+	  if(fwrite(&task->shot[k],sizeof(struct lvis_dhdt_shot),1,job->spill[task->shot[k].part])!=1)
+	    {
+	       fprintf(stderr,"Error writing a dhdt spill file (%s)\n",strerror(errno));
+	       exit(-1);
+	    }
+     }
+   else if(task->file < job->nref)
+     {
+	if(x->n + task->nshot > job->maxshot)
+	  {
+	     job->maxshot = 2 * job->maxshot + task->nshot;
+	     if((x->shot = (struct lvis_dhdt_shot *) realloc(x->shot,job->maxshot * sizeof(struct lvis_dhdt_shot)))==NULL)
+	       {
+		  fprintf(stderr,"Unable to allocate the reference index\n");
+		  exit(-1);
+	       }
+	  }
+	if(task->nshot > 0) memcpy(x->shot + x->n,task->shot,task->nshot * sizeof(struct lvis_dhdt_shot));
+	x->n += task->nshot;
+     }
+   else lvis_dhdt_write(job->out,task->text,task->length,"output file",job->name);
+   job->kept += task->kept;
+   job->written += task->written;
+   free(task->shot);
+   free(task->text);
+   task->shot = NULL;
+   task->text = NULL;
+}
+
+// read tasks first .. last - 1 a wave at a time: their shots go to the
+// index (in memory) or the partition files (parts), their pairs to out
+static int lvis_dhdt_pass(struct lvis_dhdt_job * job, long first, long last, struct lvis_pool * pool,
+			  FILE ** parts, FILE * out, long * kept, long * written)
+{
+   job->spill = parts;
+   job->out = out;
+   job->name = job->opt->outfile[0] ? job->opt->outfile : "stdout";
+   job->maxshot = job->index.n;
+   job->kept = job->written = 0;
+   job->errors = 0;
+   lvis_batch_waves(pool,first,last,job->files,lvis_dhdt_input,lvis_dhdt_read_run,lvis_dhdt_join,job);
+   *kept += job->kept;
+   *written += job->written;
+   return job->errors;
+}
+
+static FILE ** lvis_dhdt_parts_open(struct lvis_dhdt_job * job, int reference)
+{
+   FILE ** parts;
+   char    name[2048];
+   int     p;
+
+   if((parts = (FILE **) calloc(job->nparts,sizeof(FILE *)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the dhdt partitions\n");
+	exit(-1);
+     }
+   for(p=0;p<job->nparts;p++)
+     {
+	lvis_dhdt_part_name(job,reference,p,name,sizeof(name));
+	if((parts[p] = fopen(name,"wb"))==NULL)
+	  {
+	     fprintf(stderr,"Error opening the dhdt spill file: %s (%s)\n",name,strerror(errno));
+	     exit(-1);
+	  }
+     }
+   return parts;
+}
+
+static void lvis_dhdt_parts_close(struct lvis_dhdt_job * job, FILE ** parts)
+{
+   int p;
+
+   for(p=0;p<job->nparts;p++)
+     if(fclose(parts[p])!=0)
+       {
+	  fprintf(stderr,"Error writing a dhdt spill file (%s)\n",strerror(errno));
+	  exit(-1);
+       }
+   free(parts);
+}
+
+int lvis_dhdt_pairs(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		    struct lvis_batch_options * b, struct lvis_dhdt_options * d)
+{
+   struct lvis_dhdt_job    job;
+   struct lvis_pool      * pool;
+   FILE                  * out,** parts;
+   char                  * field,* name;
+   uint64_t                need=0,budget;
+   long                    t,nreads=0,nrefreads=0,maxtasks=0,base,count,inflight;
+   long                    nrefshots=0,nshots=0,written=0;
+   int64_t                 records,first;
+   int                     i,nfiles,threads,errors=0;
+
+   if(d->nrefs == 0)
+     {
+	fprintf(stderr,"dhdt needs the reference campaign, -ref file or -reflist list\n");
+	return 1;
+     }
+   if(!(d->radius > 0.0))
+     {
+	fprintf(stderr,"-radius must be more than 0\n");
+	return 1;
+     }
+   if(d->dates == 1 || d->dates == 2)
+     {
+	fprintf(stderr,"Give both -refdate and -date, or neither\n");
+	return 1;
+     }
+   memset(&job,0,sizeof(job));
+   job.opt = opt;
+   job.d = d;
+   job.nref = d->nrefs;
+   nfiles = d->nrefs + ninputs;
+   job.files = (struct lvis_release_file *) calloc(nfiles,sizeof(struct lvis_release_file));
+   job.column = (struct lvis_canon_column **) calloc(4 * nfiles,sizeof(struct lvis_canon_column *));
+   if(job.files == NULL || job.column == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+   for(i=0;i<nfiles;i++)
+     {
+	name = (i < job.nref) ? d->refs[i] : inputs[i - job.nref];
+	if(lvis_file_open(&job.files[i],name,opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	lvis_file_close(&job.files[i]);
+	field = d->field;
+	if(field[0] == 0 && job.files[i].fileType == LVIS_RELEASE_FILETYPE_LGE) field = "zg";
+	if(field[0] == 0 && job.files[i].fileType == LVIS_RELEASE_FILETYPE_LCE) field = "zt";
+	if(field[0] == 0 && job.files[i].fileType == LVIS_RELEASE_FILETYPE_LGW) field = "z0";
+	if((job.column[4*i] = lvis_canon_find_column(job.files[i].fileType,field)) == NULL)
+	  {
+	     fprintf(stderr,"%s (%s) has no numeric field '%s' to difference, see -field\n",name,
+		     lvis_file_type_name(job.files[i].fileType),field);
+	     errors++;
+	     continue;
+	  }
+	job.column[4*i+1] = lvis_canon_find_column(job.files[i].fileType,"lfid");
+	job.column[4*i+2] = lvis_canon_find_column(job.files[i].fileType,"shotnumber");
+	job.column[4*i+3] = lvis_canon_find_column(job.files[i].fileType,"lvistime");
+	records = job.files[i].recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < records) records = opt->maxSampleNumber;
+	job.files[i].recordCount = records;
+	if(i < job.nref) need += (uint64_t) records * LVIS_DHDT_SHOT_BYTES;
+	maxtasks += (long) ((records + LVIS_DHDT_CHUNK - 1) / LVIS_DHDT_CHUNK);
+     }
+   if(errors > 0)
+     {
+	free(job.files);
+	free(job.column);
+	return errors;
+     }
+
+   job.reads = (struct lvis_dhdt_read *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_dhdt_read));
+   if(job.reads == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the task table\n");
+	exit(-1);
+     }
+   for(i=0;i<nfiles;i++)
+     {
+	for(first=0;first<job.files[i].recordCount;first+=LVIS_DHDT_CHUNK)
+	  {
+	     job.reads[nreads].file  = i;
+	     job.reads[nreads].first = first;
+	     job.reads[nreads].count = (job.files[i].recordCount - first < LVIS_DHDT_CHUNK) ?
+	       job.files[i].recordCount - first : LVIS_DHDT_CHUNK;
+	     nreads++;
+	  }
+	if(i == job.nref - 1) nrefreads = nreads;
+     }
+
+   pool = lvis_pool_create(b->nthreads);
+   threads = lvis_pool_threads(pool);
+   lvis_batch_buffers(threads,LVIS_DHDT_CHUNK,sizeof(union lvis_canon_record),&job.raw,&job.canon);
+
+   // the reference index in memory, or partitions small enough that a
+   // thread's worth of them fit -dhdtmem at once
+   budget = (uint64_t) d->memoryMB << 20;
+   job.index.size = (d->radius > LVIS_DHDT_MIN_CELL) ? d->radius : LVIS_DHDT_MIN_CELL;
+   job.tile = (LVIS_DHDT_TILE > 4.0 * d->radius) ? LVIS_DHDT_TILE : 4.0 * d->radius;
+   inflight = threads;
+   if(need > budget)
+     {
+	job.nparts = (int) ((need * threads + budget - 1) / budget) * 2;
+	if(job.nparts > LVIS_DHDT_MAX_PARTS)
+	  {
+	     job.nparts = LVIS_DHDT_MAX_PARTS;
+	     // one at a time is the least memory there is
+	     if(need / LVIS_DHDT_MAX_PARTS > budget)
+	       fprintf(stderr,"dhdt: the reference campaign needs more than %d partitions to fit -dhdtmem %ld MB, "
+		       "each will take about %.0f MB\n",LVIS_DHDT_MAX_PARTS,d->memoryMB,
+		       (double) need / LVIS_DHDT_MAX_PARTS / (1 << 20));
+	  }
+	inflight = (long) (budget * job.nparts / need);
+	if(inflight < 1) inflight = 1;
+	if(inflight > threads) inflight = threads;
+     }
+
+   if(opt->outfile[0] == 0) out = stdout;
+   else if((out = fopen(opt->outfile,"w"))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	exit(-1);
+     }
+   name = opt->outfile[0] ? opt->outfile : "stdout";
+   if(opt->topcol)
+     {
+	char * s = opt->delim;
+
+	fprintf(out,"lon%slat%slfid1%sshotnumber1%stime1%sz1%s",s,s,s,s,s,s);
+	fprintf(out,"lfid2%sshotnumber2%stime2%sz2%sdistance%sdt%sdh%sdhdt\n",s,s,s,s,s,s,s);
+     }
+
+   if(job.nparts == 0)
+     {
+	errors += lvis_dhdt_pass(&job,0,nrefreads,pool,NULL,out,&nrefshots,&written);
+	lvis_dhdt_index_build(&job.index,job.index.size);
+	errors += lvis_dhdt_pass(&job,nrefreads,nreads,pool,NULL,out,&nshots,&written);
+     }
+   else
+     {
+	// split both campaigns, then index and match a partition a task
+	parts = lvis_dhdt_parts_open(&job,1);
+	errors += lvis_dhdt_pass(&job,0,nrefreads,pool,parts,out,&nrefshots,&written);
+	lvis_dhdt_parts_close(&job,parts);
+	parts = lvis_dhdt_parts_open(&job,0);
+	errors += lvis_dhdt_pass(&job,nrefreads,nreads,pool,parts,out,&nshots,&written);
+	lvis_dhdt_parts_close(&job,parts);
+	if((job.parts = (struct lvis_dhdt_part *) calloc(job.nparts,sizeof(struct lvis_dhdt_part)))==NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the dhdt partitions\n");
+	     exit(-1);
+	  }
+	for(t=0;t<job.nparts;t++) job.parts[t].part = (int) t;
+	for(base=0;base<job.nparts;base+=count)
+	  {
+	     count = (job.nparts - base < inflight) ? job.nparts - base : inflight;
+	     job.base = base;
+	     lvis_pool_run(pool,count,lvis_dhdt_part_run,&job);
+	     for(t=base;t<base+count;t++)
+	       {
+		  struct lvis_dhdt_part * part = &job.parts[t];
+
+		  if(part->status != 0)
+		    {
+		       fprintf(stderr,"Error reading back dhdt partition %d from %s\n",part->part,opt->tmpdir);
+		       errors++;
+		    }
+		  written += part->written;
+	       }
+	  }
+	free(job.parts);
+	errors += lvis_dhdt_pairs_merge(&job,out,name);
+     }
+   lvis_pool_destroy(pool);
+
+   if(out != stdout && fclose(out)!=0)
+     {
+	fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	errors++;
+     }
+   if(job.nparts > 0)
+     fprintf(stderr,"dhdt: %ld reference shots, %ld shots, %ld pairs within %g m (through %d partitions in %s)\n",
+	     nrefshots,nshots,written,d->radius,job.nparts,opt->tmpdir);
+   else
+     fprintf(stderr,"dhdt: %ld reference shots, %ld shots, %ld pairs within %g m\n",nrefshots,nshots,written,d->radius);
+
+   lvis_batch_free_buffers(threads,job.raw,job.canon);
+   lvis_dhdt_index_free(&job.index);
+   free(job.reads);
+   free(job.files);
+   free(job.column);
+   return errors;
+}
@@ -0,0 +1,66 @@
+#ifndef __LVIS_RELEASE_DHDT_H
+#define __LVIS_RELEASE_DHDT_H
+
+// lvis_release_dhdt.h
+//
+// dhdt mode: elevation change between two campaigns.  The reference
+// campaign is given with -ref file (repeated) or -reflist list, the
+// inputs are the later campaign; every shot of the inputs is paired with
+// the nearest reference shot within -radius metres (default one footprint
+// radius, LVIS_DHDT_RADIUS) and written as a text row of its lon, lat,
+// then lfid, shotnumber, lvistime and elevation (-field: zg for LGE, zt
+// for LCE, z0 for LGW) of the reference shot and of the shot, their
+// distance (m), dt (days, -refdate and -date giving the days the two
+// campaigns were flown), dh (the shot minus the reference) and dh / dt in
+// metres a year.  Shots without a match are left out.
+//
+// The reference shots are kept in a hash of cells -radius wide in earth
+// centred x / y / z, so a match is looked for in 27 cells, and the inputs
+// are streamed through it on the pool.  When the reference campaign is
+// too big for -dhdtmem, both campaigns are first split by tiles of
+// LVIS_DHDT_TILE metres into partition files in -tmpdir (a reference shot
+// goes to every tile within -radius of it), and the partitions are then
+// indexed and matched a few at a time, each on a thread; neither campaign
+// is ever held whole.  The rows come in input order either way: spilled,
+// the pairs of each partition go back to -tmpdir and are merged.
+
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_DHDT_CHUNK
+#define  LVIS_DHDT_CHUNK 4096         // shots read per task
+#endif
+
+#ifndef  LVIS_DHDT_MEMORY_MB
+#define  LVIS_DHDT_MEMORY_MB 1024     // default -dhdtmem
+#endif
+
+#define  LVIS_DHDT_RADIUS     10.0    // default -radius (m)
+#define  LVIS_DHDT_TILE       2000.0  // partition tiles (m), at least 4 -radius
+#define  LVIS_DHDT_MAX_PARTS  256
+
+struct lvis_dhdt_options
+{
+   char ** refs;          // -ref file / -reflist list: the reference campaign
+   int     nrefs;
+   double  radius;        // -radius R (m) a pair may be apart
+   long    memoryMB;      // -dhdtmem MB for the reference index, else spill to -tmpdir
+   long    refday,day;    // -refdate, -date (days since 1970-01-01)
+   int     dates;         // which of them were given: 1 -refdate, 2 -date
+   char    field[64];     // the elevation field (-field, empty = the type's default)
+};
+
+void lvis_dhdt_defaults(struct lvis_dhdt_options * d);
+void lvis_dhdt_free(struct lvis_dhdt_options * d);
+
+// handle the dhdt options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a dhdt option)
+int  lvis_dhdt_parse_option(int argc, char * argv[], int i, struct lvis_dhdt_options * d);
+
+// pair the shots of the inputs with the reference campaign, to stdout (or
+// opt->outfile), returns 0 on success
+struct lvis_batch_options;
+int  lvis_dhdt_pairs(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		     struct lvis_batch_options * b, struct lvis_dhdt_options * d);
+
+#endif
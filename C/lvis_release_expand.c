@@ -0,0 +1,392 @@
+// lvis_release_expand.c
+//
+// Per sample points of LGW waveforms (expand mode), see
+// lvis_release_expand.h.
+//
+// The shots are split into tasks of LVIS_EXPAND_CHUNK that the pool works
+// on in waves, as in the metrics mode.  Each task formats its own points
+// (text, or point records) into a buffer the calling thread writes as it
+// is, so the formatting runs on the pool too and the memory in use is a
+// couple of chunks per thread however large the output grows.
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_features.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_expand.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LVIS_EXPAND_AVX2 1
+#include <immintrin.h>
+#endif
+
+#define LVIS_EXPAND_TEXT_POINT 128    // room for a typical text row, longer ones get more
+
+struct lvis_expand_task
+{
+   int             file;
+   int64_t         first,count;
+   char          * buf;      // the points, as written
+   size_t          length,size;
+   int64_t         shots,points;
+   int             status;   // 0, -1 on a read error
+};
+
+struct lvis_expand_job
+{
+   struct lvis_release_options * opt;
+   struct lvis_expand_options  * x;
+   struct lvis_release_file    * files;
+   int                         * rxSamples;   // valid samples per input
+   struct lvis_expand_task     * tasks;
+   int                           binary;
+   unsigned char              ** raw;         // per worker
+   unsigned char              ** canon;       // per worker
+   struct lvis_expand_point   ** points;      // per worker, one shot's
+   // the join: the points of the tasks, in order, to the output
+   FILE                        * out;
+   int64_t                       shots,npoints;
+   int                           errors;
+};
+
+void lvis_expand_defaults(struct lvis_expand_options * x)
+{
+   x->threshold = LVIS_FEATURES_THRESHOLD;
+   x->scalar = 0;
+}
+
+// position of every sample: start + delta * (i * inv), the same operations
+// in the same order in both kernels so they agree to the bit
+static void lvis_expand_scalar(const double * start, const double * delta, double inv, int first, int n,
+			       double * lon, double * lat, double * z)
+{
+   double f;
+   int    i;
+
+   for(i=first;i<n;i++)
+     {
+	f = (double) i * inv;
+	lon[i] = start[0] + delta[0] * f;
+	lat[i] = start[1] + delta[1] * f;
+	z[i]   = start[2] + delta[2] * f;
+     }
+}
+
+#ifdef LVIS_EXPAND_AVX2
+// returns the number of samples it did (a multiple of 4), the caller
+// finishes the rest with the scalar kernel
+__attribute__((target("avx2")))
+static int lvis_expand_avx2(const double * start, const double * delta, double inv, int n,
+			    double * lon, double * lat, double * z)
+{
+   __m256d idx = _mm256_setr_pd(0.0,1.0,2.0,3.0);
+   __m256d step = _mm256_set1_pd(4.0);
+   __m256d vinv = _mm256_set1_pd(inv);
+   __m256d s0 = _mm256_set1_pd(start[0]),s1 = _mm256_set1_pd(start[1]),s2 = _mm256_set1_pd(start[2]);
+   __m256d d0 = _mm256_set1_pd(delta[0]),d1 = _mm256_set1_pd(delta[1]),d2 = _mm256_set1_pd(delta[2]);
+   __m256d f;
+   int     i;
+
+   for(i=0;i+4<=n;i+=4)
+     {
+	f = _mm256_mul_pd(idx,vinv);
+	_mm256_storeu_pd(lon+i,_mm256_add_pd(s0,_mm256_mul_pd(d0,f)));
+	_mm256_storeu_pd(lat+i,_mm256_add_pd(s1,_mm256_mul_pd(d1,f)));
+	_mm256_storeu_pd(z+i,_mm256_add_pd(s2,_mm256_mul_pd(d2,f)));
+	idx = _mm256_add_pd(idx,step);
+     }
+   return i;
+}
+
+static int lvis_expand_have_avx2(void)
+{
+   static int have = -1;
+
+   if(have < 0)
+     {
+	__builtin_cpu_init();
+	have = __builtin_cpu_supports("avx2") ? 1 : 0;
+     }
+   return have;
+}
+#endif
+
+int lvis_expand_shot(struct lvis_lgw_v1_04 * lgw, int n, int threshold, int scalar,
+		     struct lvis_expand_point * points)
+{
+   uint16_t * rx = (uint16_t *) ((unsigned char *) lgw + offsetof(struct lvis_lgw_v1_04,rxwave));
+   double     lon[528],lat[528],z[528],start[3],delta[3],inv,noise,level;
+   int        i,count=0,done=0;
+
+   if(n > 528) n = 528;
+   if(n < 1) return 0;
+   noise = (lgw->sigmean == lgw->sigmean) ? lgw->sigmean : 0.0;
+   level = floor(noise + threshold);
+
+   start[0] = lgw->lon0;  delta[0] = lgw->lon527 - lgw->lon0;
+   start[1] = lgw->lat0;  delta[1] = lgw->lat527 - lgw->lat0;
+   start[2] = lgw->z0;    delta[2] = lgw->z527 - lgw->z0;
+   inv = (n > 1) ? 1.0 / (n-1) : 0.0;
+#ifdef LVIS_EXPAND_AVX2
+   if(!scalar && lvis_expand_have_avx2()) done = lvis_expand_avx2(start,delta,inv,n,lon,lat,z);
+#endif
+   lvis_expand_scalar(start,delta,inv,done,n,lon,lat,z);
+
+   for(i=0;i<n;i++)
+     {
+	if(!(rx[i] > level)) continue;
+	points[count].lfid       = lgw->lfid;
+	points[count].shotnumber = lgw->shotnumber;
+	points[count].sample     = (uint16_t) i;
+	points[count].reserved   = 0;
+	points[count].lon        = lon[i];
+	points[count].lat        = lat[i];
+	points[count].z          = (float) z[i];
+	points[count].amplitude  = (float) (rx[i] - noise);
+	count++;
+     }
+   return count;
+}
+
+static void lvis_expand_reserve(struct lvis_expand_task * task, size_t bytes)
+{
+   if(task->length + bytes <= task->size) return;
+   while(task->length + bytes > task->size) task->size = (task->size > 0) ? 2 * task->size : 1 << 20;
+   if((task->buf = (char *) realloc(task->buf,task->size))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the expand output\n");
+	exit(-1);
+     }
+}
+
+// one text row into buf (at most room bytes), returns its length as snprintf
+static int lvis_expand_text(char * buf, size_t room, struct lvis_expand_point * p, char * d)
+{
+   return snprintf(buf,room,"%u%s%u%s%u%s%14.10f%s%14.10f%s%9.4f%s%8.2f\n",p->lfid,d,p->shotnumber,d,
+		   p->sample,d,p->lon,d,p->lat,d,p->z,d,p->amplitude);
+}
+
+static void lvis_expand_run(void * context, long t, int worker)
+{
+   struct lvis_expand_job      * job = (struct lvis_expand_job *) context;
+   struct lvis_expand_task     * task = &job->tasks[t];
+   struct lvis_release_options * opt = job->opt;
+   struct lvis_expand_point    * p = job->points[worker];
+   struct lvis_lgw_v1_04       * lgw;
+   double                        lon,lat;
+   int64_t                       i,got;
+   int                           k,count,n;
+   char                        * d = opt->delim;
+
+   task->length = 0;
+   task->shots = task->points = 0;
+   got = lvis_canon_read(&job->files[task->file],task->first,task->count,job->raw[worker],job->canon[worker]);
+   if(got != task->count) task->status = -1;
+   for(i=0;i<got;i++)
+     {
+	lgw = ((struct lvis_lgw_v1_04 *) job->canon[worker]) + i;
+	release_data_position((unsigned char *) lgw,LVIS_RELEASE_FILETYPE_LGW,(float)1.04,&lon,&lat);
+	if(!lvis_release_keep(opt,lon,lat)) continue;
+	count = lvis_expand_shot(lgw,job->rxSamples[task->file],job->x->threshold,job->x->scalar,p);
+	task->shots++;
+	task->points += count;
+	if(job->binary)
+	  {
+	     lvis_expand_reserve(task,count * sizeof(struct lvis_expand_point));
+	     memcpy(task->buf + task->length,p,count * sizeof(struct lvis_expand_point));
+	     task->length += count * sizeof(struct lvis_expand_point);
+	     continue;
+	  }
+	lvis_expand_reserve(task,(size_t) count * LVIS_EXPAND_TEXT_POINT);
+	for(k=0;k<count;k++)
+	  {
+	     // a wild value or a long -delim makes a longer row than expected: make room, write it again
+	     n = lvis_expand_text(task->buf + task->length,task->size - task->length,&p[k],d);
+	     if((size_t) n >= task->size - task->length)
+	       {
+		  lvis_expand_reserve(task,(size_t) n + 1);
+		  lvis_expand_text(task->buf + task->length,task->size - task->length,&p[k],d);
+	       }
+	     task->length += n;
+	  }
+     }
+}
+
+static int lvis_expand_input(void * context, long t)
+{
+   return ((struct lvis_expand_job *) context)->tasks[t].file;
+}
+
+// the points of a task to the output, in input order
+static void lvis_expand_join(void * context, long t)
+{
+   struct lvis_expand_job  * job = (struct lvis_expand_job *) context;
+   struct lvis_expand_task * task = &job->tasks[t];
+
+   if(task->status != 0)
+     {
+	fprintf(stderr,"Short read in %s at record %lld\n",job->files[task->file].filename,(long long) task->first);
+	job->errors++;
+     }
+   if(task->length > 0 && fwrite(task->buf,1,task->length,job->out) != task->length)
+     {
+	fprintf(stderr,"Error writing the expand output (%s)\n",strerror(errno));
+	exit(-1);
+     }
+   job->shots += task->shots;
+   job->npoints += task->points;
+   free(task->buf);
+   task->buf = NULL;
+   task->size = 0;
+}
+
+int lvis_expand_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			struct lvis_batch_options * b, struct lvis_expand_options * x)
+{
+   struct lvis_expand_job    job;
+   struct lvis_expand_header hdr;
+   struct lvis_pool        * pool;
+   FILE                    * out;
+   long                      ntasks=0,maxtasks=0;
+   int64_t                   n,first;
+   float                     version;
+   int                       k,threads,errors=0;
+
+   memset(&job,0,sizeof(job));
+   job.opt = opt;
+   job.x = x;
+   job.files = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file));
+   job.rxSamples = (int *) calloc(ninputs,sizeof(int));
+   if(job.files == NULL || job.rxSamples == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     {
+	if(lvis_file_open(&job.files[k],inputs[k],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	lvis_file_close(&job.files[k]);
+	if(job.files[k].fileType != LVIS_RELEASE_FILETYPE_LGW)
+	  {
+	     fprintf(stderr,"%s is not an LGW file, there are no waveforms to expand\n",inputs[k]);
+	     errors++;
+	     continue;
+	  }
+	version = job.files[k].canonical ? job.files[k].sourceVersion : job.files[k].fileVersion;
+	job.rxSamples[k] = job.files[k].canonical ? job.files[k].rxSamples : ((version == ((float)1.04)) ? 528 : 432);
+	n = job.files[k].recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+	job.files[k].recordCount = n;
+	maxtasks += (long) ((n + LVIS_EXPAND_CHUNK - 1) / LVIS_EXPAND_CHUNK);
+     }
+   if(errors > 0)
+     {
+	free(job.files);
+	free(job.rxSamples);
+	return errors;
+     }
+
+   job.tasks = (struct lvis_expand_task *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_expand_task));
+   if(job.tasks == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the task table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     for(first=0;first<job.files[k].recordCount;first+=LVIS_EXPAND_CHUNK)
+       {
+	  job.tasks[ntasks].file  = k;
+	  job.tasks[ntasks].first = first;
+	  job.tasks[ntasks].count = (job.files[k].recordCount - first < LVIS_EXPAND_CHUNK) ?
+	    job.files[k].recordCount - first : LVIS_EXPAND_CHUNK;
+	  ntasks++;
+       }
+
+   pool = lvis_pool_create(b->nthreads);
+   threads = lvis_pool_threads(pool);
+   lvis_batch_buffers(threads,LVIS_EXPAND_CHUNK,sizeof(struct lvis_lgw_v1_04),&job.raw,&job.canon);
+   job.points = (struct lvis_expand_point **) calloc(threads,sizeof(struct lvis_expand_point *));
+   if(job.points == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the expand buffers\n");
+	exit(-1);
+     }
+   for(k=0;k<threads;k++)
+     {
+	job.points[k] = (struct lvis_expand_point *) malloc(528 * sizeof(struct lvis_expand_point));
+	if(job.points[k] == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the expand buffers\n");
+	     exit(-1);
+	  }
+     }
+
+   // text rows, or a point file whose counts are filled in at the end
+   job.binary = (opt->outfile[0] != 0);
+   out = stdout;
+   if(job.binary)
+     {
+	if((out = fopen(opt->outfile,"wb"))==NULL)
+	  {
+	     fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	     exit(-1);
+	  }
+	memset(&hdr,0,sizeof(hdr));
+	memcpy(hdr.magic,LVIS_EXPAND_MAGIC,sizeof(hdr.magic));
+	hdr.byteorder  = LVIS_EXPAND_BYTEORDER;
+	hdr.headerSize = LVIS_EXPAND_HEADER_SIZE;
+	hdr.pointSize  = sizeof(struct lvis_expand_point);
+	hdr.threshold  = x->threshold;
+	if(fwrite(&hdr,sizeof(hdr),1,out)!=1)
+	  {
+	     fprintf(stderr,"Error writing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	     exit(-1);
+	  }
+     }
+   else if(opt->topcol == 1)
+     fprintf(out,"lfid%sshotnumber%ssample%slon%slat%sz%samplitude\n",opt->delim,opt->delim,opt->delim,
+	     opt->delim,opt->delim,opt->delim);
+
+   // run the waves, writing wave N while wave N+1 is worked on
+   job.out = out;
+   lvis_batch_waves(pool,0,ntasks,job.files,lvis_expand_input,lvis_expand_run,lvis_expand_join,&job);
+   errors += job.errors;
+   lvis_pool_destroy(pool);
+
+   if(job.binary)
+     {
+	hdr.shotCount = (uint64_t) job.shots;
+	hdr.pointCount = (uint64_t) job.npoints;
+	if(fseek(out,0,SEEK_SET)!=0 || fwrite(&hdr,sizeof(hdr),1,out)!=1)
+	  {
+	     fprintf(stderr,"Error writing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	     errors++;
+	  }
+	if(fclose(out)!=0)
+	  {
+	     fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	     errors++;
+	  }
+     }
+   fflush(stdout);
+   fprintf(stderr,"expand: %lld shots, %lld points\n",(long long) job.shots,(long long) job.npoints);
+
+   lvis_batch_free_buffers(threads,job.raw,job.canon);
+   for(k=0;k<threads;k++) free(job.points[k]);
+   free(job.points);
+   free(job.tasks);
+   free(job.files);
+   free(job.rxSamples);
+   return errors;
+}
@@ -0,0 +1,79 @@
+#ifndef __LVIS_RELEASE_EXPAND_H
+#define __LVIS_RELEASE_EXPAND_H
+
+// lvis_release_expand.h
+//
+// expand mode: every LGW waveform written as points, one per return sample
+// above the noise, for volumetric work.  Sample i lies at the fraction
+// i / (n-1) of the way from (lon0, lat0, z0) to (lon527, lat527, z527)
+// (the 431 values of the older releases), as in the metrics mode; the
+// positions of a whole waveform are interpolated at once, four samples a
+// step by an AVX2 kernel where the cpu has it (-nosimd for the scalar one,
+// both give the same bits).  A sample is kept when it is more than
+// -featthresh counts above sigmean, its amplitude is the counts above
+// sigmean.
+//
+// The output is around 500 points a shot, so it is made a chunk of shots
+// at a time on the pool and streamed out in input order: text rows of
+// lfid, shotnumber, sample, lon, lat, z, amplitude, or with -o a point
+// file, a lvis_expand_header followed by lvis_expand_point records (native
+// endian, the header byteorder mark tells which).
+
+#include <stdint.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#define LVIS_EXPAND_MAGIC       "LVISPTS1"
+#define LVIS_EXPAND_BYTEORDER   0x01020304
+#define LVIS_EXPAND_HEADER_SIZE 64
+
+#ifndef  LVIS_EXPAND_CHUNK
+#define  LVIS_EXPAND_CHUNK 64         // shots per task (at most 64 * 528 points)
+#endif
+
+#pragma pack(1)
+struct lvis_expand_header
+{
+   char     magic[8];       // LVIS_EXPAND_MAGIC
+   uint32_t byteorder;      // LVIS_EXPAND_BYTEORDER as written by the host that made the file
+   uint32_t headerSize;     // bytes before the first point
+   uint32_t pointSize;      // sizeof(struct lvis_expand_point)
+   uint32_t threshold;      // -featthresh the file was made with
+   uint64_t shotCount;      // shots expanded (inside -lat / -lon)
+   uint64_t pointCount;
+   char     reserved[24];
+};
+
+struct lvis_expand_point
+{
+   uint32_t lfid;
+   uint32_t shotnumber;
+   uint16_t sample;         // index in rxwave
+   uint16_t reserved;
+   double   lon;
+   double   lat;
+   float    z;
+   float    amplitude;      // counts above sigmean
+};
+#pragma pack(0)
+
+struct lvis_expand_options
+{
+   int threshold;           // -featthresh N, shared with -features
+   int scalar;              // -nosimd
+};
+
+void lvis_expand_defaults(struct lvis_expand_options * x);
+
+// the points of one canonical LGW shot (n valid rxwave samples), points[]
+// must hold n.  returns the number of points
+int  lvis_expand_shot(struct lvis_lgw_v1_04 * lgw, int n, int threshold, int scalar,
+		      struct lvis_expand_point * points);
+
+// expand the LGW inputs to stdout (text) or opt->outfile (point file),
+// returns 0 on success
+struct lvis_batch_options;
+int  lvis_expand_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			 struct lvis_batch_options * b, struct lvis_expand_options * x);
+
+#endif
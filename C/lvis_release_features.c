@@ -0,0 +1,370 @@
+// lvis_release_features.c
+//
+// Waveform features of LGW shots (-features), see lvis_release_features.h.
+//
+// Every feature comes from a handful of integer sums over the samples, so
+// the kernels only accumulate (count, sum, index weighted sum, ... of the
+// samples above the noise) and one routine turns the sums into features.
+// The AVX2 kernel takes 8 samples a step, widened to 32 bit lanes: the
+// waveform lengths of every release (80, 120, 432, 528) are multiples of 8
+// and whatever is left over goes through the scalar kernel.  A sample w is
+// above a noise level that is not a whole count exactly when it is above
+// floor(noise), which keeps the comparisons integer as well.
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_features.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LVIS_FEATURES_AVX2 1
+#include <immintrin.h>
+#endif
+
+// longest waveform the AVX2 kernel takes (its 32 bit lane sums of
+// index * sample stay below 2^32 up to here), anything longer is scalar
+#define LVIS_FEATURES_AVX2_SAMPLES 528
+
+struct lvis_features_sums
+{
+   uint64_t count;      // samples above the noise
+   uint64_t sum;        // ... their sum
+   uint64_t isum;       // ... sum of index * sample
+   uint64_t idxsum;     // ... sum of their indices
+   uint64_t saturated;
+   int      peak,peakIndex;
+   int      start,end;
+};
+
+static int lvis_features_level(double level)
+{
+   if(!(level == level)) return 0;   // NaN
+   if(level < -1.0) return -1;
+   if(level > 65535.0) return 65535;
+   return (int) floor(level);
+}
+
+static void lvis_features_scalar(const uint16_t * w, int first, int n, int nz, int thr, int sat,
+				 struct lvis_features_sums * s)
+{
+   int i,v;
+
+   for(i=first;i<n;i++)
+     {
+	v = w[i];
+	if(v > nz)
+	  {
+	     s->count++;
+	     s->sum += v;
+	     s->isum += (uint64_t) i * v;
+	     s->idxsum += i;
+	  }
+	if(v > thr)
+	  {
+	     if(s->start < 0) s->start = i;
+	     s->end = i;
+	  }
+	if(v >= sat) s->saturated++;
+	if(v > s->peak) { s->peak = v; s->peakIndex = i; }
+     }
+}
+
+#ifdef LVIS_FEATURES_AVX2
+// returns the number of samples it took (a multiple of 8), the caller
+// finishes the rest with the scalar kernel
+__attribute__((target("avx2")))
+static int lvis_features_avx2(const uint16_t * w, int n, int nz, int thr, int sat,
+			      struct lvis_features_sums * s)
+{
+   __m256i  vnz = _mm256_set1_epi32(nz);
+   __m256i  vthr = _mm256_set1_epi32(thr);
+   __m256i  vsat = _mm256_set1_epi32(sat-1);
+   __m256i  step = _mm256_set1_epi32(8);
+   __m256i  idx = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+   __m256i  count = _mm256_setzero_si256(),sum = _mm256_setzero_si256();
+   __m256i  isum = _mm256_setzero_si256(),idxsum = _mm256_setzero_si256();
+   __m256i  saturated = _mm256_setzero_si256();
+   __m256i  runmax = _mm256_set1_epi32(-1),runidx = _mm256_setzero_si256();
+   __m256i  v,above,gt;
+   uint32_t lane[6][8];
+   int      i,k,bits;
+
+   for(i=0;i+8<=n;i+=8)
+     {
+	v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (w+i)));
+	above = _mm256_cmpgt_epi32(v,vnz);
+	count = _mm256_sub_epi32(count,above);
+	sum = _mm256_add_epi32(sum,_mm256_and_si256(v,above));
+	isum = _mm256_add_epi32(isum,_mm256_and_si256(_mm256_mullo_epi32(v,idx),above));
+	idxsum = _mm256_add_epi32(idxsum,_mm256_and_si256(idx,above));
+	saturated = _mm256_sub_epi32(saturated,_mm256_cmpgt_epi32(v,vsat));
+	gt = _mm256_cmpgt_epi32(v,runmax);
+	runmax = _mm256_max_epi32(runmax,v);
+	runidx = _mm256_blendv_epi8(runidx,idx,gt);
+	bits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v,vthr)));
+	if(bits)
+	  {
+	     if(s->start < 0) s->start = i + __builtin_ctz(bits);
+	     s->end = i + 31 - __builtin_clz(bits);
+	  }
+	idx = _mm256_add_epi32(idx,step);
+     }
+
+   _mm256_storeu_si256((__m256i *) lane[0],count);
+   _mm256_storeu_si256((__m256i *) lane[1],sum);
+   _mm256_storeu_si256((__m256i *) lane[2],isum);
+   _mm256_storeu_si256((__m256i *) lane[3],idxsum);
+   _mm256_storeu_si256((__m256i *) lane[4],saturated);
+   _mm256_storeu_si256((__m256i *) lane[5],runmax);
+   for(k=0;k<8;k++)
+     {
+	s->count += lane[0][k];
+	s->sum += lane[1][k];
+	s->isum += lane[2][k];
+	s->idxsum += lane[3][k];
+	s->saturated += lane[4][k];
+     }
+   // the first occurrence of the peak: each lane kept its own first, take
+   // the lowest index among the lanes that hold the largest value
+   _mm256_storeu_si256((__m256i *) lane[4],runidx);
+   if(i > 0)
+     for(k=0;k<8;k++)
+       if((int) lane[5][k] > s->peak || ((int) lane[5][k] == s->peak && (int) lane[4][k] < s->peakIndex))
+	 {
+	    s->peak = (int) lane[5][k];
+	    s->peakIndex = (int) lane[4][k];
+	 }
+   return i;
+}
+
+static int lvis_features_have_avx2(void)
+{
+   static int have = -1;
+
+   if(have < 0)
+     {
+	__builtin_cpu_init();
+	have = __builtin_cpu_supports("avx2") ? 1 : 0;
+     }
+   return have;
+}
+#endif
+
+void lvis_features_wave(const uint16_t * w, int n, float noise, int threshold, int saturation,
+			int scalar, struct lvis_wave_features * out)
+{
+   struct lvis_features_sums s;
+   double                    energy,level;
+   int                       nz,thr,done=0;
+
+   memset(&s,0,sizeof(s));
+   s.peak = -1;
+   s.peakIndex = s.start = s.end = -1;
+   level = (noise == noise) ? noise : 0.0;
+   nz = lvis_features_level(level);
+   thr = lvis_features_level(level + threshold);
+
+#ifdef LVIS_FEATURES_AVX2
+   if(!scalar && n <= LVIS_FEATURES_AVX2_SAMPLES && lvis_features_have_avx2())
+     done = lvis_features_avx2(w,n,nz,thr,saturation,&s);
+#endif
+   lvis_features_scalar(w,done,n,nz,thr,saturation,&s);
+
+   energy = (double) s.sum - (double) s.count * level;
+   out->energy = (float) energy;
+   out->centroid = (energy > 0.0) ? (float) (((double) s.isum - level * (double) s.idxsum) / energy) : NAN;
+   out->peak = (s.peak < 0) ? 0 : s.peak;
+   out->peakIndex = s.peakIndex;
+   out->start = s.start;
+   out->end = s.end;
+   out->saturated = (int) s.saturated;
+}
+
+void lvis_features_defaults(struct lvis_features_options * o)
+{
+   memset(o,0,sizeof(struct lvis_features_options));
+   o->threshold = LVIS_FEATURES_THRESHOLD;
+}
+
+int lvis_features_parse_option(int argc, char * argv[], int i, struct lvis_features_options * o)
+{
+   if(strcmp(argv[i],"-features")==0)
+     {
+	o->enabled = 1;
+	return 1;
+     }
+   if(strcmp(argv[i],"-featthresh")==0 && i+1<argc)
+     {
+	o->threshold = atoi(argv[i+1]);
+	if(o->threshold < 0) o->threshold = 0;
+	return 2;
+     }
+   if(strcmp(argv[i],"-nosimd")==0)
+     {
+	o->scalar = 1;
+	return 1;
+     }
+   return 0;
+}
+
+// -------------------------------------------------------------------------
+// -features output
+
+static char * const lvis_features_names[7] =
+{
+   "energy", "centroid", "peak", "peakindex", "start", "end", "saturated"
+};
+
+static void lvis_features_headers(FILE * out, struct lvis_release_options * opt)
+{
+   struct lvis_canon_column * c;
+   int                        k,w;
+
+   if(opt->indexcol==1) fprintf(out,"index%s",opt->delim);
+   for(c=lvis_canon_columns(LVIS_RELEASE_FILETYPE_LGW);c->name!=NULL;c++)
+     if(c->count == 1) fprintf(out,"%s%s",c->name,opt->delim);
+   for(w=0;w<2;w++)
+     for(k=0;k<7;k++)
+       fprintf(out,"%s%s%s",w == 0 ? "rx" : "tx",lvis_features_names[k],(w == 1 && k == 6) ? "\n" : opt->delim);
+}
+
+static void lvis_features_print(FILE * out, struct lvis_wave_features * f, char * delim)
+{
+   fprintf(out,"%f%s%f%s%d%s%d%s%d%s%d%s%d",f->energy,delim,f->centroid,delim,f->peak,delim,
+	   f->peakIndex,delim,f->start,delim,f->end,delim,f->saturated);
+}
+
+int lvis_features_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			  struct lvis_features_options * o)
+{
+   struct lvis_release_file  * files;
+   struct lvis_lgw_v1_04     * rec;
+   struct lvis_canon_column  * c;
+   struct lvis_wave_features * feat;
+   unsigned char             * raw,* canon;
+   uint16_t                  * rx,* tx;
+   FILE                      * out;
+   int64_t                     n,first,count,got,i;
+   unsigned int                colnum=1;
+   float                       version,txnoise;
+   double                      lon,lat;
+   int                         k,t,rxSamples,txSamples,saturation,errors=0;
+
+   if((files = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     {
+	if(lvis_file_open(&files[k],inputs[k],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	if(files[k].fileType != LVIS_RELEASE_FILETYPE_LGW)
+	  {
+	     fprintf(stderr,"%s is not an LGW file, -features needs waveforms\n",inputs[k]);
+	     errors++;
+	  }
+	lvis_file_close(&files[k]);
+     }
+   if(errors > 0)
+     {
+	free(files);
+	return errors;
+     }
+
+   raw = (unsigned char *) malloc(LVIS_FEATURES_BATCH * LVIS_MAX_RECORD_SIZE);
+   canon = (unsigned char *) malloc(LVIS_FEATURES_BATCH * sizeof(struct lvis_lgw_v1_04));
+   feat = (struct lvis_wave_features *) malloc(2 * LVIS_FEATURES_BATCH * sizeof(struct lvis_wave_features));
+   if(raw == NULL || canon == NULL || feat == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the feature buffers\n");
+	exit(-1);
+     }
+
+   out = stdout;
+   if(opt->outfile[0] != 0 && (out = fopen(opt->outfile,"w"))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	exit(-1);
+     }
+   if(opt->topcol == 1) lvis_features_headers(out,opt);
+
+   for(k=0;k<ninputs;k++)
+     {
+	struct lvis_release_file * f = &files[k];
+
+	if(lvis_file_reopen(f)!=0) exit(-1);
+	// how much of the canonical waveforms is real, and where they saturate
+	version = f->canonical ? f->sourceVersion : f->fileVersion;
+	rxSamples = (version == ((float)1.04)) ? 528 : 432;
+	txSamples = 0;
+	if(version == ((float)1.03)) txSamples = 80;
+	if(version == ((float)1.04)) txSamples = 120;
+	if(f->canonical) { rxSamples = f->rxSamples; txSamples = f->txSamples; }
+	saturation = (version == ((float)1.04)) ? 1023 : 255;
+
+	n = f->recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+	for(first=0;first<n;first+=count)
+	  {
+	     count = (n - first < LVIS_FEATURES_BATCH) ? n - first : LVIS_FEATURES_BATCH;
+	     if((got = lvis_canon_read(f,first,count,raw,canon)) != count)
+	       {
+		  fprintf(stderr,"Short read in %s at record %lld\n",f->filename,(long long) (first+got));
+		  exit(-1);
+	       }
+
+	     // the whole batch through the kernels, then out as text
+	     for(i=0;i<count;i++)
+	       {
+		  rec = ((struct lvis_lgw_v1_04 *) canon) + i;
+		  rx = (uint16_t *) ((unsigned char *) rec + offsetof(struct lvis_lgw_v1_04,rxwave));
+		  tx = (uint16_t *) ((unsigned char *) rec + offsetof(struct lvis_lgw_v1_04,txwave));
+		  lvis_features_wave(rx,rxSamples,rec->sigmean,o->threshold,saturation,o->scalar,&feat[2*i]);
+		  txnoise = 0.0;
+		  for(t=0;t<txSamples && t<LVIS_FEATURES_TX_NOISE;t++) txnoise += tx[t];
+		  if(t > 0) txnoise /= t;
+		  lvis_features_wave(tx,txSamples,txnoise,o->threshold,saturation,o->scalar,&feat[2*i+1]);
+	       }
+	     for(i=0;i<count;i++)
+	       {
+		  rec = ((struct lvis_lgw_v1_04 *) canon) + i;
+		  release_data_position((unsigned char *) rec,LVIS_RELEASE_FILETYPE_LGW,(float)1.04,&lon,&lat);
+		  if(!lvis_release_keep(opt,lon,lat)) { colnum++; continue; }
+		  if(opt->indexcol==1) fprintf(out,"%10i%s",colnum,opt->delim);
+		  colnum++;
+		  for(c=lvis_canon_columns(LVIS_RELEASE_FILETYPE_LGW);c->name!=NULL;c++)
+		    if(c->count == 1)
+		      {
+			 lvis_canon_print_column(out,(unsigned char *) rec,c,opt->delim);
+			 fprintf(out,"%s",opt->delim);
+		      }
+		  lvis_features_print(out,&feat[2*i],opt->delim);
+		  fprintf(out,"%s",opt->delim);
+		  lvis_features_print(out,&feat[2*i+1],opt->delim);
+		  fprintf(out,"\n");
+	       }
+	  }
+	lvis_file_close(f);
+     }
+
+   if(out != stdout && fclose(out)!=0)
+     {
+	fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	errors++;
+     }
+   fflush(stdout);
+   free(raw);
+   free(canon);
+   free(feat);
+   free(files);
+   return errors;
+}
@@ -0,0 +1,71 @@
+#ifndef __LVIS_RELEASE_FEATURES_H
+#define __LVIS_RELEASE_FEATURES_H
+
+// lvis_release_features.h
+//
+// Waveform features (-features): for every LGW shot the scalar fields of
+// the record are written followed by a summary of its return (rxwave /
+// wave) and transmit (txwave) waveforms:
+//   energy     sum of (sample - noise) over the samples above the noise
+//   centroid   energy weighted mean sample index
+//   peak       largest sample and the index of its first occurrence
+//   start/end  first and last index above noise + -featthresh
+//   saturated  samples at the digitiser maximum (255, 1023 for v1.04)
+// The noise of rxwave is sigmean, the noise of txwave (which has none
+// recorded) is the mean of its first LVIS_FEATURES_TX_NOISE samples.
+//
+// The waveforms are read a batch of shots at a time as canonical records
+// and reduced by an AVX2 kernel where the cpu has it, a scalar one
+// otherwise.  Both do the same integer sums, so their output is identical.
+
+#include <stdint.h>
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_FEATURES_THRESHOLD
+#define  LVIS_FEATURES_THRESHOLD 8    // default -featthresh (counts above the noise)
+#endif
+
+#ifndef  LVIS_FEATURES_TX_NOISE
+#define  LVIS_FEATURES_TX_NOISE 8     // leading txwave samples averaged for its noise
+#endif
+
+#ifndef  LVIS_FEATURES_BATCH
+#define  LVIS_FEATURES_BATCH 256      // shots per batch (about 350KB of canonical lgw)
+#endif
+
+struct lvis_features_options
+{
+   int   enabled;        // -features
+   int   threshold;      // -featthresh N
+   int   scalar;         // -nosimd: use the scalar kernel (to check the AVX2 one)
+};
+
+// the summary of one waveform (start, end and peakIndex are -1 when not found)
+struct lvis_wave_features
+{
+   float energy;
+   float centroid;       // NaN without energy
+   int   peak;
+   int   peakIndex;
+   int   start;
+   int   end;
+   int   saturated;
+};
+
+void lvis_features_defaults(struct lvis_features_options * o);
+
+// handle the feature options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a feature option)
+int  lvis_features_parse_option(int argc, char * argv[], int i, struct lvis_features_options * o);
+
+// summarise the n samples of w above noise (samples > noise + threshold
+// bound the signal, samples >= saturation are counted as saturated)
+void lvis_features_wave(const uint16_t * w, int n, float noise, int threshold, int saturation,
+			int scalar, struct lvis_wave_features * out);
+
+// write the LGW inputs with their waveform features to stdout (or
+// opt->outfile), returns 0 on success
+int  lvis_features_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			   struct lvis_features_options * o);
+
+#endif
@@ -0,0 +1,235 @@
+// lvis_release_fft.c
+//
+// Mixed radix FFT for the waveform lengths, see lvis_release_fft.h.
+//
+// The complex transform is the recursive decimation in time of the usual
+// small FFT libraries: a length h = p * m transform does p transforms of
+// length m on every p-th input, then one pass of radix p butterflies.  The
+// factors are taken 4s first, then 2, 3, 5 and the remaining odd primes; a
+// radix 4 pass has its own butterfly, the others use the general one.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_fft.h"
+
+#define LVIS_FFT_MAX_FACTORS 32
+#define LVIS_FFT_MAX_RADIX   64   // largest prime factor the general butterfly takes
+
+struct lvis_fft_cpx
+{
+   double re,im;
+};
+
+struct lvis_fft_plan
+{
+   int                   n;         // real points
+   int                   h;         // complex points (n/2)
+   int                   factors[2*LVIS_FFT_MAX_FACTORS];  // radix, remaining length, ...
+   struct lvis_fft_cpx * twiddle;   // exp(-2 pi i k / h), k < h
+   struct lvis_fft_cpx * split;     // exp(-2 pi i k / n), k <= h
+};
+
+static void lvis_fft_butterfly4(struct lvis_fft_cpx * out, int fstride, struct lvis_fft_plan * plan, int m)
+{
+   struct lvis_fft_cpx * tw = plan->twiddle,s[6],t1,t2,t3;
+   int                   k,i1,i2,i3;
+
+   for(k=0;k<m;k++)
+     {
+	i1 = k*fstride; i2 = 2*k*fstride; i3 = 3*k*fstride;
+	t1.re = out[k+m].re*tw[i1].re - out[k+m].im*tw[i1].im;
+	t1.im = out[k+m].re*tw[i1].im + out[k+m].im*tw[i1].re;
+	t2.re = out[k+2*m].re*tw[i2].re - out[k+2*m].im*tw[i2].im;
+	t2.im = out[k+2*m].re*tw[i2].im + out[k+2*m].im*tw[i2].re;
+	t3.re = out[k+3*m].re*tw[i3].re - out[k+3*m].im*tw[i3].im;
+	t3.im = out[k+3*m].re*tw[i3].im + out[k+3*m].im*tw[i3].re;
+
+	s[0].re = out[k].re - t2.re;  s[0].im = out[k].im - t2.im;
+	s[1].re = out[k].re + t2.re;  s[1].im = out[k].im + t2.im;
+	s[2].re = t1.re + t3.re;      s[2].im = t1.im + t3.im;
+	s[3].re = t1.re - t3.re;      s[3].im = t1.im - t3.im;
+
+	out[k+2*m].re = s[1].re - s[2].re;  out[k+2*m].im = s[1].im - s[2].im;
+	out[k].re = s[1].re + s[2].re;      out[k].im = s[1].im + s[2].im;
+	// forward transform: multiply s[3] by -i
+	out[k+m].re   = s[0].re + s[3].im;  out[k+m].im   = s[0].im - s[3].re;
+	out[k+3*m].re = s[0].re - s[3].im;  out[k+3*m].im = s[0].im + s[3].re;
+     }
+}
+
+static void lvis_fft_butterfly(struct lvis_fft_cpx * out, int fstride, struct lvis_fft_plan * plan, int m, int p)
+{
+   struct lvis_fft_cpx * tw = plan->twiddle,scratch[LVIS_FFT_MAX_RADIX],t;
+   int                   u,q,q1,k,twidx;
+
+   for(u=0;u<m;u++)
+     {
+	for(q1=0,k=u;q1<p;q1++,k+=m) scratch[q1] = out[k];
+	for(q1=0,k=u;q1<p;q1++,k+=m)
+	  {
+	     twidx = 0;
+	     out[k] = scratch[0];
+	     for(q=1;q<p;q++)
+	       {
+		  twidx += fstride * k;
+		  if(twidx >= plan->h) twidx -= plan->h;
+		  t.re = scratch[q].re*tw[twidx].re - scratch[q].im*tw[twidx].im;
+		  t.im = scratch[q].re*tw[twidx].im + scratch[q].im*tw[twidx].re;
+		  out[k].re += t.re;
+		  out[k].im += t.im;
+	       }
+	  }
+     }
+}
+
+static void lvis_fft_pass(struct lvis_fft_cpx * out, const struct lvis_fft_cpx * in, int fstride,
+			  const int * factors, struct lvis_fft_plan * plan)
+{
+   struct lvis_fft_cpx * begin = out,* end;
+   int                   p = factors[0],m = factors[1];
+
+   end = out + p*m;
+   if(m == 1)
+     for(;out!=end;out++,in+=fstride) *out = *in;
+   else
+     for(;out!=end;out+=m,in+=fstride) lvis_fft_pass(out,in,fstride*p,factors+2,plan);
+
+   if(p == 4) lvis_fft_butterfly4(begin,fstride,plan,m);
+   else lvis_fft_butterfly(begin,fstride,plan,m,p);
+}
+
+struct lvis_fft_plan * lvis_fft_plan_create(int n)
+{
+   struct lvis_fft_plan * plan;
+   int                    k,p,left,nf=0;
+
+   if(n < 4 || (n & 1)) return NULL;
+   if((plan = (struct lvis_fft_plan *) calloc(1,sizeof(struct lvis_fft_plan)))==NULL) return NULL;
+   plan->n = n;
+   plan->h = n / 2;
+
+   // 4s, then 2, 3, 5, 7 ...
+   left = plan->h;
+   p = 4;
+   while(left > 1)
+     {
+	while(left % p)
+	  {
+	     if(p == 4) p = 2;
+	     else if(p == 2) p = 3;
+	     else p += 2;
+	  }
+	if(p > LVIS_FFT_MAX_RADIX || nf == LVIS_FFT_MAX_FACTORS)
+	  {
+	     free(plan);
+	     return NULL;
+	  }
+	left /= p;
+	plan->factors[2*nf] = p;
+	plan->factors[2*nf+1] = left;
+	nf++;
+     }
+   if(nf == 0) { plan->factors[0] = 1; plan->factors[1] = 1; }
+
+   plan->twiddle = (struct lvis_fft_cpx *) malloc(plan->h * sizeof(struct lvis_fft_cpx));
+   plan->split = (struct lvis_fft_cpx *) malloc((plan->h+1) * sizeof(struct lvis_fft_cpx));
+   if(plan->twiddle == NULL || plan->split == NULL)
+     {
+	lvis_fft_plan_destroy(plan);
+	return NULL;
+     }
+   for(k=0;k<plan->h;k++)
+     {
+	plan->twiddle[k].re = cos(-2.0 * M_PI * k / plan->h);
+	plan->twiddle[k].im = sin(-2.0 * M_PI * k / plan->h);
+     }
+   for(k=0;k<=plan->h;k++)
+     {
+	plan->split[k].re = cos(-2.0 * M_PI * k / n);
+	plan->split[k].im = sin(-2.0 * M_PI * k / n);
+     }
+   return plan;
+}
+
+void lvis_fft_plan_destroy(struct lvis_fft_plan * plan)
+{
+   if(plan == NULL) return;
+   free(plan->twiddle);
+   free(plan->split);
+   free(plan);
+}
+
+int lvis_fft_size(struct lvis_fft_plan * plan)
+{
+   return plan->n;
+}
+
+int lvis_fft_scratch_size(struct lvis_fft_plan * plan)
+{
+   return 4 * plan->h;
+}
+
+// the complex transform of h points, z -> Z
+static void lvis_fft_complex(struct lvis_fft_plan * plan, const struct lvis_fft_cpx * z, struct lvis_fft_cpx * Z)
+{
+   if(plan->h == 1) { Z[0] = z[0]; return; }
+   lvis_fft_pass(Z,z,1,plan->factors,plan);
+}
+
+void lvis_fft_forward(struct lvis_fft_plan * plan, const double * in, double * out, double * scratch)
+{
+   struct lvis_fft_cpx * z = (struct lvis_fft_cpx *) scratch;
+   struct lvis_fft_cpx * Z = z + plan->h;
+   struct lvis_fft_cpx   a,b,fe,fo,w;
+   int                   k,h = plan->h;
+
+   // the even samples as the real parts, the odd ones as the imaginary
+   memcpy(z,in,plan->n * sizeof(double));
+   lvis_fft_complex(plan,z,Z);
+
+   // split: X[k] = Fe[k] + W^k Fo[k], with Fe / Fo from Z[k] and Z[h-k]*
+   for(k=0;k<=h;k++)
+     {
+	a = Z[k % h];
+	b = Z[(h - k) % h];
+	b.im = -b.im;
+	fe.re = 0.5 * (a.re + b.re);  fe.im = 0.5 * (a.im + b.im);
+	// (a - b) / 2i
+	fo.re = 0.5 * (a.im - b.im);  fo.im = -0.5 * (a.re - b.re);
+	w = plan->split[k];
+	out[2*k]   = fe.re + w.re*fo.re - w.im*fo.im;
+	out[2*k+1] = fe.im + w.re*fo.im + w.im*fo.re;
+     }
+}
+
+void lvis_fft_inverse(struct lvis_fft_plan * plan, const double * in, double * out, double * scratch)
+{
+   struct lvis_fft_cpx * Z = (struct lvis_fft_cpx *) scratch;
+   struct lvis_fft_cpx * z = Z + plan->h;
+   struct lvis_fft_cpx   a,b,fe,fo,d,w;
+   int                   k,h = plan->h;
+
+   // undo the split, Fe = (X[k] + X[h-k]*) / 2, Fo = (X[k] - X[h-k]*) W^-k / 2,
+   // and conjugate so the forward transform computes the inverse
+   for(k=0;k<h;k++)
+     {
+	a.re = in[2*k];        a.im = in[2*k+1];
+	b.re = in[2*(h-k)];    b.im = -in[2*(h-k)+1];
+	fe.re = 0.5 * (a.re + b.re);  fe.im = 0.5 * (a.im + b.im);
+	d.re = 0.5 * (a.re - b.re);   d.im = 0.5 * (a.im - b.im);
+	w = plan->split[k];
+	fo.re = d.re*w.re + d.im*w.im;
+	fo.im = d.im*w.re - d.re*w.im;
+	// Z = Fe + i Fo, conjugated
+	z[k].re = fe.re - fo.im;
+	z[k].im = -(fe.im + fo.re);
+     }
+   lvis_fft_complex(plan,z,Z);
+   for(k=0;k<h;k++)
+     {
+	out[2*k]   = Z[k].re / h;
+	out[2*k+1] = -Z[k].im / h;
+     }
+}
@@ -0,0 +1,28 @@
+#ifndef __LVIS_RELEASE_FFT_H
+#define __LVIS_RELEASE_FFT_H
+
+// lvis_release_fft.h
+//
+// A small mixed radix FFT for the fixed waveform lengths (528, 432 and the
+// transmit lengths): nothing to link against and plans made once per size.
+// A real transform of n points (n even) runs as a complex transform of n/2
+// points, factored into radix 4, 2, 3, 5 ... passes, plus one split pass.
+//
+// A plan is read only once made, so any number of threads can share it;
+// each passes its own scratch of lvis_fft_scratch_size() doubles.
+
+struct lvis_fft_plan;
+
+// plan real transforms of n points (n even), NULL if n is not supported
+struct lvis_fft_plan * lvis_fft_plan_create(int n);
+void lvis_fft_plan_destroy(struct lvis_fft_plan * plan);
+int  lvis_fft_size(struct lvis_fft_plan * plan);
+// doubles of scratch a transform needs
+int  lvis_fft_scratch_size(struct lvis_fft_plan * plan);
+
+// in[n] -> out[n+2]: the n/2+1 complex bins 0 .. n/2 as re,im pairs
+void lvis_fft_forward(struct lvis_fft_plan * plan, const double * in, double * out, double * scratch);
+// in[n+2] (bins as above) -> out[n], scaled by 1/n so forward + inverse is the identity
+void lvis_fft_inverse(struct lvis_fft_plan * plan, const double * in, double * out, double * scratch);
+
+#endif
@@ -0,0 +1,172 @@
+// lvis_release_file.c
+//
+// Opening, identifying and reading LVIS release files for the batch and
+// processing modes.  The detection itself is the one used by the reader
+// (detect_release_version), so a file is identified the same way no matter
+// which mode touches it.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_canon.h"
+
+int lvis_file_open(struct lvis_release_file * f, char * filename,
+		   int forceType, float forceVersion, int myendian)
+{
+   struct stat              st;
+   struct lvis_canon_header hdr;
+   int         fileType = -1;
+   float       fileVersion = -1.0;
+
+   memset(f,0,sizeof(struct lvis_release_file));
+   f->fd = -1;
+   strncpy(f->filename,filename,sizeof(f->filename)-1);
+
+   if((f->fd = open(filename,O_RDONLY))<0)
+     {
+	fprintf(stderr,"Error opening the input file: %s (%s)\n",filename,strerror(errno));
+	return -1;
+     }
+   if(fstat(f->fd,&st)!=0)
+     {
+	fprintf(stderr,"Error reading the size of the input file: %s (%s)\n",filename,strerror(errno));
+	lvis_file_close(f);
+	return -1;
+     }
+   f->fileSize = (int64_t) st.st_size;
+
+   // a canonical file says what it is, nothing to detect or force
+   if(lvis_canon_read_header(filename,&hdr)==0)
+     {
+	f->canonical     = 1;
+	f->fileType      = hdr.fileType;
+	f->fileVersion   = (float)1.04;
+	f->sourceVersion = hdr.sourceVersion;
+	f->txSamples     = hdr.txSamples;
+	f->rxSamples     = hdr.rxSamples;
+	f->myendian      = lvis_canon_endian(&hdr);
+	f->dataOffset    = hdr.headerSize;
+	f->recordSize    = hdr.recordSize;
+	if(f->recordSize != lvis_record_size(f->fileType,f->fileVersion))
+	  {
+	     fprintf(stderr,"Corrupt canonical header in: %s\n",filename);
+	     lvis_file_close(f);
+	     return -1;
+	  }
+	f->recordCount = (f->fileSize - f->dataOffset) / f->recordSize;
+	if(hdr.recordCount < (uint64_t) f->recordCount) f->recordCount = (int64_t) hdr.recordCount;
+	return 0;
+     }
+
+   // only detect what was not forced on the command line
+   if(forceType < 0 || forceVersion < 0)
+     detect_release_version(filename,&fileType,&fileVersion,myendian);
+   if(forceType >= 0) fileType = forceType;
+   if(forceVersion >= 0) fileVersion = forceVersion;
+
+   f->fileType    = fileType;
+   f->fileVersion = fileVersion;
+   f->myendian    = myendian;
+   f->dataOffset  = 0;
+   f->recordSize  = lvis_record_size(fileType,fileVersion);
+   if(f->recordSize <= 0)
+     {
+	fprintf(stderr,"Unable to determine the record layout of: %s\n",filename);
+	lvis_file_close(f);
+	return -1;
+     }
+   f->recordCount = (f->fileSize - f->dataOffset) / f->recordSize;
+   return 0;
+}
+
+void lvis_file_close(struct lvis_release_file * f)
+{
+   if(f->fd >= 0) close(f->fd);
+   f->fd = -1;
+}
+
+int lvis_file_reopen(struct lvis_release_file * f)
+{
+   if(f->fd >= 0) return 0;
+   if((f->fd = open(f->filename,O_RDONLY))<0)
+     {
+	fprintf(stderr,"Error opening the input file: %s (%s)\n",f->filename,strerror(errno));
+	return -1;
+     }
+   return 0;
+}
+
+int64_t lvis_file_read(struct lvis_release_file * f, int64_t first, int64_t count, unsigned char * buf)
+{
+   int64_t want,got=0;
+   ssize_t status;
+   off_t   offset;
+
+   if(first >= f->recordCount) return 0;
+   if(first + count > f->recordCount) count = f->recordCount - first;
+   want   = count * f->recordSize;
+   offset = (off_t) (f->dataOffset + first * f->recordSize);
+
+   // pread may return short counts on large requests, keep going until done
+   while(got < want)
+     {
+	status = pread(f->fd,buf+got,(size_t)(want-got),offset+got);
+	if(status < 0 && errno == EINTR) continue;
+	if(status <= 0) break;
+	got += status;
+     }
+   return got / f->recordSize;
+}
+
+int lvis_file_map(struct lvis_release_file * f)
+{
+   void * map;
+
+   if(f->map != NULL) return 0;
+   if(f->fileSize <= 0) return -1;  // nothing to map (mmap refuses empty files)
+   if(lvis_file_reopen(f)!=0) return -1;
+   if((map = mmap(NULL,(size_t) f->fileSize,PROT_READ,MAP_SHARED,f->fd,0))==MAP_FAILED)
+     {
+	fprintf(stderr,"Error mapping the input file: %s (%s)\n",f->filename,strerror(errno));
+	return -1;
+     }
+   // read front to back, let the kernel read ahead hard
+   madvise(map,(size_t) f->fileSize,MADV_SEQUENTIAL);
+   f->map = (unsigned char *) map;
+   f->mapLength = f->fileSize;
+   return 0;
+}
+
+void lvis_file_unmap(struct lvis_release_file * f)
+{
+   if(f->map != NULL) munmap(f->map,(size_t) f->mapLength);
+   f->map = NULL;
+   f->mapLength = 0;
+}
+
+void lvis_file_release(struct lvis_release_file * f, int64_t first)
+{
+   long    page = sysconf(_SC_PAGESIZE);
+   int64_t end;
+
+   if(f->map == NULL || page <= 0) return;
+   end = f->dataOffset + first * f->recordSize;
+   end -= end % page;
+   if(end > 0) madvise(f->map,(size_t) end,MADV_DONTNEED);
+}
+
+char * lvis_file_type_name(int fileType)
+{
+   if(fileType == LVIS_RELEASE_FILETYPE_LCE) return "LCE";
+   if(fileType == LVIS_RELEASE_FILETYPE_LGE) return "LGE";
+   if(fileType == LVIS_RELEASE_FILETYPE_LGW) return "LGW";
+   return "???";
+}
@@ -0,0 +1,55 @@
+#ifndef __LVIS_RELEASE_FILE_H
+#define __LVIS_RELEASE_FILE_H
+
+// lvis_release_file.h
+//
+// An opened LVIS release file: the detected (or forced) type and version,
+// the record size and the number of whole records it holds.  Records are
+// read with pread() so one descriptor can be shared by several threads.
+
+#include <stdint.h>
+
+struct lvis_release_file
+{
+   char     filename[1024];
+   int      fd;            // -1 when closed
+   int      fileType;      // LVIS_RELEASE_FILETYPE_xxx
+   float    fileVersion;   // 1.00 -> 1.04
+   int      myendian;      // endian used when swapping records of this file
+   int      recordSize;    // bytes per record
+   int64_t  dataOffset;    // byte offset of the first record
+   int64_t  fileSize;      // bytes
+   int64_t  recordCount;   // number of whole records in the file
+   int      canonical;     // 1 if this is a canonical (upgraded) file
+   float    sourceVersion; // canonical: release version it was upgraded from
+   int      txSamples;     // canonical lgw: valid txwave / rxwave samples
+   int      rxSamples;
+   unsigned char * map;    // lvis_file_map: the whole file in memory (NULL = not mapped)
+   int64_t  mapLength;
+};
+
+// open and identify a file; forceType / forceVersion < 0 means auto detect.
+// canonical files are recognised by their header and ignore both.
+// returns 0 on success, prints a message and returns -1 on failure
+int     lvis_file_open(struct lvis_release_file * f, char * filename,
+		       int forceType, float forceVersion, int myendian);
+void    lvis_file_close(struct lvis_release_file * f);
+// re-open the descriptor of a file that was opened and closed before
+int     lvis_file_reopen(struct lvis_release_file * f);
+
+// read count records starting at record first into buf (raw file order)
+// returns the number of whole records read
+int64_t lvis_file_read(struct lvis_release_file * f, int64_t first, int64_t count, unsigned char * buf);
+
+// map the whole file read only (records then at lvis_file_record), the
+// mapping stays valid after lvis_file_close.  returns 0 on success
+int     lvis_file_map(struct lvis_release_file * f);
+void    lvis_file_unmap(struct lvis_release_file * f);
+// let the kernel drop the mapped pages before record first (already used)
+void    lvis_file_release(struct lvis_release_file * f, int64_t first);
+#define lvis_file_record(f,i) ((f)->map + (f)->dataOffset + (int64_t) (i) * (f)->recordSize)
+
+// three letter name for a file type (LCE, LGE, LGW)
+char *  lvis_file_type_name(int fileType);
+
+#endif
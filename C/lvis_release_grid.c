@@ -0,0 +1,600 @@
+// lvis_release_grid.c
+//
+// Gridding of a shot field (grid mode), see lvis_release_grid.h.
+//
+// A pass over the inputs runs their chunks on the pool in waves of a few
+// per thread (the files are opened a wave at a time, as in the batch
+// converter); the order the chunks finish in does not matter here, each
+// worker only adds into its own partial grid.  Without -lon / -lat one
+// pass more is made first, for the bounds of the data.  Under -sample the
+// chunks are of the sample's records and a fifth band holds the standard
+// error of each cell's mean.  For -sample NxB a task is whole blocks, so a
+// cell can keep the mean of each block it is in, and the error is that of
+// those block means (the blocks are clusters, as in -summary).
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_sample.h"
+#include "lvis_release_grid.h"
+
+#define LVIS_GRID_PRJ "GEOGCS[\"GCS_WGS_1984\",DATUM[\"D_WGS_1984\",SPHEROID[\"WGS_1984\",6378137.0,298.257223563]]," \
+   "PRIMEM[\"Greenwich\",0.0],UNIT[\"Degree\",0.0174532925199433]]"
+
+struct lvis_grid_cell
+{
+   double   sum,sumsq;
+   float    min,max;
+   uint32_t count;
+   // -sample NxB: the block being read, and the means of the blocks so far
+   uint32_t ccount,blocks;
+   double   csum,bsum,bsumsq;
+};
+
+// the cells a worker has put shots of the current block into
+struct lvis_grid_touched
+{
+   long * cell;
+   long   n,room;
+};
+
+struct lvis_grid_task
+{
+   int     file;
+   int64_t first,count;
+   int     status;   // 0, -1 on a read error
+};
+
+struct lvis_grid_job
+{
+   struct lvis_release_options * opt;
+   struct lvis_grid_options    * g;
+   struct lvis_release_file    * files;
+   struct lvis_canon_column   ** column;     // the field, per input
+   int64_t                     * samples;    // records of the -sample, per input
+   struct lvis_grid_task       * tasks;
+   long                          ntasks;
+   unsigned char              ** raw;        // per worker
+   unsigned char              ** canon;      // per worker
+   // the grid: cell (row, col) covers lon minlon + col * cell ..., lat maxlat - row * cell ...
+   double                        minlon,maxlat,cell;
+   long                          ncols,nrows;
+   // the tile being made, rows row0 .. row0 + trows - 1
+   long                          row0,trows;
+   struct lvis_grid_cell      ** partial;    // per worker, trows * ncols
+   int                           step;       // merge round: partial[i + step] into partial[i]
+   double                      * bounds;     // per worker minlon, maxlon, minlat, maxlat
+   int64_t                     * binned;     // per worker
+   int64_t                     * dropped;    // per worker, shots that fell outside the grid
+   int                           clusters;   // -sample NxB: band 5 from the block means
+   int                           errors;     // short reads of the pass
+   struct lvis_grid_touched    * touched;    // per worker
+};
+
+void lvis_grid_defaults(struct lvis_grid_options * g)
+{
+   memset(g,0,sizeof(struct lvis_grid_options));
+   g->cell = LVIS_GRID_CELL;
+   g->memoryMB = LVIS_GRID_MEMORY_MB;
+}
+
+int lvis_grid_parse_option(int argc, char * argv[], int i, struct lvis_grid_options * g)
+{
+   if(strcmp(argv[i],"-cell")==0 && i+1<argc)
+     {
+	g->cell = atof(argv[i+1]);
+	return 2;
+     }
+   if(strcmp(argv[i],"-field")==0 && i+1<argc)
+     {
+	strncpy(g->field,argv[i+1],sizeof(g->field)-1);
+	return 2;
+     }
+   if(strcmp(argv[i],"-gridmem")==0 && i+1<argc)
+     {
+	g->memoryMB = atoi(argv[i+1]);
+	if(g->memoryMB < 1) g->memoryMB = 1;
+	return 2;
+     }
+   return 0;
+}
+
+static void lvis_grid_bounds_run(void * context, long t, int worker)
+{
+   struct lvis_grid_job  * job = (struct lvis_grid_job *) context;
+   struct lvis_grid_task * task = &job->tasks[t];
+   struct lvis_release_file * f = &job->files[task->file];
+   double                * b = job->bounds + 4 * worker;
+   unsigned char         * rec;
+   double                  lon,lat;
+   int64_t                 i,got,done,piece;
+   int                     size = lvis_record_size(f->fileType,(float)1.04);
+
+   for(done=0;done<task->count;done+=piece)
+     {
+	piece = (task->count - done < LVIS_GRID_CHUNK) ? task->count - done : LVIS_GRID_CHUNK;
+	got = lvis_sample_read(f,job->opt->sample,task->first + done,piece,job->raw[worker],job->canon[worker]);
+	if(got != piece) task->status = -1;
+	for(i=0;i<got;i++)
+	  {
+	     rec = job->canon[worker] + i * size;
+	     release_data_position(rec,f->fileType,(float)1.04,&lon,&lat);
+	     if(!(lon == lon && lat == lat)) continue;
+	     if(!lvis_release_keep(job->opt,lon,lat)) continue;
+	     if(!(lvis_canon_value(rec,job->column[task->file]) == lvis_canon_value(rec,job->column[task->file]))) continue;
+	     if(lon < b[0]) b[0] = lon;
+	     if(lon > b[1]) b[1] = lon;
+	     if(lat < b[2]) b[2] = lat;
+	     if(lat > b[3]) b[3] = lat;
+	  }
+	if(got != piece) break;
+     }
+}
+
+// the block a worker was reading is done: its mean in each cell it touched
+static void lvis_grid_block(struct lvis_grid_job * job, int worker)
+{
+   struct lvis_grid_touched * u = &job->touched[worker];
+   struct lvis_grid_cell    * c;
+   double                     m;
+   long                       k;
+
+   for(k=0;k<u->n;k++)
+     {
+	c = job->partial[worker] + u->cell[k];
+	m = c->csum / c->ccount;
+	c->bsum += m;
+	c->bsumsq += m * m;
+	c->blocks++;
+	c->csum = 0.0;
+	c->ccount = 0;
+     }
+   u->n = 0;
+}
+
+// bin shot j of the sample (rec) into the worker's partial grid; block is
+// the block the worker is reading (-sample NxB)
+static void lvis_grid_shot(struct lvis_grid_job * job, int worker, struct lvis_grid_task * task,
+			   unsigned char * rec, int64_t j, int64_t * block)
+{
+   struct lvis_release_file * f = &job->files[task->file];
+   struct lvis_grid_touched * u = &job->touched[worker];
+   struct lvis_grid_cell    * c;
+   double                     lon,lat,v;
+   long                       row,col;
+
+   if(job->clusters && lvis_sample_cluster(job->opt->sample,j) != *block)
+     {
+	lvis_grid_block(job,worker);
+	*block = lvis_sample_cluster(job->opt->sample,j);
+     }
+   release_data_position(rec,f->fileType,(float)1.04,&lon,&lat);
+   if(!lvis_release_keep(job->opt,lon,lat)) return;
+   v = lvis_canon_value(rec,job->column[task->file]);
+   if(!(v == v)) return;
+   col = (long) floor((lon - job->minlon) / job->cell);
+   row = (long) floor((job->maxlat - lat) / job->cell);
+   // a shot on the far edge of the extent (the last shot of the data) is in the last cell
+   if(col == job->ncols) col--;
+   if(row == job->nrows) row--;
+   if(col < 0 || col >= job->ncols || row < 0 || row >= job->nrows)
+     {
+	if(job->row0 == 0) job->dropped[worker]++;   // once, not once a tile
+	return;
+     }
+   if(row < job->row0 || row >= job->row0 + job->trows) return;
+   c = job->partial[worker] + (row - job->row0) * job->ncols + col;
+   if(c->count == 0) c->min = c->max = v;
+   if(v < c->min) c->min = v;
+   if(v > c->max) c->max = v;
+   c->sum += v;
+   c->sumsq += v * v;
+   c->count++;
+   job->binned[worker]++;
+   if(!job->clusters) return;
+   if(c->ccount == 0)
+     {
+	if(u->n == u->room)
+	  {
+	     u->room = 2 * u->room + 256;
+	     if((u->cell = (long *) realloc(u->cell,u->room * sizeof(long)))==NULL)
+	       {
+		  fprintf(stderr,"Unable to allocate the grid block cells\n");
+		  exit(-1);
+	       }
+	  }
+	u->cell[u->n++] = c - job->partial[worker];
+     }
+   c->csum += v;
+   c->ccount++;
+}
+
+static void lvis_grid_run(void * context, long t, int worker)
+{
+   struct lvis_grid_job     * job = (struct lvis_grid_job *) context;
+   struct lvis_grid_task    * task = &job->tasks[t];
+   struct lvis_release_file * f = &job->files[task->file];
+   int64_t                    i,got,done,piece,block=-1;
+   int                        size = lvis_record_size(f->fileType,(float)1.04);
+
+   // a task is whole blocks of a -sample NxB, read LVIS_GRID_CHUNK at a time
+   for(done=0;done<task->count;done+=piece)
+     {
+	piece = (task->count - done < LVIS_GRID_CHUNK) ? task->count - done : LVIS_GRID_CHUNK;
+	got = lvis_sample_read(f,job->opt->sample,task->first + done,piece,job->raw[worker],job->canon[worker]);
+	if(got != piece) task->status = -1;
+	for(i=0;i<got;i++) lvis_grid_shot(job,worker,task,job->canon[worker] + i * size,task->first + done + i,&block);
+	if(got != piece) break;
+     }
+   if(job->clusters) lvis_grid_block(job,worker);
+}
+
+// one merge of a round: partial[2 * step * t + step] into partial[2 * step * t]
+static void lvis_grid_merge(void * context, long t, int worker)
+{
+   struct lvis_grid_job  * job = (struct lvis_grid_job *) context;
+   struct lvis_grid_cell * a = job->partial[2 * job->step * t];
+   struct lvis_grid_cell * b = job->partial[2 * job->step * t + job->step];
+   long                    k,n = job->trows * job->ncols;
+
+   for(k=0;k<n;k++)
+     {
+	if(b[k].count == 0) continue;
+	if(a[k].count == 0) { a[k] = b[k]; continue; }
+	if(b[k].min < a[k].min) a[k].min = b[k].min;
+	if(b[k].max > a[k].max) a[k].max = b[k].max;
+	a[k].sum += b[k].sum;
+	a[k].sumsq += b[k].sumsq;
+	a[k].count += b[k].count;
+	a[k].bsum += b[k].bsum;
+	a[k].bsumsq += b[k].bsumsq;
+	a[k].blocks += b[k].blocks;
+     }
+}
+
+static int lvis_grid_input(void * context, long t)
+{
+   return ((struct lvis_grid_job *) context)->tasks[t].file;
+}
+
+static void lvis_grid_join(void * context, long t)
+{
+   struct lvis_grid_job  * job = (struct lvis_grid_job *) context;
+   struct lvis_grid_task * task = &job->tasks[t];
+
+   if(task->status != 0)
+     {
+	fprintf(stderr,"Short read in %s at record %lld\n",job->files[task->file].filename,(long long) task->first);
+	task->status = 0;
+	job->errors++;
+     }
+}
+
+// run fn over every task of the inputs, a wave of files open at a time
+static int lvis_grid_pass(struct lvis_grid_job * job, struct lvis_pool * pool, lvis_pool_task fn)
+{
+   job->errors = 0;
+   lvis_batch_waves(pool,0,job->ntasks,job->files,lvis_grid_input,fn,lvis_grid_join,job);
+   return job->errors;
+}
+
+// name.bil -> name.ext (or name + .ext when it does not end in .bil)
+static void lvis_grid_sidecar(char * outfile, char * ext, char * name, size_t size)
+{
+   size_t n = strlen(outfile);
+
+   if(n > 4 && strcmp(outfile + n - 4,".bil")==0) n -= 4;
+   snprintf(name,size,"%.*s%s",(int) n,outfile,ext);
+}
+
+static int lvis_grid_sidecars(struct lvis_grid_job * job, char * outfile, int myendian)
+{
+   char   name[2048];
+   FILE * fp;
+   double ulx = job->minlon + 0.5 * job->cell,uly = job->maxlat - 0.5 * job->cell;
+   int    errors=0;
+
+   lvis_grid_sidecar(outfile,".hdr",name,sizeof(name));
+   if((fp = fopen(name,"w"))==NULL) return 1;
+   fprintf(fp,"BYTEORDER      %s\n",(myendian == GENLIB_LITTLE_ENDIAN) ? "I" : "M");
+   fprintf(fp,"LAYOUT         BSQ\n");
+   fprintf(fp,"NROWS          %ld\n",job->nrows);
+   fprintf(fp,"NCOLS          %ld\n",job->ncols);
+   fprintf(fp,"NBANDS         %d\n",LVIS_GRID_BANDS + (job->opt->sample != NULL));
+   fprintf(fp,"NBITS          32\n");
+   fprintf(fp,"PIXELTYPE      FLOAT\n");
+   fprintf(fp,"BANDROWBYTES   %ld\n",job->ncols * 4);
+   fprintf(fp,"TOTALROWBYTES  %ld\n",job->ncols * 4);
+   fprintf(fp,"ULXMAP         %.10f\n",ulx);
+   fprintf(fp,"ULYMAP         %.10f\n",uly);
+   fprintf(fp,"XDIM           %.10f\n",job->cell);
+   fprintf(fp,"YDIM           %.10f\n",job->cell);
+   fprintf(fp,"NODATA         %.1f\n",LVIS_GRID_NODATA);
+   errors += (fclose(fp) != 0);
+
+   lvis_grid_sidecar(outfile,".blw",name,sizeof(name));
+   if((fp = fopen(name,"w"))==NULL) return 1;
+   fprintf(fp,"%.10f\n0.0\n0.0\n%.10f\n%.10f\n%.10f\n",job->cell,-job->cell,ulx,uly);
+   errors += (fclose(fp) != 0);
+
+   lvis_grid_sidecar(outfile,".prj",name,sizeof(name));
+   if((fp = fopen(name,"w"))==NULL) return 1;
+   fprintf(fp,"%s\n",LVIS_GRID_PRJ);
+   errors += (fclose(fp) != 0);
+   return errors;
+}
+
+int lvis_grid_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		      struct lvis_batch_options * b, struct lvis_grid_options * g)
+{
+   struct lvis_grid_job       job;
+   struct lvis_pool         * pool;
+   struct lvis_grid_cell    * cell;
+   FILE                     * out;
+   float                    * band;
+   char                     * field,bil[2048];
+   double                     minlon,maxlon,minlat,maxlat,var,fpc=1.0,taken=0.0,records=0.0;
+   long                       maxtasks=0,row,col,tiles=0;
+   int64_t                    chunk=LVIS_GRID_CHUNK;
+   int64_t                    n,first,binned=0,dropped=0;
+   size_t                     perRow;
+   int                        k,w,threads,errors=0;
+
+   if(opt->outfile[0] == 0)
+     {
+	fprintf(stderr,"grid writes a raster, give its name with -o (name.bil)\n");
+	return 1;
+     }
+   if(!(g->cell > 0.0))
+     {
+	fprintf(stderr,"-cell must be more than 0 degrees\n");
+	return 1;
+     }
+   memset(&job,0,sizeof(job));
+   job.opt = opt;
+   job.g = g;
+   job.cell = g->cell;
+   // -sample NxB: a task is whole blocks, so a worker sees each block entire
+   job.clusters = (opt->sample != NULL && opt->sample->blocks > 0);
+   if(job.clusters)
+     chunk = opt->sample->blockRecords * ((LVIS_GRID_CHUNK > opt->sample->blockRecords) ?
+					  LVIS_GRID_CHUNK / opt->sample->blockRecords : 1);
+   job.files = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file));
+   job.column = (struct lvis_canon_column **) calloc(ninputs,sizeof(struct lvis_canon_column *));
+   job.samples = (int64_t *) calloc(ninputs,sizeof(int64_t));
+   if(job.files == NULL || job.column == NULL || job.samples == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     {
+	if(lvis_file_open(&job.files[k],inputs[k],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	lvis_file_close(&job.files[k]);
+	field = g->field;
+	if(field[0] == 0 && job.files[k].fileType == LVIS_RELEASE_FILETYPE_LGE) field = "zg";
+	if(field[0] == 0 && job.files[k].fileType == LVIS_RELEASE_FILETYPE_LCE) field = "zt";
+	job.column[k] = lvis_canon_find_column(job.files[k].fileType,field);
+	if(job.column[k] == NULL && field[0] == 0)
+	  {
+	     fprintf(stderr,"%s (%s) has no default field to grid, name one with -field\n",inputs[k],
+		     lvis_file_type_name(job.files[k].fileType));
+	     errors++;
+	     continue;
+	  }
+	if(job.column[k] == NULL)
+	  {
+	     fprintf(stderr,"%s (%s) has no numeric field '%s' to grid, see -field\n",inputs[k],
+		     lvis_file_type_name(job.files[k].fileType),field);
+	     errors++;
+	     continue;
+	  }
+	n = job.files[k].recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+	job.files[k].recordCount = n;
+	job.samples[k] = lvis_sample_count(opt->sample,n);
+	maxtasks += (long) ((job.samples[k] + chunk - 1) / chunk);
+	taken += (double) job.samples[k];
+	records += (double) n;
+     }
+   // a stride samples every cell at the rate of the whole sample: the finite
+   // population correction of -summary.  Blocks take some cells whole and
+   // miss others, so there is no one rate; the block means are not corrected.
+   if(records > 0.0 && !job.clusters) fpc = 1.0 - taken / records;
+   if(fpc < 0.0) fpc = 0.0;
+   if(errors > 0)
+     {
+	free(job.files);
+	free(job.column);
+	free(job.samples);
+	return errors;
+     }
+
+   job.tasks = (struct lvis_grid_task *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_grid_task));
+   if(job.tasks == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the task table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     for(first=0;first<job.samples[k];first+=chunk)
+       {
+	  job.tasks[job.ntasks].file  = k;
+	  job.tasks[job.ntasks].first = first;
+	  job.tasks[job.ntasks].count = (job.samples[k] - first < chunk) ? job.samples[k] - first : chunk;
+	  job.ntasks++;
+       }
+
+   pool = lvis_pool_create(b->nthreads);
+   threads = lvis_pool_threads(pool);
+   lvis_batch_buffers(threads,LVIS_GRID_CHUNK,sizeof(union lvis_canon_record),&job.raw,&job.canon);
+   job.partial = (struct lvis_grid_cell **) calloc(threads,sizeof(struct lvis_grid_cell *));
+   job.bounds = (double *) calloc(4 * threads,sizeof(double));
+   job.binned = (int64_t *) calloc(threads,sizeof(int64_t));
+   job.dropped = (int64_t *) calloc(threads,sizeof(int64_t));
+   job.touched = (struct lvis_grid_touched *) calloc(threads,sizeof(struct lvis_grid_touched));
+   if(job.partial == NULL || job.bounds == NULL || job.binned == NULL || job.dropped == NULL || job.touched == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the grid buffers\n");
+	exit(-1);
+     }
+
+   // the extent: -lon / -lat, or where the data is
+   minlon = opt->minlon; maxlon = opt->maxlon;
+   minlat = opt->minlat; maxlat = opt->maxlat;
+   if(minlon <= -400.0 || maxlon >= 400.0 || minlat <= -400.0 || maxlat >= 400.0)
+     {
+	for(w=0;w<threads;w++)
+	  {
+	     job.bounds[4*w] = job.bounds[4*w+2] = HUGE_VAL;
+	     job.bounds[4*w+1] = job.bounds[4*w+3] = -HUGE_VAL;
+	  }
+	errors += lvis_grid_pass(&job,pool,lvis_grid_bounds_run);
+	for(w=1;w<threads;w++)
+	  {
+	     if(job.bounds[4*w] < job.bounds[0]) job.bounds[0] = job.bounds[4*w];
+	     if(job.bounds[4*w+1] > job.bounds[1]) job.bounds[1] = job.bounds[4*w+1];
+	     if(job.bounds[4*w+2] < job.bounds[2]) job.bounds[2] = job.bounds[4*w+2];
+	     if(job.bounds[4*w+3] > job.bounds[3]) job.bounds[3] = job.bounds[4*w+3];
+	  }
+	if(job.bounds[0] > job.bounds[1])
+	  {
+	     fprintf(stderr,"grid: no shots with a '%s' to grid\n",g->field[0] ? g->field : job.column[0]->name);
+	     exit(-1);
+	  }
+	// whole cells around the data, the last shot inside the last cell
+	if(minlon <= -400.0 || maxlon >= 400.0)
+	  {
+	     minlon = job.cell * floor(job.bounds[0] / job.cell);
+	     maxlon = job.cell * (floor(job.bounds[1] / job.cell) + 1.0);
+	  }
+	if(minlat <= -400.0 || maxlat >= 400.0)
+	  {
+	     minlat = job.cell * floor(job.bounds[2] / job.cell);
+	     maxlat = job.cell * (floor(job.bounds[3] / job.cell) + 1.0);
+	  }
+     }
+   job.minlon = minlon;
+   job.maxlat = maxlat;
+   job.ncols = (long) ceil((maxlon - minlon) / job.cell - 1e-9);
+   job.nrows = (long) ceil((maxlat - minlat) / job.cell - 1e-9);
+   if(job.ncols < 1) job.ncols = 1;
+   if(job.nrows < 1) job.nrows = 1;
+
+   // rows a tile may have, with a partial grid per thread and a band of floats
+   perRow = (size_t) job.ncols * (threads * sizeof(struct lvis_grid_cell) + sizeof(float));
+   job.trows = (long) (((size_t) g->memoryMB << 20) / perRow);
+   if(job.trows < 1) job.trows = 1;
+   if(job.trows > job.nrows) job.trows = job.nrows;
+   for(k=0;k<threads;k++)
+     if((job.partial[k] = (struct lvis_grid_cell *) malloc(job.trows * job.ncols * sizeof(struct lvis_grid_cell)))==NULL)
+       {
+	  fprintf(stderr,"Unable to allocate the partial grids (%ld x %ld cells)\n",job.trows,job.ncols);
+	  exit(-1);
+       }
+   if((band = (float *) malloc(job.trows * job.ncols * sizeof(float)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the grid buffers\n");
+	exit(-1);
+     }
+
+   lvis_grid_sidecar(opt->outfile,".bil",bil,sizeof(bil));
+   if((out = fopen(bil,"wb"))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",bil,strerror(errno));
+	exit(-1);
+     }
+
+   for(job.row0=0;job.row0<job.nrows;job.row0+=job.trows)
+     {
+	if(job.row0 + job.trows > job.nrows) job.trows = job.nrows - job.row0;
+	for(k=0;k<threads;k++) memset(job.partial[k],0,job.trows * job.ncols * sizeof(struct lvis_grid_cell));
+	errors += lvis_grid_pass(&job,pool,lvis_grid_run);
+
+	// tree reduction: threads/2 merges, then threads/4 ... into partial[0]
+	for(job.step=1;job.step<threads;job.step*=2)
+	  lvis_pool_run(pool,(threads - job.step + 2 * job.step - 1) / (2 * job.step),lvis_grid_merge,&job);
+
+	for(k=0;k<LVIS_GRID_BANDS + (opt->sample != NULL);k++)
+	  {
+	     for(row=0;row<job.trows;row++)
+	       for(col=0;col<job.ncols;col++)
+		 {
+		    cell = job.partial[0] + row * job.ncols + col;
+		    if(cell->count == 0) { band[row * job.ncols + col] = LVIS_GRID_NODATA; continue; }
+		    if(k == 0) band[row * job.ncols + col] = (float) (cell->sum / cell->count);
+		    if(k == 1) band[row * job.ncols + col] = cell->min;
+		    if(k == 2) band[row * job.ncols + col] = cell->max;
+		    if(k == 3) band[row * job.ncols + col] = (float) cell->count;
+		    if(k == 4 && job.clusters)
+		      {
+			 // that of the mean of the cell's block means, none from one block
+			 var = (cell->bsumsq - cell->bsum * cell->bsum / cell->blocks) / (cell->blocks - 1);
+			 band[row * job.ncols + col] = (cell->blocks < 2) ? LVIS_GRID_NODATA :
+			   (float) sqrt(((var > 0.0) ? var : 0.0) / cell->blocks);
+		      }
+		    else if(k == 4)
+		      {
+			 // the standard error of the mean, none from one shot
+			 var = (cell->sumsq - cell->sum * cell->sum / cell->count) / (cell->count - 1);
+			 band[row * job.ncols + col] = (cell->count < 2) ? LVIS_GRID_NODATA :
+			   (float) sqrt(((var > 0.0) ? var : 0.0) / cell->count * fpc);
+		      }
+		 }
+	     if(fseeko(out,((off_t) k * job.nrows + job.row0) * job.ncols * sizeof(float),SEEK_SET)!=0 ||
+		fwrite(band,sizeof(float),job.trows * job.ncols,out) != (size_t) (job.trows * job.ncols))
+	       {
+		  fprintf(stderr,"Error writing the output file: %s (%s)\n",bil,strerror(errno));
+		  exit(-1);
+	       }
+	  }
+	tiles++;
+     }
+   lvis_pool_destroy(pool);
+
+   if(fclose(out)!=0)
+     {
+	fprintf(stderr,"Error closing the output file: %s (%s)\n",bil,strerror(errno));
+	errors++;
+     }
+   if(lvis_grid_sidecars(&job,opt->outfile,opt->myendian) != 0)
+     {
+	fprintf(stderr,"Error writing the header files of %s\n",bil);
+	errors++;
+     }
+   for(k=0;k<threads;k++) { binned += job.binned[k]; dropped += job.dropped[k]; }
+   fprintf(stderr,"grid: %lld shots binned into %ld x %ld cells of %g degrees (%s), %ld tile%s\n",(long long) binned,
+	   job.ncols,job.nrows,job.cell,job.column[0]->name,tiles,tiles == 1 ? "" : "s");
+   if(dropped > 0) fprintf(stderr,"grid: %lld shots fell outside the grid and were dropped\n",(long long) dropped);
+   if(opt->sample != NULL)
+     {
+	lvis_sample_describe(opt->sample,bil,sizeof(bil));
+	fprintf(stderr,"grid: a sample of %s, band 5 the standard error of the cell means%s\n",bil,
+		job.clusters ? " (from the block means)" : "");
+     }
+
+   lvis_batch_free_buffers(threads,job.raw,job.canon);
+   for(k=0;k<threads;k++) { free(job.partial[k]); free(job.touched[k].cell); }
+   free(band);
+   free(job.partial);
+   free(job.bounds);
+   free(job.binned);
+   free(job.dropped);
+   free(job.touched);
+   free(job.tasks);
+   free(job.files);
+   free(job.column);
+   free(job.samples);
+   return errors;
+}
@@ -0,0 +1,58 @@
+#ifndef __LVIS_RELEASE_GRID_H
+#define __LVIS_RELEASE_GRID_H
+
+// lvis_release_grid.h
+//
+// grid mode: bin one field of the shots (zg, zt, rh100 ... any numeric
+// scalar of the canonical record, -field) into a lon / lat grid of -cell
+// degree cells over the -lon / -lat extent (the extent of the data when
+// they are not given), and write the mean, min, max and count of every
+// cell as a 4 band float raster: an ESRI .bil (band sequential, host byte
+// order) with its .hdr, a .blw world file and a .prj, which GDAL and the
+// GIS tools read as they are.  Empty cells hold LVIS_GRID_NODATA.  Under
+// -sample a fifth band holds the standard error of each cell's mean.
+//
+// Each pool thread accumulates the shots it reads into its own partial
+// grid, so there is no locking; the partial grids are then merged pairwise
+// in parallel, log2(threads) rounds.  When the partial grids of every
+// thread would not fit in -gridmem MB, the grid is made a band of rows (a
+// tile) at a time, each tile one more pass over the inputs.
+
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_GRID_CELL
+#define  LVIS_GRID_CELL 0.001         // default -cell (degrees)
+#endif
+
+#ifndef  LVIS_GRID_MEMORY_MB
+#define  LVIS_GRID_MEMORY_MB 1024     // default -gridmem
+#endif
+
+#ifndef  LVIS_GRID_CHUNK
+#define  LVIS_GRID_CHUNK 4096         // shots per task
+#endif
+
+#define  LVIS_GRID_NODATA -9999.0
+#define  LVIS_GRID_BANDS  4           // mean, min, max, count
+
+struct lvis_grid_options
+{
+   double cell;             // -cell S (degrees)
+   char   field[64];        // -field NAME (empty = zg for LGE, zt for LCE)
+   int    memoryMB;         // -gridmem MB
+};
+
+void lvis_grid_defaults(struct lvis_grid_options * g);
+
+// handle the grid options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a grid option)
+int  lvis_grid_parse_option(int argc, char * argv[], int i, struct lvis_grid_options * g);
+
+// grid the inputs into the raster opt->outfile (.bil, the .hdr / .blw /
+// .prj next to it), returns 0 on success
+struct lvis_batch_options;
+int  lvis_grid_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		       struct lvis_batch_options * b, struct lvis_grid_options * g);
+
+#endif
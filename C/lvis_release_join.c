@@ -0,0 +1,772 @@
+// lvis_release_join.c
+//
+// Joining LGW / LGE / LCE products on (lfid, shotnumber), see
+// lvis_release_join.h.
+//
+// Every product is read as one stream of canonical records (its files in
+// the order given), so the join never cares about release versions.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_join.h"
+
+#define LVIS_JOIN_PRODUCTS    3      // lce, lge, lgw
+#define LVIS_JOIN_BLOCK       512    // records read at a time
+#define LVIS_JOIN_MAX_FIELDS  64
+#define LVIS_JOIN_MAX_PARTS   256    // partition files per product
+
+// one product: its files read back to back as canonical records
+struct lvis_join_stream
+{
+   int                        fileType;
+   struct lvis_release_file * files;
+   int                        nfiles;
+   int                        cur;       // file being read
+   int64_t                    next;      // next record of that file to read
+   int64_t                    limit;     // -n
+   int                        csize;     // canonical record size
+   unsigned char            * raw;
+   unsigned char            * canon;
+   int64_t                    have,pos;  // records in canon[], current one
+   unsigned char            * rec;       // current record (NULL at the end)
+   uint64_t                   key;
+};
+
+// a hashed product: records plus an open addressing index on the key
+struct lvis_join_table
+{
+   int             csize;
+   unsigned char * records;
+   int64_t         count,room;
+   int64_t       * slots;     // record index, -1 = empty
+   uint64_t        mask;
+};
+
+struct lvis_join_field
+{
+   int                        product;
+   struct lvis_canon_column * column;
+};
+
+struct lvis_join_job
+{
+   struct lvis_release_options * opt;
+   struct lvis_join_options    * j;
+   struct lvis_join_stream       streams[LVIS_JOIN_PRODUCTS];
+   int                           nstreams;
+   struct lvis_join_field        fields[LVIS_JOIN_MAX_FIELDS];
+   int                           nfields;
+   FILE                        * out;
+   unsigned int                  colnum;
+   int64_t                       rows;
+   FILE                        * matches;  // partitioned: the rows of a partition, to be put back in order
+};
+
+static uint64_t lvis_join_key(unsigned char * canon)
+{
+   // lfid and shotnumber lead every v1.04 record
+   struct lvis_lce_v1_04 * r = (struct lvis_lce_v1_04 *) canon;
+   return ((uint64_t) r->lfid << 32) | r->shotnumber;
+}
+
+static uint64_t lvis_join_hash(uint64_t key)
+{
+   key ^= key >> 30; key *= 0xbf58476d1ce4e5b9ULL;
+   key ^= key >> 27; key *= 0x94d049bb133111ebULL;
+   key ^= key >> 31;
+   return key;
+}
+
+static char * lvis_join_type_word(int fileType)
+{
+   if(fileType == LVIS_RELEASE_FILETYPE_LCE) return "lce";
+   if(fileType == LVIS_RELEASE_FILETYPE_LGE) return "lge";
+   if(fileType == LVIS_RELEASE_FILETYPE_LGW) return "lgw";
+   return "???";
+}
+
+// ---------------------------------------------------------------- streams
+
+static void lvis_join_stream_rewind(struct lvis_join_stream * s)
+{
+   s->cur = 0;
+   s->next = 0;
+   s->have = s->pos = 0;
+   s->rec = NULL;
+}
+
+// step to the next record, returns 0 at the end of the product
+static int lvis_join_stream_next(struct lvis_join_stream * s)
+{
+   struct lvis_release_file * f;
+   int64_t                    n,count;
+
+   s->pos++;
+   while(s->pos >= s->have)
+     {
+	if(s->cur >= s->nfiles) { s->rec = NULL; return 0; }
+	f = &s->files[s->cur];
+	n = f->recordCount;
+	if(s->limit > 0 && s->limit < n) n = s->limit;
+	count = (n - s->next < LVIS_JOIN_BLOCK) ? n - s->next : LVIS_JOIN_BLOCK;
+	if(count <= 0)
+	  {
+	     lvis_file_close(f);
+	     s->cur++;
+	     s->next = 0;
+	     continue;
+	  }
+	if(lvis_file_reopen(f)!=0) exit(-1);
+	if((s->have = lvis_canon_read(f,s->next,count,s->raw,s->canon)) != count)
+	  {
+	     fprintf(stderr,"Short read in %s at record %lld\n",f->filename,(long long) (s->next+s->have));
+	     exit(-1);
+	  }
+	s->next += count;
+	s->pos = 0;
+     }
+   s->rec = s->canon + s->pos * s->csize;
+   s->key = lvis_join_key(s->rec);
+   return 1;
+}
+
+static int lvis_join_stream_first(struct lvis_join_stream * s)
+{
+   lvis_join_stream_rewind(s);
+   s->pos = -1;
+   return lvis_join_stream_next(s);
+}
+
+static int64_t lvis_join_stream_records(struct lvis_join_stream * s)
+{
+   int64_t total=0,n;
+   int     k;
+
+   for(k=0;k<s->nfiles;k++)
+     {
+	n = s->files[k].recordCount;
+	if(s->limit > 0 && s->limit < n) n = s->limit;
+	total += n;
+     }
+   return total;
+}
+
+// is the whole product in key order?
+static int lvis_join_stream_sorted(struct lvis_join_stream * s)
+{
+   uint64_t last=0;
+   int      ok;
+
+   for(ok=lvis_join_stream_first(s);ok;ok=lvis_join_stream_next(s))
+     {
+	if(s->key < last) return 0;
+	last = s->key;
+     }
+   return 1;
+}
+
+// ----------------------------------------------------------------- tables
+
+static void lvis_join_table_init(struct lvis_join_table * t, int csize, int64_t expected)
+{
+   uint64_t size = 1024;
+
+   while(size < 2*(uint64_t)expected) size <<= 1;
+   t->csize = csize;
+   t->count = 0;
+   t->room = expected > 0 ? expected : 1;
+   t->records = (unsigned char *) malloc((size_t) t->room * csize);
+   t->slots = (int64_t *) malloc(size * sizeof(int64_t));
+   if(t->records == NULL || t->slots == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the join table (%lld records)\n",(long long) expected);
+	exit(-1);
+     }
+   memset(t->slots,0xFF,size * sizeof(int64_t));
+   t->mask = size - 1;
+}
+
+static void lvis_join_table_free(struct lvis_join_table * t)
+{
+   free(t->records);
+   free(t->slots);
+   t->records = NULL;
+   t->slots = NULL;
+}
+
+static void lvis_join_table_add(struct lvis_join_table * t, unsigned char * rec)
+{
+   uint64_t i,key = lvis_join_key(rec);
+
+   // the first record of a key is the one joined, like the merge join
+   for(i=lvis_join_hash(key) & t->mask; t->slots[i] >= 0; i=(i+1) & t->mask)
+     if(lvis_join_key(t->records + t->slots[i] * t->csize) == key) return;
+   if(t->count >= t->room || 2*(uint64_t)(t->count+1) > t->mask+1)
+     {
+	// only when a partition came out bigger than expected
+	struct lvis_join_table bigger;
+	int64_t                k;
+
+	lvis_join_table_init(&bigger,t->csize,2*t->room);
+	for(k=0;k<t->count;k++) lvis_join_table_add(&bigger,t->records + k*t->csize);
+	lvis_join_table_free(t);
+	*t = bigger;
+	lvis_join_table_add(t,rec);
+	return;
+     }
+   memcpy(t->records + t->count * t->csize,rec,t->csize);
+   t->slots[i] = t->count++;
+}
+
+static unsigned char * lvis_join_table_find(struct lvis_join_table * t, uint64_t key)
+{
+   uint64_t i;
+
+   for(i=lvis_join_hash(key) & t->mask; t->slots[i] >= 0; i=(i+1) & t->mask)
+     if(lvis_join_key(t->records + t->slots[i] * t->csize) == key) return t->records + t->slots[i] * t->csize;
+   return NULL;
+}
+
+// ----------------------------------------------------------------- output
+
+static void lvis_join_emit(struct lvis_join_job * job, unsigned char ** recs)
+{
+   struct lvis_release_options * opt = job->opt;
+   double                        lon,lat;
+   int                           k;
+
+   // cut on the position of the product that drives the join
+   release_data_position(recs[0],job->streams[0].fileType,(float)1.04,&lon,&lat);
+   if(!lvis_release_keep(opt,lon,lat)) { job->colnum++; return; }
+
+   if(opt->indexcol==1) fprintf(job->out,"%10i%s",job->colnum,opt->delim);
+   job->colnum++;
+   for(k=0;k<job->nfields;k++)
+     {
+	if(k > 0) fprintf(job->out,"%s",opt->delim);
+	lvis_canon_print_column(job->out,recs[job->fields[k].product],job->fields[k].column,opt->delim);
+     }
+   fprintf(job->out,"\n");
+   job->rows++;
+}
+
+static void lvis_join_headers(struct lvis_join_job * job)
+{
+   struct lvis_join_field * f;
+   int                      k,e;
+
+   if(job->opt->indexcol==1) fprintf(job->out,"index%s",job->opt->delim);
+   for(k=0;k<job->nfields;k++)
+     {
+	f = &job->fields[k];
+	if(k > 0) fprintf(job->out,"%s",job->opt->delim);
+	if(f->column->count == 1)
+	  fprintf(job->out,"%s.%s",lvis_join_type_word(job->streams[f->product].fileType),f->column->name);
+	else
+	  for(e=0;e<f->column->count;e++)
+	    fprintf(job->out,"%s%s.%s%03d",e > 0 ? job->opt->delim : "",
+		    lvis_join_type_word(job->streams[f->product].fileType),f->column->name,e);
+     }
+   fprintf(job->out,"\n");
+}
+
+// find "name" or "lge.name" among the products
+static int lvis_join_add_field(struct lvis_join_job * job, char * spec)
+{
+   struct lvis_canon_column * c;
+   char                     * dot = strchr(spec,'.'),* name = spec;
+   int                        k;
+
+   if(dot != NULL) name = dot+1;
+   for(k=0;k<job->nstreams;k++)
+     {
+	if(dot != NULL && (dot-spec != 3 || strncasecmp(spec,lvis_join_type_word(job->streams[k].fileType),3)!=0))
+	  continue;
+	for(c=lvis_canon_columns(job->streams[k].fileType);c->name!=NULL;c++)
+	  if(strcmp(c->name,name)==0)
+	    {
+	       if(job->nfields >= LVIS_JOIN_MAX_FIELDS)
+		 {
+		    fprintf(stderr,"Too many -fields (at most %d)\n",LVIS_JOIN_MAX_FIELDS);
+		    return -1;
+		 }
+	       job->fields[job->nfields].product = k;
+	       job->fields[job->nfields].column = c;
+	       job->nfields++;
+	       return 0;
+	    }
+     }
+   fprintf(stderr,"No field %s in the joined products\n",spec);
+   return -1;
+}
+
+static int lvis_join_choose_fields(struct lvis_join_job * job)
+{
+   struct lvis_canon_column * c;
+   char                       list[4096],* spec,* save=NULL;
+   int                        k;
+
+   if(job->j->fields[0] != 0)
+     {
+	strncpy(list,job->j->fields,sizeof(list)-1);
+	list[sizeof(list)-1] = 0;
+	for(spec=strtok_r(list,",",&save);spec!=NULL;spec=strtok_r(NULL,",",&save))
+	  if(lvis_join_add_field(job,spec)!=0) return -1;
+	return 0;
+     }
+   // the key once, then everything else of every product
+   lvis_join_add_field(job,"lfid");
+   lvis_join_add_field(job,"shotnumber");
+   for(k=0;k<job->nstreams;k++)
+     for(c=lvis_canon_columns(job->streams[k].fileType);c->name!=NULL;c++)
+       if(strcmp(c->name,"lfid")!=0 && strcmp(c->name,"shotnumber")!=0)
+	 {
+	    if(job->nfields >= LVIS_JOIN_MAX_FIELDS) break;
+	    job->fields[job->nfields].product = k;
+	    job->fields[job->nfields].column = c;
+	    job->nfields++;
+	 }
+   return 0;
+}
+
+// ------------------------------------------------------------------ joins
+
+// step a product of the merge join, which must stay in order
+static int lvis_join_merge_next(struct lvis_join_stream * s)
+{
+   uint64_t last = s->key;
+
+   if(!lvis_join_stream_next(s)) return 0;
+   if(s->key < last)
+     {
+	fprintf(stderr,"The %s input is not in (lfid, shotnumber) order, run join without -sorted\n",
+		lvis_join_type_word(s->fileType));
+	exit(-1);
+     }
+   return 1;
+}
+
+// every product in key order: one pass, the others follow the first
+static void lvis_join_merge(struct lvis_join_job * job)
+{
+   struct lvis_join_stream * d = &job->streams[0],* s;
+   unsigned char           * recs[LVIS_JOIN_PRODUCTS];
+   int                       k,match;
+
+   for(k=0;k<job->nstreams;k++)
+     if(!lvis_join_stream_first(&job->streams[k])) return;
+   do
+     {
+	match = 1;
+	recs[0] = d->rec;
+	for(k=1;k<job->nstreams;k++)
+	  {
+	     s = &job->streams[k];
+	     while(s->key < d->key)
+	       if(!lvis_join_merge_next(s)) return;   // a product is used up, no more rows
+	     if(s->key != d->key) match = 0;
+	     recs[k] = s->rec;
+	  }
+	if(match) lvis_join_emit(job,recs);
+     }
+   while(lvis_join_merge_next(d));
+}
+
+// a row of the partitioned join: the number of its record of the first
+// product, then the joined records
+static void lvis_join_spill_match(struct lvis_join_job * job, int64_t seq, unsigned char ** recs)
+{
+   int k,ok;
+
+   ok = (fwrite(&seq,sizeof(seq),1,job->matches)==1);
+   for(k=0;k<job->nstreams && ok;k++) ok = (fwrite(recs[k],job->streams[k].csize,1,job->matches)==1);
+   if(!ok)
+     {
+	fprintf(stderr,"Error writing a join spill file (%s)\n",strerror(errno));
+	exit(-1);
+     }
+}
+
+// stream the first product past the others, hashed
+static void lvis_join_probe(struct lvis_join_job * job, struct lvis_join_table * tables,
+			    unsigned char * (*next)(void *, uint64_t *, int64_t *), void * source)
+{
+   unsigned char * recs[LVIS_JOIN_PRODUCTS];
+   uint64_t        key;
+   int64_t         seq;
+   int             k;
+
+   while((recs[0] = next(source,&key,&seq)) != NULL)
+     {
+	for(k=1;k<job->nstreams;k++)
+	  if((recs[k] = lvis_join_table_find(&tables[k],key)) == NULL) break;
+	if(k < job->nstreams) continue;
+	if(job->matches != NULL) lvis_join_spill_match(job,seq,recs);
+	else lvis_join_emit(job,recs);
+     }
+}
+
+static unsigned char * lvis_join_stream_source(void * source, uint64_t * key, int64_t * seq)
+{
+   struct lvis_join_stream * s = (struct lvis_join_stream *) source;
+
+   if(s->rec == NULL ? !lvis_join_stream_first(s) : !lvis_join_stream_next(s)) return NULL;
+   *key = s->key;
+   *seq = -1;
+   return s->rec;
+}
+
+struct lvis_join_file_source
+{
+   FILE          * fp;
+   int             csize;
+   int             numbered;   // each record follows its number (the first product)
+   unsigned char   rec[LVIS_MAX_RECORD_SIZE];
+};
+
+static unsigned char * lvis_join_file_next(void * source, uint64_t * key, int64_t * seq)
+{
+   struct lvis_join_file_source * s = (struct lvis_join_file_source *) source;
+
+   *seq = -1;
+   if(s->numbered && fread(seq,sizeof(int64_t),1,s->fp)!=1) return NULL;
+   if(fread(s->rec,s->csize,1,s->fp)!=1) return NULL;
+   *key = lvis_join_key(s->rec);
+   return s->rec;
+}
+
+static FILE * lvis_join_open_spill(char * name, char * mode)
+{
+   FILE * fp;
+
+   if((fp = fopen(name,mode))==NULL)
+     {
+	fprintf(stderr,"Error opening the join spill file: %s (%s)\n",name,strerror(errno));
+	exit(-1);
+     }
+   return fp;
+}
+
+// k = -1: the rows of partition p
+static void lvis_join_part_name(struct lvis_join_job * job, int k, int p, char * name, int size)
+{
+   snprintf(name,size,"%s/lvis_join.%d.%s.%04d",job->opt->tmpdir,(int) getpid(),
+	    k < 0 ? "rows" : lvis_join_type_word(job->streams[k].fileType),p);
+}
+
+struct lvis_join_rows
+{
+   FILE          * fp;
+   int64_t         seq;
+   unsigned char * row;
+};
+
+// next row of a partition, 0 at its end
+static int lvis_join_rows_next(struct lvis_join_rows * r, int rowsize)
+{
+   if(fread(&r->seq,sizeof(int64_t),1,r->fp)!=1) return 0;
+   if(fread(r->row,rowsize,1,r->fp)!=1)
+     {
+	fprintf(stderr,"Short read in a join spill file\n");
+	exit(-1);
+     }
+   return 1;
+}
+
+// sift heap[i] down the min heap of partitions by row number
+static void lvis_join_rows_sift(struct lvis_join_rows * rows, int * heap, int n, int i)
+{
+   int c,t;
+
+   while((c = 2*i+1) < n)
+     {
+	if(c+1 < n && rows[heap[c+1]].seq < rows[heap[c]].seq) c++;
+	if(rows[heap[i]].seq <= rows[heap[c]].seq) break;
+	t = heap[i]; heap[i] = heap[c]; heap[c] = t;
+	i = c;
+     }
+}
+
+// each partition's rows are in the order of the first product, merge them
+// back into that order, as the in-memory join writes them
+static void lvis_join_rows_merge(struct lvis_join_job * job, int nparts)
+{
+   struct lvis_join_rows * rows;
+   unsigned char         * recs[LVIS_JOIN_PRODUCTS];
+   char                    name[2048];
+   int                   * heap,rowsize=0,n=0,k,p,off;
+
+   for(k=0;k<job->nstreams;k++) rowsize += job->streams[k].csize;
+   rows = (struct lvis_join_rows *) calloc(nparts,sizeof(struct lvis_join_rows));
+   heap = (int *) calloc(nparts,sizeof(int));
+   if(rows == NULL || heap == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the join merge\n");
+	exit(-1);
+     }
+   for(p=0;p<nparts;p++)
+     {
+	lvis_join_part_name(job,-1,p,name,sizeof(name));
+	rows[p].fp = lvis_join_open_spill(name,"rb");
+	unlink(name);
+	if((rows[p].row = (unsigned char *) malloc(rowsize)) == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the join merge\n");
+	     exit(-1);
+	  }
+	if(lvis_join_rows_next(&rows[p],rowsize)) heap[n++] = p;
+     }
+   for(p=n/2-1;p>=0;p--) lvis_join_rows_sift(rows,heap,n,p);
+   while(n > 0)
+     {
+	p = heap[0];
+	for(k=0,off=0;k<job->nstreams;off+=job->streams[k].csize,k++) recs[k] = rows[p].row + off;
+	lvis_join_emit(job,recs);
+	if(!lvis_join_rows_next(&rows[p],rowsize)) heap[0] = heap[--n];
+	lvis_join_rows_sift(rows,heap,n,0);
+     }
+   for(p=0;p<nparts;p++)
+     {
+	fclose(rows[p].fp);
+	free(rows[p].row);
+     }
+   free(rows);
+   free(heap);
+}
+
+// the products do not fit: split them all by key hash, join partition by
+// partition, then merge the rows of the partitions back into input order
+static void lvis_join_partitioned(struct lvis_join_job * job, int nparts)
+{
+   struct lvis_join_table       tables[LVIS_JOIN_PRODUCTS];
+   struct lvis_join_file_source src;
+   FILE                       * parts[LVIS_JOIN_MAX_PARTS],* fp;
+   char                         name[2048];
+   long                         size;
+   int64_t                      seq;
+   int                          k,p,ok;
+
+   for(k=0;k<job->nstreams;k++)
+     {
+	struct lvis_join_stream * s = &job->streams[k];
+
+	for(p=0;p<nparts;p++)
+	  {
+	     lvis_join_part_name(job,k,p,name,sizeof(name));
+	     parts[p] = lvis_join_open_spill(name,"wb");
+	  }
+	// the records of the first product keep their number, the order of the rows
+	for(seq=0,ok=lvis_join_stream_first(s);ok;seq++,ok=lvis_join_stream_next(s))
+	  {
+	     fp = parts[(lvis_join_hash(s->key) >> 40) % nparts];
+	     if((k == 0 && fwrite(&seq,sizeof(seq),1,fp)!=1) || fwrite(s->rec,s->csize,1,fp)!=1)
+	       {
+		  fprintf(stderr,"Error writing a join spill file (%s)\n",strerror(errno));
+		  exit(-1);
+	       }
+	  }
+	for(p=0;p<nparts;p++)
+	  if(fclose(parts[p])!=0)
+	    {
+	       fprintf(stderr,"Error writing a join spill file (%s)\n",strerror(errno));
+	       exit(-1);
+	    }
+     }
+
+   for(p=0;p<nparts;p++)
+     {
+	for(k=1;k<job->nstreams;k++)
+	  {
+	     lvis_join_part_name(job,k,p,name,sizeof(name));
+	     src.csize = job->streams[k].csize;
+	     src.numbered = 0;
+	     src.fp = lvis_join_open_spill(name,"rb");
+	     fseek(src.fp,0,SEEK_END);
+	     size = ftell(src.fp);
+	     rewind(src.fp);
+	     lvis_join_table_init(&tables[k],src.csize,size / src.csize);
+	     while(fread(src.rec,src.csize,1,src.fp)==1) lvis_join_table_add(&tables[k],src.rec);
+	     fclose(src.fp);
+	     unlink(name);
+	  }
+	lvis_join_part_name(job,0,p,name,sizeof(name));
+	src.csize = job->streams[0].csize;
+	src.numbered = 1;
+	src.fp = lvis_join_open_spill(name,"rb");
+	lvis_join_part_name(job,-1,p,name,sizeof(name));
+	job->matches = lvis_join_open_spill(name,"wb");
+	lvis_join_probe(job,tables,lvis_join_file_next,&src);
+	if(fclose(job->matches)!=0)
+	  {
+	     fprintf(stderr,"Error writing a join spill file (%s)\n",strerror(errno));
+	     exit(-1);
+	  }
+	job->matches = NULL;
+	fclose(src.fp);
+	lvis_join_part_name(job,0,p,name,sizeof(name));
+	unlink(name);
+	for(k=1;k<job->nstreams;k++) lvis_join_table_free(&tables[k]);
+     }
+   lvis_join_rows_merge(job,nparts);
+}
+
+void lvis_join_defaults(struct lvis_join_options * j)
+{
+   memset(j,0,sizeof(struct lvis_join_options));
+   j->memoryMB = LVIS_JOIN_MEMORY_MB;
+}
+
+int lvis_join_parse_option(int argc, char * argv[], int i, struct lvis_join_options * j)
+{
+   if(strcmp(argv[i],"-fields")==0 && i+1<argc)
+     {
+	strncpy(j->fields,argv[i+1],sizeof(j->fields)-1);
+	return 2;
+     }
+   if(strcmp(argv[i],"-joinmem")==0 && i+1<argc)
+     {
+	j->memoryMB = atol(argv[i+1]);
+	if(j->memoryMB < 1) j->memoryMB = 1;
+	return 2;
+     }
+   if(strcmp(argv[i],"-sorted")==0)
+     {
+	j->sorted = 1;
+	return 1;
+     }
+   return 0;
+}
+
+int lvis_join_products(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		       struct lvis_join_options * j)
+{
+   struct lvis_join_job     job;
+   struct lvis_join_table   tables[LVIS_JOIN_PRODUCTS];
+   struct lvis_release_file f;
+   uint64_t                 need=0,budget;
+   float                    version;
+   int                      i,k,sorted=1,nparts,errors=0;
+
+   memset(&job,0,sizeof(job));
+   job.opt = opt;
+   job.j = j;
+   job.colnum = 1;
+
+   // group the inputs by product, in the order the products first appear
+   for(i=0;i<ninputs;i++)
+     {
+	if(lvis_file_open(&f,inputs[i],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	lvis_file_close(&f);
+	version = f.canonical ? f.sourceVersion : f.fileVersion;
+	if(version < (float)1.01)
+	  {
+	     fprintf(stderr,"%s (release %4.2f) has no lfid / shotnumber to join on\n",inputs[i],version);
+	     errors++;
+	     continue;
+	  }
+	for(k=0;k<job.nstreams && job.streams[k].fileType != f.fileType;k++);
+	if(k == job.nstreams)
+	  {
+	     job.streams[k].fileType = f.fileType;
+	     job.streams[k].csize = lvis_record_size(f.fileType,(float)1.04);
+	     job.streams[k].limit = opt->maxSampleNumber;
+	     job.nstreams++;
+	  }
+	job.streams[k].files = (struct lvis_release_file *)
+	  realloc(job.streams[k].files,(job.streams[k].nfiles+1) * sizeof(struct lvis_release_file));
+	if(job.streams[k].files == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the input table\n");
+	     exit(-1);
+	  }
+	job.streams[k].files[job.streams[k].nfiles++] = f;
+     }
+   if(errors == 0 && job.nstreams < 2)
+     {
+	fprintf(stderr,"join needs the files of at least two products (lgw, lge, lce)\n");
+	errors++;
+     }
+   if(errors == 0 && lvis_join_choose_fields(&job)!=0) errors++;
+   if(errors > 0)
+     {
+	for(k=0;k<job.nstreams;k++) free(job.streams[k].files);
+	return errors;
+     }
+
+   for(k=0;k<job.nstreams;k++)
+     {
+	job.streams[k].raw = (unsigned char *) malloc(LVIS_JOIN_BLOCK * LVIS_MAX_RECORD_SIZE);
+	job.streams[k].canon = (unsigned char *) malloc(LVIS_JOIN_BLOCK * job.streams[k].csize);
+	if(job.streams[k].raw == NULL || job.streams[k].canon == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the join buffers\n");
+	     exit(-1);
+	  }
+     }
+
+   job.out = stdout;
+   if(opt->outfile[0] != 0 && (job.out = fopen(opt->outfile,"w"))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	exit(-1);
+     }
+   if(opt->topcol == 1) lvis_join_headers(&job);
+
+   // delivered products are in shot order, check (the small ones first, they are cheap)
+   if(!j->sorted)
+     for(k=job.nstreams-1;k>=0 && sorted;k--) sorted = lvis_join_stream_sorted(&job.streams[k]);
+
+   if(sorted) lvis_join_merge(&job);
+   else
+     {
+	// hash everything but the first product, records + about two slots each
+	for(k=1;k<job.nstreams;k++)
+	  need += lvis_join_stream_records(&job.streams[k]) * (job.streams[k].csize + 2*sizeof(int64_t));
+	budget = (uint64_t) j->memoryMB << 20;
+	if(need <= budget)
+	  {
+	     for(k=1;k<job.nstreams;k++)
+	       {
+		  struct lvis_join_stream * s = &job.streams[k];
+		  int                       ok;
+
+		  lvis_join_table_init(&tables[k],s->csize,lvis_join_stream_records(s));
+		  for(ok=lvis_join_stream_first(s);ok;ok=lvis_join_stream_next(s)) lvis_join_table_add(&tables[k],s->rec);
+	       }
+	     lvis_join_stream_rewind(&job.streams[0]);
+	     lvis_join_probe(&job,tables,lvis_join_stream_source,&job.streams[0]);
+	     for(k=1;k<job.nstreams;k++) lvis_join_table_free(&tables[k]);
+	  }
+	else
+	  {
+	     nparts = (int) ((need + budget - 1) / budget) * 2;
+	     if(nparts > LVIS_JOIN_MAX_PARTS) nparts = LVIS_JOIN_MAX_PARTS;
+	     lvis_join_partitioned(&job,nparts);
+	  }
+     }
+
+   if(job.out != stdout && fclose(job.out)!=0)
+     {
+	fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	errors++;
+     }
+   fflush(stdout);
+   for(k=0;k<job.nstreams;k++)
+     {
+	for(i=0;i<job.streams[k].nfiles;i++) lvis_file_close(&job.streams[k].files[i]);
+	free(job.streams[k].files);
+	free(job.streams[k].raw);
+	free(job.streams[k].canon);
+     }
+   return errors;
+}
@@ -0,0 +1,41 @@
+#ifndef __LVIS_RELEASE_JOIN_H
+#define __LVIS_RELEASE_JOIN_H
+
+// lvis_release_join.h
+//
+// join mode: the LGW, LGE and LCE products of a flight share lfid and
+// shotnumber; join writes one text row per shot found in all of the given
+// products, with the chosen fields (-fields) of each.  The inputs are
+// grouped by product, the product given first drives the output order.
+//
+// Products that are in (lfid, shotnumber) order, as delivered, are merge
+// joined in one streaming pass.  Otherwise the smaller products are hashed
+// and the first one streamed past them; when the hashed products do not
+// fit in -joinmem every product is first split into hash partitions on
+// disk (-tmpdir) and joined one partition at a time, the rows of each
+// partition spilled and merged back into the order of the first product.
+
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_JOIN_MEMORY_MB
+#define  LVIS_JOIN_MEMORY_MB 1024   // default -joinmem
+#endif
+
+struct lvis_join_options
+{
+   long  memoryMB;       // -joinmem MB, for the hashed products
+   int   sorted;         // -sorted: trust the inputs to be in order, do not check first
+   char  fields[4096];   // -fields a,lge.b,... (empty = every field of every product)
+};
+
+void lvis_join_defaults(struct lvis_join_options * j);
+
+// handle the join options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a join option)
+int  lvis_join_parse_option(int argc, char * argv[], int i, struct lvis_join_options * j);
+
+// join the inputs to stdout (or opt->outfile), returns 0 on success
+int  lvis_join_products(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			struct lvis_join_options * j);
+
+#endif
@@ -0,0 +1,559 @@
+// lvis_release_las.c
+//
+// LAS 1.4 output (-las), see lvis_release_las.h.
+//
+// LAS is little endian whatever the host, so every field is put byte by
+// byte by the lvis_las_putxx helpers rather than written as a structure.
+// The shots are split into tasks that the pool encodes in waves, as in the
+// metrics mode; each task keeps its encoded points and their bounds until
+// the calling thread writes them, in input order.
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_expand.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_las.h"
+
+#define LVIS_LAS_MAX_EXTRAS 8
+
+// the horizontal coordinate system, for the OGC WKT VLR
+#define LVIS_LAS_WKT "GEOGCS[\"WGS 84\",DATUM[\"WGS_1984\",SPHEROID[\"WGS 84\",6378137,298.257223563," \
+   "AUTHORITY[\"EPSG\",\"7030\"]],AUTHORITY[\"EPSG\",\"6326\"]],PRIMEM[\"Greenwich\",0," \
+   "AUTHORITY[\"EPSG\",\"8901\"]],UNIT[\"degree\",0.0174532925199433,AUTHORITY[\"EPSG\",\"9122\"]]," \
+   "AUTHORITY[\"EPSG\",\"4326\"]]"
+
+// LAS point classes
+#define LVIS_LAS_UNCLASSIFIED 1
+#define LVIS_LAS_GROUND       2
+
+// Extra Bytes data types
+#define LVIS_LAS_USHORT 3
+#define LVIS_LAS_FLOAT  9
+
+struct lvis_las_extra
+{
+   char * name;
+   int    type;          // LVIS_LAS_USHORT or LVIS_LAS_FLOAT
+   char * description;
+};
+
+static struct lvis_las_extra lvis_las_lce_extras[] =
+{
+   { "azimuth",       LVIS_LAS_FLOAT,  "heading aircraft to ground (deg)" },
+   { "incidentangle", LVIS_LAS_FLOAT,  "off nadir angle (deg)" },
+   { "range",         LVIS_LAS_FLOAT,  "range aircraft to ground (m)" },
+   { NULL, 0, NULL }
+};
+
+static struct lvis_las_extra lvis_las_lge_extras[] =
+{
+   { "rh25",          LVIS_LAS_FLOAT,  "height of 25% of the energy (m)" },
+   { "rh50",          LVIS_LAS_FLOAT,  "height of 50% of the energy (m)" },
+   { "rh75",          LVIS_LAS_FLOAT,  "height of 75% of the energy (m)" },
+   { "rh100",         LVIS_LAS_FLOAT,  "height of 100% of the energy (m)" },
+   { "azimuth",       LVIS_LAS_FLOAT,  "heading aircraft to ground (deg)" },
+   { "incidentangle", LVIS_LAS_FLOAT,  "off nadir angle (deg)" },
+   { "range",         LVIS_LAS_FLOAT,  "range aircraft to ground (m)" },
+   { NULL, 0, NULL }
+};
+
+static struct lvis_las_extra lvis_las_lgw_extras[] =
+{
+   { "amplitude",     LVIS_LAS_FLOAT,  "counts above sigmean" },
+   { "sample",        LVIS_LAS_USHORT, "index in rxwave" },
+   { "sigmean",       LVIS_LAS_FLOAT,  "mean noise of rxwave (counts)" },
+   { "azimuth",       LVIS_LAS_FLOAT,  "heading aircraft to ground (deg)" },
+   { "incidentangle", LVIS_LAS_FLOAT,  "off nadir angle (deg)" },
+   { "range",         LVIS_LAS_FLOAT,  "range aircraft to ground (m)" },
+   { NULL, 0, NULL }
+};
+
+struct lvis_las_bounds
+{
+   double min[3],max[3];
+};
+
+struct lvis_las_task
+{
+   int                    file;
+   int64_t                first,count;
+   unsigned char        * buf;      // encoded points
+   int64_t                points;
+   struct lvis_las_bounds bounds;
+   int                    status;   // 0, -1 on a read error
+};
+
+struct lvis_las_job
+{
+   struct lvis_release_options * opt;
+   struct lvis_expand_options  * x;
+   struct lvis_release_file    * files;
+   int                         * rxSamples;   // lgw: valid samples per input
+   int                           fileType;
+   struct lvis_las_extra       * extras;
+   int                           nextras;
+   int                           recordLength;
+   double                        offset[3];
+   struct lvis_las_task        * tasks;
+   unsigned char              ** raw;         // per worker
+   unsigned char              ** canon;       // per worker
+   struct lvis_expand_point   ** points;      // per worker, lgw
+   // the join: the points of the tasks, in order, to the output
+   FILE                        * out;
+   struct lvis_las_bounds        bounds;
+   int64_t                       shots,npoints;
+   int                           errors;
+};
+
+void lvis_las_defaults(struct lvis_las_options * l)
+{
+   l->enabled = 0;
+}
+
+int lvis_las_parse_option(int argc, char * argv[], int i, struct lvis_las_options * l)
+{
+   if(strcmp(argv[i],"-las")==0)
+     {
+	l->enabled = 1;
+	return 1;
+     }
+   return 0;
+}
+
+static void lvis_las_put16(unsigned char * p, uint16_t v)
+{
+   p[0] = v & 0xFF;
+   p[1] = v >> 8;
+}
+
+static void lvis_las_put32(unsigned char * p, uint32_t v)
+{
+   int k;
+   for(k=0;k<4;k++) p[k] = (v >> (8*k)) & 0xFF;
+}
+
+static void lvis_las_put64(unsigned char * p, uint64_t v)
+{
+   int k;
+   for(k=0;k<8;k++) p[k] = (v >> (8*k)) & 0xFF;
+}
+
+static void lvis_las_putf32(unsigned char * p, float v)
+{
+   uint32_t u;
+   memcpy(&u,&v,sizeof(u));
+   lvis_las_put32(p,u);
+}
+
+static void lvis_las_putf64(unsigned char * p, double v)
+{
+   uint64_t u;
+   memcpy(&u,&v,sizeof(u));
+   lvis_las_put64(p,u);
+}
+
+// a fixed size text field, NUL padded (not terminated when full)
+static void lvis_las_putstr(unsigned char * p, const char * text, size_t size)
+{
+   size_t n = strlen(text);
+   memcpy(p,text,(n < size) ? n : size);
+}
+
+static int lvis_las_extra_size(int type)
+{
+   return (type == LVIS_LAS_USHORT) ? 2 : 4;
+}
+
+static void lvis_las_bounds_clear(struct lvis_las_bounds * b)
+{
+   int k;
+   for(k=0;k<3;k++) { b->min[k] = HUGE_VAL; b->max[k] = -HUGE_VAL; }
+}
+
+static void lvis_las_bounds_add(struct lvis_las_bounds * b, struct lvis_las_bounds * a)
+{
+   int k;
+   for(k=0;k<3;k++)
+     {
+	if(a->min[k] < b->min[k]) b->min[k] = a->min[k];
+	if(a->max[k] > b->max[k]) b->max[k] = a->max[k];
+     }
+}
+
+// encode one point at p, with the values of the job's extras in extra[]
+static void lvis_las_point(struct lvis_las_job * job, struct lvis_las_task * task, unsigned char * p,
+			   double lon, double lat, double z, double intensity, int classification,
+			   float incidentangle, double lvistime, float * extra)
+{
+   static const double scale[3] = { LVIS_LAS_SCALE_XY, LVIS_LAS_SCALE_XY, LVIS_LAS_SCALE_Z };
+   double              v[3],q;
+   int32_t             xyz[3];
+   int                 k,at;
+
+   v[0] = lon; v[1] = lat; v[2] = z;
+   for(k=0;k<3;k++)
+     {
+	q = floor((v[k] - job->offset[k]) / scale[k] + 0.5);
+	if(!(q == q)) q = 0.0;
+	if(q > 2147483647.0) q = 2147483647.0;
+	if(q < -2147483648.0) q = -2147483648.0;
+	xyz[k] = (int32_t) q;
+	// the bounds of what the file holds, not of the unrounded values
+	v[k] = xyz[k] * scale[k] + job->offset[k];
+	if(v[k] < task->bounds.min[k]) task->bounds.min[k] = v[k];
+	if(v[k] > task->bounds.max[k]) task->bounds.max[k] = v[k];
+	lvis_las_put32(p + 4*k,(uint32_t) xyz[k]);
+     }
+   if(!(intensity > 0.0)) intensity = 0.0;
+   if(intensity > 65535.0) intensity = 65535.0;
+   lvis_las_put16(p + 12,(uint16_t) floor(intensity + 0.5));
+   p[14] = 0x11;                    // return 1 of 1
+   p[15] = 0;                       // no flags, channel 0
+   p[16] = (unsigned char) classification;
+   p[17] = 0;                       // user data
+   q = (incidentangle == incidentangle) ? floor(incidentangle / 0.006 + 0.5) : 0.0;
+   if(q > 30000.0) q = 30000.0;
+   if(q < -30000.0) q = -30000.0;
+   lvis_las_put16(p + 18,(uint16_t) (int16_t) q);
+   lvis_las_put16(p + 20,0);        // point source
+   lvis_las_putf64(p + 22,(lvistime == lvistime) ? lvistime : 0.0);
+   for(at=LVIS_LAS_FORMAT_SIZE,k=0;k<job->nextras;k++)
+     {
+	if(job->extras[k].type == LVIS_LAS_USHORT) lvis_las_put16(p + at,(uint16_t) extra[k]);
+	else lvis_las_putf32(p + at,extra[k]);
+	at += lvis_las_extra_size(job->extras[k].type);
+     }
+}
+
+static void lvis_las_run(void * context, long t, int worker)
+{
+   struct lvis_las_job         * job = (struct lvis_las_job *) context;
+   struct lvis_las_task        * task = &job->tasks[t];
+   struct lvis_release_options * opt = job->opt;
+   struct lvis_expand_point    * pt = job->points[worker];
+   union lvis_canon_record     * rec;
+   unsigned char               * p;
+   double                        lon,lat;
+   float                         extra[LVIS_LAS_MAX_EXTRAS];
+   int64_t                       i,got,size;
+   int                           k,count;
+
+   size = (int64_t) job->recordLength * task->count;
+   if(job->fileType == LVIS_RELEASE_FILETYPE_LGW) size *= job->rxSamples[task->file];
+   if((task->buf = (unsigned char *) malloc(size > 0 ? size : 1))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the LAS output\n");
+	exit(-1);
+     }
+   task->points = 0;
+   lvis_las_bounds_clear(&task->bounds);
+   got = lvis_canon_read(&job->files[task->file],task->first,task->count,job->raw[worker],job->canon[worker]);
+   if(got != task->count) task->status = -1;
+   for(i=0;i<got;i++)
+     {
+	rec = (union lvis_canon_record *) (job->canon[worker] + i * lvis_record_size(job->fileType,(float)1.04));
+	release_data_position((unsigned char *) rec,job->fileType,(float)1.04,&lon,&lat);
+	if(!lvis_release_keep(opt,lon,lat)) continue;
+	p = task->buf + task->points * job->recordLength;
+	if(job->fileType == LVIS_RELEASE_FILETYPE_LCE)
+	  {
+	     extra[0] = rec->lce.azimuth;
+	     extra[1] = rec->lce.incidentangle;
+	     extra[2] = rec->lce.range;
+	     lvis_las_point(job,task,p,rec->lce.tlon,rec->lce.tlat,rec->lce.zt,0.0,LVIS_LAS_UNCLASSIFIED,
+			    rec->lce.incidentangle,rec->lce.lvistime,extra);
+	     task->points++;
+	  }
+	if(job->fileType == LVIS_RELEASE_FILETYPE_LGE)
+	  {
+	     extra[0] = rec->lge.rh25;
+	     extra[1] = rec->lge.rh50;
+	     extra[2] = rec->lge.rh75;
+	     extra[3] = rec->lge.rh100;
+	     extra[4] = rec->lge.azimuth;
+	     extra[5] = rec->lge.incidentangle;
+	     extra[6] = rec->lge.range;
+	     lvis_las_point(job,task,p,rec->lge.glon,rec->lge.glat,rec->lge.zg,0.0,LVIS_LAS_GROUND,
+			    rec->lge.incidentangle,rec->lge.lvistime,extra);
+	     task->points++;
+	  }
+	if(job->fileType == LVIS_RELEASE_FILETYPE_LGW)
+	  {
+	     count = lvis_expand_shot(&rec->lgw,job->rxSamples[task->file],job->x->threshold,job->x->scalar,pt);
+	     extra[2] = rec->lgw.sigmean;
+	     extra[3] = rec->lgw.azimuth;
+	     extra[4] = rec->lgw.incidentangle;
+	     extra[5] = rec->lgw.range;
+	     for(k=0;k<count;k++)
+	       {
+		  extra[0] = pt[k].amplitude;
+		  extra[1] = pt[k].sample;
+		  lvis_las_point(job,task,p,pt[k].lon,pt[k].lat,pt[k].z,pt[k].amplitude,LVIS_LAS_UNCLASSIFIED,
+				 rec->lgw.incidentangle,rec->lgw.lvistime,extra);
+		  p += job->recordLength;
+		  task->points++;
+	       }
+	  }
+     }
+}
+
+// the public header block, with the totals known so far
+static void lvis_las_header(struct lvis_las_job * job, unsigned char * h, uint32_t offsetToPoints,
+			    uint64_t points, struct lvis_las_bounds * b)
+{
+   time_t      now = time(NULL);
+   struct tm * utc = gmtime(&now);
+   int         k;
+
+   memset(h,0,LVIS_LAS_HEADER_SIZE);
+   memcpy(h,"LASF",4);
+   lvis_las_put16(h + 6,0x10);                 // global encoding: the CRS is WKT
+   h[24] = 1;                                  // version 1.4
+   h[25] = 4;
+   lvis_las_putstr(h + 26,"EXTRACTION",32);
+   lvis_las_putstr(h + 58,"lvis_release_reader",32);
+   lvis_las_put16(h + 90,(uint16_t) (utc != NULL ? utc->tm_yday + 1 : 0));
+   lvis_las_put16(h + 92,(uint16_t) (utc != NULL ? utc->tm_year + 1900 : 0));
+   lvis_las_put16(h + 94,LVIS_LAS_HEADER_SIZE);
+   lvis_las_put32(h + 96,offsetToPoints);
+   lvis_las_put32(h + 100,2);                  // WKT and Extra Bytes VLRs
+   h[104] = LVIS_LAS_FORMAT;
+   lvis_las_put16(h + 105,(uint16_t) job->recordLength);
+   // the legacy counts (107 .. 130) stay 0 for format 6
+   lvis_las_putf64(h + 131,LVIS_LAS_SCALE_XY);
+   lvis_las_putf64(h + 139,LVIS_LAS_SCALE_XY);
+   lvis_las_putf64(h + 147,LVIS_LAS_SCALE_Z);
+   for(k=0;k<3;k++) lvis_las_putf64(h + 155 + 8*k,job->offset[k]);
+   for(k=0;k<3;k++)
+     {
+	lvis_las_putf64(h + 179 + 16*k,(points > 0) ? b->max[k] : 0.0);
+	lvis_las_putf64(h + 187 + 16*k,(points > 0) ? b->min[k] : 0.0);
+     }
+   // no waveform packets (227), no EVLRs (235, 243)
+   lvis_las_put64(h + 247,points);
+   lvis_las_put64(h + 255,points);             // all of them return 1
+}
+
+static void lvis_las_vlr(unsigned char * v, char * user, uint16_t record, uint16_t length, char * description)
+{
+   memset(v,0,LVIS_LAS_VLR_SIZE);
+   lvis_las_putstr(v + 2,user,16);
+   lvis_las_put16(v + 18,record);
+   lvis_las_put16(v + 20,length);
+   lvis_las_putstr(v + 22,description,32);
+}
+
+static int lvis_las_input(void * context, long t)
+{
+   return ((struct lvis_las_job *) context)->tasks[t].file;
+}
+
+// the points of a task to the output, in input order
+static void lvis_las_join(void * context, long t)
+{
+   struct lvis_las_job  * job = (struct lvis_las_job *) context;
+   struct lvis_las_task * task = &job->tasks[t];
+
+   if(task->status != 0)
+     {
+	fprintf(stderr,"Short read in %s at record %lld\n",job->files[task->file].filename,(long long) task->first);
+	job->errors++;
+     }
+   if(task->points > 0 && fwrite(task->buf,job->recordLength,task->points,job->out) != (size_t) task->points)
+     {
+	fprintf(stderr,"Error writing the output file: %s (%s)\n",job->opt->outfile,strerror(errno));
+	exit(-1);
+     }
+   if(task->points > 0) lvis_las_bounds_add(&job->bounds,&task->bounds);
+   job->npoints += task->points;
+   job->shots += task->count;
+   free(task->buf);
+   task->buf = NULL;
+}
+
+int lvis_las_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		     struct lvis_batch_options * b, struct lvis_las_options * l,
+		     struct lvis_expand_options * x)
+{
+   struct lvis_las_job     job;
+   struct lvis_pool      * pool;
+   unsigned char           header[LVIS_LAS_HEADER_SIZE],vlr[LVIS_LAS_VLR_SIZE],extra[LVIS_LAS_EXTRA_SIZE];
+   unsigned char         * first_record;
+   FILE                  * out;
+   long                    ntasks=0,maxtasks=0;
+   int64_t                 n,first,chunk;
+   uint32_t                offsetToPoints;
+   float                   version;
+   double                  lon,lat;
+   int                     k,threads,wktLength,errors=0;
+
+   if(opt->outfile[0] == 0)
+     {
+	fprintf(stderr,"-las writes a binary file, give it with -o\n");
+	return 1;
+     }
+   memset(&job,0,sizeof(job));
+   job.opt = opt;
+   job.x = x;
+   job.fileType = -1;
+   job.files = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file));
+   job.rxSamples = (int *) calloc(ninputs,sizeof(int));
+   if(job.files == NULL || job.rxSamples == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     {
+	if(lvis_file_open(&job.files[k],inputs[k],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	lvis_file_close(&job.files[k]);
+	if(job.fileType < 0) job.fileType = job.files[k].fileType;
+	if(job.files[k].fileType != job.fileType)
+	  {
+	     fprintf(stderr,"%s is an %s file, the other inputs are %s: one LAS file holds one type\n",inputs[k],
+		     lvis_file_type_name(job.files[k].fileType),lvis_file_type_name(job.fileType));
+	     errors++;
+	     continue;
+	  }
+	version = job.files[k].canonical ? job.files[k].sourceVersion : job.files[k].fileVersion;
+	job.rxSamples[k] = job.files[k].canonical ? job.files[k].rxSamples : ((version == ((float)1.04)) ? 528 : 432);
+	n = job.files[k].recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+	job.files[k].recordCount = n;
+     }
+   if(errors > 0)
+     {
+	free(job.files);
+	free(job.rxSamples);
+	return errors;
+     }
+
+   job.extras = lvis_las_lce_extras;
+   if(job.fileType == LVIS_RELEASE_FILETYPE_LGE) job.extras = lvis_las_lge_extras;
+   if(job.fileType == LVIS_RELEASE_FILETYPE_LGW) job.extras = lvis_las_lgw_extras;
+   job.recordLength = LVIS_LAS_FORMAT_SIZE;
+   for(job.nextras=0;job.extras[job.nextras].name!=NULL;job.nextras++)
+     job.recordLength += lvis_las_extra_size(job.extras[job.nextras].type);
+
+   chunk = (job.fileType == LVIS_RELEASE_FILETYPE_LGW) ? LVIS_EXPAND_CHUNK : LVIS_LAS_CHUNK;
+   for(k=0;k<ninputs;k++) maxtasks += (long) ((job.files[k].recordCount + chunk - 1) / chunk);
+   job.tasks = (struct lvis_las_task *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_las_task));
+   if(job.tasks == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the task table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     for(first=0;first<job.files[k].recordCount;first+=chunk)
+       {
+	  job.tasks[ntasks].file  = k;
+	  job.tasks[ntasks].first = first;
+	  job.tasks[ntasks].count = (job.files[k].recordCount - first < chunk) ? job.files[k].recordCount - first : chunk;
+	  ntasks++;
+       }
+
+   pool = lvis_pool_create(b->nthreads);
+   threads = lvis_pool_threads(pool);
+   lvis_batch_buffers(threads,chunk,sizeof(union lvis_canon_record),&job.raw,&job.canon);
+   job.points = (struct lvis_expand_point **) calloc(threads,sizeof(struct lvis_expand_point *));
+   if(job.points == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the LAS buffers\n");
+	exit(-1);
+     }
+   for(k=0;k<threads;k++)
+     {
+	job.points[k] = (struct lvis_expand_point *) malloc(528 * sizeof(struct lvis_expand_point));
+	if(job.points[k] == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the LAS buffers\n");
+	     exit(-1);
+	  }
+     }
+
+   // the offsets have to be known before any point is encoded: the tens
+   // of degrees of the first shot, so every shot of a flight fits 32 bits
+   for(k=0;k<ninputs && job.files[k].recordCount == 0;k++);
+   if(k < ninputs)
+     {
+	lvis_file_reopen(&job.files[k]);
+	first_record = job.canon[0];
+	if(lvis_canon_read(&job.files[k],0,1,job.raw[0],first_record) == 1)
+	  {
+	     release_data_position(first_record,job.fileType,(float)1.04,&lon,&lat);
+	     if(lon == lon) job.offset[0] = 10.0 * floor(lon / 10.0);
+	     if(lat == lat) job.offset[1] = 10.0 * floor(lat / 10.0);
+	  }
+	lvis_file_close(&job.files[k]);
+     }
+
+   if((out = fopen(opt->outfile,"wb"))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	exit(-1);
+     }
+   wktLength = strlen(LVIS_LAS_WKT) + 1;
+   offsetToPoints = LVIS_LAS_HEADER_SIZE + 2 * LVIS_LAS_VLR_SIZE + wktLength + job.nextras * LVIS_LAS_EXTRA_SIZE;
+   lvis_las_bounds_clear(&job.bounds);
+   lvis_las_header(&job,header,offsetToPoints,0,&job.bounds);
+   errors += (fwrite(header,LVIS_LAS_HEADER_SIZE,1,out) != 1);
+   lvis_las_vlr(vlr,"LASF_Projection",2112,(uint16_t) wktLength,"OGC coordinate system WKT");
+   errors += (fwrite(vlr,LVIS_LAS_VLR_SIZE,1,out) != 1);
+   errors += (fwrite(LVIS_LAS_WKT,wktLength,1,out) != 1);
+   lvis_las_vlr(vlr,"LASF_Spec",4,(uint16_t) (job.nextras * LVIS_LAS_EXTRA_SIZE),"LVIS fields");
+   errors += (fwrite(vlr,LVIS_LAS_VLR_SIZE,1,out) != 1);
+   for(k=0;k<job.nextras;k++)
+     {
+	memset(extra,0,sizeof(extra));
+	extra[2] = (unsigned char) job.extras[k].type;
+	lvis_las_putstr(extra + 4,job.extras[k].name,32);
+	lvis_las_putstr(extra + 160,job.extras[k].description,32);
+	errors += (fwrite(extra,LVIS_LAS_EXTRA_SIZE,1,out) != 1);
+     }
+   if(errors > 0)
+     {
+	fprintf(stderr,"Error writing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	exit(-1);
+     }
+
+   // run the waves, writing wave N while wave N+1 is worked on
+   job.out = out;
+   lvis_batch_waves(pool,0,ntasks,job.files,lvis_las_input,lvis_las_run,lvis_las_join,&job);
+   errors += job.errors;
+   lvis_pool_destroy(pool);
+
+   // the counts and bounds are only known now
+   lvis_las_header(&job,header,offsetToPoints,(uint64_t) job.npoints,&job.bounds);
+   if(fseek(out,0,SEEK_SET)!=0 || fwrite(header,LVIS_LAS_HEADER_SIZE,1,out)!=1)
+     {
+	fprintf(stderr,"Error writing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	errors++;
+     }
+   if(fclose(out)!=0)
+     {
+	fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	errors++;
+     }
+   fprintf(stderr,"las: %lld shots, %lld points (%s, format %d, %d byte records)\n",(long long) job.shots,
+	   (long long) job.npoints,lvis_file_type_name(job.fileType),LVIS_LAS_FORMAT,job.recordLength);
+
+   lvis_batch_free_buffers(threads,job.raw,job.canon);
+   for(k=0;k<threads;k++) free(job.points[k]);
+   free(job.points);
+   free(job.tasks);
+   free(job.files);
+   free(job.rxSamples);
+   return errors;
+}
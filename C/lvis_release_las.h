@@ -0,0 +1,60 @@
+#ifndef __LVIS_RELEASE_LAS_H
+#define __LVIS_RELEASE_LAS_H
+
+// lvis_release_las.h
+//
+// -las: write the inputs as one LAS 1.4 file (point data record format 6)
+// instead of text, for GIS and point cloud tools.  LCE shots become their
+// highest return (tlon, tlat, zt), LGE shots their ground (glon, glat, zg,
+// classified ground), and LGW shots the per sample points of the expand
+// mode (amplitude as intensity).  Fields that do not fit format 6 go into
+// extra bytes described by an Extra Bytes VLR:
+//   LCE  azimuth, incidentangle, range
+//   LGE  rh25, rh50, rh75, rh100, azimuth, incidentangle, range
+//   LGW  amplitude, sample, sigmean, azimuth, incidentangle, range
+// The coordinates are geographic (WGS 84, lon east as in the releases,
+// described by an OGC WKT VLR), stored as integers of 1e-7 degree and
+// 1 mm, offset from the tens of degrees of the first shot.  GPS time is
+// lvistime.
+//
+// The file is written in one pass: the header goes out with empty counts
+// and bounds, the points are encoded a chunk of shots at a time on the
+// pool (each chunk with its own bounds) and written in input order, and
+// the header is rewritten at the end with the totals.
+
+#include <stdint.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#define LVIS_LAS_HEADER_SIZE   375
+#define LVIS_LAS_VLR_SIZE      54
+#define LVIS_LAS_EXTRA_SIZE    192      // one Extra Bytes descriptor
+#define LVIS_LAS_FORMAT        6
+#define LVIS_LAS_FORMAT_SIZE   30       // format 6 without extra bytes
+#define LVIS_LAS_SCALE_XY      1e-7     // degrees
+#define LVIS_LAS_SCALE_Z       0.001    // m
+
+#ifndef  LVIS_LAS_CHUNK
+#define  LVIS_LAS_CHUNK 1024            // LCE / LGE shots per task (LGW: LVIS_EXPAND_CHUNK)
+#endif
+
+struct lvis_las_options
+{
+   int enabled;          // -las
+};
+
+void lvis_las_defaults(struct lvis_las_options * l);
+
+// handle the LAS options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a LAS option)
+int  lvis_las_parse_option(int argc, char * argv[], int i, struct lvis_las_options * l);
+
+// write the inputs (all of one type) to the LAS file opt->outfile, LGW
+// samples kept by the expand options.  returns 0 on success
+struct lvis_batch_options;
+struct lvis_expand_options;
+int  lvis_las_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		      struct lvis_batch_options * b, struct lvis_las_options * l,
+		      struct lvis_expand_options * x);
+
+#endif
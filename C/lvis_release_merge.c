@@ -0,0 +1,366 @@
+// lvis_release_merge.c
+//
+// Ordered k-way merge of sorted inputs (see lvis_release_merge.h).
+//
+// Each input is mapped and walked front to back; the pages behind the
+// cursor are handed back to the kernel as we go, so even hundreds of large
+// inputs only keep a few megabytes each resident.  The current record of
+// every input is kept swapped (and in canonical form) next to its key; a
+// binary heap of the inputs picks the smallest key, ties going to the
+// input given first so the output is deterministic.
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_merge.h"
+
+#ifndef  LVIS_MERGE_RELEASE_BYTES
+#define  LVIS_MERGE_RELEASE_BYTES (8 * 1024 * 1024) // drop consumed pages this often
+#endif
+
+#ifndef  LVIS_MERGE_BUFFER_BYTES
+#define  LVIS_MERGE_BUFFER_BYTES (1024 * 1024)      // stdio buffer of the outputs
+#endif
+
+struct lvis_merge_input
+{
+   struct lvis_release_file f;
+   int64_t                  next;      // next record to load
+   int64_t                  count;     // records of this input to merge (-n)
+   int64_t                  released;  // pages before this record were dropped
+   double                   time;      // key of the current record
+   uint64_t                 id;
+   int                      warned;    // already said this input is out of order
+   unsigned char          * raw;       // current record, as in the file
+   unsigned char            host[LVIS_MAX_RECORD_SIZE];  // ... in host order
+   union lvis_canon_record  canon;     // ... in canonical form
+};
+
+void lvis_merge_defaults(struct lvis_merge_options * m)
+{
+   m->key = LVIS_MERGE_KEY_TIME;
+   m->format = LVIS_MERGE_FORMAT_TEXT;
+}
+
+int lvis_merge_parse_option(int argc, char * argv[], int i, struct lvis_merge_options * m)
+{
+   if(strcmp(argv[i],"-key")==0 && i+1<argc)
+     {
+	if(strcmp(argv[i+1],"time")==0) m->key = LVIS_MERGE_KEY_TIME;
+	else if(strcmp(argv[i+1],"shot")==0) m->key = LVIS_MERGE_KEY_SHOT;
+	else
+	  {
+	     fprintf(stderr,"Invalid argument to -key (expected time or shot)\n");
+	     exit(-1);
+	  }
+	return 2;
+     }
+   if(strcmp(argv[i],"-format")==0 && i+1<argc)
+     {
+	if(strcmp(argv[i+1],"text")==0) m->format = LVIS_MERGE_FORMAT_TEXT;
+	else if(strcmp(argv[i+1],"binary")==0) m->format = LVIS_MERGE_FORMAT_BINARY;
+	else if(strcmp(argv[i+1],"columns")==0) m->format = LVIS_MERGE_FORMAT_COLUMNS;
+	else
+	  {
+	     fprintf(stderr,"Invalid argument to -format (expected text, binary or columns)\n");
+	     exit(-1);
+	  }
+	return 2;
+     }
+   return 0;
+}
+
+// is input a before input b?
+static int lvis_merge_before(struct lvis_merge_input * inputs, int a, int b, int key)
+{
+   if(key == LVIS_MERGE_KEY_TIME)
+     {
+	if(inputs[a].time != inputs[b].time) return inputs[a].time < inputs[b].time;
+     }
+   else
+     {
+	if(inputs[a].id != inputs[b].id) return inputs[a].id < inputs[b].id;
+     }
+   return a < b;
+}
+
+static void lvis_merge_down(struct lvis_merge_input * inputs, int * heap, int n, int k, int key)
+{
+   int child,top = heap[k];
+
+   while((child = 2*k+1) < n)
+     {
+	if(child+1 < n && lvis_merge_before(inputs,heap[child+1],heap[child],key)) child++;
+	if(!lvis_merge_before(inputs,heap[child],top,key)) break;
+	heap[k] = heap[child];
+	k = child;
+     }
+   heap[k] = top;
+}
+
+// make the next record of input c current, returns 0 when it has no more
+static int lvis_merge_load(struct lvis_merge_input * c, int key)
+{
+   struct lvis_release_file * f = &c->f;
+   double                     time;
+   uint64_t                   id;
+
+   if(c->next >= c->count) return 0;
+   c->raw = lvis_file_record(f,c->next);
+   memcpy(c->host,c->raw,f->recordSize);
+   swap_release_data(c->host,f->fileType,f->fileVersion,f->myendian);
+   lvis_canon_from_release(c->host,f->fileType,f->fileVersion,&c->canon);
+
+   // the three v1.04 records start alike, the key fields sit at the same place
+   time = c->canon.lce.lvistime;
+   id   = ((uint64_t) c->canon.lce.lfid << 32) | c->canon.lce.shotnumber;
+   if(c->next > 0 && !c->warned &&
+      ((key == LVIS_MERGE_KEY_TIME && time < c->time) || (key == LVIS_MERGE_KEY_SHOT && id < c->id)))
+     {
+	fprintf(stderr,"Warning: %s is out of order at record %lld, the merged output will be too\n",
+		f->filename,(long long) c->next);
+	c->warned = 1;
+     }
+   c->time = time;
+   c->id = id;
+
+   c->next++;
+   if((c->next - c->released) * f->recordSize >= LVIS_MERGE_RELEASE_BYTES)
+     {
+	lvis_file_release(f,c->next-1);
+	c->released = c->next-1;
+     }
+   return 1;
+}
+
+static FILE * lvis_merge_open(char * name, char * mode)
+{
+   FILE * fp;
+
+   if((fp = fopen(name,mode))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",name,strerror(errno));
+	exit(-1);
+     }
+   setvbuf(fp,NULL,_IOFBF,LVIS_MERGE_BUFFER_BYTES);
+   return fp;
+}
+
+int lvis_merge_sorted(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		      struct lvis_merge_options * m)
+{
+   struct lvis_merge_input  * in;
+   struct lvis_canon_column  * columns=NULL;
+   struct lvis_canon_header   hdr,each;
+   FILE                     * out=NULL,** colfp=NULL;
+   char                       name[4096];
+   int                      * heap;
+   int                        i,n=0,k,fileType=-1,sameVersion=1,rawOK=1,errors=0,ncolumns=0;
+   float                      version,lowest=(float)9.99;
+   double                     lon,lat;
+   unsigned int               colnum=1;
+   int64_t                    written=0;
+
+   memset(&hdr,0,sizeof(hdr));
+   if(m->format != LVIS_MERGE_FORMAT_TEXT && opt->outfile[0] == 0)
+     {
+	fprintf(stderr,"merge -format binary / columns needs an output (-o)\n");
+	return -1;
+     }
+   in   = (struct lvis_merge_input *) calloc(ninputs,sizeof(struct lvis_merge_input));
+   heap = (int *) calloc(ninputs,sizeof(int));
+   if(in == NULL || heap == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the merge inputs\n");
+	exit(-1);
+     }
+
+   // open and map everything first, so a bad input stops us before any output
+   for(i=0;i<ninputs;i++)
+     {
+	if(lvis_file_open(&in[i].f,inputs[i],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	version = in[i].f.canonical ? in[i].f.sourceVersion : in[i].f.fileVersion;
+	if(fileType >= 0 && in[i].f.fileType != fileType)
+	  {
+	     fprintf(stderr,"Cannot merge %s (%s) with %s files\n",in[i].f.filename,
+		     lvis_file_type_name(in[i].f.fileType),lvis_file_type_name(fileType));
+	     errors++;
+	  }
+	if((m->key == LVIS_MERGE_KEY_TIME && version < (float)1.02) ||
+	   (m->key == LVIS_MERGE_KEY_SHOT && version < (float)1.01))
+	  {
+	     fprintf(stderr,"%s (release %4.2f) has no %s to merge on\n",in[i].f.filename,version,
+		     m->key == LVIS_MERGE_KEY_TIME ? "lvistime" : "lfid / shotnumber");
+	     errors++;
+	  }
+	if(n > 0 && in[i].f.fileVersion != in[0].f.fileVersion) sameVersion = 0;
+	if(in[i].f.canonical || (n > 0 && (in[i].f.fileVersion != in[0].f.fileVersion ||
+					    in[i].f.myendian != in[0].f.myendian))) rawOK = 0;
+	if(version < lowest) lowest = version;
+	fileType = in[i].f.fileType;
+
+	in[i].count = in[i].f.recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < in[i].count) in[i].count = opt->maxSampleNumber;
+	if(in[i].count > 0 && lvis_file_map(&in[i].f)!=0) { errors++; continue; }
+	lvis_file_close(&in[i].f);  // the map is enough, keep hundreds of inputs under the fd limit
+	n++;
+     }
+   // one canonical header describes every record of a binary output: the
+   // waveforms must agree in length, a 432 sample record read as 528 would
+   // be misplaced
+   if(errors == 0 && n > 0 && m->format == LVIS_MERGE_FORMAT_BINARY && !rawOK)
+     {
+	for(i=0;i<ninputs;i++)
+	  {
+	     lvis_canon_make_header(&each,fileType,in[i].f.canonical ? in[i].f.sourceVersion : in[i].f.fileVersion,0);
+	     if(in[i].f.canonical) { each.txSamples = in[i].f.txSamples; each.rxSamples = in[i].f.rxSamples; }
+	     if(i == 0) hdr = each;
+	     else if(each.txSamples != hdr.txSamples || each.rxSamples != hdr.rxSamples)
+	       {
+		  fprintf(stderr,"%s (%u tx / %u rx samples) and %s (%u / %u) cannot be merged into one binary file\n",
+			  in[0].f.filename,hdr.txSamples,hdr.rxSamples,in[i].f.filename,each.txSamples,each.rxSamples);
+		  errors++;
+		  break;
+	       }
+	  }
+	each = hdr;
+	lvis_canon_make_header(&hdr,fileType,lowest,0);
+	hdr.txSamples = each.txSamples;
+	hdr.rxSamples = each.rxSamples;
+     }
+   if(errors > 0 || n == 0)
+     {
+	for(i=0;i<ninputs;i++) lvis_file_unmap(&in[i].f);
+	free(in);
+	free(heap);
+	return -1;
+     }
+
+   // the outputs
+   if(m->format == LVIS_MERGE_FORMAT_TEXT)
+     {
+	out = (opt->outfile[0] != 0) ? lvis_merge_open(opt->outfile,"w") : stdout;
+	if(out == stdout) setvbuf(out,NULL,_IOFBF,LVIS_MERGE_BUFFER_BYTES);
+	if(opt->topcol == 1)
+	  print_release_column_headers(out,fileType,sameVersion ? in[0].f.fileVersion : (float)1.04,
+				       opt->indexcol,opt->delim);
+     }
+   if(m->format == LVIS_MERGE_FORMAT_BINARY)
+     {
+	out = lvis_merge_open(opt->outfile,"wb");
+	// one release version in one byte order is copied as it is, anything
+	// else becomes one canonical file (its count is filled in at the end)
+	if(!rawOK) fwrite(&hdr,sizeof(hdr),1,out);
+     }
+   if(m->format == LVIS_MERGE_FORMAT_COLUMNS)
+     {
+	if(mkdir(opt->outfile,0755)!=0 && errno != EEXIST)
+	  {
+	     fprintf(stderr,"Error creating the output directory: %s (%s)\n",opt->outfile,strerror(errno));
+	     exit(-1);
+	  }
+	columns = lvis_canon_columns(fileType);
+	while(columns[ncolumns].name != NULL) ncolumns++;
+	colfp = (FILE **) calloc(ncolumns,sizeof(FILE *));
+	if(colfp == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the column outputs\n");
+	     exit(-1);
+	  }
+	for(k=0;k<ncolumns;k++)
+	  {
+	     snprintf(name,sizeof(name),"%s/%s.bin",opt->outfile,columns[k].name);
+	     colfp[k] = lvis_merge_open(name,"wb");
+	  }
+     }
+
+   // prime the heap with the first record of every input
+   n = 0;
+   for(i=0;i<ninputs;i++)
+     if(lvis_merge_load(&in[i],m->key)) heap[n++] = i;
+   for(k=n/2-1;k>=0;k--) lvis_merge_down(in,heap,n,k,m->key);
+
+   while(n > 0)
+     {
+	struct lvis_merge_input * c = &in[heap[0]];
+
+	release_data_position(c->host,fileType,c->f.fileVersion,&lon,&lat);
+	if(m->format == LVIS_MERGE_FORMAT_TEXT)
+	  {
+	     // print_release_data cuts on -lat / -lon itself
+	     if(!lvis_poly_contains(opt->poly,lon,lat)) colnum++;
+	     else if(sameVersion)
+	       print_release_data(out,c->host,fileType,c->f.fileVersion,opt->indexcol,colnum++,opt->delim,
+				  opt->minlat,opt->maxlat,opt->minlon,opt->maxlon);
+	     else
+	       print_release_data(out,(unsigned char *) &c->canon,fileType,(float)1.04,opt->indexcol,colnum++,
+				  opt->delim,opt->minlat,opt->maxlat,opt->minlon,opt->maxlon);
+	  }
+	else if(lvis_release_keep(opt,lon,lat))
+	  {
+	     if(m->format == LVIS_MERGE_FORMAT_BINARY)
+	       {
+		  if(rawOK) fwrite(c->raw,c->f.recordSize,1,out);
+		  else fwrite(&c->canon,hdr.recordSize,1,out);
+	       }
+	     else
+	       for(k=0;k<ncolumns;k++)
+		 fwrite(((unsigned char *) &c->canon)+columns[k].offset,columns[k].size,1,colfp[k]);
+	     written++;
+	  }
+
+	// next record of the same input, or drop the input from the heap
+	if(!lvis_merge_load(c,m->key)) heap[0] = heap[--n];
+	if(n > 0) lvis_merge_down(in,heap,n,0,m->key);
+     }
+
+   if(m->format == LVIS_MERGE_FORMAT_BINARY && !rawOK)
+     {
+	hdr.recordCount = (uint64_t) written;
+	if(fseek(out,0,SEEK_SET)!=0 || fwrite(&hdr,sizeof(hdr),1,out)!=1)
+	  {
+	     fprintf(stderr,"Error writing the merge header: %s\n",strerror(errno));
+	     errors++;
+	  }
+     }
+   if(m->format == LVIS_MERGE_FORMAT_COLUMNS)
+     {
+	for(k=0;k<ncolumns;k++)
+	  if(fclose(colfp[k])!=0)
+	    {
+	       fprintf(stderr,"Error closing the column output %s (%s)\n",columns[k].name,strerror(errno));
+	       errors++;
+	    }
+	free(colfp);
+	// describe the columns so they can be read without this program
+	snprintf(name,sizeof(name),"%s/columns.txt",opt->outfile);
+	out = lvis_merge_open(name,"w");
+	fprintf(out,"# lvis_release_reader columns\n");
+	fprintf(out,"type %s\n",lvis_file_type_name(fileType));
+	fprintf(out,"byteorder %s\n",host_endian() == GENLIB_BIG_ENDIAN ? "big" : "little");
+	fprintf(out,"records %lld\n",(long long) written);
+	for(k=0;k<ncolumns;k++)
+	  fprintf(out,"column %s %s %s.bin\n",columns[k].name,columns[k].type,columns[k].name);
+     }
+   if(out != NULL && out != stdout && fclose(out)!=0)
+     {
+	fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	errors++;
+     }
+   if(out == stdout) fflush(stdout);
+
+   for(i=0;i<ninputs;i++) lvis_file_unmap(&in[i].f);
+   free(in);
+   free(heap);
+   return errors;
+}
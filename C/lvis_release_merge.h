@@ -0,0 +1,38 @@
+#ifndef __LVIS_RELEASE_MERGE_H
+#define __LVIS_RELEASE_MERGE_H
+
+// lvis_release_merge.h
+//
+// Ordered merge: inputs that are each already in time order (or lfid +
+// shotnumber order) are k-way merged into one ordered stream.  Every input
+// is memory mapped and read front to back, the next record of each input
+// sits in a binary heap, so memory stays bounded by the number of inputs
+// no matter how big they are.  The merged stream is written as text, as a
+// binary release file or as one column file per field.
+
+#include "lvis_release_reader.h"
+
+#define LVIS_MERGE_KEY_TIME    0   // -key time: lvistime
+#define LVIS_MERGE_KEY_SHOT    1   // -key shot: lfid, then shotnumber
+
+#define LVIS_MERGE_FORMAT_TEXT    0   // -format text (default, to stdout or -o)
+#define LVIS_MERGE_FORMAT_BINARY  1   // -format binary (to -o)
+#define LVIS_MERGE_FORMAT_COLUMNS 2   // -format columns (into the directory -o)
+
+struct lvis_merge_options
+{
+   int key;      // LVIS_MERGE_KEY_xxx
+   int format;   // LVIS_MERGE_FORMAT_xxx
+};
+
+void lvis_merge_defaults(struct lvis_merge_options * m);
+
+// handle the merge options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a merge option)
+int  lvis_merge_parse_option(int argc, char * argv[], int i, struct lvis_merge_options * m);
+
+// merge the (individually sorted) inputs, returns 0 on success
+int  lvis_merge_sorted(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		       struct lvis_merge_options * m);
+
+#endif
@@ -0,0 +1,492 @@
+// lvis_release_metrics.c
+//
+// LGE records from LGW waveforms (metrics mode), see lvis_release_metrics.h.
+//
+// The inputs are split into tasks of LVIS_METRICS_CHUNK shots which the
+// pool reads (as canonical records) and reduces to LGE records in memory.
+// Like the batch converter the tasks run in waves of a few per thread, the
+// calling thread writing wave N while wave N+1 is worked on, so the output
+// is in input order and memory stays bounded.
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_features.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_metrics.h"
+
+#define LVIS_METRICS_EMPTY UINT64_MAX   // free slot (no v1.01+ shot has both ids all ones)
+
+struct lvis_metrics_task
+{
+   int                     file;
+   int64_t                 first,count;
+   struct lvis_lge_v1_04 * lge;      // the shots with a signal, in order
+   int64_t                 kept;
+   int                     status;   // 0, -1 on a read error
+};
+
+// one shot of the -validate product, zg and rh25 .. rh100
+struct lvis_metrics_check
+{
+   uint64_t key;   // lfid, shotnumber; LVIS_METRICS_EMPTY = free slot
+   float    v[5];
+};
+
+struct lvis_metrics_validation
+{
+   struct lvis_metrics_check * slots;
+   uint64_t                    mask;     // slots - 1 (a power of two)
+   int64_t                     shots,matched;
+   double                      sum[5],sumsq[5];
+};
+
+struct lvis_metrics_job
+{
+   struct lvis_release_options * opt;
+   struct lvis_metrics_options * m;
+   struct lvis_release_file    * files;
+   int                         * rxSamples;   // valid rxwave samples per input
+   struct lvis_metrics_task    * tasks;
+   unsigned char              ** raw;         // per worker
+   unsigned char              ** canon;       // per worker
+   float                         kernel[2*LVIS_METRICS_MAX_RADIUS+1];
+   int                           radius;
+   // the join: the records of the tasks, in order, to the output
+   FILE                        * out;
+   int                           binary;
+   unsigned int                  colnum;
+   int64_t                       shots,records;
+   struct lvis_metrics_validation * check;    // -validate (NULL = none)
+   int                           errors;
+};
+
+void lvis_metrics_defaults(struct lvis_metrics_options * m)
+{
+   memset(m,0,sizeof(struct lvis_metrics_options));
+   m->smooth = LVIS_METRICS_SMOOTH;
+   m->threshold = LVIS_FEATURES_THRESHOLD;
+}
+
+int lvis_metrics_parse_option(int argc, char * argv[], int i, struct lvis_metrics_options * m)
+{
+   if(strcmp(argv[i],"-smooth")==0 && i+1<argc)
+     {
+	m->smooth = atof(argv[i+1]);
+	if(m->smooth < 0.0) m->smooth = 0.0;
+	return 2;
+     }
+   if(strcmp(argv[i],"-validate")==0 && i+1<argc)
+     {
+	strncpy(m->validate,argv[i+1],sizeof(m->validate)-1);
+	return 2;
+     }
+   return 0;
+}
+
+// splitmix64 finaliser, spreads consecutive shot numbers over the table
+static uint64_t lvis_metrics_hash(uint64_t key)
+{
+   key ^= key >> 30; key *= 0xbf58476d1ce4e5b9ULL;
+   key ^= key >> 27; key *= 0x94d049bb133111ebULL;
+   key ^= key >> 31;
+   return key;
+}
+
+static struct lvis_metrics_check * lvis_metrics_slot(struct lvis_metrics_validation * v, uint64_t key)
+{
+   uint64_t i;
+
+   for(i=lvis_metrics_hash(key) & v->mask; v->slots[i].key != LVIS_METRICS_EMPTY && v->slots[i].key != key;
+       i=(i+1) & v->mask);
+   return &v->slots[i];
+}
+
+// the shots of the -validate product into the hash, returns 0 on success
+static int lvis_metrics_validation_load(struct lvis_metrics_validation * v, struct lvis_release_options * opt,
+					char * filename)
+{
+   struct lvis_release_file    f;
+   struct lvis_metrics_check * c;
+   struct lvis_lge_v1_04     * lge;
+   unsigned char             * raw,* canon;
+   uint64_t                    size=1024,key;
+   int64_t                     first,got,i;
+
+   if(lvis_file_open(&f,filename,-1,-1.0,opt->myendian)!=0) return 1;
+   if(f.fileType != LVIS_RELEASE_FILETYPE_LGE)
+     {
+	fprintf(stderr,"%s is not an LGE file, -validate compares the derived LGE records with one\n",filename);
+	lvis_file_close(&f);
+	return 1;
+     }
+   while(size < 2*(uint64_t)f.recordCount) size <<= 1;
+   v->slots = (struct lvis_metrics_check *) malloc(size * sizeof(struct lvis_metrics_check));
+   raw = (unsigned char *) malloc(LVIS_METRICS_CHUNK * LVIS_MAX_RECORD_SIZE);
+   canon = (unsigned char *) malloc(LVIS_METRICS_CHUNK * sizeof(struct lvis_lge_v1_04));
+   if(v->slots == NULL || raw == NULL || canon == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the -validate table (%lld shots)\n",(long long) f.recordCount);
+	exit(-1);
+     }
+   memset(v->slots,0xFF,size * sizeof(struct lvis_metrics_check));
+   v->mask = size - 1;
+   for(first=0;first<f.recordCount;first+=got)
+     {
+	got = lvis_canon_read(&f,first,LVIS_METRICS_CHUNK,raw,canon);
+	if(got <= 0)
+	  {
+	     fprintf(stderr,"Short read in %s at record %lld\n",filename,(long long) first);
+	     break;
+	  }
+	for(i=0;i<got;i++)
+	  {
+	     lge = ((struct lvis_lge_v1_04 *) canon) + i;
+	     key = ((uint64_t) lge->lfid << 32) | lge->shotnumber;
+	     // the first shot of a key is the one compared
+	     if((c = lvis_metrics_slot(v,key))->key == key) continue;
+	     c->key  = key;
+	     c->v[0] = lge->zg;
+	     c->v[1] = lge->rh25;
+	     c->v[2] = lge->rh50;
+	     c->v[3] = lge->rh75;
+	     c->v[4] = lge->rh100;
+	     v->shots++;
+	  }
+     }
+   lvis_file_close(&f);
+   free(raw);
+   free(canon);
+   return (first < f.recordCount) ? 1 : 0;
+}
+
+// a derived record against the product's shot of the same key
+static void lvis_metrics_validate(struct lvis_metrics_validation * v, struct lvis_lge_v1_04 * lge)
+{
+   struct lvis_metrics_check * c = lvis_metrics_slot(v,((uint64_t) lge->lfid << 32) | lge->shotnumber);
+   double                      d[5];
+   int                         k;
+
+   if(c->key == LVIS_METRICS_EMPTY) return;
+   d[0] = (double) lge->zg - c->v[0];
+   d[1] = (double) lge->rh25 - c->v[1];
+   d[2] = (double) lge->rh50 - c->v[2];
+   d[3] = (double) lge->rh75 - c->v[3];
+   d[4] = (double) lge->rh100 - c->v[4];
+   for(k=0;k<5;k++) { v->sum[k] += d[k]; v->sumsq[k] += d[k] * d[k]; }
+   v->matched++;
+}
+
+static void lvis_metrics_validation_report(struct lvis_metrics_validation * v, char * filename)
+{
+   static char * names[5] = { "zg", "rh25", "rh50", "rh75", "rh100" };
+   int           k;
+
+   fprintf(stderr,"metrics: %lld records matched in %s (of its %lld shots)\n",(long long) v->matched,filename,
+	   (long long) v->shots);
+   if(v->matched == 0) return;
+   for(k=0;k<5;k++)
+     fprintf(stderr,"metrics: %-5s bias %.3f m, RMS %.3f m\n",names[k],v->sum[k] / v->matched,
+	     sqrt(v->sumsq[k] / v->matched));
+}
+
+int lvis_metrics_kernel(double sigma, float * kernel)
+{
+   double sum=0.0;
+   int    k,radius;
+
+   radius = (int) ceil(3.0 * sigma);
+   if(radius > LVIS_METRICS_MAX_RADIUS) radius = LVIS_METRICS_MAX_RADIUS;
+   if(sigma <= 0.0) radius = 0;
+   for(k=-radius;k<=radius;k++)
+     {
+	kernel[k+radius] = (radius == 0) ? 1.0 : exp(-0.5 * (k/sigma) * (k/sigma));
+	sum += kernel[k+radius];
+     }
+   for(k=0;k<=2*radius;k++) kernel[k] /= sum;
+   return radius;
+}
+
+void lvis_metrics_sample_position(struct lvis_lgw_v1_04 * lgw, int n, double i,
+				  double * lon, double * lat, double * z)
+{
+   double f = (n > 1) ? i / (n-1) : 0.0;
+
+   *lon = lgw->lon0 + (lgw->lon527 - lgw->lon0) * f;
+   *lat = lgw->lat0 + (lgw->lat527 - lgw->lat0) * f;
+   *z   = lgw->z0 + (lgw->z527 - lgw->z0) * f;
+}
+
+void lvis_metrics_smooth(uint16_t * wave, int n, float * kernel, int radius, float * out)
+{
+   float acc;
+   int   i,j,k;
+
+   for(i=0;i<n;i++)
+     {
+	acc = 0.0;
+	for(k=-radius;k<=radius;k++)
+	  {
+	     j = i + k;
+	     if(j < 0) j = 0;
+	     if(j > n-1) j = n-1;
+	     acc += kernel[k+radius] * wave[j];
+	  }
+	out[i] = acc;
+     }
+}
+
+int lvis_metrics_shot(struct lvis_lgw_v1_04 * lgw, int n, float * kernel, int radius, int threshold,
+		      struct lvis_lge_v1_04 * lge)
+{
+   uint16_t * rx = (uint16_t *) ((unsigned char *) lgw + offsetof(struct lvis_lgw_v1_04,rxwave));
+   float      s[528],noise,e;
+   double     ground,lon,lat,z,total=0.0,cum=0.0,target,frac;
+   double     rh[4],a,b,c,d;
+   int        i,p,top,bottom;
+
+   if(n > 528) n = 528;
+   noise = (lgw->sigmean == lgw->sigmean) ? lgw->sigmean : 0.0;
+
+   // smooth, with the ends of the waveform repeated past its edges
+   lvis_metrics_smooth(rx,n,kernel,radius,s);
+   for(i=0;i<n;i++) s[i] -= noise;
+
+   for(top=0;top<n && !(s[top] > threshold);top++);
+   if(top == n) return 0;
+   for(bottom=n-1;!(s[bottom] > threshold);bottom--);
+
+   // the lowest local maximum above the threshold (the bottom of a signal
+   // that only rises towards it), refined to a parabola through its peak
+   for(i=bottom;i>=top;i--)
+     if(s[i] > threshold && (i == n-1 || s[i] >= s[i+1]) && (i == 0 || s[i] > s[i-1])) break;
+   if(i < top) i = bottom;
+   ground = i;
+   if(i > 0 && i < n-1)
+     {
+	a = s[i-1]; b = s[i]; c = s[i+1];
+	d = a - 2.0*b + c;
+	if(d < 0.0) ground += 0.5 * (a - c) / d;
+     }
+
+   lge->lfid          = lgw->lfid;
+   lge->shotnumber    = lgw->shotnumber;
+   lge->azimuth       = lgw->azimuth;
+   lge->incidentangle = lgw->incidentangle;
+   lge->range         = lgw->range;
+   lge->lvistime      = lgw->lvistime;
+   lvis_metrics_sample_position(lgw,n,ground,&lon,&lat,&z);
+   lge->glon = lon;
+   lge->glat = lat;
+   lge->zg   = z;
+
+   // energy from the bottom of the signal up, sample i covering i+0.5 .. i-0.5
+   for(i=top;i<=bottom;i++) if(s[i] > 0.0) total += s[i];
+   for(p=0,i=bottom;i>=top && p<4;i--)
+     {
+	e = (s[i] > 0.0) ? s[i] : 0.0;
+	while(p < 4 && cum + e >= (target = total * (p+1) / 4.0))
+	  {
+	     frac = (e > 0.0) ? (target - cum) / e : 0.0;
+	     lvis_metrics_sample_position(lgw,n,i + 0.5 - frac,&lon,&lat,&z);
+	     rh[p++] = z - lge->zg;
+	  }
+	cum += e;
+     }
+   // rounding may leave the last quarter just short, it ends at the top
+   for(;p<4;p++)
+     {
+	lvis_metrics_sample_position(lgw,n,top - 0.5,&lon,&lat,&z);
+	rh[p] = z - lge->zg;
+     }
+   lge->rh25  = rh[0];
+   lge->rh50  = rh[1];
+   lge->rh75  = rh[2];
+   lge->rh100 = rh[3];
+   return 1;
+}
+
+static void lvis_metrics_run(void * context, long t, int worker)
+{
+   struct lvis_metrics_job  * job = (struct lvis_metrics_job *) context;
+   struct lvis_metrics_task * task = &job->tasks[t];
+   struct lvis_lgw_v1_04    * lgw;
+   int64_t                    i,got;
+
+   task->kept = 0;
+   if((task->lge = (struct lvis_lge_v1_04 *) malloc(task->count * sizeof(struct lvis_lge_v1_04)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the metrics output\n");
+	exit(-1);
+     }
+   got = lvis_canon_read(&job->files[task->file],task->first,task->count,job->raw[worker],job->canon[worker]);
+   if(got != task->count) task->status = -1;
+   for(i=0;i<got;i++)
+     {
+	lgw = ((struct lvis_lgw_v1_04 *) job->canon[worker]) + i;
+	if(lvis_metrics_shot(lgw,job->rxSamples[task->file],job->kernel,job->radius,job->m->threshold,
+			     &task->lge[task->kept]))
+	  task->kept++;
+     }
+}
+
+static int lvis_metrics_input(void * context, long t)
+{
+   return ((struct lvis_metrics_job *) context)->tasks[t].file;
+}
+
+// the records of a task to the output, in input order
+static void lvis_metrics_join(void * context, long t)
+{
+   struct lvis_metrics_job     * job = (struct lvis_metrics_job *) context;
+   struct lvis_release_options * opt = job->opt;
+   struct lvis_metrics_task    * task = &job->tasks[t];
+   struct lvis_lge_v1_04         rec;
+   int64_t                       i;
+
+   if(task->status != 0)
+     {
+	fprintf(stderr,"Short read in %s at record %lld\n",job->files[task->file].filename,(long long) task->first);
+	job->errors++;
+     }
+   for(i=0;i<task->kept;i++)
+     {
+	rec = task->lge[i];
+	if(!lvis_release_keep(opt,rec.glon,rec.glat))
+	  { job->colnum++; continue; }
+	job->records++;
+	if(job->check != NULL) lvis_metrics_validate(job->check,&rec);
+	if(!job->binary)
+	  {
+	     print_release_data(job->out,(unsigned char *) &rec,LVIS_RELEASE_FILETYPE_LGE,(float)1.04,
+				opt->indexcol,job->colnum++,opt->delim,opt->minlat,opt->maxlat,opt->minlon,opt->maxlon);
+	     continue;
+	  }
+	swap_release_data((unsigned char *) &rec,LVIS_RELEASE_FILETYPE_LGE,(float)1.04,opt->myendian);
+	if(fwrite(&rec,sizeof(rec),1,job->out)!=1)
+	  {
+	     fprintf(stderr,"Error writing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	     exit(-1);
+	  }
+     }
+   job->shots += task->count;
+   free(task->lge);
+   task->lge = NULL;
+}
+
+int lvis_metrics_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			 struct lvis_batch_options * b, struct lvis_metrics_options * m)
+{
+   struct lvis_metrics_job    job;
+   struct lvis_metrics_validation check;
+   struct lvis_pool         * pool;
+   FILE                     * out;
+   long                       ntasks=0,maxtasks=0;
+   int64_t                    n,first;
+   float                      version;
+   int                        k,threads,binary,errors=0;
+
+   memset(&job,0,sizeof(job));
+   memset(&check,0,sizeof(check));
+   job.opt = opt;
+   job.m = m;
+   job.radius = lvis_metrics_kernel(m->smooth,job.kernel);
+   job.files = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file));
+   job.rxSamples = (int *) calloc(ninputs,sizeof(int));
+   if(job.files == NULL || job.rxSamples == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     {
+	if(lvis_file_open(&job.files[k],inputs[k],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	lvis_file_close(&job.files[k]);
+	if(job.files[k].fileType != LVIS_RELEASE_FILETYPE_LGW)
+	  {
+	     fprintf(stderr,"%s is not an LGW file, metrics are made from waveforms\n",inputs[k]);
+	     errors++;
+	     continue;
+	  }
+	version = job.files[k].canonical ? job.files[k].sourceVersion : job.files[k].fileVersion;
+	job.rxSamples[k] = job.files[k].canonical ? job.files[k].rxSamples : ((version == ((float)1.04)) ? 528 : 432);
+	n = job.files[k].recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+	job.files[k].recordCount = n;
+	maxtasks += (long) ((n + LVIS_METRICS_CHUNK - 1) / LVIS_METRICS_CHUNK);
+     }
+   if(errors == 0 && m->validate[0] != 0) errors += lvis_metrics_validation_load(&check,opt,m->validate);
+   if(errors > 0)
+     {
+	free(check.slots);
+	free(job.files);
+	free(job.rxSamples);
+	return errors;
+     }
+
+   job.tasks = (struct lvis_metrics_task *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_metrics_task));
+   if(job.tasks == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the task table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     for(first=0;first<job.files[k].recordCount;first+=LVIS_METRICS_CHUNK)
+       {
+	  job.tasks[ntasks].file  = k;
+	  job.tasks[ntasks].first = first;
+	  job.tasks[ntasks].count = (job.files[k].recordCount - first < LVIS_METRICS_CHUNK) ?
+	    job.files[k].recordCount - first : LVIS_METRICS_CHUNK;
+	  ntasks++;
+       }
+
+   pool = lvis_pool_create(b->nthreads);
+   threads = lvis_pool_threads(pool);
+   lvis_batch_buffers(threads,LVIS_METRICS_CHUNK,sizeof(struct lvis_lgw_v1_04),&job.raw,&job.canon);
+
+   // text like the reader prints LGE v1.04, or the binary release records
+   binary = (opt->outfile[0] != 0);
+   out = stdout;
+   if(binary && (out = fopen(opt->outfile,"wb"))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	exit(-1);
+     }
+   if(!binary && opt->topcol == 1)
+     print_release_column_headers(out,LVIS_RELEASE_FILETYPE_LGE,(float)1.04,opt->indexcol,opt->delim);
+
+   // run the waves, writing wave N while wave N+1 is worked on
+   job.binary = binary;
+   job.out = out;
+   job.colnum = 1;
+   if(check.slots != NULL) job.check = &check;
+   lvis_batch_waves(pool,0,ntasks,job.files,lvis_metrics_input,lvis_metrics_run,lvis_metrics_join,&job);
+   errors += job.errors;
+   lvis_pool_destroy(pool);
+
+   if(out != stdout && fclose(out)!=0)
+     {
+	fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	errors++;
+     }
+   fflush(stdout);
+   fprintf(stderr,"metrics: %lld shots, %lld LGE records\n",(long long) job.shots,(long long) job.records);
+   if(check.slots != NULL) lvis_metrics_validation_report(&check,m->validate);
+
+   lvis_batch_free_buffers(threads,job.raw,job.canon);
+   free(job.tasks);
+   free(job.files);
+   free(job.rxSamples);
+   free(check.slots);
+   return errors;
+}
@@ -0,0 +1,76 @@
+#ifndef __LVIS_RELEASE_METRICS_H
+#define __LVIS_RELEASE_METRICS_H
+
+// lvis_release_metrics.h
+//
+// metrics mode: derive LGE records (ground elevation zg and the relative
+// heights rh25 .. rh100) from the waveforms of LGW files, for flights that
+// only have the LGW product or to redo the LGE with other settings.
+//
+// Each rxwave has its noise (sigmean) taken off and is smoothed with a
+// gaussian of -smooth samples.  The signal runs from the first to the last
+// sample more than -featthresh counts above the noise; the ground is the
+// lowest local maximum of the signal.  The energy of the signal is summed
+// from the bottom up and rhNN is the height above the ground at which NN
+// percent of it has been reached.  Sample i lies at the fraction i / (n-1)
+// of the way from (lon0, lat0, z0) to (lon527, lat527, z527) (the 431
+// values of the older releases).  Shots without a signal have no LGE
+// record.
+//
+// -validate names an existing LGE product of the same flight: the derived
+// records are matched to it on (lfid, shotnumber) and the bias (derived
+// minus the product) and RMS difference of zg and rh25 .. rh100 go to
+// stderr at the end.  Its shots are held in a hash, 64 bytes a shot.
+
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_METRICS_SMOOTH
+#define  LVIS_METRICS_SMOOTH 2.0      // default -smooth (gaussian sigma, samples)
+#endif
+
+#ifndef  LVIS_METRICS_MAX_RADIUS
+#define  LVIS_METRICS_MAX_RADIUS 32   // longest smoothing kernel half width (samples)
+#endif
+
+#ifndef  LVIS_METRICS_CHUNK
+#define  LVIS_METRICS_CHUNK 1024      // shots per task
+#endif
+
+struct lvis_metrics_options
+{
+   double smooth;       // -smooth sigma in samples (0 = no smoothing)
+   int    threshold;    // -featthresh N, shared with -features
+   char   validate[1024];  // -validate file.lge (empty = none)
+};
+
+void lvis_metrics_defaults(struct lvis_metrics_options * m);
+
+// handle the metrics options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a metrics option)
+int  lvis_metrics_parse_option(int argc, char * argv[], int i, struct lvis_metrics_options * m);
+
+// fill kernel (2*LVIS_METRICS_MAX_RADIUS+1 weights) with a gaussian of
+// sigma samples, returns its half width
+int  lvis_metrics_kernel(double sigma, float * kernel);
+
+// the n samples of wave convolved with kernel (2*radius+1 weights) into
+// out, the ends of the waveform repeated past its edges
+void lvis_metrics_smooth(uint16_t * wave, int n, float * kernel, int radius, float * out);
+
+// position of (fractional) sample i of an n sample canonical waveform
+void lvis_metrics_sample_position(struct lvis_lgw_v1_04 * lgw, int n, double i,
+				  double * lon, double * lat, double * z);
+
+// the LGE record of one canonical LGW shot (n valid rxwave samples) given
+// a smoothing kernel of 2*radius+1 weights, returns 0 if it has no signal
+int  lvis_metrics_shot(struct lvis_lgw_v1_04 * lgw, int n, float * kernel, int radius, int threshold,
+		       struct lvis_lge_v1_04 * lge);
+
+// metrics mode: the LGE records of the LGW inputs as text, or as one
+// binary LGE v1.04 release file with -o, returns 0 on success
+struct lvis_batch_options;
+int  lvis_metrics_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			  struct lvis_batch_options * b, struct lvis_metrics_options * m);
+
+#endif
@@ -0,0 +1,364 @@
+// lvis_release_poly.c
+//
+// Polygon filter (-poly), see lvis_release_poly.h.
+//
+// An edge marks every cell it touches as boundary: for each row of cells
+// it spans, the part of the edge inside the row gives a range of columns
+// (widened by a hair so an edge on a cell border marks both sides).  The
+// other cells of a row are inside or outside as a whole, so the crossings
+// of the row's centre line tell them apart in one sweep.  The exact test
+// counts the crossings of a ray to the left of the shot with the row's
+// edges, the only ones that can reach its latitude.
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_poly.h"
+
+#define LVIS_POLY_OUTSIDE  0
+#define LVIS_POLY_INSIDE   1
+#define LVIS_POLY_BOUNDARY 2
+
+#define LVIS_POLY_EPSILON  1e-9   // in cells
+
+struct lvis_poly
+{
+   double        * x,* y;        // vertices, every ring closed (last = first)
+   long            nvertices;
+   long          * edge;         // first vertex of each edge (edge e: edge[e] -> edge[e] + 1)
+   long            nedges;
+   double          minx,maxx,miny,maxy;
+   double          cx;           // middle longitude, shots are wrapped to within 180 of it
+   long            nx,ny;        // grid
+   double          cw,ch;        // cell width, height (degrees)
+   unsigned char * cell;         // LVIS_POLY_xxx, ny rows of nx
+   long          * rowStart;     // edges of row r: rowEdges[rowStart[r] .. rowStart[r+1]-1]
+   long          * rowEdges;
+};
+
+static void lvis_poly_add_vertex(struct lvis_poly * p, long * size, double x, double y)
+{
+   if(p->nvertices == *size)
+     {
+	*size = (*size > 0) ? 2 * *size : 1024;
+	p->x = (double *) realloc(p->x,*size * sizeof(double));
+	p->y = (double *) realloc(p->y,*size * sizeof(double));
+	if(p->x == NULL || p->y == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the polygon\n");
+	     exit(-1);
+	  }
+     }
+   p->x[p->nvertices] = x;
+   p->y[p->nvertices] = y;
+   p->nvertices++;
+}
+
+// the vertices and edges of every ring of the WKT text, returns the rings
+static long lvis_poly_parse(struct lvis_poly * p, char * text)
+{
+   char   * s = strchr(text,'('),* end;
+   long     size=0,start=-1,rings=0,e,esize=0;
+   double   x,y;
+
+   while(s != NULL && *s != 0)
+     {
+	if(*s == ')' && start >= 0)
+	  {
+	     // close the ring, keep it if it has an area at all
+	     if(p->nvertices - start >= 1 &&
+		(p->x[p->nvertices-1] != p->x[start] || p->y[p->nvertices-1] != p->y[start]))
+	       lvis_poly_add_vertex(p,&size,p->x[start],p->y[start]);
+	     if(p->nvertices - start < 4) p->nvertices = start;
+	     else
+	       {
+		  for(e=start;e<p->nvertices-1;e++)
+		    {
+		       if(p->nedges == esize)
+			 {
+			    esize = (esize > 0) ? 2 * esize : 1024;
+			    if((p->edge = (long *) realloc(p->edge,esize * sizeof(long)))==NULL)
+			      {
+				 fprintf(stderr,"Unable to allocate the polygon\n");
+				 exit(-1);
+			      }
+			 }
+		       p->edge[p->nedges++] = e;
+		    }
+		  rings++;
+	       }
+	     start = -1;
+	     s++;
+	     continue;
+	  }
+	if((*s >= '0' && *s <= '9') || *s == '-' || *s == '+' || *s == '.')
+	  {
+	     // a vertex: x y [z [m]]
+	     x = strtod(s,&end);
+	     if(end == s) { s++; continue; }
+	     y = strtod(end,&s);
+	     if(s == end) return -1;
+	     if(start < 0) start = p->nvertices;
+	     lvis_poly_add_vertex(p,&size,x,y);
+	     while(*s != 0 && *s != ',' && *s != ')') s++;
+	     continue;
+	  }
+	s++;
+     }
+   return rings;
+}
+
+static long lvis_poly_row(struct lvis_poly * p, double y)
+{
+   long r = (long) floor((y - p->miny) / p->ch);
+   return (r < 0) ? 0 : ((r >= p->ny) ? p->ny - 1 : r);
+}
+
+// the rows of cells an edge reaches
+static void lvis_poly_edge_rows(struct lvis_poly * p, long e, long * r0, long * r1)
+{
+   double y1 = p->y[p->edge[e]],y2 = p->y[p->edge[e]+1];
+   double lo = (y1 < y2) ? y1 : y2,hi = (y1 < y2) ? y2 : y1;
+
+   *r0 = (long) floor((lo - p->miny) / p->ch - LVIS_POLY_EPSILON);
+   *r1 = (long) floor((hi - p->miny) / p->ch + LVIS_POLY_EPSILON);
+   if(*r0 < 0) *r0 = 0;
+   if(*r1 >= p->ny) *r1 = p->ny - 1;
+}
+
+static int lvis_poly_compare(const void * a, const void * b)
+{
+   double x = *(const double *) a,y = *(const double *) b;
+   return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static int lvis_poly_grid(struct lvis_poly * p)
+{
+   double   target,side,x1,y1,x2,y2,b0,b1,t0,t1,xa,xb,yc,xc,* cross;
+   long     e,r,r0,r1,c,c0,c1,k,ncross,* fill;
+
+   target = (double) p->nedges * LVIS_POLY_CELLS_PER_EDGE;
+   if(target < LVIS_POLY_MIN_CELLS) target = LVIS_POLY_MIN_CELLS;
+   if(target > LVIS_POLY_MAX_CELLS) target = LVIS_POLY_MAX_CELLS;
+   side = sqrt((p->maxx - p->minx) * (p->maxy - p->miny) / target);
+   p->nx = (long) ceil((p->maxx - p->minx) / side);
+   p->ny = (long) ceil((p->maxy - p->miny) / side);
+   if(p->nx < 1) p->nx = 1;
+   if(p->ny < 1) p->ny = 1;
+   p->cw = (p->maxx - p->minx) / p->nx;
+   p->ch = (p->maxy - p->miny) / p->ny;
+
+   p->cell = (unsigned char *) calloc(p->nx * p->ny,1);
+   p->rowStart = (long *) calloc(p->ny + 1,sizeof(long));
+   fill = (long *) calloc(p->ny,sizeof(long));
+   if(p->cell == NULL || p->rowStart == NULL || fill == NULL) return -1;
+
+   // the edges of each row, counted then listed
+   for(e=0;e<p->nedges;e++)
+     {
+	lvis_poly_edge_rows(p,e,&r0,&r1);
+	for(r=r0;r<=r1;r++) p->rowStart[r+1]++;
+     }
+   for(r=0;r<p->ny;r++) p->rowStart[r+1] += p->rowStart[r];
+   if((p->rowEdges = (long *) malloc((p->rowStart[p->ny] > 0 ? p->rowStart[p->ny] : 1) * sizeof(long)))==NULL)
+     return -1;
+
+   for(e=0;e<p->nedges;e++)
+     {
+	x1 = p->x[p->edge[e]]; y1 = p->y[p->edge[e]];
+	x2 = p->x[p->edge[e]+1]; y2 = p->y[p->edge[e]+1];
+	lvis_poly_edge_rows(p,e,&r0,&r1);
+	for(r=r0;r<=r1;r++)
+	  {
+	     p->rowEdges[p->rowStart[r] + fill[r]++] = e;
+	     // the part of the edge within the row, and the cells under it
+	     if(y1 == y2) { xa = x1; xb = x2; }
+	     else
+	       {
+		  b0 = p->miny + r * p->ch;
+		  b1 = b0 + p->ch;
+		  t0 = (b0 - y1) / (y2 - y1);
+		  t1 = (b1 - y1) / (y2 - y1);
+		  t0 = (t0 < 0.0) ? 0.0 : ((t0 > 1.0) ? 1.0 : t0);
+		  t1 = (t1 < 0.0) ? 0.0 : ((t1 > 1.0) ? 1.0 : t1);
+		  xa = x1 + t0 * (x2 - x1);
+		  xb = x1 + t1 * (x2 - x1);
+	       }
+	     if(xa > xb) { xc = xa; xa = xb; xb = xc; }
+	     c0 = (long) floor((xa - p->minx) / p->cw - LVIS_POLY_EPSILON);
+	     c1 = (long) floor((xb - p->minx) / p->cw + LVIS_POLY_EPSILON);
+	     if(c0 < 0) c0 = 0;
+	     if(c1 >= p->nx) c1 = p->nx - 1;
+	     for(c=c0;c<=c1;c++) p->cell[r * p->nx + c] = LVIS_POLY_BOUNDARY;
+	  }
+     }
+   free(fill);
+
+   // the rest of each row by the crossings of its centre line
+   if((cross = (double *) malloc((p->nedges > 0 ? p->nedges : 1) * sizeof(double)))==NULL) return -1;
+   for(r=0;r<p->ny;r++)
+     {
+	yc = p->miny + (r + 0.5) * p->ch;
+	ncross = 0;
+	for(k=p->rowStart[r];k<p->rowStart[r+1];k++)
+	  {
+	     e = p->rowEdges[k];
+	     x1 = p->x[p->edge[e]]; y1 = p->y[p->edge[e]];
+	     x2 = p->x[p->edge[e]+1]; y2 = p->y[p->edge[e]+1];
+	     if((y1 > yc) != (y2 > yc)) cross[ncross++] = x1 + (yc - y1) * (x2 - x1) / (y2 - y1);
+	  }
+	qsort(cross,ncross,sizeof(double),lvis_poly_compare);
+	for(c=0,k=0;c<p->nx;c++)
+	  {
+	     xc = p->minx + (c + 0.5) * p->cw;
+	     while(k < ncross && cross[k] < xc) k++;
+	     if(p->cell[r * p->nx + c] != LVIS_POLY_BOUNDARY)
+	       p->cell[r * p->nx + c] = (k & 1) ? LVIS_POLY_INSIDE : LVIS_POLY_OUTSIDE;
+	  }
+     }
+   free(cross);
+   return 0;
+}
+
+struct lvis_poly * lvis_poly_load(char * filename)
+{
+   struct lvis_poly * p;
+   FILE             * fp;
+   char             * text;
+   long               length,rings,i;
+
+   if((fp = fopen(filename,"rb"))==NULL)
+     {
+	fprintf(stderr,"Error opening the polygon file: %s (%s)\n",filename,strerror(errno));
+	return NULL;
+     }
+   fseek(fp,0,SEEK_END);
+   length = ftell(fp);
+   fseek(fp,0,SEEK_SET);
+   if((text = (char *) malloc(length + 1))==NULL || (long) fread(text,1,length,fp) != length)
+     {
+	fprintf(stderr,"Error reading the polygon file: %s\n",filename);
+	fclose(fp);
+	free(text);
+	return NULL;
+     }
+   fclose(fp);
+   text[length] = 0;
+
+   if((p = (struct lvis_poly *) calloc(1,sizeof(struct lvis_poly)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the polygon\n");
+	exit(-1);
+     }
+   rings = lvis_poly_parse(p,text);
+   free(text);
+   if(rings <= 0)
+     {
+	fprintf(stderr,"%s has no WKT POLYGON / MULTIPOLYGON rings (lon lat, ...)\n",filename);
+	lvis_poly_destroy(p);
+	return NULL;
+     }
+
+   p->minx = p->maxx = p->x[0];
+   p->miny = p->maxy = p->y[0];
+   for(i=1;i<p->nvertices;i++)
+     {
+	if(p->x[i] < p->minx) p->minx = p->x[i];
+	if(p->x[i] > p->maxx) p->maxx = p->x[i];
+	if(p->y[i] < p->miny) p->miny = p->y[i];
+	if(p->y[i] > p->maxy) p->maxy = p->y[i];
+     }
+   if(!(p->maxx > p->minx && p->maxy > p->miny))
+     {
+	fprintf(stderr,"The polygon of %s has no area\n",filename);
+	lvis_poly_destroy(p);
+	return NULL;
+     }
+   p->cx = 0.5 * (p->minx + p->maxx);
+   if(lvis_poly_grid(p) != 0)
+     {
+	fprintf(stderr,"Unable to allocate the polygon grid\n");
+	exit(-1);
+     }
+   return p;
+}
+
+void lvis_poly_destroy(struct lvis_poly * p)
+{
+   if(p == NULL) return;
+   free(p->x);
+   free(p->y);
+   free(p->edge);
+   free(p->cell);
+   free(p->rowStart);
+   free(p->rowEdges);
+   free(p);
+}
+
+// the longitude in the polygon's range
+static inline double lvis_poly_wrap(struct lvis_poly * p, double lon)
+{
+   if(lon - p->cx > 180.0 || lon - p->cx < -180.0) lon -= 360.0 * floor((lon - p->cx + 180.0) / 360.0);
+   return lon;
+}
+
+// the cell class of a (wrapped) position, outside the grid is outside
+static inline int lvis_poly_class(struct lvis_poly * p, double x, double y)
+{
+   long c,r;
+
+   if(!(x >= p->minx && x <= p->maxx && y >= p->miny && y <= p->maxy)) return LVIS_POLY_OUTSIDE;
+   c = (long) ((x - p->minx) / p->cw);
+   r = (long) ((y - p->miny) / p->ch);
+   if(c >= p->nx) c = p->nx - 1;
+   if(r >= p->ny) r = p->ny - 1;
+   return p->cell[r * p->nx + c];
+}
+
+static int lvis_poly_exact(struct lvis_poly * p, double x, double y)
+{
+   double x1,y1,x2,y2;
+   long   k,e,r = lvis_poly_row(p,y);
+   int    in=0;
+
+   for(k=p->rowStart[r];k<p->rowStart[r+1];k++)
+     {
+	e = p->rowEdges[k];
+	x1 = p->x[p->edge[e]]; y1 = p->y[p->edge[e]];
+	x2 = p->x[p->edge[e]+1]; y2 = p->y[p->edge[e]+1];
+	if((y1 > y) != (y2 > y) && x1 + (y - y1) * (x2 - x1) / (y2 - y1) < x) in = !in;
+     }
+   return in;
+}
+
+int lvis_poly_contains(struct lvis_poly * p, double lon, double lat)
+{
+   int c;
+
+   if(p == NULL) return 1;
+   lon = lvis_poly_wrap(p,lon);
+   c = lvis_poly_class(p,lon,lat);
+   if(c == LVIS_POLY_BOUNDARY) return lvis_poly_exact(p,lon,lat);
+   return c;
+}
+
+int lvis_release_keep(struct lvis_release_options * opt, double lon, double lat)
+{
+   return lon>opt->minlon && lon<opt->maxlon && lat>opt->minlat && lat<opt->maxlat &&
+     lvis_poly_contains(opt->poly,lon,lat);
+}
+
+void lvis_poly_contains_n(struct lvis_poly * p, const double * lon, const double * lat, long n,
+			  unsigned char * inside)
+{
+   long i;
+
+   if(p == NULL) { memset(inside,1,n); return; }
+   for(i=0;i<n;i++) inside[i] = lvis_poly_class(p,lvis_poly_wrap(p,lon[i]),lat[i]);
+   for(i=0;i<n;i++)
+     if(inside[i] == LVIS_POLY_BOUNDARY) inside[i] = lvis_poly_exact(p,lvis_poly_wrap(p,lon[i]),lat[i]);
+}
@@ -0,0 +1,46 @@
+#ifndef __LVIS_RELEASE_POLY_H
+#define __LVIS_RELEASE_POLY_H
+
+// lvis_release_poly.h
+//
+// -poly file.wkt: keep only the shots inside a polygon (a glacier
+// catchment, a flight box, ...) as well as inside -lat / -lon.  The file
+// holds a WKT POLYGON or MULTIPOLYGON in lon / lat degrees; every ring of
+// it counts (even-odd), so holes and several parts work.  The shots are
+// tested in the polygon's own longitude range: a catchment given in
+// -180 .. 180 clips the release longitudes (0 .. 360) as it should, and a
+// polygon across the 0 / 360 or +-180 seam may simply run past 360 or 180.
+//
+// The polygon's bounding box is cut into a uniform grid of cells, each
+// classified once as inside, outside or on the boundary (an edge passes
+// through it), and the edges are listed per row of cells.  A shot in an
+// inside or outside cell is decided by one lookup; only the shots in
+// boundary cells are tested exactly, against the edges of their row.
+
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_POLY_CELLS_PER_EDGE
+#define  LVIS_POLY_CELLS_PER_EDGE 64        // grid cells per polygon edge
+#endif
+#define  LVIS_POLY_MIN_CELLS      4096
+#define  LVIS_POLY_MAX_CELLS      (1 << 22)
+
+struct lvis_poly;
+
+// read a WKT polygon, NULL (with a message) if it cannot be used
+struct lvis_poly * lvis_poly_load(char * filename);
+void               lvis_poly_destroy(struct lvis_poly * p);
+
+// 1 if lon / lat is inside the polygon (always 1 without one, p NULL)
+int  lvis_poly_contains(struct lvis_poly * p, double lon, double lat);
+
+// 1 if a shot at lon / lat is kept: inside -lon / -lat and inside -poly
+int  lvis_release_keep(struct lvis_release_options * opt, double lon, double lat);
+
+// the same for n positions, inside[i] = 0 or 1: the cells first, then the
+// exact test for the few in boundary cells
+void lvis_poly_contains_n(struct lvis_poly * p, const double * lon, const double * lat, long n,
+			  unsigned char * inside);
+
+#endif
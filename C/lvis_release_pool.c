@@ -0,0 +1,266 @@
+// lvis_release_pool.c
+//
+// Work-stealing thread pool used by the batch and processing modes.
+// See lvis_release_pool.h for the model.  A single thread pool runs the
+// tasks inline in the calling thread, so -threads 1 behaves exactly like
+// the serial reader.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lvis_release_pool.h"
+
+// one slice of the task range per worker, padded so the locks do not share
+// a cache line
+struct lvis_pool_slice
+{
+   pthread_mutex_t lock;
+   long            lo,hi;   // tasks [lo,hi) still to run
+   char            pad[64];
+};
+
+struct lvis_pool_worker
+{
+   struct lvis_pool * pool;
+   int                id;
+};
+
+struct lvis_pool
+{
+   int                       nthreads;
+   pthread_t               * threads;
+   struct lvis_pool_worker * workers;
+   struct lvis_pool_slice  * slices;
+
+   pthread_mutex_t lock;
+   pthread_cond_t  wake;       // a new job (or shutdown) is ready
+   pthread_cond_t  done;       // the last worker finished the job
+   long            generation; // bumped for every job
+   int             busy;       // workers still inside the current job
+   int             running;    // a job was started and not yet waited on
+   int             shutdown;
+
+   lvis_pool_task  task;
+   void          * context;
+};
+
+int lvis_cpu_count(void)
+{
+   long n = sysconf(_SC_NPROCESSORS_ONLN);
+   return (n < 1) ? 1 : (int) n;
+}
+
+// take the next task from our own slice
+static int lvis_pool_take(struct lvis_pool_slice * s, long * task)
+{
+   int found = 0;
+
+   pthread_mutex_lock(&s->lock);
+   if(s->lo < s->hi) { *task = s->lo++; found = 1; }
+   pthread_mutex_unlock(&s->lock);
+   return found;
+}
+
+// steal the upper half of the largest slice left, keep the first stolen task
+// for ourselves and park the rest in our (empty) slice
+static int lvis_pool_steal(struct lvis_pool * pool, int id, long * task)
+{
+   int  i,victim=-1;
+   long left,most=0,mid,hi;
+   struct lvis_pool_slice * s;
+
+   for(i=1;i<pool->nthreads;i++)
+     {
+	s = &pool->slices[(id+i) % pool->nthreads];
+	left = s->hi - s->lo;   // racy read, only used to pick a victim
+	if(left > most) { most = left; victim = (id+i) % pool->nthreads; }
+     }
+   if(victim < 0) return 0;
+
+   s = &pool->slices[victim];
+   pthread_mutex_lock(&s->lock);
+   left = s->hi - s->lo;
+   if(left <= 0)
+     {
+	pthread_mutex_unlock(&s->lock);
+	return 1;  // lost the race, but there may be more work elsewhere
+     }
+   mid = s->lo + left / 2;
+   hi  = s->hi;
+   s->hi = mid;
+   pthread_mutex_unlock(&s->lock);
+
+   *task = mid;
+   s = &pool->slices[id];
+   pthread_mutex_lock(&s->lock);
+   s->lo = mid + 1;
+   s->hi = hi;
+   pthread_mutex_unlock(&s->lock);
+   return 2;
+}
+
+static void lvis_pool_work(struct lvis_pool * pool, int id)
+{
+   long task;
+   int  status;
+
+   for(;;)
+     {
+	if(lvis_pool_take(&pool->slices[id],&task))
+	  {
+	     pool->task(pool->context,task,id);
+	     continue;
+	  }
+	status = lvis_pool_steal(pool,id,&task);
+	if(status == 2) pool->task(pool->context,task,id);
+	if(status == 0) break;
+     }
+}
+
+static void * lvis_pool_thread(void * arg)
+{
+   struct lvis_pool_worker * w = (struct lvis_pool_worker *) arg;
+   struct lvis_pool        * pool = w->pool;
+   long                      seen = 0;
+
+   for(;;)
+     {
+	pthread_mutex_lock(&pool->lock);
+	while(pool->generation == seen && pool->shutdown == 0)
+	  pthread_cond_wait(&pool->wake,&pool->lock);
+	if(pool->shutdown)
+	  {
+	     pthread_mutex_unlock(&pool->lock);
+	     break;
+	  }
+	seen = pool->generation;
+	pthread_mutex_unlock(&pool->lock);
+
+	lvis_pool_work(pool,w->id);
+
+	pthread_mutex_lock(&pool->lock);
+	if(--pool->busy == 0) pthread_cond_broadcast(&pool->done);
+	pthread_mutex_unlock(&pool->lock);
+     }
+   return NULL;
+}
+
+struct lvis_pool * lvis_pool_create(int nthreads)
+{
+   struct lvis_pool * pool;
+   int i;
+
+   if(nthreads <= 0) nthreads = lvis_cpu_count();
+
+   if((pool = (struct lvis_pool *) calloc(1,sizeof(struct lvis_pool)))==NULL ||
+      (pool->slices = (struct lvis_pool_slice *) calloc(nthreads,sizeof(struct lvis_pool_slice)))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the thread pool\n");
+	exit(-1);
+     }
+   pool->nthreads = nthreads;
+   for(i=0;i<nthreads;i++) pthread_mutex_init(&pool->slices[i].lock,NULL);
+   pthread_mutex_init(&pool->lock,NULL);
+   pthread_cond_init(&pool->wake,NULL);
+   pthread_cond_init(&pool->done,NULL);
+
+   // a single thread runs everything in the caller
+   if(nthreads == 1) return pool;
+
+   pool->threads = (pthread_t *) calloc(nthreads,sizeof(pthread_t));
+   pool->workers = (struct lvis_pool_worker *) calloc(nthreads,sizeof(struct lvis_pool_worker));
+   if(pool->threads == NULL || pool->workers == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the thread pool\n");
+	exit(-1);
+     }
+   for(i=0;i<nthreads;i++)
+     {
+	pool->workers[i].pool = pool;
+	pool->workers[i].id   = i;
+	if(pthread_create(&pool->threads[i],NULL,lvis_pool_thread,&pool->workers[i])!=0)
+	  {
+	     fprintf(stderr,"Unable to start worker thread %d\n",i);
+	     exit(-1);
+	  }
+     }
+   return pool;
+}
+
+void lvis_pool_destroy(struct lvis_pool * pool)
+{
+   int i;
+
+   if(pool == NULL) return;
+   lvis_pool_wait(pool);
+   if(pool->threads != NULL)
+     {
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+	for(i=0;i<pool->nthreads;i++) pthread_join(pool->threads[i],NULL);
+     }
+   for(i=0;i<pool->nthreads;i++) pthread_mutex_destroy(&pool->slices[i].lock);
+   pthread_mutex_destroy(&pool->lock);
+   pthread_cond_destroy(&pool->wake);
+   pthread_cond_destroy(&pool->done);
+   free(pool->threads);
+   free(pool->workers);
+   free(pool->slices);
+   free(pool);
+}
+
+int lvis_pool_threads(struct lvis_pool * pool)
+{
+   return pool->nthreads;
+}
+
+void lvis_pool_start(struct lvis_pool * pool, long ntasks, lvis_pool_task task, void * context)
+{
+   int  i;
+   long t;
+
+   lvis_pool_wait(pool);
+   if(ntasks <= 0) return;
+
+   if(pool->threads == NULL)
+     {
+	for(t=0;t<ntasks;t++) task(context,t,0);
+	return;
+     }
+
+   // hand out contiguous slices, the stealing evens out the rest
+   for(i=0;i<pool->nthreads;i++)
+     {
+	pool->slices[i].lo = (long) ((double) ntasks * i / pool->nthreads);
+	pool->slices[i].hi = (long) ((double) ntasks * (i+1) / pool->nthreads);
+     }
+
+   pthread_mutex_lock(&pool->lock);
+   pool->task     = task;
+   pool->context  = context;
+   pool->busy     = pool->nthreads;
+   pool->running  = 1;
+   pool->generation++;
+   pthread_cond_broadcast(&pool->wake);
+   pthread_mutex_unlock(&pool->lock);
+}
+
+void lvis_pool_wait(struct lvis_pool * pool)
+{
+   if(pool->threads == NULL) return;
+   pthread_mutex_lock(&pool->lock);
+   while(pool->running && pool->busy > 0)
+     pthread_cond_wait(&pool->done,&pool->lock);
+   pool->running = 0;
+   pthread_mutex_unlock(&pool->lock);
+}
+
+void lvis_pool_run(struct lvis_pool * pool, long ntasks, lvis_pool_task task, void * context)
+{
+   lvis_pool_start(pool,ntasks,task,context);
+   lvis_pool_wait(pool);
+}
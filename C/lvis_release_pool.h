@@ -0,0 +1,35 @@
+#ifndef __LVIS_RELEASE_POOL_H
+#define __LVIS_RELEASE_POOL_H
+
+// lvis_release_pool.h
+//
+// A small work-stealing thread pool.  A job is a count of independent tasks
+// (0 .. ntasks-1); each worker starts on its own contiguous slice of task
+// numbers and, once that runs dry, steals the upper half of the busiest
+// remaining slice.  Big tasks therefore never leave the other threads idle
+// at the end of a job.
+//
+// The task function receives the worker number (0 .. threads-1) so callers
+// can keep per-thread scratch space and accumulators without locking.
+
+typedef void (*lvis_pool_task)(void * context, long task, int worker);
+
+struct lvis_pool;
+
+// create a pool with nthreads workers (nthreads <= 0 uses every online cpu)
+struct lvis_pool * lvis_pool_create(int nthreads);
+void lvis_pool_destroy(struct lvis_pool * pool);
+int  lvis_pool_threads(struct lvis_pool * pool);
+
+// start a job and return immediately (the caller may do other work, such as
+// writing the results of the previous job) - only one job runs at a time
+void lvis_pool_start(struct lvis_pool * pool, long ntasks, lvis_pool_task task, void * context);
+// wait for the running job to finish
+void lvis_pool_wait(struct lvis_pool * pool);
+// start + wait
+void lvis_pool_run(struct lvis_pool * pool, long ntasks, lvis_pool_task task, void * context);
+
+// number of online cpus (at least 1)
+int  lvis_cpu_count(void);
+
+#endif
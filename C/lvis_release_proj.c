@@ -0,0 +1,272 @@
+// lvis_release_proj.c
+//
+// Polar stereographic x / y (-proj), see lvis_release_proj.h.
+//
+// With s = sin(lat) (of the pole's hemisphere) and u = e s,
+//   t   = tan(45 - lat/2) / ((1 - u) / (1 + u))^(e/2)
+//       = cos(lat) / (1 + s) * exp(e atanh(u))
+//   rho = scale * t,  x = rho sin(lon - lon0),  y = -+ rho cos(lon - lon0)
+// and as |u| < e < 0.082 the atanh and exp series converge after a few
+// terms, so a point costs two sin / cos pairs, a division and polynomials
+// the AVX2 kernel does 4 at a time.  The sin / cos reduce the angle to a
+// quarter turn in degrees (exact) and evaluate the Cephes polynomials.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_proj.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LVIS_PROJ_AVX2 1
+#include <immintrin.h>
+#endif
+
+#define LVIS_PROJ_A   LVIS_PROJ_WGS84_A
+#define LVIS_PROJ_F   (1.0 / 298.257223563)
+#define LVIS_PROJ_RAD (M_PI / 180.0)
+
+// sin(r) = r + r z S(z), cos(r) = 1 - z/2 + z z C(z), z = r r, |r| <= pi/4
+#define LVIS_PROJ_S0  1.58962301576546568060E-10
+#define LVIS_PROJ_S1 -2.50507477628578072866E-8
+#define LVIS_PROJ_S2  2.75573136213857245213E-6
+#define LVIS_PROJ_S3 -1.98412698295895385996E-4
+#define LVIS_PROJ_S4  8.33333333332211858878E-3
+#define LVIS_PROJ_S5 -1.66666666666666307295E-1
+#define LVIS_PROJ_C0 -1.13585365213876817300E-11
+#define LVIS_PROJ_C1  2.08757008419747316778E-9
+#define LVIS_PROJ_C2 -2.75573141792967388112E-7
+#define LVIS_PROJ_C3  2.48015872888517045348E-5
+#define LVIS_PROJ_C4 -1.38888888888730564116E-3
+#define LVIS_PROJ_C5  4.16666666666665929218E-2
+
+int lvis_proj_code(char * name)
+{
+   if(strcmp(name,"3413")==0 || strcmp(name,"north")==0 || strcmp(name,"EPSG:3413")==0) return LVIS_PROJ_NORTH;
+   if(strcmp(name,"3031")==0 || strcmp(name,"south")==0 || strcmp(name,"EPSG:3031")==0) return LVIS_PROJ_SOUTH;
+   return 0;
+}
+
+int lvis_proj_init(struct lvis_proj * p, int epsg, int scalar)
+{
+   double latc,e,mc,tc;
+
+   memset(p,0,sizeof(struct lvis_proj));
+   if(epsg == LVIS_PROJ_NORTH) { p->sign =  1.0; p->lon0 = -45.0; latc = 70.0; }
+   else if(epsg == LVIS_PROJ_SOUTH) { p->sign = -1.0; p->lon0 = 0.0; latc = 71.0; }
+   else return -1;
+   p->epsg = epsg;
+   p->scalar = scalar;
+   p->e = e = sqrt(LVIS_PROJ_F * (2.0 - LVIS_PROJ_F));
+   // true scale at the standard parallel (taken in the pole's hemisphere)
+   latc *= LVIS_PROJ_RAD;
+   mc = cos(latc) / sqrt(1.0 - e * e * sin(latc) * sin(latc));
+   tc = tan(M_PI / 4.0 - latc / 2.0) / pow((1.0 - e * sin(latc)) / (1.0 + e * sin(latc)),e / 2.0);
+   p->scale = LVIS_PROJ_A * mc / tc;
+   return 0;
+}
+
+static void lvis_proj_sincos(double deg, double * s, double * c)
+{
+   double q,r,z,sr,cr;
+   int    quadrant;
+
+   q = nearbyint(deg / 90.0);
+   r = (deg - 90.0 * q) * LVIS_PROJ_RAD;
+   z = r * r;
+   sr = r + r * z * (((((LVIS_PROJ_S0 * z + LVIS_PROJ_S1) * z + LVIS_PROJ_S2) * z + LVIS_PROJ_S3) * z
+		      + LVIS_PROJ_S4) * z + LVIS_PROJ_S5);
+   cr = 1.0 - 0.5 * z + z * z * (((((LVIS_PROJ_C0 * z + LVIS_PROJ_C1) * z + LVIS_PROJ_C2) * z + LVIS_PROJ_C3) * z
+				 + LVIS_PROJ_C4) * z + LVIS_PROJ_C5);
+   quadrant = (q == q) ? (int) q : 0;
+   *s = (quadrant & 1) ? cr : sr;
+   *c = (quadrant & 1) ? sr : cr;
+   if(quadrant & 2) *s = -*s;
+   if((quadrant + 1) & 2) *c = -*c;
+}
+
+// t(lat) * exp series factor, from s = sin(lat) (pole's hemisphere) and cos(lat)
+static void lvis_proj_scalar(struct lvis_proj * p, const double * lon, const double * lat,
+			     double * x, double * y, long first, long n)
+{
+   double sp,cp,sd,cd,u,z,w,rho;
+   long   i;
+
+   for(i=first;i<n;i++)
+     {
+	lvis_proj_sincos(lat[i],&sp,&cp);
+	lvis_proj_sincos(lon[i] - p->lon0,&sd,&cd);
+	sp = p->sign * sp;
+	u = p->e * sp;
+	z = u * u;
+	w = p->e * (u * (1.0 + z * (1.0/3.0 + z * (1.0/5.0 + z * (1.0/7.0 + z * (1.0/9.0 + z * (1.0/11.0
+	    + z * (1.0/13.0 + z * (1.0/15.0)))))))));
+	rho = p->scale * (cp / (1.0 + sp)) * (1.0 + w * (1.0 + w * (1.0/2.0 + w * (1.0/6.0 + w * (1.0/24.0
+	    + w * (1.0/120.0 + w * (1.0/720.0)))))));
+	x[i] = rho * sd;
+	y[i] = -p->sign * rho * cd;
+     }
+}
+
+#ifdef LVIS_PROJ_AVX2
+__attribute__((target("avx2")))
+static inline __m256d lvis_proj_horner(__m256d z, __m256d c0, double c1, double c2, double c3, double c4, double c5)
+{
+   __m256d v = _mm256_add_pd(_mm256_mul_pd(c0,z),_mm256_set1_pd(c1));
+   v = _mm256_add_pd(_mm256_mul_pd(v,z),_mm256_set1_pd(c2));
+   v = _mm256_add_pd(_mm256_mul_pd(v,z),_mm256_set1_pd(c3));
+   v = _mm256_add_pd(_mm256_mul_pd(v,z),_mm256_set1_pd(c4));
+   return _mm256_add_pd(_mm256_mul_pd(v,z),_mm256_set1_pd(c5));
+}
+
+__attribute__((target("avx2")))
+static inline void lvis_proj_sincos_avx2(__m256d deg, __m256d * s, __m256d * c)
+{
+   __m256d q,r,z,sr,cr,odd,neg,cneg;
+   __m256d sign = _mm256_set1_pd(-0.0);
+   __m256i quadrant;
+
+   q = _mm256_round_pd(_mm256_div_pd(deg,_mm256_set1_pd(90.0)),_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+   r = _mm256_mul_pd(_mm256_sub_pd(deg,_mm256_mul_pd(_mm256_set1_pd(90.0),q)),_mm256_set1_pd(LVIS_PROJ_RAD));
+   z = _mm256_mul_pd(r,r);
+   sr = _mm256_add_pd(r,_mm256_mul_pd(_mm256_mul_pd(r,z),
+		      lvis_proj_horner(z,_mm256_set1_pd(LVIS_PROJ_S0),LVIS_PROJ_S1,LVIS_PROJ_S2,LVIS_PROJ_S3,
+				       LVIS_PROJ_S4,LVIS_PROJ_S5)));
+   cr = _mm256_add_pd(_mm256_sub_pd(_mm256_set1_pd(1.0),_mm256_mul_pd(_mm256_set1_pd(0.5),z)),
+		      _mm256_mul_pd(_mm256_mul_pd(z,z),
+				    lvis_proj_horner(z,_mm256_set1_pd(LVIS_PROJ_C0),LVIS_PROJ_C1,LVIS_PROJ_C2,
+						     LVIS_PROJ_C3,LVIS_PROJ_C4,LVIS_PROJ_C5)));
+   // the quadrant's bits as 64 bit lane masks
+   quadrant = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(q));
+   odd  = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(quadrant,_mm256_set1_epi64x(1)),
+						 _mm256_set1_epi64x(1)));
+   neg  = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(quadrant,_mm256_set1_epi64x(2)),
+						 _mm256_set1_epi64x(2)));
+   cneg = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(_mm256_add_epi64(quadrant,_mm256_set1_epi64x(1)),
+								  _mm256_set1_epi64x(2)),_mm256_set1_epi64x(2)));
+   *s = _mm256_xor_pd(_mm256_blendv_pd(sr,cr,odd),_mm256_and_pd(neg,sign));
+   *c = _mm256_xor_pd(_mm256_blendv_pd(cr,sr,odd),_mm256_and_pd(cneg,sign));
+}
+
+// returns the number of points it did (a multiple of 4), the caller
+// finishes the rest with the scalar kernel
+__attribute__((target("avx2")))
+static long lvis_proj_avx2(struct lvis_proj * p, const double * lon, const double * lat,
+			   double * x, double * y, long n)
+{
+   __m256d one = _mm256_set1_pd(1.0),e = _mm256_set1_pd(p->e),vsign = _mm256_set1_pd(p->sign);
+   __m256d lon0 = _mm256_set1_pd(p->lon0),scale = _mm256_set1_pd(p->scale),ysign = _mm256_set1_pd(-p->sign);
+   __m256d sp,cp,sd,cd,u,z,w,v,rho;
+   long    i;
+
+   for(i=0;i+4<=n;i+=4)
+     {
+	lvis_proj_sincos_avx2(_mm256_loadu_pd(lat+i),&sp,&cp);
+	lvis_proj_sincos_avx2(_mm256_sub_pd(_mm256_loadu_pd(lon+i),lon0),&sd,&cd);
+	sp = _mm256_mul_pd(vsign,sp);
+	u = _mm256_mul_pd(e,sp);
+	z = _mm256_mul_pd(u,u);
+	// atanh(u) / u, innermost term first as in the scalar kernel
+	v = _mm256_set1_pd(1.0/15.0);
+	v = _mm256_add_pd(_mm256_set1_pd(1.0/13.0),_mm256_mul_pd(z,v));
+	v = _mm256_add_pd(_mm256_set1_pd(1.0/11.0),_mm256_mul_pd(z,v));
+	v = _mm256_add_pd(_mm256_set1_pd(1.0/9.0),_mm256_mul_pd(z,v));
+	v = _mm256_add_pd(_mm256_set1_pd(1.0/7.0),_mm256_mul_pd(z,v));
+	v = _mm256_add_pd(_mm256_set1_pd(1.0/5.0),_mm256_mul_pd(z,v));
+	v = _mm256_add_pd(_mm256_set1_pd(1.0/3.0),_mm256_mul_pd(z,v));
+	v = _mm256_add_pd(one,_mm256_mul_pd(z,v));
+	w = _mm256_mul_pd(e,_mm256_mul_pd(u,v));
+	// exp(w)
+	v = _mm256_set1_pd(1.0/720.0);
+	v = _mm256_add_pd(_mm256_set1_pd(1.0/120.0),_mm256_mul_pd(w,v));
+	v = _mm256_add_pd(_mm256_set1_pd(1.0/24.0),_mm256_mul_pd(w,v));
+	v = _mm256_add_pd(_mm256_set1_pd(1.0/6.0),_mm256_mul_pd(w,v));
+	v = _mm256_add_pd(_mm256_set1_pd(1.0/2.0),_mm256_mul_pd(w,v));
+	v = _mm256_add_pd(one,_mm256_mul_pd(w,v));
+	v = _mm256_add_pd(one,_mm256_mul_pd(w,v));
+	rho = _mm256_mul_pd(_mm256_mul_pd(scale,_mm256_div_pd(cp,_mm256_add_pd(one,sp))),v);
+	_mm256_storeu_pd(x+i,_mm256_mul_pd(rho,sd));
+	_mm256_storeu_pd(y+i,_mm256_mul_pd(_mm256_mul_pd(ysign,rho),cd));
+     }
+   return i;
+}
+
+static int lvis_proj_have_avx2(void)
+{
+   static int have = -1;
+
+   if(have < 0)
+     {
+	__builtin_cpu_init();
+	have = __builtin_cpu_supports("avx2") ? 1 : 0;
+     }
+   return have;
+}
+#endif
+
+void lvis_proj_forward(struct lvis_proj * p, const double * lon, const double * lat, double * x, double * y, long n)
+{
+   long done=0;
+
+#ifdef LVIS_PROJ_AVX2
+   if(!p->scalar && lvis_proj_have_avx2()) done = lvis_proj_avx2(p,lon,lat,x,y,n);
+#endif
+   lvis_proj_scalar(p,lon,lat,x,y,done,n);
+}
+
+void lvis_proj_ecef(double lon, double lat, double * p)
+{
+   double sinlat = sin(lat * LVIS_PROJ_RAD),coslat = cos(lat * LVIS_PROJ_RAD);
+   double n = LVIS_PROJ_WGS84_A / sqrt(1.0 - LVIS_PROJ_WGS84_E2 * sinlat * sinlat);
+
+   p[0] = n * coslat * cos(lon * LVIS_PROJ_RAD);
+   p[1] = n * coslat * sin(lon * LVIS_PROJ_RAD);
+   p[2] = n * (1.0 - LVIS_PROJ_WGS84_E2) * sinlat;
+}
+
+void lvis_proj_radii(double lat, double * m, double * n)
+{
+   double sinlat = sin(lat * LVIS_PROJ_RAD),q = 1.0 - LVIS_PROJ_WGS84_E2 * sinlat * sinlat;
+
+   *n = LVIS_PROJ_WGS84_A / sqrt(q);
+   *m = *n * (1.0 - LVIS_PROJ_WGS84_E2) / q;
+}
+
+int lvis_proj_positions(unsigned char * data, int fileType, float dataVersion, double * lon, double * lat)
+{
+   if(fileType == LVIS_RELEASE_FILETYPE_LCE || fileType == LVIS_RELEASE_FILETYPE_LGE)
+     {
+	release_data_position(data,fileType,dataVersion,lon,lat);
+	return 1;
+     }
+   if(fileType != LVIS_RELEASE_FILETYPE_LGW) return 0;
+   if(dataVersion == ((float)1.00)) { lon[0] = ((struct lvis_lgw_v1_00 *) data)->lon0; lat[0] = ((struct lvis_lgw_v1_00 *) data)->lat0; }
+   if(dataVersion == ((float)1.01)) { lon[0] = ((struct lvis_lgw_v1_01 *) data)->lon0; lat[0] = ((struct lvis_lgw_v1_01 *) data)->lat0; }
+   if(dataVersion == ((float)1.02)) { lon[0] = ((struct lvis_lgw_v1_02 *) data)->lon0; lat[0] = ((struct lvis_lgw_v1_02 *) data)->lat0; }
+   if(dataVersion == ((float)1.03)) { lon[0] = ((struct lvis_lgw_v1_03 *) data)->lon0; lat[0] = ((struct lvis_lgw_v1_03 *) data)->lat0; }
+   if(dataVersion == ((float)1.04)) { lon[0] = ((struct lvis_lgw_v1_04 *) data)->lon0; lat[0] = ((struct lvis_lgw_v1_04 *) data)->lat0; }
+   // the last sample is the position the records are cut on
+   release_data_position(data,fileType,dataVersion,&lon[1],&lat[1]);
+   return 2;
+}
+
+void lvis_proj_print_headers(FILE * out, int fileType, float dataVersion, char * delim)
+{
+   if(fileType == LVIS_RELEASE_FILETYPE_LCE) fprintf(out,"%sxt%syt",delim,delim);
+   if(fileType == LVIS_RELEASE_FILETYPE_LGE) fprintf(out,"%sxg%syg",delim,delim);
+   if(fileType == LVIS_RELEASE_FILETYPE_LGW)
+     {
+	fprintf(out,"%sx0%sy0",delim,delim);
+	if(dataVersion == ((float)1.04)) fprintf(out,"%sx527%sy527",delim,delim);
+	else fprintf(out,"%sx431%sy431",delim,delim);
+     }
+}
+
+void lvis_proj_print(FILE * out, const double * x, const double * y, int npairs, char * delim)
+{
+   int i;
+
+   for(i=0;i<npairs;i++) fprintf(out,"%s%13.3f%s%13.3f",delim,x[i],delim,y[i]);
+}
@@ -0,0 +1,62 @@
+#ifndef __LVIS_RELEASE_PROJ_H
+#define __LVIS_RELEASE_PROJ_H
+
+// lvis_release_proj.h
+//
+// -proj: polar stereographic x / y (m) appended to the text conversion,
+// one pair of columns for every geolocation of the record: xt yt (LCE),
+// xg yg (LGE), x0 y0 x431 y431 (LGW, x527 y527 in 1.04).  The ellipsoidal
+// forward transform (WGS 84, Snyder 1987) of the two grids IceBridge uses:
+//   3413  NSIDC sea ice polar stereographic north, true scale at 70N, lon -45
+//   3031  Antarctic polar stereographic, true scale at 71S, lon 0
+// The release longitudes are degrees east (0 .. 360), any other range of
+// the same angle gives the same x / y.
+//
+// A chunk of positions is projected at once, 4 a step by an AVX2 kernel
+// where the cpu has it (-nosimd: the scalar kernel).  Both evaluate the
+// same polynomials in the same order so they agree to the bit, and the
+// series are carried far enough for well under a millimetre anywhere.
+
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#define LVIS_PROJ_NORTH     3413
+#define LVIS_PROJ_SOUTH     3031
+#define LVIS_PROJ_MAX_PAIRS 2       // geolocations in a record (lgw: first and last sample)
+#define LVIS_PROJ_WGS84_A   6378137.0            // semi-major axis (m)
+#define LVIS_PROJ_WGS84_E2  0.00669437999014     // eccentricity squared
+
+struct lvis_proj
+{
+   int    epsg;         // LVIS_PROJ_NORTH or LVIS_PROJ_SOUTH
+   double sign;         // 1 north, -1 south
+   double lon0;         // central meridian (degrees)
+   double e;            // eccentricity of the ellipsoid
+   double scale;        // a * m(c) / t(c), rho = scale * t(lat)
+   int    scalar;       // -nosimd
+};
+
+// the EPSG code of a -proj argument (3413, north, 3031, south), 0 if unknown
+int  lvis_proj_code(char * name);
+
+// set up the transform of an EPSG code, returns 0 on success
+int  lvis_proj_init(struct lvis_proj * p, int epsg, int scalar);
+
+// x / y of n lon / lat pairs (degrees)
+void lvis_proj_forward(struct lvis_proj * p, const double * lon, const double * lat, double * x, double * y, long n);
+
+// the geolocations of a (host order) record into lon / lat, returns how many
+int  lvis_proj_positions(unsigned char * data, int fileType, float dataVersion, double * lon, double * lat);
+
+// earth centred x / y / z (m) of lon / lat (degrees) on the WGS 84 ellipsoid,
+// for the distances between shots of crossovers, query and dhdt
+void lvis_proj_ecef(double lon, double lat, double * p);
+// the radii of curvature (m) at lat: m along the meridian, n across it
+void lvis_proj_radii(double lat, double * m, double * n);
+
+// the column headers and the values the text conversion appends to a row
+// (each column preceded by delim, no end of line)
+void lvis_proj_print_headers(FILE * out, int fileType, float dataVersion, char * delim);
+void lvis_proj_print(FILE * out, const double * x, const double * y, int npairs, char * delim);
+
+#endif
@@ -0,0 +1,677 @@
+// lvis_release_quantile.c
+//
+// Campaign percentiles from KLL sketches (quantiles mode), see
+// lvis_release_quantile.h.
+//
+// The inputs without a usable sketch file are split into tasks of
+// LVIS_QUANTILE_CHUNK shots which the pool reads (as canonical records)
+// into sketches of their own; like the metrics mode the tasks run in waves
+// of a few per thread, the calling thread merging wave N into the inputs'
+// sketches (and writing the sketch file of an input after its last task)
+// while wave N+1 is worked on.  A compaction keeps the odd or the even
+// half of a level by a generator seeded the same in every sketch, so with
+// the merges in input order the figures do not depend on -threads.
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_quantile.h"
+
+#define LVIS_QUANTILE_BYTEORDER 0x01020304
+#define LVIS_QUANTILE_NAME      32
+
+#pragma pack(1)
+struct lvis_quantile_header
+{
+   char     magic[8];       // LVIS_QUANTILE_MAGIC
+   uint32_t byteorder;      // LVIS_QUANTILE_BYTEORDER as written by the host that made the file
+   uint32_t fileType;       // of the input sketched
+   int64_t  sourceSize;     // bytes and modification time of the input
+   int64_t  sourceTime;
+   int64_t  records;        // shots sketched
+   uint32_t k;
+   uint32_t nfields;        // then per field its name[32], n, min, max, coin, nlevels, sizes, values
+};
+#pragma pack(0)
+
+// the sketches of one input
+struct lvis_quantile_input
+{
+   char                       sketchfile[2048];
+   int                        fileType;
+   int                        nfields;
+   struct lvis_canon_column * columns[LVIS_QUANTILE_MAX_FIELDS];
+   char                       names[LVIS_QUANTILE_MAX_FIELDS][LVIS_QUANTILE_NAME];
+   struct lvis_kll            kll[LVIS_QUANTILE_MAX_FIELDS];
+   int64_t                    records;
+   int                        sketched;    // 1 when read from the data (else from a sketch file)
+   int64_t                    sourceSize,sourceTime;
+};
+
+struct lvis_quantile_task
+{
+   int             file;
+   int64_t         first,count;
+   struct lvis_kll kll[LVIS_QUANTILE_MAX_FIELDS];
+   int64_t         records;
+   int             status;   // 0, -1 on a read error
+};
+
+struct lvis_quantile_job
+{
+   struct lvis_release_options  * opt;
+   struct lvis_quantile_options * o;
+   struct lvis_release_file     * files;
+   struct lvis_quantile_input   * inputs;
+   struct lvis_quantile_task    * tasks;
+   unsigned char               ** raw;         // per worker
+   unsigned char               ** canon;       // per worker
+   // the join: sketches saved as each input completes
+   int                            filtered;
+   int64_t                        shots;
+   int                            saved;
+   int                            errors;
+};
+
+static int lvis_kll_compare(const void * a, const void * b)
+{
+   double x = *(const double *) a, y = *(const double *) b;
+
+   return (x < y) ? -1 : (x > y);
+}
+
+void lvis_kll_init(struct lvis_kll * s, int k)
+{
+   memset(s,0,sizeof(*s));
+   s->k = k;
+   s->nlevels = 1;
+   s->min = HUGE_VAL;
+   s->max = -HUGE_VAL;
+   s->coin = 2463534242u;
+}
+
+void lvis_kll_free(struct lvis_kll * s)
+{
+   int h;
+
+   for(h=0;h<LVIS_QUANTILE_LEVELS;h++) free(s->items[h]);
+   memset(s,0,sizeof(*s));
+}
+
+// the values level h may hold before it is compacted, the top level k
+// and each one below two thirds of the one above
+static int lvis_kll_capacity(struct lvis_kll * s, int h)
+{
+   int c = (int) ceil(s->k * pow(2.0 / 3.0,s->nlevels - 1 - h));
+
+   return (c < 8) ? 8 : c;
+}
+
+static void lvis_kll_reserve(struct lvis_kll * s, int h, int n)
+{
+   if(n <= s->alloc[h]) return;
+   s->alloc[h] = (n < 2 * s->alloc[h]) ? 2 * s->alloc[h] : n;
+   if(s->alloc[h] < 16) s->alloc[h] = 16;
+   if((s->items[h] = (double *) realloc(s->items[h],s->alloc[h] * sizeof(double))) == NULL)
+     {
+	fprintf(stderr,"Unable to allocate a sketch\n");
+	exit(-1);
+     }
+}
+
+// sort level h and move every other value of it up a level, an odd one
+// out staying behind
+static void lvis_kll_compact(struct lvis_kll * s, int h)
+{
+   int m = s->size[h], odd = m & 1, j, up;
+
+   if(h+1 >= LVIS_QUANTILE_LEVELS) return;
+   if(h+1 >= s->nlevels) s->nlevels = h+2;
+   qsort(s->items[h],m,sizeof(double),lvis_kll_compare);
+   s->coin ^= s->coin << 13;
+   s->coin ^= s->coin >> 17;
+   s->coin ^= s->coin << 5;
+   up = (m - odd) / 2;
+   lvis_kll_reserve(s,h+1,s->size[h+1] + up);
+   for(j=odd+(s->coin & 1);j<m;j+=2) s->items[h+1][s->size[h+1]++] = s->items[h][j];
+   s->size[h] = odd;
+}
+
+static void lvis_kll_compress(struct lvis_kll * s)
+{
+   int h;
+
+   for(h=0;h<s->nlevels;h++)
+     while(s->size[h] >= lvis_kll_capacity(s,h) && h+1 < LVIS_QUANTILE_LEVELS) lvis_kll_compact(s,h);
+}
+
+void lvis_kll_add(struct lvis_kll * s, double v)
+{
+   int h;
+
+   if(v != v) return;
+   s->n++;
+   if(v < s->min) s->min = v;
+   if(v > s->max) s->max = v;
+   lvis_kll_reserve(s,0,s->size[0] + 1);
+   s->items[0][s->size[0]++] = v;
+   for(h=0;h<s->nlevels && s->size[h] >= lvis_kll_capacity(s,h);h++) lvis_kll_compact(s,h);
+}
+
+void lvis_kll_merge(struct lvis_kll * a, struct lvis_kll * b)
+{
+   int h;
+
+   if(b->n == 0) return;
+   a->n += b->n;
+   if(b->min < a->min) a->min = b->min;
+   if(b->max > a->max) a->max = b->max;
+   if(b->nlevels > a->nlevels) a->nlevels = b->nlevels;
+   for(h=0;h<b->nlevels;h++)
+     {
+	if(b->size[h] == 0) continue;
+	lvis_kll_reserve(a,h,a->size[h] + b->size[h]);
+	memcpy(a->items[h] + a->size[h],b->items[h],b->size[h] * sizeof(double));
+	a->size[h] += b->size[h];
+     }
+   lvis_kll_compress(a);
+}
+
+struct lvis_kll_item
+{
+   double  value;
+   int64_t weight;
+};
+
+static int lvis_kll_item_compare(const void * a, const void * b)
+{
+   return lvis_kll_compare(&((const struct lvis_kll_item *) a)->value,&((const struct lvis_kll_item *) b)->value);
+}
+
+void lvis_kll_quantiles(struct lvis_kll * s, const double * q, int n, double * out)
+{
+   struct lvis_kll_item * items;
+   int64_t                total=0,cum;
+   long                   count=0,j;
+   int                    h,i;
+
+   for(h=0;h<s->nlevels;h++) total += s->size[h];
+   if(s->n == 0 || total == 0)
+     {
+	for(i=0;i<n;i++) out[i] = NAN;
+	return;
+     }
+   if((items = (struct lvis_kll_item *) malloc(total * sizeof(struct lvis_kll_item))) == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the sketch values\n");
+	exit(-1);
+     }
+   for(h=0;h<s->nlevels;h++)
+     for(j=0;j<s->size[h];j++)
+       {
+	  items[count].value = s->items[h][j];
+	  items[count].weight = (int64_t) 1 << h;
+	  count++;
+       }
+   qsort(items,count,sizeof(struct lvis_kll_item),lvis_kll_item_compare);
+   for(i=0;i<n;i++)
+     {
+	if(q[i] <= 0.0) { out[i] = s->min; continue; }
+	if(q[i] >= 1.0) { out[i] = s->max; continue; }
+	for(cum=0,j=0;j<count-1;j++)
+	  {
+	     cum += items[j].weight;
+	     if(cum >= q[i] * s->n) break;
+	  }
+	out[i] = items[j].value;
+     }
+   free(items);
+}
+
+void lvis_quantile_defaults(struct lvis_quantile_options * o)
+{
+   static const double q[] = { 1, 5, 25, 50, 75, 95, 99 };
+
+   memcpy(o->q,q,sizeof(q));
+   o->nq = sizeof(q) / sizeof(q[0]);
+   o->k = LVIS_QUANTILE_K;
+   o->persist = 1;
+   o->rebuild = 0;
+   o->fields[0] = 0;
+}
+
+int lvis_quantile_parse_option(int argc, char * argv[], int i, struct lvis_quantile_options * o)
+{
+   char * p,* end;
+
+   if(strcmp(argv[i],"-q")==0 && i+1<argc)
+     {
+	o->nq = 0;
+	for(p=argv[i+1];*p && o->nq < LVIS_QUANTILE_MAX_Q;p=(*end==',') ? end+1 : end)
+	  {
+	     o->q[o->nq] = strtod(p,&end);
+	     if(end == p || !(o->q[o->nq] >= 0.0 && o->q[o->nq] <= 100.0))
+	       {
+		  fprintf(stderr,"Invalid argument to -q (percentiles 0 .. 100, comma separated): %s\n",argv[i+1]);
+		  exit(-1);
+	       }
+	     o->nq++;
+	  }
+	return 2;
+     }
+   if(strcmp(argv[i],"-sketchk")==0 && i+1<argc)
+     {
+	o->k = atoi(argv[i+1]);
+	if(o->k < 8) o->k = 8;
+	return 2;
+     }
+   if(strcmp(argv[i],"-nosketch")==0)
+     {
+	o->persist = 0;
+	return 1;
+     }
+   if(strcmp(argv[i],"-resketch")==0)
+     {
+	o->rebuild = 1;
+	return 1;
+     }
+   return 0;
+}
+
+// is filename a sketch file?
+static int lvis_quantile_is_sketch(char * filename)
+{
+   char   magic[8];
+   FILE * fp;
+   int    is;
+
+   if((fp = fopen(filename,"rb")) == NULL) return 0;
+   is = (fread(magic,8,1,fp)==1 && memcmp(magic,LVIS_QUANTILE_MAGIC,8)==0);
+   fclose(fp);
+   return is;
+}
+
+// read the sketches of in from its sketch file, returns 0 on success (-1
+// if there is none, it is from another host / -sketchk or it is out of
+// date when source is given)
+static int lvis_quantile_load(struct lvis_quantile_input * in, struct lvis_quantile_options * o, int source)
+{
+   struct lvis_quantile_header hdr;
+   struct lvis_kll           * s;
+   uint32_t                    u[2],size[LVIS_QUANTILE_LEVELS];
+   FILE                      * fp;
+   int                         f,h,ok=1;
+
+   if((fp = fopen(in->sketchfile,"rb")) == NULL) return -1;
+   if(fread(&hdr,sizeof(hdr),1,fp)!=1 || memcmp(hdr.magic,LVIS_QUANTILE_MAGIC,8)!=0 ||
+      hdr.byteorder != LVIS_QUANTILE_BYTEORDER || hdr.nfields > LVIS_QUANTILE_MAX_FIELDS ||
+      (source && (hdr.sourceSize != in->sourceSize || hdr.sourceTime != in->sourceTime || (int) hdr.k != o->k)))
+     {
+	fclose(fp);
+	return -1;
+     }
+   in->fileType = hdr.fileType;
+   in->records = hdr.records;
+   in->nfields = hdr.nfields;
+   for(f=0;f<in->nfields && ok;f++)
+     {
+	s = &in->kll[f];
+	lvis_kll_init(s,hdr.k);
+	ok = (fread(in->names[f],LVIS_QUANTILE_NAME,1,fp)==1 && fread(&s->n,sizeof(s->n),1,fp)==1 &&
+	      fread(&s->min,sizeof(double),1,fp)==1 && fread(&s->max,sizeof(double),1,fp)==1 &&
+	      fread(u,sizeof(u),1,fp)==1 && u[1] >= 1 && u[1] <= LVIS_QUANTILE_LEVELS &&
+	      fread(size,sizeof(uint32_t),u[1],fp)==u[1]);
+	in->names[f][LVIS_QUANTILE_NAME-1] = 0;
+	if(!ok) break;
+	s->coin = u[0];
+	s->nlevels = u[1];
+	for(h=0;h<s->nlevels && ok;h++)
+	  {
+	     lvis_kll_reserve(s,h,size[h]);
+	     s->size[h] = size[h];
+	     ok = (size[h] == 0 || fread(s->items[h],sizeof(double),size[h],fp)==size[h]);
+	  }
+     }
+   fclose(fp);
+   if(!ok)
+     {
+	fprintf(stderr,"The sketch file %s is damaged\n",in->sketchfile);
+	for(f=0;f<in->nfields;f++) lvis_kll_free(&in->kll[f]);
+	in->nfields = 0;
+	return -1;
+     }
+   return 0;
+}
+
+static int lvis_quantile_save(struct lvis_quantile_input * in, struct lvis_quantile_options * o)
+{
+   struct lvis_quantile_header hdr;
+   struct lvis_kll           * s;
+   uint32_t                    u[2],size[LVIS_QUANTILE_LEVELS];
+   FILE                      * fp;
+   int                         f,h,ok;
+
+   memset(&hdr,0,sizeof(hdr));
+   memcpy(hdr.magic,LVIS_QUANTILE_MAGIC,8);
+   hdr.byteorder = LVIS_QUANTILE_BYTEORDER;
+   hdr.fileType = in->fileType;
+   hdr.sourceSize = in->sourceSize;
+   hdr.sourceTime = in->sourceTime;
+   hdr.records = in->records;
+   hdr.k = o->k;
+   hdr.nfields = in->nfields;
+   if((fp = fopen(in->sketchfile,"wb")) == NULL)
+     {
+	fprintf(stderr,"Unable to write the sketch file %s (%s), continuing without it\n",in->sketchfile,strerror(errno));
+	return -1;
+     }
+   ok = (fwrite(&hdr,sizeof(hdr),1,fp)==1);
+   for(f=0;f<in->nfields && ok;f++)
+     {
+	s = &in->kll[f];
+	u[0] = s->coin;
+	u[1] = s->nlevels;
+	for(h=0;h<s->nlevels;h++) size[h] = s->size[h];
+	ok = (fwrite(in->names[f],LVIS_QUANTILE_NAME,1,fp)==1 && fwrite(&s->n,sizeof(s->n),1,fp)==1 &&
+	      fwrite(&s->min,sizeof(double),1,fp)==1 && fwrite(&s->max,sizeof(double),1,fp)==1 &&
+	      fwrite(u,sizeof(u),1,fp)==1 && fwrite(size,sizeof(uint32_t),u[1],fp)==u[1]);
+	for(h=0;h<s->nlevels && ok;h++)
+	  ok = (s->size[h] == 0 || fwrite(s->items[h],sizeof(double),s->size[h],fp)==(size_t) s->size[h]);
+     }
+   if(fclose(fp)!=0) ok = 0;
+   if(!ok)
+     {
+	fprintf(stderr,"Unable to write the sketch file %s (%s), continuing without it\n",in->sketchfile,strerror(errno));
+	remove(in->sketchfile);
+	return -1;
+     }
+   return 0;
+}
+
+static void lvis_quantile_run(void * context, long t, int worker)
+{
+   struct lvis_quantile_job   * job = (struct lvis_quantile_job *) context;
+   struct lvis_quantile_task  * task = &job->tasks[t];
+   struct lvis_quantile_input * in = &job->inputs[task->file];
+   struct lvis_release_options * opt = job->opt;
+   struct lvis_canon_column   * c;
+   size_t                       size = lvis_record_size(in->fileType,(float)1.04);
+   unsigned char              * rec;
+   int64_t                      i,got;
+   double                       lon,lat,v;
+   uint32_t                     u;
+   float                        f;
+   int                          k;
+
+   for(k=0;k<in->nfields;k++) lvis_kll_init(&task->kll[k],job->o->k);
+   got = lvis_canon_read(&job->files[task->file],task->first,task->count,job->raw[worker],job->canon[worker]);
+   if(got != task->count) task->status = -1;
+   for(i=0;i<got;i++)
+     {
+	rec = job->canon[worker] + i * size;
+	release_data_position(rec,in->fileType,(float)1.04,&lon,&lat);
+	if(!lvis_release_keep(opt,lon,lat))
+	  continue;
+	task->records++;
+	for(k=0;k<in->nfields;k++)
+	  {
+	     c = in->columns[k];
+	     if(c->kind == LVIS_CANON_UINT32)
+	       {
+		  memcpy(&u,rec + c->offset,sizeof(u));
+		  if(u == LVIS_CANON_NO_ID) continue;
+		  v = u;
+	       }
+	     else if(c->kind == LVIS_CANON_FLOAT32)
+	       {
+		  memcpy(&f,rec + c->offset,sizeof(f));
+		  v = f;
+	       }
+	     else memcpy(&v,rec + c->offset,sizeof(v));
+	     lvis_kll_add(&task->kll[k],v);
+	  }
+     }
+}
+
+static int lvis_quantile_input(void * context, long t)
+{
+   return ((struct lvis_quantile_job *) context)->tasks[t].file;
+}
+
+// a task's sketches into its input's, in order, saving an input's when it completes
+static void lvis_quantile_join(void * context, long t)
+{
+   struct lvis_quantile_job   * job = (struct lvis_quantile_job *) context;
+   struct lvis_quantile_task  * task = &job->tasks[t];
+   struct lvis_quantile_input * in = &job->inputs[task->file];
+   int                          f;
+
+   if(task->status != 0)
+     {
+	fprintf(stderr,"Short read in %s at record %lld\n",job->files[task->file].filename,(long long) task->first);
+	job->errors++;
+     }
+   for(f=0;f<in->nfields;f++)
+     {
+	lvis_kll_merge(&in->kll[f],&task->kll[f]);
+	lvis_kll_free(&task->kll[f]);
+     }
+   in->records += task->records;
+   job->shots += task->count;
+   if(task->first + task->count >= job->files[task->file].recordCount &&
+      job->o->persist && !job->filtered && task->status == 0)
+     job->saved += (lvis_quantile_save(in,job->o)==0);
+}
+
+// is name one of the -fields (or are there none)?
+static int lvis_quantile_wanted(char * fields, char * name)
+{
+   size_t n = strlen(name);
+   char * p;
+
+   if(fields[0] == 0) return 1;
+   for(p=fields;(p = strstr(p,name)) != NULL;p++)
+     if((p == fields || p[-1] == ',') && (p[n] == 0 || p[n] == ',')) return 1;
+   return 0;
+}
+
+int lvis_quantile_report(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			 struct lvis_batch_options * b, struct lvis_quantile_options * o)
+{
+   struct lvis_quantile_job     job;
+   struct lvis_quantile_input * in;
+   struct lvis_pool           * pool;
+   struct lvis_canon_column   * c;
+   struct lvis_kll              total;
+   struct stat                  st;
+   FILE                       * out;
+   char                         names[LVIS_QUANTILE_MAX_FIELDS * 4][LVIS_QUANTILE_NAME],* base;
+   double                       q[LVIS_QUANTILE_MAX_Q],value[LVIS_QUANTILE_MAX_Q];
+   long                         ntasks=0,maxtasks=0;
+   int64_t                      n,first;
+   int                          k,f,j,nnames=0,threads=0,filtered,sketched=0,loaded=0,saved=0,errors=0;
+
+   // the sketch files hold whole inputs, not a cut of them
+   filtered = (opt->minlat > -400.0 || opt->maxlat < 400.0 || opt->minlon > -400.0 || opt->maxlon < 400.0 ||
+	       opt->poly != NULL || opt->maxSampleNumber > 0);
+
+   memset(&job,0,sizeof(job));
+   job.opt = opt;
+   job.o = o;
+   job.files = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file));
+   job.inputs = (struct lvis_quantile_input *) calloc(ninputs,sizeof(struct lvis_quantile_input));
+   if(job.files == NULL || job.inputs == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     {
+	in = &job.inputs[k];
+
+	// a sketch file given as an input
+	if(lvis_quantile_is_sketch(inputs[k]))
+	  {
+	     strncpy(in->sketchfile,inputs[k],sizeof(in->sketchfile)-1);
+	     if(lvis_quantile_load(in,o,0)!=0)
+	       {
+		  fprintf(stderr,"Unable to use the sketch file %s\n",inputs[k]);
+		  errors++;
+	       }
+	     if(filtered)
+	       fprintf(stderr,"%s holds a whole input, -lat / -lon / -poly / -n do not apply to it\n",inputs[k]);
+	     loaded++;
+	     continue;
+	  }
+
+	if(lvis_file_open(&job.files[k],inputs[k],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	lvis_file_close(&job.files[k]);
+	if(stat(inputs[k],&st)==0)
+	  {
+	     in->sourceSize = (int64_t) st.st_size;
+	     in->sourceTime = (int64_t) st.st_mtime;
+	  }
+	if(b->outdir[0] != 0)
+	  {
+	     base = strrchr(inputs[k],'/');
+	     base = (base == NULL) ? inputs[k] : base+1;
+	     snprintf(in->sketchfile,sizeof(in->sketchfile),"%s/%s%s",b->outdir,base,LVIS_QUANTILE_SUFFIX);
+	  }
+	else
+	  snprintf(in->sketchfile,sizeof(in->sketchfile),"%s%s",inputs[k],LVIS_QUANTILE_SUFFIX);
+	if(o->persist && !o->rebuild && !filtered && lvis_quantile_load(in,o,1)==0 &&
+	   (int) in->fileType == job.files[k].fileType)
+	  { loaded++; continue; }
+
+	// sketch every numeric scalar of the record
+	in->fileType = job.files[k].fileType;
+	in->nfields = 0;
+	for(c=lvis_canon_columns(in->fileType);c->name!=NULL && in->nfields<LVIS_QUANTILE_MAX_FIELDS;c++)
+	  if(c->count == 1 && c->kind != LVIS_CANON_UINT16)
+	    {
+	       in->columns[in->nfields] = c;
+	       strncpy(in->names[in->nfields],c->name,LVIS_QUANTILE_NAME-1);
+	       lvis_kll_init(&in->kll[in->nfields],o->k);
+	       in->nfields++;
+	    }
+	in->sketched = 1;
+	sketched++;
+	n = job.files[k].recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+	job.files[k].recordCount = n;
+	maxtasks += (long) ((n + LVIS_QUANTILE_CHUNK - 1) / LVIS_QUANTILE_CHUNK);
+     }
+   if(errors > 0)
+     {
+	for(k=0;k<ninputs;k++) for(f=0;f<job.inputs[k].nfields;f++) lvis_kll_free(&job.inputs[k].kll[f]);
+	free(job.inputs);
+	free(job.files);
+	return errors;
+     }
+
+   job.tasks = (struct lvis_quantile_task *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_quantile_task));
+   if(job.tasks == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the task table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     if(job.inputs[k].sketched)
+       for(first=0;first<job.files[k].recordCount;first+=LVIS_QUANTILE_CHUNK)
+	 {
+	    job.tasks[ntasks].file  = k;
+	    job.tasks[ntasks].first = first;
+	    job.tasks[ntasks].count = (job.files[k].recordCount - first < LVIS_QUANTILE_CHUNK) ?
+	      job.files[k].recordCount - first : LVIS_QUANTILE_CHUNK;
+	    ntasks++;
+	 }
+
+   // an input of no records has no tasks, its (empty) sketches are done
+   for(k=0;k<ninputs;k++)
+     if(job.inputs[k].sketched && job.files[k].recordCount == 0 && o->persist && !filtered)
+       saved += (lvis_quantile_save(&job.inputs[k],o)==0);
+
+   if(ntasks > 0)
+     {
+	pool = lvis_pool_create(b->nthreads);
+	threads = lvis_pool_threads(pool);
+	lvis_batch_buffers(threads,LVIS_QUANTILE_CHUNK,sizeof(union lvis_canon_record),&job.raw,&job.canon);
+
+	// run the waves, merging wave N while wave N+1 is worked on
+	job.filtered = filtered;
+	job.saved = saved;
+	lvis_batch_waves(pool,0,ntasks,job.files,lvis_quantile_input,lvis_quantile_run,lvis_quantile_join,&job);
+	saved = job.saved;
+	errors += job.errors;
+	lvis_pool_destroy(pool);
+     }
+
+   // the fields in the order met, each merged over every input that has it
+   for(k=0;k<ninputs;k++)
+     for(f=0;f<job.inputs[k].nfields;f++)
+       {
+	  for(j=0;j<nnames && strcmp(names[j],job.inputs[k].names[f])!=0;j++);
+	  if(j == nnames && nnames < LVIS_QUANTILE_MAX_FIELDS * 4 && lvis_quantile_wanted(o->fields,job.inputs[k].names[f]))
+	    strcpy(names[nnames++],job.inputs[k].names[f]);
+       }
+   if(o->fields[0] != 0 && nnames == 0)
+     {
+	fprintf(stderr,"None of the inputs has the -fields %s\n",o->fields);
+	errors++;
+     }
+
+   out = stdout;
+   if(opt->outfile[0] != 0 && (out = fopen(opt->outfile,"w"))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	exit(-1);
+     }
+   if(opt->topcol == 1)
+     {
+	fprintf(out,"field%scount%smin",opt->delim,opt->delim);
+	for(j=0;j<o->nq;j++) fprintf(out,"%sp%g",opt->delim,o->q[j]);
+	fprintf(out,"%smax\n",opt->delim);
+     }
+   for(j=0;j<o->nq;j++) q[j] = o->q[j] / 100.0;
+   for(j=0;j<nnames;j++)
+     {
+	lvis_kll_init(&total,o->k);
+	for(k=0;k<ninputs;k++)
+	  for(f=0;f<job.inputs[k].nfields;f++)
+	    if(strcmp(job.inputs[k].names[f],names[j])==0) lvis_kll_merge(&total,&job.inputs[k].kll[f]);
+	lvis_kll_quantiles(&total,q,o->nq,value);
+	fprintf(out,"%s%s%lld%s%.10g",names[j],opt->delim,(long long) total.n,opt->delim,
+		total.n > 0 ? total.min : NAN);
+	for(f=0;f<o->nq;f++) fprintf(out,"%s%.10g",opt->delim,value[f]);
+	fprintf(out,"%s%.10g\n",opt->delim,total.n > 0 ? total.max : NAN);
+	lvis_kll_free(&total);
+     }
+   if(out != stdout && fclose(out)!=0)
+     {
+	fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	errors++;
+     }
+   fflush(stdout);
+   fprintf(stderr,"quantiles: %d inputs, %d sketched (%lld shots, %d sketch files written), %d from sketch files\n",
+	   ninputs,sketched,(long long) job.shots,saved,loaded);
+
+   lvis_batch_free_buffers(threads,job.raw,job.canon);
+   for(k=0;k<ninputs;k++) for(f=0;f<job.inputs[k].nfields;f++) lvis_kll_free(&job.inputs[k].kll[f]);
+   free(job.tasks);
+   free(job.inputs);
+   free(job.files);
+   return errors;
+}
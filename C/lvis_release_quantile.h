@@ -0,0 +1,86 @@
+#ifndef __LVIS_RELEASE_QUANTILE_H
+#define __LVIS_RELEASE_QUANTILE_H
+
+// lvis_release_quantile.h
+//
+// quantiles mode: percentiles of the fields of a whole campaign without
+// sorting it.  Every numeric scalar field of every input goes into a KLL
+// sketch (Karnin, Lang & Liberty): levels of sampled values, a value of
+// level h standing for 2^h of the input, each level compacted into the
+// one above when it outgrows its share of -sketchk.  A sketch takes
+// O(-sketchk) values whatever the count and a quantile is off by about
+// 1.7 / -sketchk of the count in rank; sketches merge into a sketch of
+// the union, so the inputs are sketched in parallel (a chunk of shots a
+// task, merged in input order) and then merged into the campaign's.
+//
+// Each input's sketches are kept next to it as <input>.sketch (or in
+// -odir) with the size and time of the input they were made from; a later
+// run over the same inputs reads the sketch files instead of the data, and
+// .sketch files may be given as inputs themselves.  The sketches hold the
+// whole file: with -lat / -lon / -poly / -n they are made for the run only.
+//
+// The rows are field, count, min, one column per -q percentile and max
+// (min and max exact); -fields picks the fields (default all of them).
+
+#include <stdint.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_QUANTILE_K
+#define  LVIS_QUANTILE_K 200          // default -sketchk
+#endif
+
+#ifndef  LVIS_QUANTILE_CHUNK
+#define  LVIS_QUANTILE_CHUNK 16384    // shots per task
+#endif
+
+#define  LVIS_QUANTILE_MAGIC      "LVISKLL1"
+#define  LVIS_QUANTILE_SUFFIX     ".sketch"
+#define  LVIS_QUANTILE_LEVELS     48      // 2^48 values at most
+#define  LVIS_QUANTILE_MAX_Q      64
+#define  LVIS_QUANTILE_MAX_FIELDS 16
+
+struct lvis_quantile_options
+{
+   double q[LVIS_QUANTILE_MAX_Q];   // -q percentiles (0 .. 100)
+   int    nq;
+   int    k;                        // -sketchk K
+   int    persist;                  // 0 with -nosketch: neither read nor write sketch files
+   int    rebuild;                  // -resketch: make them again
+   char   fields[4096];             // -fields a,b (empty = all)
+};
+
+// a KLL sketch of one field
+struct lvis_kll
+{
+   int      k;
+   int      nlevels;
+   int64_t  n;                      // values seen
+   double   min,max;
+   double * items[LVIS_QUANTILE_LEVELS];
+   int      size[LVIS_QUANTILE_LEVELS];
+   int      alloc[LVIS_QUANTILE_LEVELS];
+   uint32_t coin;                   // which half a compaction keeps, in turn
+};
+
+void   lvis_kll_init(struct lvis_kll * s, int k);
+void   lvis_kll_free(struct lvis_kll * s);
+void   lvis_kll_add(struct lvis_kll * s, double v);
+// merge b into a (b is left as it was)
+void   lvis_kll_merge(struct lvis_kll * a, struct lvis_kll * b);
+// the values at the fractions q[0 .. n-1] (0 .. 1) of the ranks, nan when empty
+void   lvis_kll_quantiles(struct lvis_kll * s, const double * q, int n, double * out);
+
+void lvis_quantile_defaults(struct lvis_quantile_options * o);
+
+// handle the quantile options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a quantile option)
+int  lvis_quantile_parse_option(int argc, char * argv[], int i, struct lvis_quantile_options * o);
+
+// the percentiles of the inputs to stdout (or opt->outfile), returns 0 on
+// success
+struct lvis_batch_options;
+int  lvis_quantile_report(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			  struct lvis_batch_options * b, struct lvis_quantile_options * o);
+
+#endif
@@ -0,0 +1,761 @@
+// lvis_release_query.c
+//
+// Radius and nearest shot queries (query mode), see lvis_release_query.h.
+//
+// The shots are read on the pool in waves, as in the other modes, into
+// one array of positions (x, y, z and the file / record they came from).
+// The tree is implicit in that array: a node is the middle element of its
+// range, the shots before it are on the low side of its split axis and
+// those after it on the high side, and a range of LVIS_QUERY_LEAF or fewer
+// is a leaf, scanned in full.  Only the split axis of each node is kept
+// next to it.  Nothing depends on the number of threads, so the tree and
+// the answers are the same on any.
+//
+// A wave of query blocks is searched, then the files their shots are in
+// are opened, the rows rendered (each block into its own text) and
+// written in order.
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_proj.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_query.h"
+
+#define LVIS_QUERY_FILE_SHIFT 40                  // ref = file << 40 | record
+
+struct lvis_query_shot
+{
+   double  p[3];      // earth centred x, y, z (m)
+   int64_t ref;       // input file and record
+};
+
+struct lvis_query_hit
+{
+   double  d2;        // squared chord (m^2)
+   int64_t ref;
+};
+
+// a chunk of an input, read into the shot array
+struct lvis_query_read
+{
+   int     file;
+   int64_t first,count;
+   int64_t offset;    // where its shots go in the shot array
+   int64_t kept;
+   int     status;    // 0, -1 on a read error
+};
+
+struct lvis_query_point
+{
+   double  lon,lat;
+   double  p[3];
+   double  rho;       // radius of curvature there (m)
+};
+
+struct lvis_query_block
+{
+   long                    first,count;   // query points
+   struct lvis_query_hit * hits;          // of every point, in turn
+   long                  * start;         // count + 1 offsets into hits
+   char                  * text;          // the rendered rows
+   size_t                  length;
+   int                     status;        // 0, -1 on a read or render error
+};
+
+// per worker search state
+struct lvis_query_search
+{
+   double                  q[3];
+   double                  bound;         // squared chord a shot has to be within
+   double                  limit;         // -radius as a squared chord (HUGE_VAL without)
+   long                    knn;           // 0: every shot within the bound
+   struct lvis_query_hit * hit;           // max heap (knn) or list
+   long                    n,max;
+};
+
+struct lvis_query_range
+{
+   long lo,hi;
+};
+
+struct lvis_query_job
+{
+   struct lvis_release_options * opt;
+   struct lvis_query_options   * q;
+   struct lvis_release_file    * files;
+   int                           fileType;
+   struct lvis_query_read      * reads;
+   long                          base;       // first block of the running wave
+   unsigned char              ** raw;        // per worker
+   unsigned char              ** canon;      // per worker
+   // the tree
+   struct lvis_query_shot      * shots;
+   unsigned char               * dim;        // split axis of the node at each index
+   long                          nshots;
+   struct lvis_query_range     * ranges;     // the nodes of the level being split
+   // the queries
+   struct lvis_query_point     * points;
+   long                          npoints;
+   struct lvis_query_block     * blocks;
+   struct lvis_query_search    * search;     // per worker
+   int                           errors;     // short reads of the positions
+};
+
+void lvis_query_defaults(struct lvis_query_options * q)
+{
+   memset(q,0,sizeof(struct lvis_query_options));
+}
+
+int lvis_query_parse_option(int argc, char * argv[], int i, struct lvis_query_options * q)
+{
+   if(strcmp(argv[i],"-points")==0 && i+1<argc)
+     {
+	strncpy(q->points,argv[i+1],sizeof(q->points)-1);
+	return 2;
+     }
+   if(strcmp(argv[i],"-radius")==0 && i+1<argc)
+     {
+	q->radius = atof(argv[i+1]);
+	return 2;
+     }
+   if(strcmp(argv[i],"-knn")==0 && i+1<argc)
+     {
+	q->knn = atol(argv[i+1]);
+	if(q->knn < 1) q->knn = 1;
+	return 2;
+     }
+   return 0;
+}
+
+static double lvis_query_d2(const double * a, const double * b)
+{
+   double dx = a[0] - b[0],dy = a[1] - b[1],dz = a[2] - b[2];
+
+   return dx * dx + dy * dy + dz * dz;
+}
+
+// the surface distance of a chord, bent over the radius rho
+static double lvis_query_arc(double d2, double rho)
+{
+   double s = sqrt(d2) / (2.0 * rho);
+
+   return 2.0 * rho * asin(s < 1.0 ? s : 1.0);
+}
+
+// -------------------------------------------------------------------------
+// the shots
+
+static void lvis_query_read_run(void * context, long t, int worker)
+{
+   struct lvis_query_job    * job = (struct lvis_query_job *) context;
+   struct lvis_query_read   * task = &job->reads[t];
+   struct lvis_release_file * f = &job->files[task->file];
+   struct lvis_query_shot   * s = job->shots + task->offset;
+   unsigned char            * rec;
+   double                     lon,lat;
+   int64_t                    i,got;
+   int                        size = lvis_record_size(f->fileType,(float)1.04);
+
+   got = lvis_canon_read(f,task->first,task->count,job->raw[worker],job->canon[worker]);
+   if(got != task->count) task->status = -1;
+   for(i=0;i<got;i++)
+     {
+	rec = job->canon[worker] + i * size;
+	release_data_position(rec,f->fileType,(float)1.04,&lon,&lat);
+	if(!(lon == lon && lat == lat)) continue;
+	if(!lvis_release_keep(job->opt,lon,lat)) continue;
+	lvis_proj_ecef(lon,lat,s->p);
+	s->ref = ((int64_t) task->file << LVIS_QUERY_FILE_SHIFT) | (task->first + i);
+	s++;
+	task->kept++;
+     }
+}
+
+// -------------------------------------------------------------------------
+// the tree
+
+// put the k-th smallest shot of lo .. hi-1 on axis d at k, the smaller
+// ones before it and the larger ones after it
+static void lvis_query_select(struct lvis_query_shot * s, long lo, long hi, long k, int d)
+{
+   struct lvis_query_shot t;
+   double                 a,b,c,pivot;
+   long                   l = lo,r = hi - 1,i,j;
+
+   while(r > l)
+     {
+	a = s[l].p[d]; b = s[l + (r - l) / 2].p[d]; c = s[r].p[d];
+	pivot = (a < b) ? ((b < c) ? b : ((a < c) ? c : a)) : ((a < c) ? a : ((b < c) ? c : b));
+	i = l; j = r;
+	while(i <= j)
+	  {
+	     while(s[i].p[d] < pivot) i++;
+	     while(s[j].p[d] > pivot) j--;
+	     if(i <= j) { t = s[i]; s[i] = s[j]; s[j] = t; i++; j--; }
+	  }
+	if(k <= j) r = j;
+	else if(k >= i) l = i;
+	else break;
+     }
+}
+
+// split the node of lo .. hi-1 on its widest axis, returns its index
+static long lvis_query_split(struct lvis_query_job * job, long lo, long hi)
+{
+   double min[3],max[3];
+   long   k,m = lo + (hi - lo) / 2;
+   int    d,axis=0;
+
+   for(d=0;d<3;d++) min[d] = max[d] = job->shots[lo].p[d];
+   for(k=lo+1;k<hi;k++)
+     for(d=0;d<3;d++)
+       {
+	  if(job->shots[k].p[d] < min[d]) min[d] = job->shots[k].p[d];
+	  if(job->shots[k].p[d] > max[d]) max[d] = job->shots[k].p[d];
+       }
+   for(d=1;d<3;d++)
+     if(max[d] - min[d] > max[axis] - min[axis]) axis = d;
+   lvis_query_select(job->shots,lo,hi,m,axis);
+   job->dim[m] = (unsigned char) axis;
+   return m;
+}
+
+static void lvis_query_build(struct lvis_query_job * job, long lo, long hi)
+{
+   long m;
+
+   while(hi - lo > LVIS_QUERY_LEAF)
+     {
+	m = lvis_query_split(job,lo,hi);
+	lvis_query_build(job,lo,m);
+	lo = m + 1;
+     }
+}
+
+// one node of a top level
+static void lvis_query_split_run(void * context, long t, int worker)
+{
+   struct lvis_query_job * job = (struct lvis_query_job *) context;
+
+   lvis_query_split(job,job->ranges[t].lo,job->ranges[t].hi);
+}
+
+// one subtree below the top levels
+static void lvis_query_build_run(void * context, long t, int worker)
+{
+   struct lvis_query_job * job = (struct lvis_query_job *) context;
+
+   lvis_query_build(job,job->ranges[t].lo,job->ranges[t].hi);
+}
+
+// split the top levels a level at a time until there are a few subtrees
+// a thread, then build those
+static void lvis_query_tree(struct lvis_query_job * job, struct lvis_pool * pool)
+{
+   struct lvis_query_range * next;
+   long                      n=1,k,j,m,want = 4 * lvis_pool_threads(pool);
+
+   job->ranges = (struct lvis_query_range *) malloc(2 * want * sizeof(struct lvis_query_range));
+   next = (struct lvis_query_range *) malloc(2 * want * sizeof(struct lvis_query_range));
+   if(job->ranges == NULL || next == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the tree\n");
+	exit(-1);
+     }
+   job->ranges[0].lo = 0;
+   job->ranges[0].hi = job->nshots;
+   while(n < want)
+     {
+	for(k=0;k<n;k++)
+	  if(job->ranges[k].hi - job->ranges[k].lo > LVIS_QUERY_LEAF) break;
+	if(k == n) break;
+	// the leaves stay as they are, every other node is split
+	for(j=k=0;k<n;k++)
+	  if(job->ranges[k].hi - job->ranges[k].lo > LVIS_QUERY_LEAF) job->ranges[j++] = job->ranges[k];
+	n = j;
+	lvis_pool_run(pool,n,lvis_query_split_run,job);
+	for(j=k=0;k<n;k++)
+	  {
+	     m = job->ranges[k].lo + (job->ranges[k].hi - job->ranges[k].lo) / 2;
+	     next[j].lo = job->ranges[k].lo; next[j++].hi = m;
+	     next[j].lo = m + 1; next[j++].hi = job->ranges[k].hi;
+	  }
+	memcpy(job->ranges,next,j * sizeof(struct lvis_query_range));
+	n = j;
+     }
+   lvis_pool_run(pool,n,lvis_query_build_run,job);
+   free(next);
+   free(job->ranges);
+   job->ranges = NULL;
+}
+
+// -------------------------------------------------------------------------
+// the search
+
+static void lvis_query_sift(struct lvis_query_hit * h, long n)
+{
+   struct lvis_query_hit t;
+   long                  i=0,c;
+
+   while((c = 2 * i + 1) < n)
+     {
+	if(c + 1 < n && h[c + 1].d2 > h[c].d2) c++;
+	if(h[c].d2 <= h[i].d2) break;
+	t = h[i]; h[i] = h[c]; h[c] = t;
+	i = c;
+     }
+}
+
+static void lvis_query_offer(struct lvis_query_search * s, struct lvis_query_shot * shot)
+{
+   struct lvis_query_hit t;
+   double                d2 = lvis_query_d2(s->q,shot->p);
+   long                  i,parent;
+
+   if(d2 > s->bound) return;
+   if(s->knn > 0 && s->n == s->knn)
+     {
+	// full: replace the farthest
+	if(d2 >= s->hit[0].d2) return;
+	s->hit[0].d2 = d2;
+	s->hit[0].ref = shot->ref;
+	lvis_query_sift(s->hit,s->n);
+	s->bound = s->hit[0].d2;
+	return;
+     }
+   if(s->n == s->max)
+     {
+	s->max = 2 * s->max + 64;
+	if((s->hit = (struct lvis_query_hit *) realloc(s->hit,s->max * sizeof(struct lvis_query_hit)))==NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the query results\n");
+	     exit(-1);
+	  }
+     }
+   s->hit[s->n].d2 = d2;
+   s->hit[s->n].ref = shot->ref;
+   s->n++;
+   if(s->knn == 0) return;
+   for(i=s->n-1;i>0;i=parent)
+     {
+	parent = (i - 1) / 2;
+	if(s->hit[parent].d2 >= s->hit[i].d2) break;
+	t = s->hit[i]; s->hit[i] = s->hit[parent]; s->hit[parent] = t;
+     }
+   if(s->n == s->knn) s->bound = s->hit[0].d2;
+}
+
+static void lvis_query_visit(struct lvis_query_job * job, long lo, long hi, struct lvis_query_search * s)
+{
+   double diff;
+   long   m;
+   int    d;
+
+   while(hi - lo > LVIS_QUERY_LEAF)
+     {
+	m = lo + (hi - lo) / 2;
+	d = job->dim[m];
+	lvis_query_offer(s,&job->shots[m]);
+	diff = s->q[d] - job->shots[m].p[d];
+	// the near side first, the far one only if it can still be close enough
+	if(diff < 0.0)
+	  {
+	     lvis_query_visit(job,lo,m,s);
+	     if(diff * diff > s->bound) return;
+	     lo = m + 1;
+	  }
+	else
+	  {
+	     lvis_query_visit(job,m + 1,hi,s);
+	     if(diff * diff > s->bound) return;
+	     hi = m;
+	  }
+     }
+   for(m=lo;m<hi;m++) lvis_query_offer(s,&job->shots[m]);
+}
+
+static int lvis_query_hit_compare(const void * a, const void * b)
+{
+   const struct lvis_query_hit * x = (const struct lvis_query_hit *) a;
+   const struct lvis_query_hit * y = (const struct lvis_query_hit *) b;
+
+   if(x->d2 < y->d2) return -1;
+   if(x->d2 > y->d2) return 1;
+   return (x->ref < y->ref) ? -1 : (x->ref > y->ref);
+}
+
+static void lvis_query_search_run(void * context, long t, int worker)
+{
+   struct lvis_query_job    * job = (struct lvis_query_job *) context;
+   struct lvis_query_block  * block = &job->blocks[job->base + t];
+   struct lvis_query_search * s = &job->search[worker];
+   struct lvis_query_point  * point;
+   double                     c;
+   long                       i,k,n=0,max=0;
+
+   block->start = (long *) malloc((block->count + 1) * sizeof(long));
+   if(block->start == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the query results\n");
+	exit(-1);
+     }
+   for(i=0;i<block->count;i++)
+     {
+	point = &job->points[block->first + i];
+	memcpy(s->q,point->p,sizeof(s->q));
+	s->limit = HUGE_VAL;
+	if(job->q->radius > 0.0 && job->q->radius < M_PI * point->rho)
+	  {
+	     // the chord of -radius along the surface, a hair wider for the rounding
+	     c = 2.0 * point->rho * sin(job->q->radius / (2.0 * point->rho));
+	     s->limit = c * c * (1.0 + 1e-9);
+	  }
+	s->bound = s->limit;
+	s->n = 0;
+	lvis_query_visit(job,0,job->nshots,s);
+	qsort(s->hit,s->n,sizeof(struct lvis_query_hit),lvis_query_hit_compare);
+
+	block->start[i] = n;
+	if(n + s->n > max)
+	  {
+	     max = 2 * (n + s->n) + 16;
+	     if((block->hits = (struct lvis_query_hit *) realloc(block->hits,max * sizeof(struct lvis_query_hit)))==NULL)
+	       {
+		  fprintf(stderr,"Unable to allocate the query results\n");
+		  exit(-1);
+	       }
+	  }
+	for(k=0;k<s->n;k++)
+	  {
+	     if(job->q->radius > 0.0 && lvis_query_arc(s->hit[k].d2,point->rho) > job->q->radius) break;
+	     block->hits[n++] = s->hit[k];
+	  }
+     }
+   block->start[block->count] = n;
+}
+
+static void lvis_query_render_run(void * context, long t, int worker)
+{
+   struct lvis_query_job    * job = (struct lvis_query_job *) context;
+   struct lvis_query_block  * block = &job->blocks[job->base + t];
+   struct lvis_query_point  * point;
+   struct lvis_release_file * f;
+   char                     * delim = job->opt->delim;
+   int64_t                    record;
+   long                       i,k;
+   FILE                     * out;
+
+   if((out = open_memstream(&block->text,&block->length))==NULL)
+     {
+	block->status = -1;
+	return;
+     }
+   for(i=0;i<block->count;i++)
+     {
+	point = &job->points[block->first + i];
+	for(k=block->start[i];k<block->start[i+1];k++)
+	  {
+	     f = &job->files[block->hits[k].ref >> LVIS_QUERY_FILE_SHIFT];
+	     record = block->hits[k].ref & (((int64_t) 1 << LVIS_QUERY_FILE_SHIFT) - 1);
+	     if(lvis_canon_read(f,record,1,job->raw[worker],job->canon[worker]) != 1)
+	       {
+		  block->status = -1;
+		  continue;
+	       }
+	     fprintf(out,"%ld%s%14.10f%s%14.10f%s%ld%s%12.3f%s",block->first + i + 1,delim,point->lon,delim,
+		     point->lat,delim,k - block->start[i] + 1,delim,lvis_query_arc(block->hits[k].d2,point->rho),delim);
+	     print_release_data(out,job->canon[worker],f->fileType,(float)1.04,job->opt->indexcol,
+				(unsigned int) (record + 1),delim,-400.0,400.0,-400.0,400.0);
+	  }
+     }
+   if(fclose(out)!=0) block->status = -1;
+}
+
+// -------------------------------------------------------------------------
+
+// lon lat (degrees) a line, by spaces, tabs or commas; lines that do not
+// start with two numbers (headers, # comments) are skipped
+static long lvis_query_read_points(char * filename, struct lvis_query_point ** points, long * skipped)
+{
+   struct lvis_query_point * p=NULL;
+   char                      line[4096],* s,* e;
+   double                    v[2],m,r;
+   long                      n=0,max=0;
+   int                       k;
+   FILE                    * fp;
+
+   *skipped = 0;
+   if((fp = fopen(filename,"r"))==NULL)
+     {
+	fprintf(stderr,"Error opening the points file: %s (%s)\n",filename,strerror(errno));
+	return -1;
+     }
+   while(fgets(line,sizeof(line),fp)!=NULL)
+     {
+	s = line;
+	for(k=0;k<2;k++)
+	  {
+	     while(*s == ' ' || *s == '\t' || *s == ',') s++;
+	     v[k] = strtod(s,&e);
+	     if(e == s) break;
+	     s = e;
+	  }
+	if(k < 2 || !(v[1] >= -90.0 && v[1] <= 90.0))
+	  {
+	     for(s=line;*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n';s++);
+	     if(*s != 0 && *s != '#') (*skipped)++;
+	     continue;
+	  }
+	if(n == max)
+	  {
+	     max = 2 * max + 1024;
+	     if((p = (struct lvis_query_point *) realloc(p,max * sizeof(struct lvis_query_point)))==NULL)
+	       {
+		  fprintf(stderr,"Unable to allocate the query points\n");
+		  exit(-1);
+	       }
+	  }
+	p[n].lon = v[0];
+	p[n].lat = v[1];
+	lvis_proj_ecef(v[0],v[1],p[n].p);
+	// the gaussian radius sqrt(M N)
+	lvis_proj_radii(v[1],&m,&r);
+	p[n].rho = sqrt(m * r);
+	n++;
+     }
+   fclose(fp);
+   *points = p;
+   return n;
+}
+
+static int lvis_query_input(void * context, long t)
+{
+   return ((struct lvis_query_job *) context)->reads[t].file;
+}
+
+static void lvis_query_join(void * context, long t)
+{
+   struct lvis_query_job  * job = (struct lvis_query_job *) context;
+   struct lvis_query_read * task = &job->reads[t];
+
+   if(task->status != 0)
+     {
+	fprintf(stderr,"Short read in %s at record %lld\n",job->files[task->file].filename,(long long) task->first);
+	job->errors++;
+     }
+}
+
+int lvis_query_points(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		      struct lvis_batch_options * b, struct lvis_query_options * q)
+{
+   struct lvis_query_job   job;
+   struct lvis_pool      * pool;
+   unsigned char         * used;
+   FILE                  * out;
+   long                    t,base,count,wave,maxtasks=0,nreads=0,nblocks,skipped;
+   int64_t                 n,first,total=0,hits=0;
+   int                     k,threads,errors=0;
+
+   if(q->points[0] == 0)
+     {
+	fprintf(stderr,"query needs the points to look around, give them with -points file (lon lat per line)\n");
+	return 1;
+     }
+   if(q->radius < 0.0)
+     {
+	fprintf(stderr,"-radius must be more than 0 metres\n");
+	return 1;
+     }
+   // neither: the nearest shot
+   if(q->radius == 0.0 && q->knn == 0) q->knn = 1;
+
+   memset(&job,0,sizeof(job));
+   job.opt = opt;
+   job.q = q;
+   if((job.npoints = lvis_query_read_points(q->points,&job.points,&skipped)) < 0) return 1;
+   if(skipped > 0) fprintf(stderr,"query: %ld lines of %s are not lon lat, skipped\n",skipped,q->points);
+
+   job.files = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file));
+   if(job.files == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+   job.fileType = -1;
+   for(k=0;k<ninputs;k++)
+     {
+	if(lvis_file_open(&job.files[k],inputs[k],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	lvis_file_close(&job.files[k]);
+	if(job.fileType < 0) job.fileType = job.files[k].fileType;
+	if(job.files[k].fileType != job.fileType)
+	  {
+	     fprintf(stderr,"%s is %s, query takes inputs of one type (%s)\n",inputs[k],
+		     lvis_file_type_name(job.files[k].fileType),lvis_file_type_name(job.fileType));
+	     errors++;
+	     continue;
+	  }
+	n = job.files[k].recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+	job.files[k].recordCount = n;
+	total += n;
+	maxtasks += (long) ((n + LVIS_QUERY_CHUNK - 1) / LVIS_QUERY_CHUNK);
+     }
+   if(ninputs >= (1 << 23))
+     {
+	fprintf(stderr,"query takes at most %d inputs\n",(1 << 23) - 1);
+	errors++;
+     }
+   if(errors > 0)
+     {
+	free(job.files);
+	free(job.points);
+	return errors;
+     }
+
+   job.reads = (struct lvis_query_read *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_query_read));
+   job.shots = (struct lvis_query_shot *) malloc((total > 0 ? total : 1) * sizeof(struct lvis_query_shot));
+   if(job.reads == NULL || job.shots == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the positions of %lld shots\n",(long long) total);
+	exit(-1);
+     }
+   total = 0;
+   for(k=0;k<ninputs;k++)
+     for(first=0;first<job.files[k].recordCount;first+=LVIS_QUERY_CHUNK)
+       {
+	  job.reads[nreads].file   = k;
+	  job.reads[nreads].first  = first;
+	  job.reads[nreads].count  = (job.files[k].recordCount - first < LVIS_QUERY_CHUNK) ?
+	    job.files[k].recordCount - first : LVIS_QUERY_CHUNK;
+	  job.reads[nreads].offset = total;
+	  total += job.reads[nreads].count;
+	  nreads++;
+       }
+
+   pool = lvis_pool_create(b->nthreads);
+   threads = lvis_pool_threads(pool);
+   wave = 2 * threads;
+   lvis_batch_buffers(threads,LVIS_QUERY_CHUNK,sizeof(union lvis_canon_record),&job.raw,&job.canon);
+   job.search = (struct lvis_query_search *) calloc(threads,sizeof(struct lvis_query_search));
+   if(job.search == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the query buffers\n");
+	exit(-1);
+     }
+   for(k=0;k<threads;k++) job.search[k].knn = q->knn;
+
+   // the positions, then packed together
+   lvis_batch_waves(pool,0,nreads,job.files,lvis_query_input,lvis_query_read_run,lvis_query_join,&job);
+   errors += job.errors;
+   for(t=0;t<nreads;t++)
+     {
+	if(job.reads[t].offset != job.nshots)
+	  memmove(job.shots + job.nshots,job.shots + job.reads[t].offset,job.reads[t].kept * sizeof(struct lvis_query_shot));
+	job.nshots += job.reads[t].kept;
+     }
+   free(job.reads);
+   if(job.nshots == 0)
+     {
+	fprintf(stderr,"query: no shots to look for\n");
+	exit(-1);
+     }
+   if((job.dim = (unsigned char *) calloc(job.nshots,1))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the tree\n");
+	exit(-1);
+     }
+   lvis_query_tree(&job,pool);
+
+   // the points, a wave of blocks at a time
+   if(opt->outfile[0] == 0) out = stdout;
+   else if((out = fopen(opt->outfile,"w"))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	exit(-1);
+     }
+   if(opt->topcol)
+     {
+	fprintf(out,"point%splon%splat%srank%sdistance%s",opt->delim,opt->delim,opt->delim,opt->delim,opt->delim);
+	print_release_column_headers(out,job.fileType,(float)1.04,opt->indexcol,opt->delim);
+     }
+   nblocks = (job.npoints + LVIS_QUERY_BLOCK - 1) / LVIS_QUERY_BLOCK;
+   job.blocks = (struct lvis_query_block *) calloc(nblocks > 0 ? nblocks : 1,sizeof(struct lvis_query_block));
+   used = (unsigned char *) calloc(ninputs,1);
+   if(job.blocks == NULL || used == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the query blocks\n");
+	exit(-1);
+     }
+   for(t=0;t<nblocks;t++)
+     {
+	job.blocks[t].first = t * LVIS_QUERY_BLOCK;
+	job.blocks[t].count = (job.npoints - job.blocks[t].first < LVIS_QUERY_BLOCK) ?
+	  job.npoints - job.blocks[t].first : LVIS_QUERY_BLOCK;
+     }
+   for(base=0;base<nblocks;base+=count)
+     {
+	count = (nblocks - base < wave) ? nblocks - base : wave;
+	job.base = base;
+	lvis_pool_run(pool,count,lvis_query_search_run,&job);
+	// open the files the shots found are in, render, write
+	for(t=base;t<base+count;t++)
+	  for(n=0;n<job.blocks[t].start[job.blocks[t].count];n++)
+	    used[job.blocks[t].hits[n].ref >> LVIS_QUERY_FILE_SHIFT] = 1;
+	for(k=0;k<ninputs;k++)
+	  if(used[k] && lvis_file_reopen(&job.files[k])!=0) errors++;
+	lvis_pool_run(pool,count,lvis_query_render_run,&job);
+	for(t=base;t<base+count;t++)
+	  {
+	     struct lvis_query_block * block = &job.blocks[t];
+
+	     if(block->status != 0)
+	       {
+		  fprintf(stderr,"Error reading the shots found for points %ld .. %ld\n",block->first + 1,
+			  block->first + block->count);
+		  errors++;
+	       }
+	     if(block->length > 0 && fwrite(block->text,1,block->length,out) != block->length)
+	       {
+		  fprintf(stderr,"Error writing the output file: %s (%s)\n",opt->outfile[0] ? opt->outfile : "stdout",
+			  strerror(errno));
+		  exit(-1);
+	       }
+	     hits += block->start[block->count];
+	     free(block->text);
+	     free(block->hits);
+	     free(block->start);
+	  }
+	for(k=0;k<ninputs;k++)
+	  if(used[k]) { lvis_file_close(&job.files[k]); used[k] = 0; }
+     }
+   lvis_pool_destroy(pool);
+
+   if(out != stdout && fclose(out)!=0)
+     {
+	fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	errors++;
+     }
+   fprintf(stderr,"query: %ld shots indexed, %ld points, %lld shots found\n",job.nshots,job.npoints,(long long) hits);
+
+   lvis_batch_free_buffers(threads,job.raw,job.canon);
+   for(k=0;k<threads;k++) free(job.search[k].hit);
+   free(job.search);
+   free(job.blocks);
+   free(used);
+   free(job.dim);
+   free(job.shots);
+   free(job.points);
+   free(job.files);
+   return errors;
+}
@@ -0,0 +1,57 @@
+#ifndef __LVIS_RELEASE_QUERY_H
+#define __LVIS_RELEASE_QUERY_H
+
+// lvis_release_query.h
+//
+// query mode: the shots near a list of points (ground stations, GPS
+// marks ...), -points file with a lon lat pair (degrees) per line.  Every
+// point gets the shots within -radius metres of it, or its -knn nearest
+// shots (its nearest one without either), or its -knn nearest within
+// -radius.  Each one is a text row of the point's number (in the order of
+// the file), lon, lat, the rank and distance (m) of the shot, then the
+// shot's record as the text conversion writes it.  The inputs may be any
+// number of files (several, -list) of one product type.
+//
+// The positions are put on the WGS 84 ellipsoid (height 0) in earth
+// centred x / y / z and a KD-tree is built over them, the top levels a
+// level at a time with every node of a level split in parallel, then the
+// subtrees below them each on a thread.  The tree is searched by the
+// straight line (chord) distance, which orders the shots as the surface
+// distance does; the distances given are along the surface, the chord
+// bent over the local radius of curvature, within a millimetre of the
+// ellipsoidal geodesic to 150 km and a few centimetres at 350 km.  The
+// points are searched in blocks on the pool and written in file order.
+
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_QUERY_CHUNK
+#define  LVIS_QUERY_CHUNK 4096        // shots read per task
+#endif
+
+#ifndef  LVIS_QUERY_BLOCK
+#define  LVIS_QUERY_BLOCK 256         // query points per task
+#endif
+
+#define  LVIS_QUERY_LEAF  8           // shots in a leaf of the tree
+
+struct lvis_query_options
+{
+   char   points[1024];   // -points file: lon lat per line
+   double radius;         // -radius R (m), 0 = no radius
+   long   knn;            // -knn K, 0 = every shot within -radius
+};
+
+void lvis_query_defaults(struct lvis_query_options * q);
+
+// handle the query options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a query option)
+int  lvis_query_parse_option(int argc, char * argv[], int i, struct lvis_query_options * q);
+
+// answer the -points against the shots of the inputs, to stdout (or
+// opt->outfile), returns 0 on success
+struct lvis_batch_options;
+int  lvis_query_points(char ** inputs, int ninputs, struct lvis_release_options * opt,
+		       struct lvis_batch_options * b, struct lvis_query_options * q);
+
+#endif
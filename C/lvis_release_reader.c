@@ -1,14 +1,39 @@
 // lvis_release_reader.c
 // 
-// HOWTO compile:  gcc -Wall lvis_release_reader.c -o lvis_release_reader
+// HOWTO compile:  gcc -Wall lvis_release_*.c -o lvis_release_reader -lm -lpthread
 // 
 // (or just run 'make', as there is a Makefile included)
 // 
 // HOWTO execute:
 // ./lvis_release_reader LVIS_HB_2003_grid_0.lce
 // ./lvis_release_reader LVIS_HOW_2003_grid_0.lce -lon 290.00-291.40 -lat 44.74-44.76
+// ./lvis_release_reader LVIS_HOW_2003_grid_0.lce -lon 290.00-291.40 -lat 44.74-44.76 -o subset.lce
 // ./lvis_release_reader LVIS_HOW_2003_Flux_Tower_West_grid_0.lgw -c
 // ./lvis_release_reader LVIS_US_CA_day4_2008_VECT_20081120.lge.1.03 -c -i -lge -r 1.03
+// ./lvis_release_reader *.LGW -threads 8 -odir ./text
+// ./lvis_release_reader -list flight.txt --shard 3/8 -prefix run1 ; ./lvis_release_reader merge run1.shard-*.manifest -o flight.txt
+// ./lvis_release_reader upgrade *.lge.1.0? -odir ./canonical
+// ./lvis_release_reader merge LVIS_*_2009_*.lge -key time -format binary -o day.lge
+// ./lvis_release_reader delivery1/*.lge delivery2/*.lge -dedup -o unique.lge
+// ./lvis_release_reader flight.lgw -features -featthresh 12 -t
+// ./lvis_release_reader metrics flight.lgw -smooth 1.5 -o flight.lge
+// ./lvis_release_reader decompose flight.lgw -maxmodes 6 -o flight.gdc
+// ./lvis_release_reader deconvolve flight.lgw -deconreg 0.02 -o flight_sharp.canonical
+// ./lvis_release_reader expand flight.lgw -featthresh 20 -threads 8 -o flight.pts
+// ./lvis_release_reader flight.lge -las -o flight_ground.las
+// ./lvis_release_reader IceBridge_2017.lge -proj 3413 -t
+// ./lvis_release_reader IceBridge_2017.lge -poly jakobshavn.wkt -o jakobshavn.lge
+// ./lvis_release_reader IceBridge_2017.lge -proj 3413 -demlist gimp_tiles.txt -demmem 512 -t
+// ./lvis_release_reader grid LVIS_*.lge -field rh100 -cell 0.0005 -o canopy.bil
+// ./lvis_release_reader query -list campaign.txt -points stations.txt -radius 50 -t
+// ./lvis_release_reader crossovers -list campaign.txt -threads 8 -t -o crossovers.txt
+// ./lvis_release_reader dhdt -list IceBridge_2017.txt -reflist IceBridge_2009.txt -refdate 2009-04-21 -date 2017-05-03 -t
+// ./lvis_release_reader render flight.lgw -width 8192 -reduce max -o flight.png -pyramid flight_tiles
+// ./lvis_release_reader IceBridge_2017.lge -summary -json -zbin 5 -threads 8
+// ./lvis_release_reader quantiles -list campaign.txt -fields zg,rh100,range -q 1,50,99 -threads 8 -t
+// ./lvis_release_reader flight.lgw -windows 1 -wingap 0.05 -threads 8 -t -o flight_qa.txt
+// ./lvis_release_reader delivery_2024.lgw -summary -sample 64x4096 -threads 8
+// ./lvis_release_reader join flight.lgw flight.lge flight.lce -fields lvistime,lge.zg,lge.rh50,lce.zt -t
 // 
 // Version 1.0
 // Begun: 2004/08/19
@@ -48,6 +73,91 @@
 // * fixed some of the auto detection code (was using double functions on float variables)
 // * inserted a #define to update all of the loops with a single change (LVIS_VERSION_COUNT)
 //  
+// Version 1.05 - 20261018
+// * the shared routines are declared in lvis_release_reader.h and the processing
+//   modes live in their own lvis_release_*.c modules (see the Makefile)
+// * several inputs may be given (or listed in a file with -list); all of them are
+//   converted on a work-stealing thread pool (-threads), whole files and chunks of
+//   large files alike, to one merged stream or one output per input (-odir)
+// * --shard i/N converts a deterministic piece of the inputs, so a job can be spread
+//   over several processes / machines; each shard writes its partial output and a
+//   manifest, the 'merge' mode checks the manifests and joins the pieces back in order
+// * -o out.bin writes the records inside -lat / -lon as a binary subset, byte for byte
+//   as they are in the input, copying runs of records inside the kernel where possible
+// * the 'upgrade' mode rewrites any release (1.00 -> 1.04) as a canonical file: native
+//   endian v1.04 records behind a self describing header, with sentinels (0xFFFFFFFF,
+//   NaN) for the fields the source did not have.  Every mode reads canonical files
+//   directly, recognised by their header instead of the detection heuristics
+// * BUG Squashed!  LCE / LGE v1.04 records were neither swapped nor printed, and the
+//   LGW v1.04 waveforms are now swapped with the rest of the record
+// * merge also k-way merges release files that are each in time (or lfid +
+//   shotnumber) order into one ordered stream: the inputs are memory mapped and
+//   read front to back through a heap, in bounded memory however many there are,
+//   and written as text, as one binary file or as one file per column
+// * -dedup drops repeated (lfid, shotnumber) across all the inputs, keeping the first;
+//   the keys live in an open addressing hash set within -dedupmem, beyond that they
+//   are spilled to hash partitions on disk and the duplicates found per partition
+// * the 'join' mode writes one row per shot of matching LGW / LGE / LCE products:
+//   a streaming merge join when they are in shot order (as delivered), otherwise a
+//   hash join, partitioned through -tmpdir when the products outgrow -joinmem
+// * -features writes the scalar fields of each LGW shot followed by features of its
+//   return and transmit waveforms (noise subtracted energy, centroid, peak, signal
+//   start / end, saturation), computed a batch of shots at a time by AVX2 kernels
+//   where the cpu has them
+// * the 'metrics' mode makes LGE v1.04 records (zg, rh25 .. rh100) from LGW waveforms:
+//   smoothed, noise subtracted, ground at the lowest mode and the relative heights
+//   from the energy summed from the bottom up, on the thread pool; -validate compares
+//   them with a delivered LGE (bias and RMS of zg and the relative heights)
+// * the 'decompose' mode fits each return waveform with gaussian modes, started at the
+//   width of the shot's transmit pulse, by a Levenberg-Marquardt solver that works in a
+//   fixed workspace per thread; the modes go to a compact binary side file (-o)
+// * the 'deconvolve' mode divides each return waveform by its shot's transmit pulse in
+//   the frequency domain (regularized by -deconreg), through a small in-tree real FFT
+//   with one plan per waveform length, written as LGW text or a canonical file
+// * the 'expand' mode writes a geolocated point (lon, lat, z, amplitude) for every
+//   return sample above the noise, interpolated along the waveform by an AVX2 kernel
+//   and streamed out a chunk of shots at a time, as text or a binary point file (-o)
+// * -las writes LAS 1.4 (point format 6) with the other fields as extra bytes: LCE /
+//   LGE shots as one point each, LGW as the expand mode's points; encoded in parallel
+//   and written in one pass, the header counts and bounds filled in at the end
+// * the 'grid' mode bins a field of the shots into the mean, min, max and count of
+//   each cell of a lon / lat raster (ESRI .bil + .hdr / .blw / .prj), from partial
+//   grids per thread merged pairwise, in tiles of rows when over -gridmem
+// * -proj appends polar stereographic x / y (EPSG 3413 north, 3031 south) of every
+//   geolocation of the record to the text, a chunk of positions at a time through an
+//   AVX2 kernel of the ellipsoidal forward transform
+// * -poly clips every mode to a WKT polygon (catchments of thousands of vertices, in the
+//   polygon's own longitude range so the 0 / 360 seam does not matter): a grid of cells
+//   classed inside / outside / boundary, exact edge tests only in boundary cells
+// * the 'query' mode finds the shots within -radius metres of a list of points, or
+//   their -knn nearest, through a KD-tree of earth centred positions built in
+//   parallel, the points searched in blocks on the pool (-points, lon lat a line)
+// * the 'crossovers' mode cuts the shots into flight lines (lfid, -shotgap, -timegap),
+//   averages them into centre lines, finds where those cross through a grid of cells
+//   swept in parallel and reports the elevation of both lines there, dz and dt
+// * the 'dhdt' mode pairs every shot with the nearest shot of a reference campaign
+//   (-ref, -reflist) within -radius metres through a hash of earth centred cells,
+//   streaming the inputs past it on the pool; a reference campaign bigger than
+//   -dhdtmem is split with the inputs into tile partitions in -tmpdir first
+// * -dem appends the height of a reference DEM (float .bil / .flt tiles) under every
+//   shot and the shot's elevation minus it, bilinear, from an LRU cache of decoded
+//   blocks (-demmem) that a thread fills ahead of the flight direction
+// * the 'render' mode draws LGW echograms (shots along x, rxwave counts down y) as PGM /
+//   PNG, a whole flight reduced into -width columns of max / mean in parallel, and / or
+//   a pyramid of tiles from one column a shot up to the whole flight (-pyramid)
+// * -summary prints what is in each input (type, version, counts, box, time range, the
+//   min / max / mean / stddev of every field, elevation and rxwave histograms, quality
+//   counts) as text or -json, from one pass on the pool into per task accumulators
+// * the 'quantiles' mode gives percentiles (-q) of the fields of a whole campaign from
+//   mergeable KLL sketches, made per chunk on the pool and kept next to each input as
+//   <input>.sketch, so the next query over the same files only merges the sketches
+// * -windows / -windowshots write instrument QA a row a window of seconds / shots: shot
+//   rate, missing shotnumbers and gaps, range / incidentangle / azimuth / sigmean and
+//   rxwave peaks and saturation, from fixed size aggregates joined across pool tasks
+// * -sample K / NxB makes -summary and grid read every K-th record (with pread, the
+//   records between never read) or N evenly spread blocks of B records, adding the
+//   standard error of the means, for a quick look at a large delivery
+//  
 // Systems Tested on:  Linux Slackware 12.1, CentOS 5.2(xi386 & x86_64)
 //                     Solaris Ultra 2
 //                     Mac OS X (10.5.1)
@@ -58,10 +168,32 @@
 #include <stdlib.h>
 #include <string.h>
 #include "lvis_release_structures.h"
-
-typedef unsigned char  byte;
-typedef unsigned short word;
-typedef unsigned int  dword;
+#include "lvis_release_reader.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_shard.h"
+#include "lvis_release_subset.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_merge.h"
+#include "lvis_release_dedup.h"
+#include "lvis_release_join.h"
+#include "lvis_release_features.h"
+#include "lvis_release_metrics.h"
+#include "lvis_release_decomp.h"
+#include "lvis_release_deconv.h"
+#include "lvis_release_expand.h"
+#include "lvis_release_las.h"
+#include "lvis_release_grid.h"
+#include "lvis_release_proj.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_query.h"
+#include "lvis_release_cross.h"
+#include "lvis_release_dhdt.h"
+#include "lvis_release_dem.h"
+#include "lvis_release_render.h"
+#include "lvis_release_summary.h"
+#include "lvis_release_quantile.h"
+#include "lvis_release_windows.h"
+#include "lvis_release_sample.h"
 
 #ifndef  DEFAULT_DATA_RELEASE_VERSION
 #define  DEFAULT_DATA_RELEASE_VERSION ((float) 1.03)
@@ -75,14 +207,6 @@ typedef unsigned int  dword;
 #define  LVIS_RELEASE_READER_VERSION_DATE 20111213
 #endif
 
-#ifndef  GENLIB_LITTLE_ENDIAN
-#define  GENLIB_LITTLE_ENDIAN 0x00
-#endif
-
-#ifndef  GENLIB_BIG_ENDIAN
-#define  GENLIB_BIG_ENDIAN 0x01
-#endif
-
 #ifndef  LVIS_VERSION_COUNT
 #define  LVIS_VERSION_COUNT 5  // 1.00 -> 1.04 is 5 total versions
 #endif
@@ -91,10 +215,6 @@ typedef unsigned int  dword;
 #define  VERSION_TESTBLOCK_LENGTH (128 * 1024) // 128k should be enough to figure it out
 #endif
 
-// prototypes we need
-double host_double(double input_double,int host_endian);
-float  host_float(float input_float,int host_endian);
-
 // if you want a little more info to start...uncomment this
 /* #define DEBUG_ON */
 
@@ -333,7 +453,7 @@ int detect_release_version(char * filename, int * fileType, float * fileVersion,
 
 double host_double(double input_double,int host_endian)
 {
-   double return_value;
+   double return_value = input_double;
    unsigned char * inptr, * outptr;
    
    inptr = (unsigned char *) &input_double;
@@ -359,7 +479,7 @@ double host_double(double input_double,int host_endian)
 
 float host_float(float input_float,int host_endian)
 {
-   float return_value;
+   float return_value = input_float;
    unsigned char * inptr, * outptr;
    
    inptr = (unsigned char *) &input_float;
@@ -381,7 +501,7 @@ float host_float(float input_float,int host_endian)
 
 dword host_dword(dword input_dword,int host_endian)
 {
-   dword return_value;
+   dword return_value = input_dword;
    unsigned char * inptr, * outptr;
    
    inptr = (unsigned char *) &input_dword;
@@ -403,7 +523,7 @@ dword host_dword(dword input_dword,int host_endian)
 
 word host_word(word input_word,int host_endian)
 {
-   word return_value;
+   word return_value = input_word;
    unsigned char * inptr, * outptr;
    
    inptr = (unsigned char *) &input_word;
@@ -441,44 +561,44 @@ int host_endian(void)
    return host_endian;
 }
 
-void print_lce_column_headers(float dataVersion,int indexcol,char * delim)
+void print_lce_column_headers(FILE * out,float dataVersion,int indexcol,char * delim)
 {
    int i;
    
-   if(indexcol==1) fprintf(stdout,"%s%s",lvis_index_header_string,delim);
+   if(indexcol==1) fprintf(out,"%s%s",lvis_index_header_string,delim);
    if(dataVersion == ((float)1.00))
      {
 	for(i=0;i<(LVIS_LCE_V1_00_ELEMENTS-1);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lce_v1_00_header[i],delim); }
-	fprintf(stdout,"%s\n",lvis_lce_v1_00_header[i]);
+	  { fprintf(out,"%s%s",lvis_lce_v1_00_header[i],delim); }
+	fprintf(out,"%s\n",lvis_lce_v1_00_header[i]);
      }
    if(dataVersion == ((float)1.01))
      {
 	for(i=0;i<(LVIS_LCE_V1_01_ELEMENTS-1);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lce_v1_01_header[i],delim); }
-	fprintf(stdout,"%s\n",lvis_lce_v1_01_header[i]);
+	  { fprintf(out,"%s%s",lvis_lce_v1_01_header[i],delim); }
+	fprintf(out,"%s\n",lvis_lce_v1_01_header[i]);
      }
    if(dataVersion == ((float)1.02))
      {
 	for(i=0;i<(LVIS_LCE_V1_02_ELEMENTS-1);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lce_v1_02_header[i],delim); }
-	fprintf(stdout,"%s\n",lvis_lce_v1_02_header[i]);
+	  { fprintf(out,"%s%s",lvis_lce_v1_02_header[i],delim); }
+	fprintf(out,"%s\n",lvis_lce_v1_02_header[i]);
      }
    if(dataVersion == ((float)1.03))
      {
 	for(i=0;i<(LVIS_LCE_V1_03_ELEMENTS-1);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lce_v1_03_header[i],delim); }
-	fprintf(stdout,"%s\n",lvis_lce_v1_03_header[i]);
+	  { fprintf(out,"%s%s",lvis_lce_v1_03_header[i],delim); }
+	fprintf(out,"%s\n",lvis_lce_v1_03_header[i]);
      }   
    if(dataVersion == ((float)1.04))
      {
 	for(i=0;i<(LVIS_LCE_V1_04_ELEMENTS-1);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lce_v1_04_header[i],delim); }
-	fprintf(stdout,"%s\n",lvis_lce_v1_04_header[i]);
+	  { fprintf(out,"%s%s",lvis_lce_v1_04_header[i],delim); }
+	fprintf(out,"%s\n",lvis_lce_v1_04_header[i]);
      }   
 }
 
-void print_lce_data_v1_00(unsigned char *lcedata, int indexcol, unsigned int colnum, char * delim,
+void print_lce_data_v1_00(FILE * out,unsigned char *lcedata, int indexcol, unsigned int colnum, char * delim,
 			  double minlat, double maxlat, double minlon, double maxlon)
 {
    struct lvis_lce_v1_00 * lce;
@@ -486,12 +606,12 @@ void print_lce_data_v1_00(unsigned char *lcedata, int indexcol, unsigned int col
    
    if(lce->tlon>minlon && lce->tlon<maxlon && lce->tlat>minlat && lce->tlat<maxlat)
      {
-	if(indexcol==1) fprintf(stdout,"%10i%s",colnum++,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f\n",lce->tlon,delim,lce->tlat,delim,lce->zt);
+	if(indexcol==1) fprintf(out,"%10i%s",colnum++,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f\n",lce->tlon,delim,lce->tlat,delim,lce->zt);
      }
 }
 
-void print_lce_data_v1_01(unsigned char *lcedata, int indexcol, unsigned int colnum, char * delim,
+void print_lce_data_v1_01(FILE * out,unsigned char *lcedata, int indexcol, unsigned int colnum, char * delim,
 			  double minlat, double maxlat, double minlon, double maxlon)
 {
    struct lvis_lce_v1_01 * lce;
@@ -499,13 +619,13 @@ void print_lce_data_v1_01(unsigned char *lcedata, int indexcol, unsigned int col
    
    if(lce->tlon>minlon && lce->tlon<maxlon && lce->tlat>minlat && lce->tlat<maxlat)
      {
-	if(indexcol==1) fprintf(stdout,"%10i%s",colnum++,delim);
-	fprintf(stdout,"%u%s%u%s",lce->lfid,delim,lce->shotnumber,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f\n",lce->tlon,delim,lce->tlat,delim,lce->zt);
+	if(indexcol==1) fprintf(out,"%10i%s",colnum++,delim);
+	fprintf(out,"%u%s%u%s",lce->lfid,delim,lce->shotnumber,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f\n",lce->tlon,delim,lce->tlat,delim,lce->zt);
      }
 }
 
-void print_lce_data_v1_02(unsigned char *lcedata, int indexcol, unsigned int colnum, char * delim,
+void print_lce_data_v1_02(FILE * out,unsigned char *lcedata, int indexcol, unsigned int colnum, char * delim,
 			  double minlat, double maxlat, double minlon, double maxlon)
 {
    struct lvis_lce_v1_02 * lce;
@@ -513,13 +633,13 @@ void print_lce_data_v1_02(unsigned char *lcedata, int indexcol, unsigned int col
    
    if(lce->tlon>minlon && lce->tlon<maxlon && lce->tlat>minlat && lce->tlat<maxlat)
      {
-	if(indexcol==1) fprintf(stdout,"%10i%s",colnum++,delim);
-	fprintf(stdout,"%u%s%u%s%12.6f%s",lce->lfid,delim,lce->shotnumber,delim,lce->lvistime,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f\n",lce->tlon,delim,lce->tlat,delim,lce->zt);
+	if(indexcol==1) fprintf(out,"%10i%s",colnum++,delim);
+	fprintf(out,"%u%s%u%s%12.6f%s",lce->lfid,delim,lce->shotnumber,delim,lce->lvistime,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f\n",lce->tlon,delim,lce->tlat,delim,lce->zt);
      }
 }
 
-void print_lce_data_v1_03(unsigned char *lcedata, int indexcol, unsigned int colnum, char * delim,
+void print_lce_data_v1_03(FILE * out,unsigned char *lcedata, int indexcol, unsigned int colnum, char * delim,
 			  double minlat, double maxlat, double minlon, double maxlon)
 {
    struct lvis_lce_v1_03 * lce;
@@ -527,52 +647,68 @@ void print_lce_data_v1_03(unsigned char *lcedata, int indexcol, unsigned int col
    
    if(lce->tlon>minlon && lce->tlon<maxlon && lce->tlat>minlat && lce->tlat<maxlat)
      {
-	if(indexcol==1) fprintf(stdout,"%10i%s",colnum++,delim);
-	fprintf(stdout,"%u%s%u%s",lce->lfid,delim,lce->shotnumber,delim);
-	fprintf(stdout,"%9.4f%s%9.4f%s%9.4f%s",lce->azimuth,delim,lce->incidentangle,delim,lce->range,delim);
-	fprintf(stdout,"%12.6f%s",lce->lvistime,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f\n",lce->tlon,delim,lce->tlat,delim,lce->zt);
+	if(indexcol==1) fprintf(out,"%10i%s",colnum++,delim);
+	fprintf(out,"%u%s%u%s",lce->lfid,delim,lce->shotnumber,delim);
+	fprintf(out,"%9.4f%s%9.4f%s%9.4f%s",lce->azimuth,delim,lce->incidentangle,delim,lce->range,delim);
+	fprintf(out,"%12.6f%s",lce->lvistime,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f\n",lce->tlon,delim,lce->tlat,delim,lce->zt);
+     }
+}
+
+void print_lce_data_v1_04(FILE * out,unsigned char *lcedata, int indexcol, unsigned int colnum, char * delim,
+			  double minlat, double maxlat, double minlon, double maxlon)
+{
+   struct lvis_lce_v1_04 * lce;
+   lce = (struct lvis_lce_v1_04 * ) lcedata;
+   
+   if(lce->tlon>minlon && lce->tlon<maxlon && lce->tlat>minlat && lce->tlat<maxlat)
+     {
+	if(indexcol==1) fprintf(out,"%10i%s",colnum++,delim);
+	fprintf(out,"%u%s%u%s",lce->lfid,delim,lce->shotnumber,delim);
+	fprintf(out,"%9.4f%s%9.4f%s%9.4f%s",lce->azimuth,delim,lce->incidentangle,delim,lce->range,delim);
+	fprintf(out,"%12.6f%s",lce->lvistime,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f\n",lce->tlon,delim,lce->tlat,delim,lce->zt);
      }
 }
 
-void print_lge_column_headers(float dataVersion,int indexcol, char * delim)
+void print_lge_column_headers(FILE * out,float dataVersion,int indexcol, char * delim)
 {
    int i;
    
-   if(indexcol==1) fprintf(stdout,"%s%s",lvis_index_header_string,delim);
+   if(indexcol==1) fprintf(out,"%s%s",lvis_index_header_string,delim);
    if(dataVersion == ((float)1.00))
      {
 	for(i=0;i<(LVIS_LGE_V1_00_ELEMENTS-1);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lge_v1_00_header[i],delim); }
-	fprintf(stdout,"%s\n",lvis_lge_v1_00_header[i]);
+	  { fprintf(out,"%s%s",lvis_lge_v1_00_header[i],delim); }
+	fprintf(out,"%s\n",lvis_lge_v1_00_header[i]);
      }
    if(dataVersion == ((float)1.01))
      {
 	for(i=0;i<(LVIS_LGE_V1_01_ELEMENTS-1);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lge_v1_01_header[i],delim); }
-	fprintf(stdout,"%s\n",lvis_lge_v1_01_header[i]);
+	  { fprintf(out,"%s%s",lvis_lge_v1_01_header[i],delim); }
+	fprintf(out,"%s\n",lvis_lge_v1_01_header[i]);
      }
    if(dataVersion == ((float)1.02))
      {
 	for(i=0;i<(LVIS_LGE_V1_02_ELEMENTS-1);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lge_v1_02_header[i],delim); }
-	fprintf(stdout,"%s\n",lvis_lge_v1_02_header[i]);
+	  { fprintf(out,"%s%s",lvis_lge_v1_02_header[i],delim); }
+	fprintf(out,"%s\n",lvis_lge_v1_02_header[i]);
      }
    if(dataVersion == ((float)1.03))
      {
 	for(i=0;i<(LVIS_LGE_V1_03_ELEMENTS-1);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lge_v1_03_header[i],delim); }
-	fprintf(stdout,"%s\n",lvis_lge_v1_03_header[i]);
+	  { fprintf(out,"%s%s",lvis_lge_v1_03_header[i],delim); }
+	fprintf(out,"%s\n",lvis_lge_v1_03_header[i]);
      }
    if(dataVersion == ((float)1.04))
      {
 	for(i=0;i<(LVIS_LGE_V1_04_ELEMENTS-1);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lge_v1_04_header[i],delim); }
-	fprintf(stdout,"%s\n",lvis_lge_v1_04_header[i]);
+	  { fprintf(out,"%s%s",lvis_lge_v1_04_header[i],delim); }
+	fprintf(out,"%s\n",lvis_lge_v1_04_header[i]);
      }
 }
 
-void print_lge_data_v1_00(unsigned char *lgedata, int indexcol, unsigned int colnum, char * delim,
+void print_lge_data_v1_00(FILE * out,unsigned char *lgedata, int indexcol, unsigned int colnum, char * delim,
 			  double minlat, double maxlat, double minlon, double maxlon)
 {
    struct lvis_lge_v1_00 * lge;
@@ -581,15 +717,15 @@ void print_lge_data_v1_00(unsigned char *lgedata, int indexcol, unsigned int col
    // print the data in tab delimited columns for this data block
    if(lge->glon>minlon && lge->glon<maxlon && lge->glat>minlat && lge->glat<maxlat)
      {  
-	if(indexcol==1) fprintf(stdout,"%10i%s",colnum,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f%s",lge->glon,delim,lge->glat,delim,lge->zg,delim);
-	fprintf(stdout,"%9.4f%s%9.4f%s%9.4f%s%9.4f\n",lge->rh25,delim,lge->rh50,delim,lge->rh75,delim,lge->rh100);
+	if(indexcol==1) fprintf(out,"%10i%s",colnum,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lge->glon,delim,lge->glat,delim,lge->zg,delim);
+	fprintf(out,"%9.4f%s%9.4f%s%9.4f%s%9.4f\n",lge->rh25,delim,lge->rh50,delim,lge->rh75,delim,lge->rh100);
 	// the format for the %f print is:
 	//     # total number of digits (including decimal) . # digits after the decimal
      }
 }
 
-void print_lge_data_v1_01(unsigned char *lgedata, int indexcol, unsigned int colnum, char * delim,
+void print_lge_data_v1_01(FILE * out,unsigned char *lgedata, int indexcol, unsigned int colnum, char * delim,
 			  double minlat, double maxlat, double minlon, double maxlon)
 {
    struct lvis_lge_v1_01 * lge;
@@ -598,16 +734,16 @@ void print_lge_data_v1_01(unsigned char *lgedata, int indexcol, unsigned int col
    // print the data in tab delimited columns for this data block
    if(lge->glon>minlon && lge->glon<maxlon && lge->glat>minlat && lge->glat<maxlat)
      {  
-	if(indexcol==1) fprintf(stdout,"%10i%s",colnum,delim);
-	fprintf(stdout,"%u%s%u%s",lge->lfid,delim,lge->shotnumber,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f%s",lge->glon,delim,lge->glat,delim,lge->zg,delim);
-	fprintf(stdout,"%9.4f%s%9.4f%s%9.4f%s%9.4f\n",lge->rh25,delim,lge->rh50,delim,lge->rh75,delim,lge->rh100);
+	if(indexcol==1) fprintf(out,"%10i%s",colnum,delim);
+	fprintf(out,"%u%s%u%s",lge->lfid,delim,lge->shotnumber,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lge->glon,delim,lge->glat,delim,lge->zg,delim);
+	fprintf(out,"%9.4f%s%9.4f%s%9.4f%s%9.4f\n",lge->rh25,delim,lge->rh50,delim,lge->rh75,delim,lge->rh100);
 	// the format for the %f print is:
 	//     # total number of digits (including decimal) . # digits after the decimal
      }
 }
 
-void print_lge_data_v1_02(unsigned char *lgedata, int indexcol, unsigned int colnum, char * delim,
+void print_lge_data_v1_02(FILE * out,unsigned char *lgedata, int indexcol, unsigned int colnum, char * delim,
 			  double minlat, double maxlat, double minlon, double maxlon)
 {
    struct lvis_lge_v1_02 * lge;
@@ -616,16 +752,16 @@ void print_lge_data_v1_02(unsigned char *lgedata, int indexcol, unsigned int col
    // print the data in tab delimited columns for this data block
    if(lge->glon>minlon && lge->glon<maxlon && lge->glat>minlat && lge->glat<maxlat)
      {  
-	if(indexcol==1) fprintf(stdout,"%10i%s",colnum,delim);
-	fprintf(stdout,"%u%s%u%s%12.6f%s",lge->lfid,delim,lge->shotnumber,delim,lge->lvistime,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f%s",lge->glon,delim,lge->glat,delim,lge->zg,delim);
-	fprintf(stdout,"%9.4f%s%9.4f%s%9.4f%s%9.4f\n",lge->rh25,delim,lge->rh50,delim,lge->rh75,delim,lge->rh100);
+	if(indexcol==1) fprintf(out,"%10i%s",colnum,delim);
+	fprintf(out,"%u%s%u%s%12.6f%s",lge->lfid,delim,lge->shotnumber,delim,lge->lvistime,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lge->glon,delim,lge->glat,delim,lge->zg,delim);
+	fprintf(out,"%9.4f%s%9.4f%s%9.4f%s%9.4f\n",lge->rh25,delim,lge->rh50,delim,lge->rh75,delim,lge->rh100);
 	// the format for the %f print is:
 	//     # total number of digits (including decimal) . # digits after the decimal
      }
 }
 
-void print_lge_data_v1_03(unsigned char *lgedata, int indexcol, unsigned int colnum, char * delim,
+void print_lge_data_v1_03(FILE * out,unsigned char *lgedata, int indexcol, unsigned int colnum, char * delim,
 			  double minlat, double maxlat, double minlon, double maxlon)
 {
    struct lvis_lge_v1_03 * lge;
@@ -634,17 +770,35 @@ void print_lge_data_v1_03(unsigned char *lgedata, int indexcol, unsigned int col
    // print the data in tab delimited columns for this data block
    if(lge->glon>minlon && lge->glon<maxlon && lge->glat>minlat && lge->glat<maxlat)
      {  
-	if(indexcol==1) fprintf(stdout,"%10i%s",colnum,delim);
-	fprintf(stdout,"%u%s%u%s%12.6f%s",lge->lfid,delim,lge->shotnumber,delim,lge->lvistime,delim);
-	fprintf(stdout,"%9.4f%s%9.4f%s%9.4f%s",lge->azimuth,delim,lge->incidentangle,delim,lge->range,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f%s",lge->glon,delim,lge->glat,delim,lge->zg,delim);
-	fprintf(stdout,"%9.4f%s%9.4f%s%9.4f%s%9.4f\n",lge->rh25,delim,lge->rh50,delim,lge->rh75,delim,lge->rh100);
+	if(indexcol==1) fprintf(out,"%10i%s",colnum,delim);
+	fprintf(out,"%u%s%u%s%12.6f%s",lge->lfid,delim,lge->shotnumber,delim,lge->lvistime,delim);
+	fprintf(out,"%9.4f%s%9.4f%s%9.4f%s",lge->azimuth,delim,lge->incidentangle,delim,lge->range,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lge->glon,delim,lge->glat,delim,lge->zg,delim);
+	fprintf(out,"%9.4f%s%9.4f%s%9.4f%s%9.4f\n",lge->rh25,delim,lge->rh50,delim,lge->rh75,delim,lge->rh100);
 	// the format for the %f print is:
 	//     # total number of digits (including decimal) . # digits after the decimal
      }
 }
 
-void print_lgw_column_headers(float dataVersion,int indexcol,char *delim)
+void print_lge_data_v1_04(FILE * out,unsigned char *lgedata, int indexcol, unsigned int colnum, char * delim,
+			  double minlat, double maxlat, double minlon, double maxlon)
+{
+   struct lvis_lge_v1_04 * lge;
+   lge = (struct lvis_lge_v1_04 * ) lgedata;
+   
+   // print the data in tab delimited columns for this data block (in the order of the header)
+   if(lge->glon>minlon && lge->glon<maxlon && lge->glat>minlat && lge->glat<maxlat)
+     {  
+	if(indexcol==1) fprintf(out,"%10i%s",colnum,delim);
+	fprintf(out,"%u%s%u%s",lge->lfid,delim,lge->shotnumber,delim);
+	fprintf(out,"%9.4f%s%9.4f%s%9.4f%s",lge->azimuth,delim,lge->incidentangle,delim,lge->range,delim);
+	fprintf(out,"%12.6f%s",lge->lvistime,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lge->glon,delim,lge->glat,delim,lge->zg,delim);
+	fprintf(out,"%9.4f%s%9.4f%s%9.4f%s%9.4f\n",lge->rh25,delim,lge->rh50,delim,lge->rh75,delim,lge->rh100);
+     }
+}
+
+void print_lgw_column_headers(FILE * out,float dataVersion,int indexcol,char *delim)
 {
    int i;
    struct lvis_lgw_v1_00 * lgw100;
@@ -653,55 +807,55 @@ void print_lgw_column_headers(float dataVersion,int indexcol,char *delim)
    struct lvis_lgw_v1_03 * lgw103;
    struct lvis_lgw_v1_04 * lgw104;
    
-   if(indexcol==1) fprintf(stdout,"%s%s",lvis_index_header_string,delim);
+   if(indexcol==1) fprintf(out,"%s%s",lvis_index_header_string,delim);
    if(dataVersion == ((float)1.00))
      {
 	for(i=0;i<(LVIS_LGW_V1_00_ELEMENTS);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lgw_v1_00_header[i],delim); }
+	  { fprintf(out,"%s%s",lvis_lgw_v1_00_header[i],delim); }
 	for(i=0;i<(sizeof(lgw100->wave)-1);i++)
-	  { fprintf(stdout,"rx%03d%s",i,delim); }
-	fprintf(stdout,"rx%03d\n",i);
+	  { fprintf(out,"rx%03d%s",i,delim); }
+	fprintf(out,"rx%03d\n",i);
 	
      }
    if(dataVersion == ((float)1.01))
      {
 	for(i=0;i<(LVIS_LGW_V1_01_ELEMENTS);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lgw_v1_01_header[i],delim); }
+	  { fprintf(out,"%s%s",lvis_lgw_v1_01_header[i],delim); }
 	for(i=0;i<(sizeof(lgw101->wave)-1);i++)
-	  { fprintf(stdout,"rx%03d%s",i,delim); }
-	fprintf(stdout,"rx%03d\n",i);
+	  { fprintf(out,"rx%03d%s",i,delim); }
+	fprintf(out,"rx%03d\n",i);
      }
    if(dataVersion == ((float)1.02))
      {
 	for(i=0;i<(LVIS_LGW_V1_02_ELEMENTS);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lgw_v1_02_header[i],delim); }
+	  { fprintf(out,"%s%s",lvis_lgw_v1_02_header[i],delim); }
 	for(i=0;i<(sizeof(lgw102->wave)-1);i++)
-	  { fprintf(stdout,"rx%03d%s",i,delim); }
-	fprintf(stdout,"rx%03d\n",i);
+	  { fprintf(out,"rx%03d%s",i,delim); }
+	fprintf(out,"rx%03d\n",i);
      }
    if(dataVersion == ((float)1.03))
      {
 	for(i=0;i<(LVIS_LGW_V1_03_ELEMENTS);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lgw_v1_03_header[i],delim); }
+	  { fprintf(out,"%s%s",lvis_lgw_v1_03_header[i],delim); }
 	for(i=0;i<(sizeof(lgw103->txwave));i++)
-	  { fprintf(stdout,"tx%02d%s",i,delim); }
+	  { fprintf(out,"tx%02d%s",i,delim); }
 	for(i=0;i<(sizeof(lgw103->rxwave)-1);i++)
-	  { fprintf(stdout,"rx%03d%s",i,delim); }
-	fprintf(stdout,"rx%03d\n",i);
+	  { fprintf(out,"rx%03d%s",i,delim); }
+	fprintf(out,"rx%03d\n",i);
      }   
    if(dataVersion == ((float)1.04))
      {
 	for(i=0;i<(LVIS_LGW_V1_04_ELEMENTS);i++) 
-	  { fprintf(stdout,"%s%s",lvis_lgw_v1_04_header[i],delim); }
+	  { fprintf(out,"%s%s",lvis_lgw_v1_04_header[i],delim); }
 	for(i=0;i<(sizeof(lgw104->txwave)/sizeof(lgw104->txwave[0]));i++)
-	  { fprintf(stdout,"tx%03d%s",i,delim); }
+	  { fprintf(out,"tx%03d%s",i,delim); }
 	for(i=0;i<(sizeof(lgw104->rxwave)/sizeof(lgw104->rxwave[0]))-1;i++)
-	  { fprintf(stdout,"rx%03d%s",i,delim); }
-	fprintf(stdout,"rx%03d\n",i);
+	  { fprintf(out,"rx%03d%s",i,delim); }
+	fprintf(out,"rx%03d\n",i);
      }   
 }
 
-void print_lgw_data_v1_00(unsigned char *lgwdata, int indexcol, unsigned int colnum, char * delim,
+void print_lgw_data_v1_00(FILE * out,unsigned char *lgwdata, int indexcol, unsigned int colnum, char * delim,
 			  double minlat, double maxlat, double minlon, double maxlon)
 {
    int j;
@@ -710,16 +864,16 @@ void print_lgw_data_v1_00(unsigned char *lgwdata, int indexcol, unsigned int col
    
    if(lgw->lon431>minlon && lgw->lon431<maxlon && lgw->lat431>minlat && lgw->lat431<maxlat)
      {
-	if(indexcol==1) fprintf(stdout,"%10i%s",colnum++,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon0,delim,lgw->lat0,delim,lgw->z0,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon431,delim,lgw->lat431,delim,lgw->z431,delim);
-	fprintf(stdout,"%9.4f%s",lgw->sigmean,delim);
-	for(j=0;j<sizeof(lgw->wave)-1;j++) fprintf(stdout,"%03d%s",lgw->wave[j],delim);
-	fprintf(stdout,"%03d\n",lgw->wave[j]);
+	if(indexcol==1) fprintf(out,"%10i%s",colnum++,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon0,delim,lgw->lat0,delim,lgw->z0,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon431,delim,lgw->lat431,delim,lgw->z431,delim);
+	fprintf(out,"%9.4f%s",lgw->sigmean,delim);
+	for(j=0;j<sizeof(lgw->wave)-1;j++) fprintf(out,"%03d%s",lgw->wave[j],delim);
+	fprintf(out,"%03d\n",lgw->wave[j]);
      }
 }
 
-void print_lgw_data_v1_01(unsigned char *lgwdata, int indexcol, unsigned int colnum, char * delim,
+void print_lgw_data_v1_01(FILE * out,unsigned char *lgwdata, int indexcol, unsigned int colnum, char * delim,
 			  double minlat, double maxlat, double minlon, double maxlon)
 {
    int j;
@@ -728,17 +882,17 @@ void print_lgw_data_v1_01(unsigned char *lgwdata, int indexcol, unsigned int col
    
    if(lgw->lon431>minlon && lgw->lon431<maxlon && lgw->lat431>minlat && lgw->lat431<maxlat)
      {
-	if(indexcol==1) fprintf(stdout,"%10i%s",colnum++,delim);
-	fprintf(stdout,"%u%s%u%s",lgw->lfid,delim,lgw->shotnumber,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon0,delim,lgw->lat0,delim,lgw->z0,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon431,delim,lgw->lat431,delim,lgw->z431,delim);
-	fprintf(stdout,"%9.4f%s",lgw->sigmean,delim);
-	for(j=0;j<sizeof(lgw->wave)-1;j++) fprintf(stdout,"%03d%s",lgw->wave[j],delim);
-	fprintf(stdout,"%03d\n",lgw->wave[j]);
+	if(indexcol==1) fprintf(out,"%10i%s",colnum++,delim);
+	fprintf(out,"%u%s%u%s",lgw->lfid,delim,lgw->shotnumber,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon0,delim,lgw->lat0,delim,lgw->z0,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon431,delim,lgw->lat431,delim,lgw->z431,delim);
+	fprintf(out,"%9.4f%s",lgw->sigmean,delim);
+	for(j=0;j<sizeof(lgw->wave)-1;j++) fprintf(out,"%03d%s",lgw->wave[j],delim);
+	fprintf(out,"%03d\n",lgw->wave[j]);
      }
 }
 
-void print_lgw_data_v1_02(unsigned char *lgwdata, int indexcol, unsigned int colnum, char * delim,
+void print_lgw_data_v1_02(FILE * out,unsigned char *lgwdata, int indexcol, unsigned int colnum, char * delim,
 			  double minlat, double maxlat, double minlon, double maxlon)
 {
    int j;
@@ -747,17 +901,17 @@ void print_lgw_data_v1_02(unsigned char *lgwdata, int indexcol, unsigned int col
    
    if(lgw->lon431>minlon && lgw->lon431<maxlon && lgw->lat431>minlat && lgw->lat431<maxlat)
      {
-	if(indexcol==1) fprintf(stdout,"%10i%s",colnum++,delim);
-	fprintf(stdout,"%u%s%u%s%12.6f%s",lgw->lfid,delim,lgw->shotnumber,delim,lgw->lvistime,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon0,delim,lgw->lat0,delim,lgw->z0,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon431,delim,lgw->lat431,delim,lgw->z431,delim);
-	fprintf(stdout,"%9.4f%s",lgw->sigmean,delim);
-	for(j=0;j<sizeof(lgw->wave)-1;j++) fprintf(stdout,"%03d%s",lgw->wave[j],delim);
-	fprintf(stdout,"%03d\n",lgw->wave[j]);
+	if(indexcol==1) fprintf(out,"%10i%s",colnum++,delim);
+	fprintf(out,"%u%s%u%s%12.6f%s",lgw->lfid,delim,lgw->shotnumber,delim,lgw->lvistime,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon0,delim,lgw->lat0,delim,lgw->z0,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon431,delim,lgw->lat431,delim,lgw->z431,delim);
+	fprintf(out,"%9.4f%s",lgw->sigmean,delim);
+	for(j=0;j<sizeof(lgw->wave)-1;j++) fprintf(out,"%03d%s",lgw->wave[j],delim);
+	fprintf(out,"%03d\n",lgw->wave[j]);
      }
 }
 
-void print_lgw_data_v1_03(unsigned char *lgwdata, int indexcol, unsigned int colnum, char * delim,
+void print_lgw_data_v1_03(FILE * out,unsigned char *lgwdata, int indexcol, unsigned int colnum, char * delim,
 			  double minlat, double maxlat, double minlon, double maxlon)
 {
    int j;
@@ -766,86 +920,88 @@ void print_lgw_data_v1_03(unsigned char *lgwdata, int indexcol, unsigned int col
    
    if(lgw->lon431>minlon && lgw->lon431<maxlon && lgw->lat431>minlat && lgw->lat431<maxlat)
      {
-	if(indexcol==1) fprintf(stdout,"%10i%s",colnum++,delim);
-	fprintf(stdout,"%u%s%u%s",lgw->lfid,delim,lgw->shotnumber,delim);
-	fprintf(stdout,"%9.4f%s%9.4f%s%9.4f%s",lgw->azimuth,delim,lgw->incidentangle,delim,lgw->range,delim);
-	fprintf(stdout,"%12.6f%s",lgw->lvistime,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon0,delim,lgw->lat0,delim,lgw->z0,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon431,delim,lgw->lat431,delim,lgw->z431,delim);
-	fprintf(stdout,"%9.4f%s",lgw->sigmean,delim);
-	for(j=0;j<sizeof(lgw->txwave)-1;j++) fprintf(stdout,"%03d%s",lgw->txwave[j],delim);
-	fprintf(stdout,"%03d\n",lgw->txwave[j]);
-	for(j=0;j<sizeof(lgw->rxwave)-1;j++) fprintf(stdout,"%03d%s",lgw->rxwave[j],delim);
-	fprintf(stdout,"%03d\n",lgw->rxwave[j]);
+	if(indexcol==1) fprintf(out,"%10i%s",colnum++,delim);
+	fprintf(out,"%u%s%u%s",lgw->lfid,delim,lgw->shotnumber,delim);
+	fprintf(out,"%9.4f%s%9.4f%s%9.4f%s",lgw->azimuth,delim,lgw->incidentangle,delim,lgw->range,delim);
+	fprintf(out,"%12.6f%s",lgw->lvistime,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon0,delim,lgw->lat0,delim,lgw->z0,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon431,delim,lgw->lat431,delim,lgw->z431,delim);
+	fprintf(out,"%9.4f%s",lgw->sigmean,delim);
+	for(j=0;j<sizeof(lgw->txwave)-1;j++) fprintf(out,"%03d%s",lgw->txwave[j],delim);
+	fprintf(out,"%03d\n",lgw->txwave[j]);
+	for(j=0;j<sizeof(lgw->rxwave)-1;j++) fprintf(out,"%03d%s",lgw->rxwave[j],delim);
+	fprintf(out,"%03d\n",lgw->rxwave[j]);
      }
 }
 
-void print_lgw_data_v1_04(unsigned char *lgwdata, int indexcol, unsigned int colnum, char * delim,
+void print_lgw_data_v1_04(FILE * out,unsigned char *lgwdata, int indexcol, unsigned int colnum, char * delim,
 			  double minlat, double maxlat, double minlon, double maxlon)
 {
-   int j,myendian;
+   int j;
    struct lvis_lgw_v1_04 * lgw;
    lgw = (struct lvis_lgw_v1_04 * ) lgwdata;
    
-   myendian = host_endian();
-   
    if(lgw->lon527>minlon && lgw->lon527<maxlon && lgw->lat527>minlat && lgw->lat527<maxlat)
      {
-	if(indexcol==1) fprintf(stdout,"%10i%s",colnum++,delim);
-	fprintf(stdout,"%u%s%u%s",lgw->lfid,delim,lgw->shotnumber,delim);
-	fprintf(stdout,"%9.4f%s%9.4f%s%9.4f%s",lgw->azimuth,delim,lgw->incidentangle,delim,lgw->range,delim);
-	fprintf(stdout,"%12.6f%s",lgw->lvistime,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon0,delim,lgw->lat0,delim,lgw->z0,delim);
-	fprintf(stdout,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon527,delim,lgw->lat527,delim,lgw->z527,delim);
-	fprintf(stdout,"%9.4f%s",lgw->sigmean,delim);
-	for(j=0;j<(sizeof(lgw->txwave)/sizeof(lgw->txwave[0]))-1;j++) fprintf(stdout,"%04d%s",host_word(lgw->txwave[j],myendian),delim);
-	fprintf(stdout,"%04d\n",host_word(lgw->txwave[j],myendian));
-	for(j=0;j<(sizeof(lgw->rxwave)/sizeof(lgw->rxwave[0]))-1;j++) fprintf(stdout,"%04d%s",host_word(lgw->rxwave[j],myendian),delim);
-	fprintf(stdout,"%04d\n",host_word(lgw->rxwave[j],myendian));
+	if(indexcol==1) fprintf(out,"%10i%s",colnum++,delim);
+	fprintf(out,"%u%s%u%s",lgw->lfid,delim,lgw->shotnumber,delim);
+	fprintf(out,"%9.4f%s%9.4f%s%9.4f%s",lgw->azimuth,delim,lgw->incidentangle,delim,lgw->range,delim);
+	fprintf(out,"%12.6f%s",lgw->lvistime,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon0,delim,lgw->lat0,delim,lgw->z0,delim);
+	fprintf(out,"%14.10f%s%14.10f%s%9.4f%s",lgw->lon527,delim,lgw->lat527,delim,lgw->z527,delim);
+	fprintf(out,"%9.4f%s",lgw->sigmean,delim);
+	for(j=0;j<(sizeof(lgw->txwave)/sizeof(lgw->txwave[0]))-1;j++) fprintf(out,"%04d%s",lgw->txwave[j],delim);
+	fprintf(out,"%04d\n",lgw->txwave[j]);
+	for(j=0;j<(sizeof(lgw->rxwave)/sizeof(lgw->rxwave[0]))-1;j++) fprintf(out,"%04d%s",lgw->rxwave[j],delim);
+	fprintf(out,"%04d\n",lgw->rxwave[j]);
      }
 }
 
 void print_lce_data
-  (unsigned char *lcedata, float dataVersion, int indexcol, unsigned int colnum, char * delim,
+  (FILE * out,unsigned char *lcedata, float dataVersion, int indexcol, unsigned int colnum, char * delim,
    double minlat, double maxlat, double minlon, double maxlon)
 {
-   if(dataVersion == ((float)1.00)) print_lce_data_v1_00(lcedata,indexcol,colnum,delim,
+   if(dataVersion == ((float)1.00)) print_lce_data_v1_00(out,lcedata,indexcol,colnum,delim,
 						minlat,maxlat,minlon,maxlon);
-   if(dataVersion == ((float)1.01)) print_lce_data_v1_01(lcedata,indexcol,colnum,delim,
+   if(dataVersion == ((float)1.01)) print_lce_data_v1_01(out,lcedata,indexcol,colnum,delim,
 						minlat,maxlat,minlon,maxlon);
-   if(dataVersion == ((float)1.02)) print_lce_data_v1_02(lcedata,indexcol,colnum,delim,
+   if(dataVersion == ((float)1.02)) print_lce_data_v1_02(out,lcedata,indexcol,colnum,delim,
 						minlat,maxlat,minlon,maxlon);
-   if(dataVersion == ((float)1.03)) print_lce_data_v1_03(lcedata,indexcol,colnum,delim,
+   if(dataVersion == ((float)1.03)) print_lce_data_v1_03(out,lcedata,indexcol,colnum,delim,
+						minlat,maxlat,minlon,maxlon);
+   if(dataVersion == ((float)1.04)) print_lce_data_v1_04(out,lcedata,indexcol,colnum,delim,
 						minlat,maxlat,minlon,maxlon);
 }
 
 void print_lge_data
-  (unsigned char *lgedata, float dataVersion, int indexcol, unsigned int colnum, char * delim,
+  (FILE * out,unsigned char *lgedata, float dataVersion, int indexcol, unsigned int colnum, char * delim,
    double minlat, double maxlat, double minlon, double maxlon)
 {
-   if(dataVersion == ((float)1.00)) print_lge_data_v1_00(lgedata,indexcol,colnum,delim,
+   if(dataVersion == ((float)1.00)) print_lge_data_v1_00(out,lgedata,indexcol,colnum,delim,
+						minlat,maxlat,minlon,maxlon);
+   if(dataVersion == ((float)1.01)) print_lge_data_v1_01(out,lgedata,indexcol,colnum,delim,
 						minlat,maxlat,minlon,maxlon);
-   if(dataVersion == ((float)1.01)) print_lge_data_v1_01(lgedata,indexcol,colnum,delim,
+   if(dataVersion == ((float)1.02)) print_lge_data_v1_02(out,lgedata,indexcol,colnum,delim,
 						minlat,maxlat,minlon,maxlon);
-   if(dataVersion == ((float)1.02)) print_lge_data_v1_02(lgedata,indexcol,colnum,delim,
+   if(dataVersion == ((float)1.03)) print_lge_data_v1_03(out,lgedata,indexcol,colnum,delim,
 						minlat,maxlat,minlon,maxlon);
-   if(dataVersion == ((float)1.03)) print_lge_data_v1_03(lgedata,indexcol,colnum,delim,
+   if(dataVersion == ((float)1.04)) print_lge_data_v1_04(out,lgedata,indexcol,colnum,delim,
 						minlat,maxlat,minlon,maxlon);
 }
 
 void print_lgw_data
-  (unsigned char *lgwdata, float dataVersion, int indexcol, unsigned int colnum, char * delim,
+  (FILE * out,unsigned char *lgwdata, float dataVersion, int indexcol, unsigned int colnum, char * delim,
    double minlat, double maxlat, double minlon, double maxlon)
 {
-   if(dataVersion == ((float)1.00)) print_lgw_data_v1_00(lgwdata,indexcol,colnum,delim,
+   if(dataVersion == ((float)1.00)) print_lgw_data_v1_00(out,lgwdata,indexcol,colnum,delim,
 						minlat,maxlat,minlon,maxlon);
-   if(dataVersion == ((float)1.01)) print_lgw_data_v1_01(lgwdata,indexcol,colnum,delim,
+   if(dataVersion == ((float)1.01)) print_lgw_data_v1_01(out,lgwdata,indexcol,colnum,delim,
 						minlat,maxlat,minlon,maxlon);
-   if(dataVersion == ((float)1.02)) print_lgw_data_v1_02(lgwdata,indexcol,colnum,delim,
+   if(dataVersion == ((float)1.02)) print_lgw_data_v1_02(out,lgwdata,indexcol,colnum,delim,
 						minlat,maxlat,minlon,maxlon);
-   if(dataVersion == ((float)1.03)) print_lgw_data_v1_03(lgwdata,indexcol,colnum,delim,
+   if(dataVersion == ((float)1.03)) print_lgw_data_v1_03(out,lgwdata,indexcol,colnum,delim,
 						minlat,maxlat,minlon,maxlon);
-   if(dataVersion == ((float)1.04)) print_lgw_data_v1_04(lgwdata,indexcol,colnum,delim,
+   if(dataVersion == ((float)1.04)) print_lgw_data_v1_04(out,lgwdata,indexcol,colnum,delim,
 						minlat,maxlat,minlon,maxlon);
 }
 
@@ -900,6 +1056,22 @@ void swap_lce_data_v1_03(unsigned char *lcedata, int myendian)
    lce->zt            = host_float(lce->zt,myendian);
 }
 
+void swap_lce_data_v1_04(unsigned char *lcedata, int myendian)
+{
+   struct lvis_lce_v1_04 * lce;
+   lce = (struct lvis_lce_v1_04 * ) lcedata;
+   
+   lce->lfid          = host_dword(lce->lfid,myendian);
+   lce->shotnumber    = host_dword(lce->shotnumber,myendian);
+   lce->azimuth       = host_float(lce->azimuth,myendian);
+   lce->incidentangle = host_float(lce->incidentangle,myendian);
+   lce->range         = host_float(lce->range,myendian);
+   lce->lvistime      = host_double(lce->lvistime,myendian);
+   lce->tlon          = host_double(lce->tlon,myendian);
+   lce->tlat          = host_double(lce->tlat,myendian);
+   lce->zt            = host_float(lce->zt,myendian);
+}
+
 void swap_lge_data_v1_00(unsigned char *lgedata, int myendian)
 {
    struct lvis_lge_v1_00 * lge;
@@ -967,6 +1139,26 @@ void swap_lge_data_v1_03(unsigned char *lgedata, int myendian)
    lge->rh100         = host_float(lge->rh100,myendian);   
 }
 
+void swap_lge_data_v1_04(unsigned char *lgedata, int myendian)
+{
+   struct lvis_lge_v1_04 * lge;
+   lge = (struct lvis_lge_v1_04 * ) lgedata;
+   
+   lge->lfid          = host_dword(lge->lfid,myendian);
+   lge->shotnumber    = host_dword(lge->shotnumber,myendian);
+   lge->azimuth       = host_float(lge->azimuth,myendian);
+   lge->incidentangle = host_float(lge->incidentangle,myendian);
+   lge->range         = host_float(lge->range,myendian);
+   lge->lvistime      = host_double(lge->lvistime,myendian);
+   lge->glon          = host_double(lge->glon,myendian);
+   lge->glat          = host_double(lge->glat,myendian);
+   lge->zg            = host_float(lge->zg,myendian);
+   lge->rh25          = host_float(lge->rh25,myendian);
+   lge->rh50          = host_float(lge->rh50,myendian);
+   lge->rh75          = host_float(lge->rh75,myendian);
+   lge->rh100         = host_float(lge->rh100,myendian);   
+}
+
 void swap_lgw_data_v1_00(unsigned char *lgwdata, int myendian)
 {
    struct lvis_lgw_v1_00 * lgw;
@@ -1036,6 +1228,7 @@ void swap_lgw_data_v1_03(unsigned char *lgwdata, int myendian)
 
 void swap_lgw_data_v1_04(unsigned char *lgwdata, int myendian)
 {
+   int j;
    struct lvis_lgw_v1_04 * lgw;
    lgw = (struct lvis_lgw_v1_04 * ) lgwdata;
    
@@ -1052,6 +1245,9 @@ void swap_lgw_data_v1_04(unsigned char *lgwdata, int myendian)
    lgw->lat527        = host_double(lgw->lat527,myendian);
    lgw->z527          = host_float(lgw->z527,myendian);
    lgw->sigmean       = host_float(lgw->sigmean,myendian);
+   // the 16 bit waveforms need swapping too (the 8 bit ones of older versions do not)
+   for(j=0;j<(sizeof(lgw->txwave)/sizeof(lgw->txwave[0]));j++) lgw->txwave[j] = host_word(lgw->txwave[j],myendian);
+   for(j=0;j<(sizeof(lgw->rxwave)/sizeof(lgw->rxwave[0]));j++) lgw->rxwave[j] = host_word(lgw->rxwave[j],myendian);
 }
 
 void swap_lce_data(unsigned char *lcedata, float dataVersion, int myendian)
@@ -1060,6 +1256,7 @@ void swap_lce_data(unsigned char *lcedata, float dataVersion, int myendian)
    if(dataVersion == ((float)1.01)) swap_lce_data_v1_01(lcedata,myendian);
    if(dataVersion == ((float)1.02)) swap_lce_data_v1_02(lcedata,myendian);
    if(dataVersion == ((float)1.03)) swap_lce_data_v1_03(lcedata,myendian);
+   if(dataVersion == ((float)1.04)) swap_lce_data_v1_04(lcedata,myendian);
 }
 
 void swap_lge_data(unsigned char *lgedata, float dataVersion, int myendian)
@@ -1068,6 +1265,7 @@ void swap_lge_data(unsigned char *lgedata, float dataVersion, int myendian)
    if(dataVersion == ((float)1.01)) swap_lge_data_v1_01(lgedata,myendian);
    if(dataVersion == ((float)1.02)) swap_lge_data_v1_02(lgedata,myendian);
    if(dataVersion == ((float)1.03)) swap_lge_data_v1_03(lgedata,myendian);
+   if(dataVersion == ((float)1.04)) swap_lge_data_v1_04(lgedata,myendian);
 }
 
 void swap_lgw_data(unsigned char *lgwdata, float dataVersion, int myendian)
@@ -1079,9 +1277,122 @@ void swap_lgw_data(unsigned char *lgwdata, float dataVersion, int myendian)
    if(dataVersion == ((float)1.04)) swap_lgw_data_v1_04(lgwdata,myendian);
 }
 
+void swap_release_data(unsigned char *data, int fileType, float dataVersion, int myendian)
+{
+   if(fileType == LVIS_RELEASE_FILETYPE_LCE) swap_lce_data(data,dataVersion,myendian);
+   if(fileType == LVIS_RELEASE_FILETYPE_LGE) swap_lge_data(data,dataVersion,myendian);
+   if(fileType == LVIS_RELEASE_FILETYPE_LGW) swap_lgw_data(data,dataVersion,myendian);
+}
+
+void print_release_column_headers(FILE * out, int fileType, float dataVersion, int indexcol, char * delim)
+{
+   if(fileType == LVIS_RELEASE_FILETYPE_LCE) print_lce_column_headers(out,dataVersion,indexcol,delim);
+   if(fileType == LVIS_RELEASE_FILETYPE_LGE) print_lge_column_headers(out,dataVersion,indexcol,delim);
+   if(fileType == LVIS_RELEASE_FILETYPE_LGW) print_lgw_column_headers(out,dataVersion,indexcol,delim);
+}
+
+void print_release_data
+  (FILE * out, unsigned char *data, int fileType, float dataVersion, int indexcol, unsigned int colnum,
+   char * delim, double minlat, double maxlat, double minlon, double maxlon)
+{
+   if(fileType == LVIS_RELEASE_FILETYPE_LCE) print_lce_data(out,data,dataVersion,indexcol,colnum,delim,
+							    minlat,maxlat,minlon,maxlon);
+   if(fileType == LVIS_RELEASE_FILETYPE_LGE) print_lge_data(out,data,dataVersion,indexcol,colnum,delim,
+							    minlat,maxlat,minlon,maxlon);
+   if(fileType == LVIS_RELEASE_FILETYPE_LGW) print_lgw_data(out,data,dataVersion,indexcol,colnum,delim,
+							    minlat,maxlat,minlon,maxlon);
+}
+
+// the position a (host order) record is cut on by -lat / -lon, the same
+// one the print_xxx_data routines test
+void release_data_position(unsigned char *data, int fileType, float dataVersion, double *lon, double *lat)
+{
+   *lon = *lat = 0.0;
+   if(fileType == LVIS_RELEASE_FILETYPE_LCE)
+     {
+	if(dataVersion == ((float)1.00)) { *lon = ((struct lvis_lce_v1_00 *) data)->tlon; *lat = ((struct lvis_lce_v1_00 *) data)->tlat; }
+	if(dataVersion == ((float)1.01)) { *lon = ((struct lvis_lce_v1_01 *) data)->tlon; *lat = ((struct lvis_lce_v1_01 *) data)->tlat; }
+	if(dataVersion == ((float)1.02)) { *lon = ((struct lvis_lce_v1_02 *) data)->tlon; *lat = ((struct lvis_lce_v1_02 *) data)->tlat; }
+	if(dataVersion == ((float)1.03)) { *lon = ((struct lvis_lce_v1_03 *) data)->tlon; *lat = ((struct lvis_lce_v1_03 *) data)->tlat; }
+	if(dataVersion == ((float)1.04)) { *lon = ((struct lvis_lce_v1_04 *) data)->tlon; *lat = ((struct lvis_lce_v1_04 *) data)->tlat; }
+     }
+   if(fileType == LVIS_RELEASE_FILETYPE_LGE)
+     {
+	if(dataVersion == ((float)1.00)) { *lon = ((struct lvis_lge_v1_00 *) data)->glon; *lat = ((struct lvis_lge_v1_00 *) data)->glat; }
+	if(dataVersion == ((float)1.01)) { *lon = ((struct lvis_lge_v1_01 *) data)->glon; *lat = ((struct lvis_lge_v1_01 *) data)->glat; }
+	if(dataVersion == ((float)1.02)) { *lon = ((struct lvis_lge_v1_02 *) data)->glon; *lat = ((struct lvis_lge_v1_02 *) data)->glat; }
+	if(dataVersion == ((float)1.03)) { *lon = ((struct lvis_lge_v1_03 *) data)->glon; *lat = ((struct lvis_lge_v1_03 *) data)->glat; }
+	if(dataVersion == ((float)1.04)) { *lon = ((struct lvis_lge_v1_04 *) data)->glon; *lat = ((struct lvis_lge_v1_04 *) data)->glat; }
+     }
+   if(fileType == LVIS_RELEASE_FILETYPE_LGW)
+     {
+	if(dataVersion == ((float)1.00)) { *lon = ((struct lvis_lgw_v1_00 *) data)->lon431; *lat = ((struct lvis_lgw_v1_00 *) data)->lat431; }
+	if(dataVersion == ((float)1.01)) { *lon = ((struct lvis_lgw_v1_01 *) data)->lon431; *lat = ((struct lvis_lgw_v1_01 *) data)->lat431; }
+	if(dataVersion == ((float)1.02)) { *lon = ((struct lvis_lgw_v1_02 *) data)->lon431; *lat = ((struct lvis_lgw_v1_02 *) data)->lat431; }
+	if(dataVersion == ((float)1.03)) { *lon = ((struct lvis_lgw_v1_03 *) data)->lon431; *lat = ((struct lvis_lgw_v1_03 *) data)->lat431; }
+	if(dataVersion == ((float)1.04)) { *lon = ((struct lvis_lgw_v1_04 *) data)->lon527; *lat = ((struct lvis_lgw_v1_04 *) data)->lat527; }
+     }
+}
+
+// size in bytes of one record of the given type and release version (0 if unknown)
+int lvis_record_size(int fileType, float fileVersion)
+{
+   int lcesize=0,lgesize=0,lgwsize=0;
+
+   if(fileVersion == ((float)1.00))
+     {
+	lcesize = sizeof(struct lvis_lce_v1_00);
+	lgesize = sizeof(struct lvis_lge_v1_00);
+	lgwsize = sizeof(struct lvis_lgw_v1_00);
+     }
+   if(fileVersion == ((float)1.01))
+     {
+	lcesize = sizeof(struct lvis_lce_v1_01);
+	lgesize = sizeof(struct lvis_lge_v1_01);
+	lgwsize = sizeof(struct lvis_lgw_v1_01);
+     }
+   if(fileVersion == ((float)1.02))
+     {
+	lcesize = sizeof(struct lvis_lce_v1_02);
+	lgesize = sizeof(struct lvis_lge_v1_02);
+	lgwsize = sizeof(struct lvis_lgw_v1_02);
+     }
+   if(fileVersion == ((float)1.03))
+     {
+	lcesize = sizeof(struct lvis_lce_v1_03);
+	lgesize = sizeof(struct lvis_lge_v1_03);
+	lgwsize = sizeof(struct lvis_lgw_v1_03);
+     }
+   if(fileVersion == ((float)1.04))
+     {
+	lcesize = sizeof(struct lvis_lce_v1_04);
+	lgesize = sizeof(struct lvis_lge_v1_04);
+	lgwsize = sizeof(struct lvis_lgw_v1_04);
+     }
+
+   if(fileType == LVIS_RELEASE_FILETYPE_LCE) return lcesize;
+   if(fileType == LVIS_RELEASE_FILETYPE_LGE) return lgesize;
+   if(fileType == LVIS_RELEASE_FILETYPE_LGW) return lgwsize;
+   return 0;
+}
+
 void display_usage(char * proggy)
 {
-   fprintf(stdout,"USAGE: %s <input> [options]\n",proggy);
+   fprintf(stdout,"USAGE: %s <input> [<input> ...] [options]\n",proggy);
+   fprintf(stdout,"       %s merge <shard manifest> [...] [-o output]\n",proggy);
+   fprintf(stdout,"       %s merge <sorted input> [...] [-key time|shot] [-format text|binary|columns] [-o output]\n",proggy);
+   fprintf(stdout,"       %s join <lgw> <lge> [<lce>] [...] [-fields f,lge.f,...] [-t] [-o output]\n",proggy);
+   fprintf(stdout,"       %s metrics <lgw> [...] [-smooth S] [-featthresh N] [-validate lge] [-threads N] [-o output.lge]\n",proggy);
+   fprintf(stdout,"       %s decompose <lgw> [...] [-maxmodes N] [-txsigma S] [-smooth S] [-threads N] [-o output]\n",proggy);
+   fprintf(stdout,"       %s deconvolve <lgw> [...] [-deconreg R] [-threads N] [-o output.canonical]\n",proggy);
+   fprintf(stdout,"       %s expand <lgw> [...] [-featthresh N] [-nosimd] [-threads N] [-o output.pts]\n",proggy);
+   fprintf(stdout,"       %s grid <lce|lge|lgw> [...] [-field NAME] [-cell S] [-gridmem MB] [-threads N] -o output.bil\n",proggy);
+   fprintf(stdout,"       %s query <lce|lge|lgw> [...] -points file [-radius R] [-knn K] [-threads N] [-o output]\n",proggy);
+   fprintf(stdout,"       %s crossovers <lce|lge|lgw> [...] [-field NAME] [-linestep N] [-crossmax M] [-threads N] [-o output]\n",proggy);
+   fprintf(stdout,"       %s dhdt <lce|lge|lgw> [...] -ref <input> [...] [-field NAME] [-radius R] [-refdate D -date D] [-o output]\n",proggy);
+   fprintf(stdout,"       %s render <lgw> [...] [-width N] [-reduce max|mean] [-scale LO-HI] [-pyramid DIR] [-o image.pgm|png]\n",proggy);
+   fprintf(stdout,"       %s quantiles <lce|lge|lgw|sketch> [...] [-fields f,g] [-q 1,50,99] [-sketchk K] [-threads N] [-o output]\n",proggy);
+   fprintf(stdout,"       %s upgrade <input> [...] [-odir DIR] [-suffix .ext] [-threads N]\n",proggy);
    fprintf(stdout,"\n");
    fprintf(stdout,"-c                    Delimit data with commas (default = TAB)\n");
    fprintf(stdout,"-endianbig            Force the software to assume system is BIG Endian\n");
@@ -1093,11 +1404,136 @@ void display_usage(char * proggy)
    fprintf(stdout,"-lce                  Force file type to LCE (normally chooses by file extension)\n");
    fprintf(stdout,"-lge                  Force file type to LGE\n");
    fprintf(stdout,"-lgw                  Force file type to LGW\n");
+   fprintf(stdout,"-poly file.wkt        Keep only the shots inside a WKT POLYGON / MULTIPOLYGON (lon lat) as well\n");
    fprintf(stdout,"-n N                  Number of samples to read (1000 for example)\n");
+   fprintf(stdout,"-o file               Write the records inside -lat/-lon to file in their original binary form\n");
+   fprintf(stdout,"                      (with merge: write the merged output to file instead of stdout)\n");
    fprintf(stdout,"-r V.VV               Force version to release version V.VV (1.02 for example)\n");
    fprintf(stdout,"-t                    Top each column with a header\n");
    fprintf(stdout,"-v                    Print program version and exit\n");
    fprintf(stdout,"\n");
+   fprintf(stdout,"Batch conversion (used when more than one input or any of these is given):\n");
+   fprintf(stdout,"-list file            Read more input file names from file (one per line)\n");
+   fprintf(stdout,"-threads N            Convert on N threads (0 = every cpu, default for several inputs)\n");
+   fprintf(stdout,"-chunk N              Records per work unit (default = about 1MB of input)\n");
+   fprintf(stdout,"-odir DIR             Write one output per input into DIR (default = merged to stdout)\n");
+   fprintf(stdout,"-suffix .ext          Suffix of the -odir output names (default = .txt)\n");
+   fprintf(stdout,"--shard i/N           Convert only piece i (0..N-1) of N, to a partial output + manifest\n");
+   fprintf(stdout,"-prefix P             Name shard outputs P.shard-i-of-N.txt / .manifest (default = lvis_release)\n");
+   fprintf(stdout,"\n");
+   fprintf(stdout,"-dedup                Write each (lfid, shotnumber) once, the first met in input order\n");
+   fprintf(stdout,"                      (text, or binary with -o; needs release 1.01 or later)\n");
+   fprintf(stdout,"-dedupmem MB          Memory for the -dedup key set (default = %d), keys spill to disk beyond it\n",LVIS_DEDUP_MEMORY_MB);
+   fprintf(stdout,"-tmpdir DIR           Where -dedup and join spill (default = $TMPDIR or /tmp)\n");
+   fprintf(stdout,"\n");
+   fprintf(stdout,"merge of sorted inputs (each already in order) gives one ordered stream:\n");
+   fprintf(stdout,"-key time|shot        Order by lvistime (default) or by lfid, shotnumber\n");
+   fprintf(stdout,"-format text          Text like the reader (default, stdout or -o file)\n");
+   fprintf(stdout,"-format binary        One binary release file (-o file), canonical if the inputs differ\n");
+   fprintf(stdout,"-format columns       One native binary file per field in the directory -o, see columns.txt\n");
+   fprintf(stdout,"\n");
+   fprintf(stdout,"-summary              Describe each input instead of converting it: type, version, records, box,\n");
+   fprintf(stdout,"                      time range, count / nan / min / max / mean / stddev of every field,\n");
+   fprintf(stdout,"                      elevation (-field) and rxwave histograms, quality counts\n");
+   fprintf(stdout,"-json                 The -summary as JSON, an object per input\n");
+   fprintf(stdout,"-zbin M               Bins of the -summary elevation histogram in metres (default = %g)\n",LVIS_SUMMARY_ZBIN);
+   fprintf(stdout,"-sample K             -summary / grid of every K-th record only (the others are not read), with\n");
+   fprintf(stdout,"                      the standard error of the means (grid: a fifth band)\n");
+   fprintf(stdout,"-sample NxB           -summary / grid of N blocks of B records spread evenly over each input\n");
+   fprintf(stdout,"-sampleseed S         Where the strided sample starts and the blocks are (default = 1)\n");
+   fprintf(stdout,"\n");
+   fprintf(stdout,"-windows S            Write a row of instrument QA a window of S seconds of lvistime instead of\n");
+   fprintf(stdout,"                      converting: window, start, end, shots, rate (Hz), missed, gaps, mean / min /\n");
+   fprintf(stdout,"                      max of range, incidentangle, azimuth, sigmean, rxwave peak mean / max, saturated\n");
+   fprintf(stdout,"-windowshots N        The same a window of N records\n");
+   fprintf(stdout,"-wingap S             Seconds between two shots that count as a gap (default = %g)\n",LVIS_WINDOWS_GAP);
+   fprintf(stdout,"\n");
+   fprintf(stdout,"-features             Write the LGW scalar fields and features of rxwave and txwave instead of\n");
+   fprintf(stdout,"                      the waveforms: energy, centroid, peak, peakindex, start, end, saturated\n");
+   fprintf(stdout,"-featthresh N         Counts above the noise that start / end the signal, -features,\n");
+   fprintf(stdout,"                      metrics, decompose and expand (default = %d)\n",LVIS_FEATURES_THRESHOLD);
+   fprintf(stdout,"-nosimd               Compute the features / expand points / -proj without the AVX2 kernels\n");
+   fprintf(stdout,"\n");
+   fprintf(stdout,"-proj 3413|3031       Append polar stereographic x / y (m) of every position to the text:\n");
+   fprintf(stdout,"                      3413 (north) NSIDC sea ice, 3031 (south) Antarctic; xt yt, xg yg, x0 y0 ...\n");
+   fprintf(stdout,"-dem file.bil         Append zdem, the height of a float DEM (.bil / .flt with .hdr, lon lat or the\n");
+   fprintf(stdout,"                      -proj x y) under each shot, and dzdem = zt / zg / z527 - zdem; repeat for tiles\n");
+   fprintf(stdout,"-demlist LIST         The DEM tiles, one file a line\n");
+   fprintf(stdout,"-demmem MB            Memory for decoded DEM blocks (default = %d)\n",LVIS_DEM_MEMORY_MB);
+   fprintf(stdout,"\n");
+   fprintf(stdout,"-las                  Write the inputs (one type) as the LAS 1.4 file -o: LCE / LGE a point\n");
+   fprintf(stdout,"                      per shot, LGW a point per sample as in expand (-featthresh)\n");
+   fprintf(stdout,"\n");
+   fprintf(stdout,"join writes one row per shot (lfid, shotnumber) found in every product given:\n");
+   fprintf(stdout,"-fields list          Fields to write, e.g. lvistime,lge.zg,lce.zt,rxwave (default = all)\n");
+   fprintf(stdout,"-sorted               The products are in shot order, skip the check\n");
+   fprintf(stdout,"-joinmem MB           Memory for hashing unsorted products (default = %d), else spill to -tmpdir\n",LVIS_JOIN_MEMORY_MB);
+   fprintf(stdout,"\n");
+   fprintf(stdout,"metrics makes LGE v1.04 records (zg, rh25 .. rh100) from the LGW waveforms, as text or\n");
+   fprintf(stdout,"binary with -o (shots without a signal are left out):\n");
+   fprintf(stdout,"-smooth S             Gaussian smoothing of rxwave, sigma in samples (default = %3.1f)\n",LVIS_METRICS_SMOOTH);
+   fprintf(stdout,"-validate file        Match the records to an LGE product on (lfid, shotnumber), the bias and\n");
+   fprintf(stdout,"                      RMS difference of zg and rh25 .. rh100 to stderr\n");
+   fprintf(stdout,"\n");
+   fprintf(stdout,"decompose fits gaussian modes (amplitude, center, sigma) to each return waveform, as text\n");
+   fprintf(stdout,"or a binary side file with -o (modes start where -smooth / -featthresh find peaks):\n");
+   fprintf(stdout,"-maxmodes N           At most N modes a shot (default = %d, up to %d)\n",LVIS_DECOMP_MODES,LVIS_DECOMP_MAX_MODES);
+   fprintf(stdout,"-txsigma S            Transmit pulse width in samples where there is no txwave (default = %3.1f)\n",LVIS_DECOMP_TX_SIGMA);
+   fprintf(stdout,"\n");
+   fprintf(stdout,"deconvolve divides each return waveform by the transmit pulse of its shot (1.03 and later),\n");
+   fprintf(stdout,"as LGW v1.04 text or one canonical LGW file with -o:\n");
+   fprintf(stdout,"-deconreg R           Regularization, a fraction of the pulse's peak power (default = %4.2f)\n",LVIS_DECONV_REGULARIZATION);
+   fprintf(stdout,"\n");
+   fprintf(stdout,"expand writes lfid, shotnumber, sample, lon, lat, z, amplitude for every return sample more\n");
+   fprintf(stdout,"than -featthresh above sigmean, as text or a binary point file with -o (lvis_release_expand.h)\n");
+   fprintf(stdout,"\n");
+   fprintf(stdout,"grid writes the mean, min, max and count of a field in each -cell of the -lon / -lat extent\n");
+   fprintf(stdout,"(default = the data's) as a 4 band float raster -o name.bil with .hdr, .blw and .prj:\n");
+   fprintf(stdout,"-field NAME           Record field to grid (or crossovers, dhdt), e.g. rh100, zt, sigmean (default = zg LGE, zt LCE)\n");
+   fprintf(stdout,"-cell S               Cell size in degrees (default = %g)\n",LVIS_GRID_CELL);
+   fprintf(stdout,"-gridmem MB           Memory for the partial grids (default = %d), else made in tiles of rows\n",LVIS_GRID_MEMORY_MB);
+   fprintf(stdout,"\n");
+   fprintf(stdout,"query writes point, plon, plat, rank, distance (m) and the record of the shots found for\n");
+   fprintf(stdout,"each point (the nearest one when neither -radius nor -knn is given):\n");
+   fprintf(stdout,"-points file          The points, lon lat (degrees) a line\n");
+   fprintf(stdout,"-radius R             Every shot within R metres (along the surface) of a point\n");
+   fprintf(stdout,"-knn K                The K nearest shots of a point (within -radius when given too)\n");
+   fprintf(stdout,"\n");
+   fprintf(stdout,"crossovers writes lon, lat, then lfid, shotnumber, time, z and distance of each line's nearest\n");
+   fprintf(stdout,"shot, dt and dz (later minus earlier) where two flight lines cross (-field: default zg, zt, z0):\n");
+   fprintf(stdout,"-linestep N           Shots averaged into a vertex of a line's centre (default = %d)\n",LVIS_CROSS_STEP);
+   fprintf(stdout,"-timegap S            A line ends where lvistime jumps more than S seconds (default = %g)\n",LVIS_CROSS_TIME_GAP);
+   fprintf(stdout,"-shotgap N            ... or the shotnumber more than N (default = %d)\n",LVIS_CROSS_SHOT_GAP);
+   fprintf(stdout,"-crossmax M           Leave out crossings with no shot within M metres (default = %g)\n",LVIS_CROSS_MAX_DISTANCE);
+   fprintf(stdout,"\n");
+   fprintf(stdout,"dhdt writes lon, lat, then lfid, shotnumber, time and z of the nearest reference shot and of\n");
+   fprintf(stdout,"each input shot, their distance, dt (days), dh (input minus reference) and dh/dt (m a year):\n");
+   fprintf(stdout,"-ref FILE             A file of the reference campaign (repeat it, or -reflist)\n");
+   fprintf(stdout,"-reflist LIST         The files of the reference campaign, one a line\n");
+   fprintf(stdout,"-radius R             Pair shots at most R metres apart (default = %g)\n",LVIS_DHDT_RADIUS);
+   fprintf(stdout,"-refdate YYYY-MM-DD   The day the reference campaign was flown (with -date, else dt is lvistime's)\n");
+   fprintf(stdout,"-date YYYY-MM-DD      The day the inputs were flown\n");
+   fprintf(stdout,"-dhdtmem MB           Memory for the reference index (default = %d), else spill to -tmpdir\n",LVIS_DHDT_MEMORY_MB);
+   fprintf(stdout,"\n");
+   fprintf(stdout,"render draws the rxwave counts of the LGW inputs (one flight) as an echogram, shots along x:\n");
+   fprintf(stdout,"-o name.pgm|png       The whole flight as one image of -width columns\n");
+   fprintf(stdout,"-width N              Columns of the image, each the shots of a bin reduced (default = %d, 0 = a shot each)\n",LVIS_RENDER_WIDTH);
+   fprintf(stdout,"-reduce max|mean      How the shots of a column are reduced, sample by sample (default = max)\n");
+   fprintf(stdout,"-scale LO-HI          Counts drawn black to white (default = 0 to 1023, 255 before release 1.04)\n");
+   fprintf(stdout,"-pyramid DIR          Also write DIR/level/tile.png, %d columns a tile, level 0 a column a shot\n",LVIS_RENDER_TILE);
+   fprintf(stdout,"\n");
+   fprintf(stdout,"quantiles writes field, count, min, the -q percentiles and max of every field over all the\n");
+   fprintf(stdout,"inputs, from KLL sketches kept next to each input as <input>%s (in -odir if given):\n",LVIS_QUANTILE_SUFFIX);
+   fprintf(stdout,"-fields f,g           The fields to report (default = all of them)\n");
+   fprintf(stdout,"-q P,P,...            Percentiles, 0 .. 100 (default = 1,5,25,50,75,95,99)\n");
+   fprintf(stdout,"-sketchk K            Sketch size, rank error about 1.7/K (default = %d)\n",LVIS_QUANTILE_K);
+   fprintf(stdout,"-resketch             Make the sketch files again even if they are up to date\n");
+   fprintf(stdout,"-nosketch             Neither read nor write sketch files\n");
+   fprintf(stdout,"\n");
+   fprintf(stdout,"upgrade rewrites each input as a canonical file (native endian v1.04 records behind a\n");
+   fprintf(stdout,"header, next to the input as <input>%s unless -odir / -suffix say otherwise).\n",LVIS_CANON_SUFFIX);
+   fprintf(stdout,"Canonical files are read like any other input, without detection or -r.\n");
+   fprintf(stdout,"\n");
    fprintf(stdout,"\n");
    
 }
@@ -1112,6 +1548,30 @@ int main(int argc, char *argv[])
    int           i,j,myendian,filetype,indexcol,topcol,keepReading;
    int           lcesize=0,lgesize=0,lgwsize=0;
    unsigned int  colnum;
+   char          **inputs=NULL;
+   int           ninputs=0,consumed,mode;
+   struct lvis_release_options opt;
+   struct lvis_batch_options   batch;
+   struct lvis_canon_header    canon;
+   struct lvis_merge_options   merge;
+   struct lvis_dedup_options   dedup;
+   struct lvis_join_options    join;
+   struct lvis_features_options features;
+   struct lvis_metrics_options  metrics;
+   struct lvis_decomp_options   decomp;
+   struct lvis_deconv_options   deconv;
+   struct lvis_expand_options   expand;
+   struct lvis_las_options      las;
+   struct lvis_grid_options     grid;
+   struct lvis_query_options    query;
+   struct lvis_cross_options    cross;
+   struct lvis_dhdt_options     dhdt;
+   struct lvis_dem_options      dem;
+   struct lvis_render_options   render;
+   struct lvis_summary_options  summary;
+   struct lvis_quantile_options quantile;
+   struct lvis_windows_options  windows;
+   struct lvis_sample_options   sample;
    
    FILE *fp;
    // set up variable defaults
@@ -1159,7 +1619,6 @@ int main(int argc, char *argv[])
 
    // check for a version flag
    strcpy(temp,argv[1]);
-   strcpy((char *) filename,argv[1]);
    if(strncmp(temp,"-v",2)==0)
      { 
 	minlon = LVIS_RELEASE_READER_VERSION;
@@ -1175,18 +1634,136 @@ int main(int argc, char *argv[])
 	display_usage(argv[0]);
 	exit(2);
      }
-      
-   // open up the file for read access
-   if((fp = fopen((char *)filename,"rb"))==NULL)
+   
+   // a processing mode may come first (lvis_release_reader merge ...)
+   mode = LVIS_MODE_CONVERT;
+   i=1;
+   if(strcmp(temp,"merge")==0) { mode = LVIS_MODE_MERGE; i++; }
+   if(strcmp(temp,"upgrade")==0) { mode = LVIS_MODE_UPGRADE; i++; }
+   if(strcmp(temp,"join")==0) { mode = LVIS_MODE_JOIN; i++; }
+   if(strcmp(temp,"metrics")==0) { mode = LVIS_MODE_METRICS; i++; }
+   if(strcmp(temp,"decompose")==0) { mode = LVIS_MODE_DECOMPOSE; i++; }
+   if(strcmp(temp,"deconvolve")==0) { mode = LVIS_MODE_DECONVOLVE; i++; }
+   if(strcmp(temp,"expand")==0) { mode = LVIS_MODE_EXPAND; i++; }
+   if(strcmp(temp,"grid")==0) { mode = LVIS_MODE_GRID; i++; }
+   if(strcmp(temp,"query")==0) { mode = LVIS_MODE_QUERY; i++; }
+   if(strcmp(temp,"crossovers")==0) { mode = LVIS_MODE_CROSSOVERS; i++; }
+   if(strcmp(temp,"dhdt")==0) { mode = LVIS_MODE_DHDT; i++; }
+   if(strcmp(temp,"render")==0) { mode = LVIS_MODE_RENDER; i++; }
+   if(strcmp(temp,"quantiles")==0) { mode = LVIS_MODE_QUANTILES; i++; }
+   
+   // then normally the input file, but more inputs may follow it or come
+   // from a list (-list)
+   lvis_batch_defaults(&batch);
+   lvis_merge_defaults(&merge);
+   lvis_dedup_defaults(&dedup);
+   lvis_join_defaults(&join);
+   lvis_features_defaults(&features);
+   lvis_metrics_defaults(&metrics);
+   lvis_decomp_defaults(&decomp);
+   lvis_deconv_defaults(&deconv);
+   lvis_expand_defaults(&expand);
+   lvis_las_defaults(&las);
+   lvis_grid_defaults(&grid);
+   lvis_query_defaults(&query);
+   lvis_cross_defaults(&cross);
+   lvis_dhdt_defaults(&dhdt);
+   lvis_dem_defaults(&dem);
+   lvis_render_defaults(&render);
+   lvis_summary_defaults(&summary);
+   lvis_quantile_defaults(&quantile);
+   lvis_windows_defaults(&windows);
+   lvis_sample_defaults(&sample);
+   memset(&opt,0,sizeof(opt));
+   if(getenv("TMPDIR") != NULL && getenv("TMPDIR")[0] != 0)
+     strncpy(opt.tmpdir,getenv("TMPDIR"),sizeof(opt.tmpdir)-1);
+   else
+     strcpy(opt.tmpdir,"/tmp");
+   if(i<argc && argv[i][0] != '-')
      {
-	fprintf(stderr,"Error opening the input file: %s\n",filename);
-	exit(-1);
+	lvis_batch_add_input(&inputs,&ninputs,argv[i]);
+	i++;  // set a pointer at the next arguement of the command line
      }
    
    // check for command line arguments
-   i=2;  // set a pointer at arguement 2 of the command line
    while(i<argc)
      {
+	// the batch options are whole words, check them before the single
+	// letter flags below (which only compare the first characters)
+	if((consumed = lvis_batch_parse_option(argc,argv,i,&batch,&inputs,&ninputs)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_merge_parse_option(argc,argv,i,&merge)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_dedup_parse_option(argc,argv,i,&dedup)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_join_parse_option(argc,argv,i,&join)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_features_parse_option(argc,argv,i,&features)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_metrics_parse_option(argc,argv,i,&metrics)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_decomp_parse_option(argc,argv,i,&decomp)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_deconv_parse_option(argc,argv,i,&deconv)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_las_parse_option(argc,argv,i,&las)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_grid_parse_option(argc,argv,i,&grid)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_query_parse_option(argc,argv,i,&query)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_cross_parse_option(argc,argv,i,&cross)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_dhdt_parse_option(argc,argv,i,&dhdt)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_dem_parse_option(argc,argv,i,&dem)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_render_parse_option(argc,argv,i,&render)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_summary_parse_option(argc,argv,i,&summary)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_quantile_parse_option(argc,argv,i,&quantile)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_windows_parse_option(argc,argv,i,&windows)) > 0)
+	  { i += consumed; continue; }
+	if((consumed = lvis_sample_parse_option(argc,argv,i,&sample)) > 0)
+	  { i += consumed; continue; }
+	if(strcmp(argv[i],"-tmpdir")==0 && i+1<argc)
+	  {
+	     strncpy(opt.tmpdir,argv[i+1],sizeof(opt.tmpdir)-1);
+	     i += 2;
+	     continue;
+	  }
+	if(strcmp(argv[i],"-poly")==0 && i+1<argc)
+	  {
+	     lvis_poly_destroy(opt.poly);
+	     if((opt.poly = lvis_poly_load(argv[i+1])) == NULL) exit(-1);
+	     i += 2;
+	     continue;
+	  }
+	if(strcmp(argv[i],"-proj")==0 && i+1<argc)
+	  {
+	     if((opt.proj = lvis_proj_code(argv[i+1])) == 0)
+	       {
+		  fprintf(stderr,"Unknown projection %s for -proj (3413 / north or 3031 / south)\n",argv[i+1]);
+		  exit(-1);
+	       }
+	     i += 2;
+	     continue;
+	  }
+	if(strcmp(argv[i],"-o")==0 && i+1<argc)
+	  {
+	     strncpy(opt.outfile,argv[i+1],sizeof(opt.outfile)-1);
+	     i += 2;
+	     continue;
+	  }
+	// anything else that is not a flag is one more input file
+	if(argv[i][0] != '-')
+	  {
+	     lvis_batch_add_input(&inputs,&ninputs,argv[i]);
+	     i++;
+	     continue;
+	  }
 	strcpy(temp,argv[i]);
 	if(strncmp(temp,"-v",2)==0)
 	  { 
@@ -1281,6 +1858,203 @@ int main(int argc, char *argv[])
 	i++;
      }
 
+   if(ninputs == 0)
+     {
+	display_usage(argv[0]);
+	exit(-1);
+     }
+
+   opt.filetype = filetype;
+   opt.dataReleaseVersion = dataReleaseVersion;
+   opt.myendian = myendian;
+   opt.indexcol = indexcol;
+   opt.topcol = topcol;
+   strcpy(opt.delim,delim);
+   opt.minlat = minlat; opt.maxlat = maxlat;
+   opt.minlon = minlon; opt.maxlon = maxlon;
+   opt.maxSampleNumber = maxSampleNumber;
+   opt.scalar = features.scalar;
+   if(lvis_sample_enabled(&sample))
+     {
+	if(mode != LVIS_MODE_GRID && !(summary.enabled && mode == LVIS_MODE_CONVERT))
+	  {
+	     fprintf(stderr,"-sample is for -summary and grid\n");
+	     exit(-1);
+	  }
+	opt.sample = &sample;
+     }
+
+   // merge joins shard outputs (given their manifests) or sorted release files
+   if(mode == LVIS_MODE_MERGE)
+     {
+	if(lvis_shard_is_manifest(inputs[0]))
+	  {
+	     if(lvis_shard_merge(inputs,ninputs,&opt) != 0) exit(-1);
+	  }
+	else if(lvis_merge_sorted(inputs,ninputs,&opt,&merge) != 0) exit(-1);
+	return(1);
+     }
+
+   if(mode == LVIS_MODE_UPGRADE)
+     {
+	// the outputs are binary, do not name them .txt
+	if(strcmp(batch.suffix,".txt")==0) strcpy(batch.suffix,LVIS_CANON_SUFFIX);
+	if(lvis_canon_upgrade(inputs,ninputs,&opt,&batch) != 0) exit(-1);
+	return(1);
+     }
+
+   if(mode == LVIS_MODE_JOIN)
+     {
+	if(lvis_join_products(inputs,ninputs,&opt,&join) != 0) exit(-1);
+	return(1);
+     }
+
+   if(mode == LVIS_MODE_METRICS)
+     {
+	metrics.threshold = features.threshold;
+	if(lvis_metrics_convert(inputs,ninputs,&opt,&batch,&metrics) != 0) exit(-1);
+	return(1);
+     }
+
+   if(mode == LVIS_MODE_DECOMPOSE)
+     {
+	metrics.threshold = features.threshold;
+	if(lvis_decomp_convert(inputs,ninputs,&opt,&batch,&metrics,&decomp) != 0) exit(-1);
+	return(1);
+     }
+
+   if(mode == LVIS_MODE_DECONVOLVE)
+     {
+	if(lvis_deconv_convert(inputs,ninputs,&opt,&batch,&deconv) != 0) exit(-1);
+	return(1);
+     }
+
+   if(mode == LVIS_MODE_GRID)
+     {
+	if(lvis_grid_convert(inputs,ninputs,&opt,&batch,&grid) != 0) exit(-1);
+	return(1);
+     }
+
+   if(mode == LVIS_MODE_QUERY)
+     {
+	if(lvis_query_points(inputs,ninputs,&opt,&batch,&query) != 0) exit(-1);
+	return(1);
+     }
+
+   if(mode == LVIS_MODE_CROSSOVERS)
+     {
+	strcpy(cross.field,grid.field);
+	if(lvis_cross_find(inputs,ninputs,&opt,&batch,&cross) != 0) exit(-1);
+	return(1);
+     }
+
+   if(mode == LVIS_MODE_DHDT)
+     {
+	strcpy(dhdt.field,grid.field);
+	if(query.radius > 0.0) dhdt.radius = query.radius;
+	if(lvis_dhdt_pairs(inputs,ninputs,&opt,&batch,&dhdt) != 0) exit(-1);
+	lvis_dhdt_free(&dhdt);
+	return(1);
+     }
+
+   if(mode == LVIS_MODE_RENDER)
+     {
+	if(lvis_render_echogram(inputs,ninputs,&opt,&batch,&render) != 0) exit(-1);
+	return(1);
+     }
+
+   if(mode == LVIS_MODE_QUANTILES)
+     {
+	strcpy(quantile.fields,join.fields);
+	if(lvis_quantile_report(inputs,ninputs,&opt,&batch,&quantile) != 0) exit(-1);
+	return(1);
+     }
+
+   // -las writes shots (or the expanded samples of LGW) as one LAS file
+   expand.threshold = features.threshold;
+   expand.scalar = features.scalar;
+   if(las.enabled && (mode == LVIS_MODE_CONVERT || mode == LVIS_MODE_EXPAND))
+     {
+	if(lvis_las_convert(inputs,ninputs,&opt,&batch,&las,&expand) != 0) exit(-1);
+	return(1);
+     }
+
+   if(mode == LVIS_MODE_EXPAND)
+     {
+	if(lvis_expand_convert(inputs,ninputs,&opt,&batch,&expand) != 0) exit(-1);
+	return(1);
+     }
+
+   // -summary describes the inputs (as text or JSON)
+   if(summary.enabled && mode == LVIS_MODE_CONVERT)
+     {
+	strcpy(summary.field,grid.field);
+	if(lvis_summary_convert(inputs,ninputs,&opt,&batch,&summary) != 0) exit(-1);
+	return(1);
+     }
+
+   // -windows / -windowshots aggregate the shots a window at a time (as text)
+   if((windows.seconds > 0.0 || windows.shots > 0) && mode == LVIS_MODE_CONVERT)
+     {
+	if(lvis_windows_convert(inputs,ninputs,&opt,&batch,&windows) != 0) exit(-1);
+	return(1);
+     }
+
+   // -features summarises the waveforms of each LGW shot (as text)
+   if(features.enabled)
+     {
+	if(lvis_features_convert(inputs,ninputs,&opt,&features) != 0) exit(-1);
+	return(1);
+     }
+
+   // -dedup writes every shot once (as text, or binary with -o)
+   if(dedup.enabled)
+     {
+	if(lvis_dedup_convert(inputs,ninputs,&opt,&dedup) != 0) exit(-1);
+	return(1);
+     }
+
+   // -o writes a binary subset (the records inside -lat / -lon, unchanged)
+   if(opt.outfile[0] != 0)
+     {
+	// the records go out unchanged, there is nowhere to put zdem / dzdem or x / y
+	if(dem.nfiles > 0 || opt.proj != 0)
+	  {
+	     fprintf(stderr,"-o writes the records unchanged in binary, without the %s columns; "
+		     "redirect the text output (or use -odir) instead\n",dem.nfiles > 0 ? "-dem" : "-proj");
+	     exit(-1);
+	  }
+	if(lvis_subset_extract(inputs,ninputs,&opt) != 0) exit(-1);
+	return(1);
+     }
+
+   // several inputs (or any batch option, -proj, -poly or -dem) go through the batch converter
+   if(dem.nfiles > 0 && (opt.dem = lvis_dem_open(&dem,opt.proj)) == NULL) exit(-1);
+   if(ninputs > 1 || batch.nthreads >= 0 || batch.outdir[0] != 0 || batch.shardCount > 0 || opt.proj != 0 ||
+      opt.poly != NULL || opt.dem != NULL)
+     {
+	if(lvis_batch_convert(inputs,ninputs,&opt,&batch) != 0) exit(-1);
+	lvis_dem_destroy(opt.dem);
+	return(1);
+     }
+
+   // open up the file for read access
+   strcpy((char *) filename,inputs[0]);
+   if((fp = fopen((char *)filename,"rb"))==NULL)
+     {
+	fprintf(stderr,"Error opening the input file: %s\n",filename);
+	exit(-1);
+     }
+
+   // a canonical (upgraded) file carries its type in a header, skip past it
+   if(lvis_canon_read_header(filename,&canon)==0)
+     {
+	filetype = canon.fileType;
+	dataReleaseVersion = 1.04;
+	myendian = lvis_canon_endian(&canon);
+	fseek(fp,canon.headerSize,SEEK_SET);
+     }
+
    // before doing anything, test the file and take a guess what it is
    // but do this after the flag checking (incase endian is set)
    // ONLY check if these have not been set on the command line (forcing the issue)
@@ -1336,12 +2110,12 @@ int main(int argc, char *argv[])
      {
 	
       case LVIS_RELEASE_FILETYPE_LCE:
-	if(topcol == 1) print_lce_column_headers(dataReleaseVersion,indexcol,delim);
+	if(topcol == 1) print_lce_column_headers(stdout,dataReleaseVersion,indexcol,delim);
 	while(fread(lcedata,lcesize,1,fp)==1 && keepReading==1) 
 	  {
 	     // swap each item of this block if necessary
 	     swap_lce_data(lcedata,dataReleaseVersion,myendian);
-	     print_lce_data(lcedata,dataReleaseVersion,indexcol,colnum++,delim,
+	     print_lce_data(stdout,lcedata,dataReleaseVersion,indexcol,colnum++,delim,
 			    minlat,maxlat,minlon,maxlon);
 	     sampleNumber++;
 	     if(maxSampleNumber != 0 && sampleNumber >= maxSampleNumber) keepReading = 0;
@@ -1349,12 +2123,12 @@ int main(int argc, char *argv[])
 	break;
 
       case LVIS_RELEASE_FILETYPE_LGE:
-	if(topcol == 1) print_lge_column_headers(dataReleaseVersion,indexcol,delim);
+	if(topcol == 1) print_lge_column_headers(stdout,dataReleaseVersion,indexcol,delim);
 	while(fread(lgedata,lgesize,1,fp)==1 && keepReading==1)
 	  {
 	     // swap each item of this block if necessary
 	     swap_lge_data(lgedata,dataReleaseVersion,myendian);
-	     print_lge_data(lgedata,dataReleaseVersion,indexcol,colnum++,delim,
+	     print_lge_data(stdout,lgedata,dataReleaseVersion,indexcol,colnum++,delim,
 			    minlat,maxlat,minlon,maxlon);
 	     sampleNumber++;
 	     if(maxSampleNumber != 0 && sampleNumber >= maxSampleNumber) keepReading = 0;
@@ -1362,12 +2136,12 @@ int main(int argc, char *argv[])
 	break;
 	
       case LVIS_RELEASE_FILETYPE_LGW:
-	if(topcol == 1) print_lgw_column_headers(dataReleaseVersion,indexcol,delim);
+	if(topcol == 1) print_lgw_column_headers(stdout,dataReleaseVersion,indexcol,delim);
 	while(fread(lgwdata,lgwsize,1,fp)==1 && keepReading==1) 
 	  {
 	     // swap each item of this block if necessary
 	     swap_lgw_data(lgwdata,dataReleaseVersion,myendian);
-	     print_lgw_data(lgwdata,dataReleaseVersion,indexcol,colnum++,delim,
+	     print_lgw_data(stdout,lgwdata,dataReleaseVersion,indexcol,colnum++,delim,
 			    minlat,maxlat,minlon,maxlon);
 	     sampleNumber++;
 	     if(maxSampleNumber != 0 && sampleNumber >= maxSampleNumber) keepReading = 0;
@@ -0,0 +1,93 @@
+#ifndef __LVIS_RELEASE_READER_H
+#define __LVIS_RELEASE_READER_H
+
+// lvis_release_reader.h
+//
+// Routines shared between the release reader (lvis_release_reader.c) and
+// the processing modules that are built alongside it.  Everything that
+// needs to know about the binary layouts goes through these, so the
+// version / type dispatch stays in one place.
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef unsigned char  byte;
+typedef unsigned short word;
+typedef unsigned int  dword;
+
+#ifndef  GENLIB_LITTLE_ENDIAN
+#define  GENLIB_LITTLE_ENDIAN 0x00
+#endif
+
+#ifndef  GENLIB_BIG_ENDIAN
+#define  GENLIB_BIG_ENDIAN 0x01
+#endif
+
+// largest release record (lgw v1.04 is 1360 bytes), used to size scratch buffers
+#ifndef  LVIS_MAX_RECORD_SIZE
+#define  LVIS_MAX_RECORD_SIZE 2048
+#endif
+
+// command line settings shared by the reader and the processing modes
+struct lvis_poly;
+struct lvis_sample_options;
+struct lvis_release_options
+{
+   int    filetype;            // forced file type (-1 = detect)
+   float  dataReleaseVersion;  // forced release version (-1 = detect)
+   int    myendian;            // host endian (or forced with -endianbig / -endianlittle)
+   int    indexcol;            // -i
+   int    topcol;              // -t
+   char   delim[16];           // -c
+   double minlat,maxlat;       // -lat
+   double minlon,maxlon;       // -lon
+   long   maxSampleNumber;     // -n (0 means no limit)
+   char   outfile[1024];       // -o (empty = stdout)
+   char   tmpdir[1024];        // -tmpdir, scratch space of the modes that spill to disk
+   int    proj;                // -proj, EPSG code of the x / y columns appended to the text (0 = none)
+   int    scalar;              // -nosimd, the scalar kernels instead of the AVX2 ones
+   struct lvis_poly * poly;    // -poly, the shots must be inside it too (NULL = no polygon)
+   struct lvis_dem  * dem;     // -dem, the DEM sampled under every shot of the text (NULL = none)
+   struct lvis_sample_options * sample;  // -sample, the records -summary / grid read (NULL = all)
+};
+
+// processing modes, chosen by the first argument (lvis_release_reader merge ...)
+#define LVIS_MODE_CONVERT 0
+#define LVIS_MODE_MERGE   1
+#define LVIS_MODE_UPGRADE 2
+#define LVIS_MODE_JOIN    3
+#define LVIS_MODE_METRICS 4
+#define LVIS_MODE_DECOMPOSE 5
+#define LVIS_MODE_DECONVOLVE 6
+#define LVIS_MODE_EXPAND  7
+#define LVIS_MODE_GRID    8
+#define LVIS_MODE_QUERY   9
+#define LVIS_MODE_CROSSOVERS 10
+#define LVIS_MODE_DHDT    11
+#define LVIS_MODE_RENDER  12
+#define LVIS_MODE_QUANTILES 13
+
+// byte order helpers (the release files are written BIG endian)
+double host_double(double input_double,int host_endian);
+float  host_float(float input_float,int host_endian);
+dword  host_dword(dword input_dword,int host_endian);
+word   host_word(word input_word,int host_endian);
+int    host_endian(void);
+
+// file type / version detection and record sizes
+int  detect_release_version(char * filename, int * fileType, float * fileVersion, int myendian);
+int  lvis_record_size(int fileType, float fileVersion);
+
+// swap a single record in place into host order
+void swap_release_data(unsigned char *data, int fileType, float dataVersion, int myendian);
+
+// longitude / latitude a (host order) record is cut on by -lat / -lon
+void release_data_position(unsigned char *data, int fileType, float dataVersion, double *lon, double *lat);
+
+// print a (host order) record or the column headers for a type / version
+void print_release_column_headers(FILE * out, int fileType, float dataVersion, int indexcol, char * delim);
+void print_release_data
+  (FILE * out, unsigned char *data, int fileType, float dataVersion, int indexcol, unsigned int colnum,
+   char * delim, double minlat, double maxlat, double minlon, double maxlon);
+
+#endif
@@ -0,0 +1,704 @@
+// lvis_release_render.c
+//
+// Echogram images of LGW waveforms (render mode), see lvis_release_render.h.
+//
+// The inputs are split into tasks of LVIS_RENDER_CHUNK shots which the
+// pool reads (as canonical records) and reduces into the columns of the
+// image, a task keeping the partial columns it shares with its neighbours;
+// like the metrics mode the tasks run in waves of a few per thread, the
+// calling thread joining wave N into the image (and feeding its shots to
+// the pyramid) while wave N+1 is worked on.  PNG files are written with
+// stored (uncompressed) deflate blocks, which every reader takes and which
+// needs no zlib.
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_render.h"
+
+struct lvis_render_task
+{
+   int        file;
+   int64_t    first,count;
+   int64_t    bin0;        // the first column of the image the task adds to
+   long       nbins;
+   float    * bins;        // nbins x height: max or sum of the shots inside
+   int64_t  * weight;      // shots inside each of them
+   uint16_t * shots;       // -pyramid: count x height counts, 0 outside
+   unsigned char * inside; // -pyramid: whether each shot is inside
+   int        status;      // 0, -1 on a read error
+};
+
+struct lvis_render_job
+{
+   struct lvis_release_options * opt;
+   struct lvis_render_options  * r;
+   struct lvis_release_file    * files;
+   int                         * rxSamples;   // valid rxwave samples per input
+   int64_t                     * start;       // first shot of each input in the flight
+   int64_t                       total;       // shots of the flight
+   long                          width;       // columns of the image, 0 = none
+   int                           height;      // samples, the longest rxwave
+   struct lvis_render_task     * tasks;
+   unsigned char              ** raw;         // per worker
+   unsigned char              ** canon;       // per worker
+   // the join: the columns of the tasks, in order, into the image / pyramid
+   unsigned char               * image;       // NULL = no image
+   float                       * column;      // the column being reduced
+   long                          c;           // and its number, -1 = none yet
+   int64_t                       columnWeight;
+   double                        lo,hi;       // -scale
+   struct lvis_render_pyramid  * pyr;         // NULL = no -pyramid
+   float                       * shot;
+   int                           errors;
+};
+
+// a level of the pyramid: the tile being filled and the column waiting for
+// its pair to make a column of the level above
+struct lvis_render_level
+{
+   float   * tile;         // LVIS_RENDER_TILE x height
+   long      filled,index;
+   float   * pending;
+   int64_t   pendingWeight;
+   int       hasPending;
+   float   * pair;         // scratch for the column pushed up
+};
+
+struct lvis_render_pyramid
+{
+   struct lvis_render_options * r;
+   struct lvis_render_level   * levels;
+   int                          nlevels;
+   int                          height;
+   double                       lo,hi;
+   unsigned char              * pixels;   // a tile as bytes
+   long                         tiles;
+   int                          errors;
+};
+
+void lvis_render_defaults(struct lvis_render_options * r)
+{
+   r->width = LVIS_RENDER_WIDTH;
+   r->reduce = LVIS_RENDER_MAX;
+   r->lo = 0.0;
+   r->hi = 0.0;
+   r->pyramid[0] = 0;
+}
+
+int lvis_render_parse_option(int argc, char * argv[], int i, struct lvis_render_options * r)
+{
+   if(strcmp(argv[i],"-width")==0 && i+1<argc)
+     {
+	r->width = atol(argv[i+1]);
+	if(r->width < 0) r->width = 0;
+	return 2;
+     }
+   if(strcmp(argv[i],"-reduce")==0 && i+1<argc)
+     {
+	if(strcmp(argv[i+1],"max")==0) r->reduce = LVIS_RENDER_MAX;
+	else if(strcmp(argv[i+1],"mean")==0) r->reduce = LVIS_RENDER_MEAN;
+	else
+	  {
+	     fprintf(stderr,"Unknown -reduce %s (max or mean)\n",argv[i+1]);
+	     exit(-1);
+	  }
+	return 2;
+     }
+   if(strcmp(argv[i],"-scale")==0 && i+1<argc)
+     {
+	if(sscanf(argv[i+1],"%lf-%lf",&r->lo,&r->hi) != 2 || r->hi <= r->lo)
+	  {
+	     fprintf(stderr,"Invalid argument to -scale (LO-HI counts, LO below HI): %s\n",argv[i+1]);
+	     exit(-1);
+	  }
+	return 2;
+     }
+   if(strcmp(argv[i],"-pyramid")==0 && i+1<argc)
+     {
+	strncpy(r->pyramid,argv[i+1],sizeof(r->pyramid)-1);
+	return 2;
+     }
+   return 0;
+}
+
+static void lvis_render_run(void * context, long t, int worker)
+{
+   struct lvis_render_job  * job = (struct lvis_render_job *) context;
+   struct lvis_render_task * task = &job->tasks[t];
+   struct lvis_release_options * opt = job->opt;
+   struct lvis_lgw_v1_04   * lgw;
+   uint16_t                * rx;
+   float                   * bin;
+   double                    lon,lat;
+   int64_t                   i,got,g;
+   long                      b;
+   int                       s,n,in,height=job->height;
+
+   n = job->rxSamples[task->file];
+   if(n > height) n = height;
+   g = job->start[task->file] + task->first;
+   task->nbins = 0;
+   if(job->width > 0)
+     {
+	task->bin0  = g * job->width / job->total;
+	task->nbins = (long) ((g + task->count - 1) * job->width / job->total - task->bin0 + 1);
+	task->bins = (float *) calloc((size_t) task->nbins * height,sizeof(float));
+	task->weight = (int64_t *) calloc(task->nbins,sizeof(int64_t));
+	if(task->bins == NULL || task->weight == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the render columns\n");
+	     exit(-1);
+	  }
+     }
+   if(job->r->pyramid[0] != 0)
+     {
+	task->shots = (uint16_t *) calloc((size_t) task->count * height,sizeof(uint16_t));
+	task->inside = (unsigned char *) calloc(task->count,1);
+	if(task->shots == NULL || task->inside == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the render columns\n");
+	     exit(-1);
+	  }
+     }
+
+   got = lvis_canon_read(&job->files[task->file],task->first,task->count,job->raw[worker],job->canon[worker]);
+   if(got != task->count) task->status = -1;
+   for(i=0;i<got;i++)
+     {
+	lgw = ((struct lvis_lgw_v1_04 *) job->canon[worker]) + i;
+	rx = (uint16_t *) ((unsigned char *) lgw + offsetof(struct lvis_lgw_v1_04,rxwave));
+	release_data_position((unsigned char *) lgw,LVIS_RELEASE_FILETYPE_LGW,(float)1.04,&lon,&lat);
+	in = lvis_release_keep(opt,lon,lat);
+	if(!in) continue;
+	if(task->bins != NULL)
+	  {
+	     b = (long) ((g + i) * job->width / job->total - task->bin0);
+	     bin = task->bins + (size_t) b * height;
+	     task->weight[b]++;
+	     if(job->r->reduce == LVIS_RENDER_MEAN)
+	       for(s=0;s<n;s++) bin[s] += rx[s];
+	     else
+	       for(s=0;s<n;s++) if(rx[s] > bin[s]) bin[s] = rx[s];
+	  }
+	if(task->shots != NULL)
+	  {
+	     memcpy(task->shots + (size_t) i * height,rx,n * sizeof(uint16_t));
+	     task->inside[i] = 1;
+	  }
+     }
+}
+
+static unsigned char lvis_render_pixel(double v, double lo, double hi)
+{
+   v = (v - lo) * 255.0 / (hi - lo);
+   if(!(v > 0.0)) return 0;
+   if(v >= 255.0) return 255;
+   return (unsigned char) (v + 0.5);
+}
+
+// fold column b (weight wb) into a (weight *wa): the max, or the mean of
+// the shots behind both
+static void lvis_render_fold(float * a, int64_t * wa, const float * b, int64_t wb, int height, int reduce)
+{
+   int s;
+
+   if(reduce == LVIS_RENDER_MEAN)
+     {
+	if(*wa + wb > 0)
+	  for(s=0;s<height;s++) a[s] = (a[s] * *wa + b[s] * wb) / (*wa + wb);
+     }
+   else
+     for(s=0;s<height;s++) if(b[s] > a[s]) a[s] = b[s];
+   *wa += wb;
+}
+
+static uint32_t lvis_render_crc_table[256];
+
+static uint32_t lvis_render_crc(uint32_t crc, const unsigned char * p, size_t n)
+{
+   uint32_t c;
+   int      k,j;
+
+   if(lvis_render_crc_table[1] == 0)
+     for(k=0;k<256;k++)
+       {
+	  for(c=k,j=0;j<8;j++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+	  lvis_render_crc_table[k] = c;
+       }
+   crc = ~crc;
+   while(n-- > 0) crc = lvis_render_crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+   return ~crc;
+}
+
+static void lvis_render_put32(unsigned char * p, uint32_t v)
+{
+   p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+// one PNG chunk, its type and data already in buf[4 .. 8+length)
+static int lvis_render_chunk(FILE * out, unsigned char * buf, uint32_t length)
+{
+   unsigned char crc[4];
+
+   lvis_render_put32(buf,length);
+   lvis_render_put32(crc,lvis_render_crc(0,buf+4,length+4));
+   if(fwrite(buf,length+8,1,out)!=1 || fwrite(crc,4,1,out)!=1) return -1;
+   return 0;
+}
+
+// an 8 bit gray PNG of width x height pixels (row major): the zlib stream
+// is a run of stored blocks, an IDAT chunk each
+static int lvis_render_png(FILE * out, const unsigned char * pixels, long width, long height)
+{
+   static const unsigned char signature[8] = {137,80,78,71,13,10,26,10};
+   unsigned char * buf;
+   int64_t         size,p,row,col,n,k;
+   uint32_t        a=1,b=0,len;
+   unsigned char * d;
+   int             status=0;
+
+   if((buf = (unsigned char *) malloc(65535 + 32)) == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the PNG buffer\n");
+	exit(-1);
+     }
+   if(fwrite(signature,8,1,out)!=1) status = -1;
+   memcpy(buf+4,"IHDR",4);
+   lvis_render_put32(buf+8,(uint32_t) width);
+   lvis_render_put32(buf+12,(uint32_t) height);
+   buf[16] = 8; buf[17] = 0; buf[18] = 0; buf[19] = 0; buf[20] = 0;
+   if(status == 0) status = lvis_render_chunk(out,buf,13);
+
+   // the scanlines, each a filter byte (0, none) and the row
+   size = height * (width + 1);
+   for(p=0;status==0 && (p<size || p==0);)
+     {
+	n = (size - p < 65535) ? size - p : 65535;
+	memcpy(buf+4,"IDAT",4);
+	d = buf + 8;
+	if(p == 0) { *d++ = 0x78; *d++ = 0x01; }
+	*d++ = (p + n >= size) ? 1 : 0;
+	*d++ = n & 0xFF; *d++ = n >> 8;
+	*d++ = ~n & 0xFF; *d++ = (~n >> 8) & 0xFF;
+	for(k=0;k<n;k++)
+	  {
+	     row = (p + k) / (width + 1);
+	     col = (p + k) % (width + 1);
+	     d[k] = (col == 0) ? 0 : pixels[row * width + col - 1];
+	     a = (a + d[k]) % 65521;
+	     b = (b + a) % 65521;
+	  }
+	d += n;
+	p += n;
+	if(p >= size) { lvis_render_put32(d,(b << 16) | a); d += 4; }
+	len = (uint32_t) (d - (buf + 8));
+	status = lvis_render_chunk(out,buf,len);
+	if(size == 0) break;
+     }
+   memcpy(buf+4,"IEND",4);
+   if(status == 0) status = lvis_render_chunk(out,buf,0);
+   free(buf);
+   return status;
+}
+
+// an image as .png (by its name) or binary PGM, returns 0 on success
+static int lvis_render_write(char * filename, const unsigned char * pixels, long width, long height)
+{
+   FILE * out;
+   char * ext = strrchr(filename,'.');
+   int    status;
+
+   if((out = fopen(filename,"wb"))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",filename,strerror(errno));
+	return -1;
+     }
+   if(ext != NULL && strcasecmp(ext,".png")==0)
+     status = lvis_render_png(out,pixels,width,height);
+   else
+     {
+	status = (fprintf(out,"P5\n%ld %ld\n255\n",width,height) < 0);
+	if(status == 0 && width * height > 0 && fwrite(pixels,width * height,1,out)!=1) status = -1;
+     }
+   if(fclose(out)!=0) status = -1;
+   if(status != 0) fprintf(stderr,"Error writing the output file: %s (%s)\n",filename,strerror(errno));
+   return status;
+}
+
+static void lvis_render_write_tile(struct lvis_render_pyramid * pyr, int z)
+{
+   struct lvis_render_level * level = &pyr->levels[z];
+   char                       filename[2048];
+   long                       c;
+   int                        s;
+
+   for(s=0;s<pyr->height;s++)
+     for(c=0;c<level->filled;c++)
+       pyr->pixels[s * level->filled + c] = lvis_render_pixel(level->tile[c * pyr->height + s],pyr->lo,pyr->hi);
+   snprintf(filename,sizeof(filename),"%s/%d/%ld.png",pyr->r->pyramid,z,level->index);
+   if(lvis_render_write(filename,pyr->pixels,level->filled,pyr->height)!=0) pyr->errors++;
+   pyr->tiles++;
+   level->index++;
+   level->filled = 0;
+}
+
+// a column of level z, and up the levels as the columns pair off
+static void lvis_render_push(struct lvis_render_pyramid * pyr, int z, const float * column, int64_t weight)
+{
+   struct lvis_render_level * level = &pyr->levels[z];
+   int                        height = pyr->height;
+
+   memcpy(level->tile + level->filled * height,column,height * sizeof(float));
+   if(++level->filled == LVIS_RENDER_TILE) lvis_render_write_tile(pyr,z);
+   if(z+1 >= pyr->nlevels) return;
+   if(!level->hasPending)
+     {
+	memcpy(level->pending,column,height * sizeof(float));
+	level->pendingWeight = weight;
+	level->hasPending = 1;
+	return;
+     }
+   memcpy(level->pair,level->pending,height * sizeof(float));
+   lvis_render_fold(level->pair,&level->pendingWeight,column,weight,height,pyr->r->reduce);
+   level->hasPending = 0;
+   lvis_render_push(pyr,z+1,level->pair,level->pendingWeight);
+}
+
+static int lvis_render_mkdir(char * dirname)
+{
+   if(mkdir(dirname,0755)!=0 && errno != EEXIST)
+     {
+	fprintf(stderr,"Unable to create the directory %s (%s)\n",dirname,strerror(errno));
+	return -1;
+     }
+   return 0;
+}
+
+// the levels (and their directories) for a flight of total shots
+static int lvis_render_pyramid_open(struct lvis_render_pyramid * pyr, struct lvis_render_options * r,
+				    int64_t total, int height, double lo, double hi)
+{
+   char dirname[2048];
+   int  z;
+
+   memset(pyr,0,sizeof(*pyr));
+   pyr->r = r;
+   pyr->height = height;
+   pyr->lo = lo;
+   pyr->hi = hi;
+   for(pyr->nlevels=1;((total - 1) >> (pyr->nlevels-1)) + 1 > LVIS_RENDER_TILE;pyr->nlevels++);
+   pyr->levels = (struct lvis_render_level *) calloc(pyr->nlevels,sizeof(struct lvis_render_level));
+   pyr->pixels = (unsigned char *) malloc((size_t) LVIS_RENDER_TILE * height);
+   if(pyr->levels == NULL || pyr->pixels == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the pyramid\n");
+	exit(-1);
+     }
+   if(lvis_render_mkdir(r->pyramid)!=0) return -1;
+   for(z=0;z<pyr->nlevels;z++)
+     {
+	pyr->levels[z].tile = (float *) malloc((size_t) LVIS_RENDER_TILE * height * sizeof(float));
+	pyr->levels[z].pending = (float *) malloc(height * sizeof(float));
+	pyr->levels[z].pair = (float *) malloc(height * sizeof(float));
+	if(pyr->levels[z].tile == NULL || pyr->levels[z].pending == NULL ||
+	   pyr->levels[z].pair == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the pyramid\n");
+	     exit(-1);
+	  }
+	snprintf(dirname,sizeof(dirname),"%s/%d",r->pyramid,z);
+	if(lvis_render_mkdir(dirname)!=0) return -1;
+     }
+   return 0;
+}
+
+// push the unpaired columns up, write the last tiles and the description
+static int lvis_render_pyramid_close(struct lvis_render_pyramid * pyr, struct lvis_render_job * job,
+				     char ** inputs, int ninputs)
+{
+   struct lvis_render_level * level;
+   char                       filename[2048];
+   FILE                     * out;
+   int                        z,k;
+
+   for(z=0;z<pyr->nlevels;z++)
+     {
+	level = &pyr->levels[z];
+	if(level->hasPending && z+1 < pyr->nlevels)
+	  {
+	     level->hasPending = 0;
+	     lvis_render_push(pyr,z+1,level->pending,level->pendingWeight);
+	  }
+	if(level->filled > 0) lvis_render_write_tile(pyr,z);
+     }
+
+   snprintf(filename,sizeof(filename),"%s/pyramid.txt",pyr->r->pyramid);
+   if((out = fopen(filename,"w"))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",filename,strerror(errno));
+	pyr->errors++;
+     }
+   else
+     {
+	fprintf(out,"# LVIS echogram pyramid: level/tile.png, shots along x, rxwave samples down y\n");
+	fprintf(out,"shots %lld\n",(long long) job->total);
+	fprintf(out,"height %d\n",pyr->height);
+	fprintf(out,"tile %d\n",LVIS_RENDER_TILE);
+	fprintf(out,"reduce %s\n",(pyr->r->reduce == LVIS_RENDER_MEAN) ? "mean" : "max");
+	fprintf(out,"scale %g %g\n",pyr->lo,pyr->hi);
+	fprintf(out,"levels %d\n",pyr->nlevels);
+	for(z=0;z<pyr->nlevels;z++)
+	  fprintf(out,"level %d shots_per_column %lld columns %lld tiles %ld\n",z,1LL << z,
+		  (long long) (((job->total - 1) >> z) + 1),pyr->levels[z].index);
+	for(k=0;k<ninputs;k++)
+	  fprintf(out,"input %s first %lld shots %lld\n",inputs[k],(long long) job->start[k],
+		  (long long) job->files[k].recordCount);
+	if(fclose(out)!=0)
+	  {
+	     fprintf(stderr,"Error writing the output file: %s (%s)\n",filename,strerror(errno));
+	     pyr->errors++;
+	  }
+     }
+
+   for(z=0;z<pyr->nlevels;z++)
+     {
+	free(pyr->levels[z].tile);
+	free(pyr->levels[z].pending);
+	free(pyr->levels[z].pair);
+     }
+   free(pyr->levels);
+   free(pyr->pixels);
+   return pyr->errors;
+}
+
+static int lvis_render_input(void * context, long t)
+{
+   return ((struct lvis_render_job *) context)->tasks[t].file;
+}
+
+// the finished column of the image
+static void lvis_render_column(struct lvis_render_job * job)
+{
+   int s;
+
+   for(s=0;s<job->height;s++)
+     job->image[(size_t) s * job->width + job->c] =
+       lvis_render_pixel((job->r->reduce == LVIS_RENDER_MEAN && job->columnWeight > 0) ?
+			 job->column[s] / job->columnWeight : job->column[s],job->lo,job->hi);
+}
+
+// the columns of a task into the image and its shots into the pyramid, in order
+static void lvis_render_join(void * context, long t)
+{
+   struct lvis_render_job  * job = (struct lvis_render_job *) context;
+   struct lvis_render_task * task = &job->tasks[t];
+   int64_t                   i;
+   long                      j;
+   int                       s;
+
+   if(task->status != 0)
+     {
+	fprintf(stderr,"Short read in %s at record %lld\n",job->files[task->file].filename,(long long) task->first);
+	job->errors++;
+     }
+
+   // a column is done when the next one starts, the first column of a
+   // task may go on from the last of the one before
+   for(j=0;j<task->nbins;j++)
+     {
+	float * bin = task->bins + (size_t) j * job->height;
+
+	if(job->c == task->bin0 + j)
+	  {
+	     if(job->r->reduce == LVIS_RENDER_MEAN)
+	       for(s=0;s<job->height;s++) job->column[s] += bin[s];
+	     else
+	       for(s=0;s<job->height;s++) if(bin[s] > job->column[s]) job->column[s] = bin[s];
+	     job->columnWeight += task->weight[j];
+	     continue;
+	  }
+	if(job->c >= 0) lvis_render_column(job);
+	job->c = task->bin0 + j;
+	memcpy(job->column,bin,job->height * sizeof(float));
+	job->columnWeight = task->weight[j];
+     }
+   free(task->bins);
+   free(task->weight);
+   task->bins = NULL;
+   task->weight = NULL;
+
+   if(job->pyr != NULL)
+     {
+	for(i=0;i<task->count;i++)
+	  {
+	     for(s=0;s<job->height;s++) job->shot[s] = task->shots[i * job->height + s];
+	     lvis_render_push(job->pyr,0,job->shot,task->inside[i]);
+	  }
+	free(task->shots);
+	free(task->inside);
+	task->shots = NULL;
+	task->inside = NULL;
+     }
+}
+
+int lvis_render_echogram(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			 struct lvis_batch_options * b, struct lvis_render_options * r)
+{
+   struct lvis_render_job     job;
+   struct lvis_render_pyramid pyr;
+   struct lvis_pool         * pool;
+   unsigned char            * image=NULL;
+   float                    * column=NULL,*shot=NULL;
+   int64_t                    n,first,shots=0;
+   long                       ntasks=0,maxtasks=0,t;
+   float                      version;
+   double                     lo,hi=0.0;
+   int                        k,threads,pyramid,errors=0;
+
+   pyramid = (r->pyramid[0] != 0);
+   if(opt->outfile[0] == 0 && !pyramid)
+     {
+	fprintf(stderr,"render writes an image (-o name.pgm or name.png) and / or a tile pyramid (-pyramid dir)\n");
+	return -1;
+     }
+
+   memset(&job,0,sizeof(job));
+   job.opt = opt;
+   job.r = r;
+   job.files = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file));
+   job.rxSamples = (int *) calloc(ninputs,sizeof(int));
+   job.start = (int64_t *) calloc(ninputs,sizeof(int64_t));
+   if(job.files == NULL || job.rxSamples == NULL || job.start == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     {
+	if(lvis_file_open(&job.files[k],inputs[k],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	lvis_file_close(&job.files[k]);
+	if(job.files[k].fileType != LVIS_RELEASE_FILETYPE_LGW)
+	  {
+	     fprintf(stderr,"%s is not an LGW file, echograms are made from waveforms\n",inputs[k]);
+	     errors++;
+	     continue;
+	  }
+	version = job.files[k].canonical ? job.files[k].sourceVersion : job.files[k].fileVersion;
+	job.rxSamples[k] = job.files[k].canonical ? job.files[k].rxSamples : ((version == ((float)1.04)) ? 528 : 432);
+	if(job.rxSamples[k] > job.height) job.height = job.rxSamples[k];
+	if(version == ((float)1.04)) { if(hi < 1023.0) hi = 1023.0; }
+	else if(hi < 255.0) hi = 255.0;
+	n = job.files[k].recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+	job.files[k].recordCount = n;
+	job.start[k] = job.total;
+	job.total += n;
+	maxtasks += (long) ((n + LVIS_RENDER_CHUNK - 1) / LVIS_RENDER_CHUNK);
+     }
+   if(errors == 0 && job.total == 0)
+     {
+	fprintf(stderr,"render: the inputs hold no shots\n");
+	errors++;
+     }
+   if(errors > 0)
+     {
+	free(job.files);
+	free(job.rxSamples);
+	free(job.start);
+	return errors;
+     }
+   lo = 0.0;
+   if(r->hi > r->lo) { lo = r->lo; hi = r->hi; }
+
+   if(opt->outfile[0] != 0)
+     {
+	job.width = (r->width == 0 || r->width > job.total) ? (long) job.total : r->width;
+	image = (unsigned char *) calloc((size_t) job.width * job.height,1);
+	column = (float *) malloc(job.height * sizeof(float));
+	if(image == NULL || column == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate a %ld x %d image\n",job.width,job.height);
+	     exit(-1);
+	  }
+     }
+   if(pyramid)
+     {
+	if((shot = (float *) malloc(job.height * sizeof(float))) == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the pyramid\n");
+	     exit(-1);
+	  }
+	if(lvis_render_pyramid_open(&pyr,r,job.total,job.height,lo,hi)!=0) exit(-1);
+     }
+
+   job.tasks = (struct lvis_render_task *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_render_task));
+   if(job.tasks == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the task table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     for(first=0;first<job.files[k].recordCount;first+=LVIS_RENDER_CHUNK)
+       {
+	  job.tasks[ntasks].file  = k;
+	  job.tasks[ntasks].first = first;
+	  job.tasks[ntasks].count = (job.files[k].recordCount - first < LVIS_RENDER_CHUNK) ?
+	    job.files[k].recordCount - first : LVIS_RENDER_CHUNK;
+	  ntasks++;
+       }
+
+   pool = lvis_pool_create(b->nthreads);
+   threads = lvis_pool_threads(pool);
+   lvis_batch_buffers(threads,LVIS_RENDER_CHUNK,sizeof(struct lvis_lgw_v1_04),&job.raw,&job.canon);
+
+   // run the waves, joining wave N while wave N+1 is worked on
+   job.image = image;
+   job.column = column;
+   job.c = -1;
+   job.lo = lo;
+   job.hi = hi;
+   job.shot = shot;
+   if(pyramid) job.pyr = &pyr;
+   lvis_batch_waves(pool,0,ntasks,job.files,lvis_render_input,lvis_render_run,lvis_render_join,&job);
+   errors += job.errors;
+   lvis_pool_destroy(pool);
+   for(t=0;t<ntasks;t++) shots += job.tasks[t].count;
+
+   if(image != NULL)
+     {
+	if(job.c >= 0) lvis_render_column(&job);
+	if(lvis_render_write(opt->outfile,image,job.width,job.height)!=0) errors++;
+     }
+   if(pyramid) errors += lvis_render_pyramid_close(&pyr,&job,inputs,ninputs);
+
+   fprintf(stderr,"render: %lld shots, %d samples",(long long) shots,job.height);
+   if(image != NULL)
+     fprintf(stderr,", %ld columns of %.1f shots",job.width,(double) job.total / job.width);
+   if(pyramid)
+     fprintf(stderr,", %d pyramid levels in %ld tiles",pyr.nlevels,pyr.tiles);
+   fprintf(stderr," (counts %g - %g)\n",lo,hi);
+
+   lvis_batch_free_buffers(threads,job.raw,job.canon);
+   free(job.tasks);
+   free(job.files);
+   free(job.rxSamples);
+   free(job.start);
+   free(image);
+   free(column);
+   free(shot);
+   return errors;
+}
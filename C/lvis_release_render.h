@@ -0,0 +1,62 @@
+#ifndef __LVIS_RELEASE_RENDER_H
+#define __LVIS_RELEASE_RENDER_H
+
+// lvis_release_render.h
+//
+// render mode: quick-look echograms of LGW files.  The shots of the inputs
+// (one flight, in input order) run along x and the rxwave samples down y,
+// the first sample (the top of the waveform) in row 0; a pixel is the
+// rxwave counts, -scale LO-HI mapped onto 0 .. 255 (default 0 to the
+// largest count of the source: 1023 for 1.04 releases, 255 before).
+// Shots outside -lat / -lon / -poly are left black.
+//
+// -o name.pgm (or name.png) writes the whole flight as one image of
+// -width columns: the shots are cut into that many bins of consecutive
+// shots and each bin is reduced, sample by sample, to the max or the mean
+// (-reduce) of its shots.  The bins are reduced in parallel, a chunk of
+// shots a task, and the bins split between two tasks are joined in order.
+//
+// -pyramid DIR writes a tile pyramid a viewer can zoom through: level 0
+// has a column for every shot, each level above halves it (the max or the
+// mean of two columns), up to the level where the flight fits in one tile,
+// and every level is cut into tiles of LVIS_RENDER_TILE columns written
+// as DIR/level/tile.png, with DIR/pyramid.txt describing them.  The
+// levels are built from the level 0 columns as they stream in, a tile of
+// each level in memory, so the inputs are read once.
+
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_RENDER_WIDTH
+#define  LVIS_RENDER_WIDTH 4096       // default -width (columns)
+#endif
+
+#ifndef  LVIS_RENDER_CHUNK
+#define  LVIS_RENDER_CHUNK 1024       // shots per task
+#endif
+
+#define  LVIS_RENDER_TILE     256     // columns of a pyramid tile
+#define  LVIS_RENDER_MAX      0       // -reduce max
+#define  LVIS_RENDER_MEAN     1       // -reduce mean
+
+struct lvis_render_options
+{
+   long   width;          // -width N columns of -o (0 = a column a shot)
+   int    reduce;         // -reduce max / mean
+   double lo,hi;          // -scale LO-HI counts (hi <= lo = the source's range)
+   char   pyramid[1024];  // -pyramid DIR (empty = none)
+};
+
+void lvis_render_defaults(struct lvis_render_options * r);
+
+// handle the render options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a render option)
+int  lvis_render_parse_option(int argc, char * argv[], int i, struct lvis_render_options * r);
+
+// render the LGW inputs as the image opt->outfile and / or the tile
+// pyramid r->pyramid, returns 0 on success
+struct lvis_batch_options;
+int  lvis_render_echogram(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			  struct lvis_batch_options * b, struct lvis_render_options * r);
+
+#endif
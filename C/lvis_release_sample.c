@@ -0,0 +1,159 @@
+// lvis_release_sample.c
+//
+// Strided and block samples of the records (-sample), see
+// lvis_release_sample.h.
+//
+// Where a sample record is in the file is a function of its number, the
+// file's record count and the seed only (the start of a block is hashed
+// from the seed and the block number), so any task can read any part of
+// the sample without the others and the sample does not depend on
+// -threads.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_sample.h"
+
+void lvis_sample_defaults(struct lvis_sample_options * s)
+{
+   s->stride = 0;
+   s->blocks = 0;
+   s->blockRecords = 0;
+   s->seed = 1;
+}
+
+int lvis_sample_parse_option(int argc, char * argv[], int i, struct lvis_sample_options * s)
+{
+   long long n,b;
+   char      x;
+
+   if(strcmp(argv[i],"-sample")==0 && i+1<argc)
+     {
+	s->stride = s->blocks = s->blockRecords = 0;
+	if(sscanf(argv[i+1],"%lld%c%lld",&n,&x,&b) == 3 && (x == 'x' || x == 'X') && n >= 1 && b >= 1)
+	  {
+	     s->blocks = n;
+	     s->blockRecords = b;
+	     return 2;
+	  }
+	if(sscanf(argv[i+1],"%lld%c",&n,&x) == 1 && n >= 1)
+	  {
+	     s->stride = n;
+	     return 2;
+	  }
+	fprintf(stderr,"-sample takes K (every K-th record) or NxB (N blocks of B records): %s\n",argv[i+1]);
+	exit(-1);
+     }
+   if(strcmp(argv[i],"-sampleseed")==0 && i+1<argc)
+     {
+	s->seed = strtoull(argv[i+1],NULL,10);
+	return 2;
+     }
+   return 0;
+}
+
+int lvis_sample_enabled(struct lvis_sample_options * s)
+{
+   return (s->stride > 0 || s->blocks > 0);
+}
+
+// splitmix64, a well mixed number from the seed and n
+static uint64_t lvis_sample_hash(uint64_t seed, uint64_t n)
+{
+   uint64_t z = seed + (n + 1) * 0x9E3779B97F4A7C15ull;
+
+   z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+   z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+   return z ^ (z >> 31);
+}
+
+// the first record of the strided sample
+static int64_t lvis_sample_start(struct lvis_sample_options * s)
+{
+   return (int64_t) (lvis_sample_hash(s->seed,0) % (uint64_t) s->stride);
+}
+
+// 1 if the blocks cover the whole file (it is read as it is)
+static int lvis_sample_whole(struct lvis_sample_options * s, int64_t records)
+{
+   return (s->blocks >= records / s->blockRecords);
+}
+
+int64_t lvis_sample_count(struct lvis_sample_options * s, int64_t records)
+{
+   int64_t start;
+
+   if(s == NULL) return records;
+   if(s->stride > 0)
+     {
+	start = lvis_sample_start(s);
+	return (records > start) ? (records - start + s->stride - 1) / s->stride : 0;
+     }
+   if(lvis_sample_whole(s,records)) return records;
+   return s->blocks * s->blockRecords;
+}
+
+int64_t lvis_sample_record(struct lvis_sample_options * s, int64_t records, int64_t j)
+{
+   int64_t block,lo,hi,span;
+
+   if(s == NULL) return j;
+   if(s->stride > 0) return lvis_sample_start(s) + j * s->stride;
+   if(lvis_sample_whole(s,records)) return j;
+
+   // block b comes from records [b * records / N, (b+1) * records / N)
+   block = j / s->blockRecords;
+   lo = (int64_t) ((double) block * records / s->blocks);
+   hi = (int64_t) ((double) (block + 1) * records / s->blocks);
+   span = hi - lo - s->blockRecords;
+   if(span < 0) span = 0;
+   return lo + (int64_t) (lvis_sample_hash(s->seed,block) % (uint64_t) (span + 1)) + j % s->blockRecords;
+}
+
+int64_t lvis_sample_cluster(struct lvis_sample_options * s, int64_t j)
+{
+   if(s == NULL || s->stride > 0) return j;
+   return j / s->blockRecords;
+}
+
+int64_t lvis_sample_run(struct lvis_sample_options * s, int64_t records, int64_t j, int64_t max)
+{
+   int64_t left;
+
+   if(s == NULL || s->stride == 1 || (s->stride == 0 && lvis_sample_whole(s,records))) return max;
+   if(s->stride > 0) return 1;
+   left = s->blockRecords - j % s->blockRecords;
+   return (left < max) ? left : max;
+}
+
+int64_t lvis_sample_read(struct lvis_release_file * f, struct lvis_sample_options * s, int64_t first, int64_t count,
+			 unsigned char * raw, unsigned char * canon)
+{
+   int64_t j,run,got,done=0;
+   int     csize = lvis_record_size(f->fileType,(float)1.04);
+
+   if(s == NULL) return lvis_canon_read(f,first,count,raw,canon);
+
+   // a record here and there: keep the kernel from reading ahead of each
+   if(s->stride > 1) posix_fadvise(f->fd,0,0,POSIX_FADV_RANDOM);
+   for(j=first;j<first+count;j+=run)
+     {
+	run = lvis_sample_run(s,f->recordCount,j,first + count - j);
+	got = lvis_canon_read(f,lvis_sample_record(s,f->recordCount,j),run,raw,canon + done * csize);
+	done += got;
+	if(got != run) break;
+     }
+   return done;
+}
+
+void lvis_sample_describe(struct lvis_sample_options * s, char * text, size_t size)
+{
+   if(s == NULL) snprintf(text,size,"every record");
+   else if(s->stride > 0) snprintf(text,size,"1 record in %lld",(long long) s->stride);
+   else snprintf(text,size,"%lld blocks of %lld records",(long long) s->blocks,(long long) s->blockRecords);
+}
@@ -0,0 +1,57 @@
+#ifndef __LVIS_RELEASE_SAMPLE_H
+#define __LVIS_RELEASE_SAMPLE_H
+
+// lvis_release_sample.h
+//
+// -sample: a quick look at a file from part of its records.  -sample K
+// takes every K-th record (from a -sampleseed chosen start), each read on
+// its own with pread() so the records skipped are never read; -sample NxB
+// takes N blocks of B records, one from each of N equal stretches of the
+// file at a -sampleseed chosen place in it, so the blocks spread evenly
+// over the whole flight.  A file of fewer than N x B records is read
+// whole.  -n applies first: the sample is of the first -n records.
+//
+// The sample is numbered 0 .. lvis_sample_count() - 1; the modes split
+// that range into their tasks as they would the records and read them with
+// lvis_sample_read.  -summary and grid honour it, adding the standard
+// error of their means (the blocks taken as clusters).
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lvis_release_file.h"
+
+struct lvis_sample_options
+{
+   int64_t  stride;        // -sample K (0 = blocks)
+   int64_t  blocks;        // -sample NxB
+   int64_t  blockRecords;
+   uint64_t seed;          // -sampleseed S
+};
+
+void    lvis_sample_defaults(struct lvis_sample_options * s);
+
+// handle the sample options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a sample option)
+int     lvis_sample_parse_option(int argc, char * argv[], int i, struct lvis_sample_options * s);
+// 1 if -sample was given
+int     lvis_sample_enabled(struct lvis_sample_options * s);
+
+// records the sample takes of a file of that many records (s NULL: all of them)
+int64_t lvis_sample_count(struct lvis_sample_options * s, int64_t records);
+// the record of the file that is record j of the sample
+int64_t lvis_sample_record(struct lvis_sample_options * s, int64_t records, int64_t j);
+// the cluster (block) record j of the sample belongs to
+int64_t lvis_sample_cluster(struct lvis_sample_options * s, int64_t j);
+// records of the sample from j on that are one after the other in the file, at most max
+int64_t lvis_sample_run(struct lvis_sample_options * s, int64_t records, int64_t j, int64_t max);
+
+// read records first .. first + count - 1 of the sample of f (of f->recordCount
+// records) as canonical records into canon, raw as lvis_canon_read's
+// buffer; returns the number read
+int64_t lvis_sample_read(struct lvis_release_file * f, struct lvis_sample_options * s, int64_t first, int64_t count,
+			 unsigned char * raw, unsigned char * canon);
+
+// "1 record in 100" / "16 blocks of 4096 records" into text
+void    lvis_sample_describe(struct lvis_sample_options * s, char * text, size_t size);
+
+#endif
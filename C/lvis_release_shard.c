@@ -0,0 +1,361 @@
+// lvis_release_shard.c
+//
+// Deterministic sharding of a batch conversion and the merge of the
+// partial outputs (see lvis_release_shard.h).
+//
+// The inputs are laid end to end as one stream of bytes (only the records
+// that will be converted, so -n is honoured) and cut into nshards equal
+// pieces.  A record belongs to the shard its first byte falls in, so the
+// pieces never overlap and always cover everything, whatever the mix of
+// record sizes.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_shard.h"
+
+// bytes of the start of shard s out of n over total bytes (exact in 64 bits)
+static int64_t lvis_shard_bound(int64_t total, int s, int n)
+{
+   if(s >= n) return total;
+   return (total / n) * s + ((total % n) * s) / n;
+}
+
+static int64_t lvis_shard_ceil(int64_t a, int64_t b)
+{
+   if(a <= 0) return 0;
+   return (a + b - 1) / b;
+}
+
+void lvis_shard_ranges(struct lvis_release_file * files, int * status, int64_t * nrecords, int ninputs,
+		       int shard, int nshards, int64_t * lo, int64_t * hi)
+{
+   int64_t total=0,start,end,offset;
+   int     k;
+
+   for(k=0;k<ninputs;k++)
+     if(status[k] == 0) total += nrecords[k] * files[k].recordSize;
+
+   start = lvis_shard_bound(total,shard,nshards);
+   end   = lvis_shard_bound(total,shard+1,nshards);
+
+   offset = 0;
+   for(k=0;k<ninputs;k++)
+     {
+	lo[k] = hi[k] = -1;  // not part of this shard
+	if(status[k] != 0) continue;
+
+	if(nrecords[k] == 0)
+	  {
+	     // an empty input goes with the shard its position falls in
+	     if((offset >= start && offset < end) || (shard == nshards-1 && offset >= end))
+	       lo[k] = hi[k] = 0;
+	     continue;
+	  }
+
+	lo[k] = lvis_shard_ceil(start - offset,files[k].recordSize);
+	hi[k] = (shard == nshards-1) ? nrecords[k] : lvis_shard_ceil(end - offset,files[k].recordSize);
+	if(lo[k] > nrecords[k]) lo[k] = nrecords[k];
+	if(hi[k] > nrecords[k]) hi[k] = nrecords[k];
+	if(hi[k] <= lo[k]) lo[k] = hi[k] = -1;
+	offset += nrecords[k] * files[k].recordSize;
+     }
+}
+
+void lvis_shard_names(char * prefix, int shard, int nshards, char * output, char * manifest, int size)
+{
+   snprintf(output,size,"%s.shard-%04d-of-%04d.txt",prefix,shard,nshards);
+   snprintf(manifest,size,"%s.shard-%04d-of-%04d.manifest",prefix,shard,nshards);
+}
+
+FILE * lvis_shard_manifest_open(char * manifest, char * output, int shard, int nshards, int ninputs,
+				char ** inputs, int * status, int64_t * nrecords)
+{
+   FILE * fp;
+   char * base;
+   int    k;
+
+   if((fp = fopen(manifest,"w"))==NULL)
+     {
+	fprintf(stderr,"Error opening the manifest file: %s (%s)\n",manifest,strerror(errno));
+	exit(-1);
+     }
+   // the partial output sits next to its manifest, record its name only
+   base = strrchr(output,'/');
+   base = (base == NULL) ? output : base+1;
+   fprintf(fp,"%s\n",LVIS_SHARD_MANIFEST_MAGIC);
+   fprintf(fp,"shard %d %d\n",shard,nshards);
+   fprintf(fp,"inputs %d\n",ninputs);
+   fprintf(fp,"output %s\n",base);
+   // what the whole run converts, so the merge can tell that the shards cover all of it
+   for(k=0;k<ninputs;k++)
+     fprintf(fp,"input %d %lld %s\n",k,(long long) ((status[k] == 0) ? nrecords[k] : -1),inputs[k]);
+   return fp;
+}
+
+void lvis_shard_manifest_segment(FILE * fp, int file, int64_t first, int64_t count,
+				 int64_t offset, int64_t length, char * filename)
+{
+   fprintf(fp,"segment %d %lld %lld %lld %lld %s\n",file,(long long) first,(long long) count,
+	   (long long) offset,(long long) length,filename);
+}
+
+void lvis_shard_manifest_close(FILE * fp, int64_t total)
+{
+   // written last, a manifest without it belongs to a shard that did not finish
+   fprintf(fp,"end %lld\n",(long long) total);
+   fclose(fp);
+}
+
+int lvis_shard_is_manifest(char * filename)
+{
+   FILE * fp;
+   char   line[256];
+   int    yes=0;
+
+   if((fp = fopen(filename,"r"))==NULL) return 0;
+   if(fgets(line,sizeof(line),fp)!=NULL &&
+      strncmp(line,LVIS_SHARD_MANIFEST_MAGIC,strlen(LVIS_SHARD_MANIFEST_MAGIC))==0) yes = 1;
+   fclose(fp);
+   return yes;
+}
+
+struct lvis_shard_segment
+{
+   int      file;
+   int64_t  first,count,offset,length;
+};
+
+struct lvis_shard_manifest
+{
+   char                        name[1024];
+   char                        output[2048];
+   int                         shard,nshards,ninputs,complete;
+   int64_t                     total;
+   int64_t                   * records;      // of every input (-1 unreadable), NULL if not given
+   int                         nsegments;
+   struct lvis_shard_segment * segments;
+};
+
+static int lvis_shard_read_manifest(char * name, struct lvis_shard_manifest * m)
+{
+   FILE   * fp;
+   char     line[4096],word[32],value[2048];
+   char   * slash;
+   long long a,b,c,d;
+   int      file;
+
+   memset(m,0,sizeof(struct lvis_shard_manifest));
+   strncpy(m->name,name,sizeof(m->name)-1);
+   m->shard = -1;
+   if((fp = fopen(name,"r"))==NULL)
+     {
+	fprintf(stderr,"Error opening the manifest file: %s\n",name);
+	return -1;
+     }
+   if(fgets(line,sizeof(line),fp)==NULL ||
+      strncmp(line,LVIS_SHARD_MANIFEST_MAGIC,strlen(LVIS_SHARD_MANIFEST_MAGIC))!=0)
+     {
+	fprintf(stderr,"Not a shard manifest: %s\n",name);
+	fclose(fp);
+	return -1;
+     }
+   while(fgets(line,sizeof(line),fp)!=NULL)
+     {
+	if(sscanf(line,"%31s",word)!=1) continue;
+	if(strcmp(word,"shard")==0) sscanf(line,"%*s %d %d",&m->shard,&m->nshards);
+	if(strcmp(word,"inputs")==0 && sscanf(line,"%*s %d",&m->ninputs)==1 && m->ninputs > 0 && m->records == NULL)
+	  {
+	     if((m->records = (int64_t *) malloc(m->ninputs * sizeof(int64_t))) == NULL)
+	       {
+		  fprintf(stderr,"Unable to allocate the manifest table\n");
+		  exit(-1);
+	       }
+	     for(file=0;file<m->ninputs;file++) m->records[file] = -2;
+	  }
+	if(strcmp(word,"input")==0 && sscanf(line,"%*s %d %lld",&file,&a)==2 && m->records != NULL &&
+	   file >= 0 && file < m->ninputs)
+	  m->records[file] = a;
+	if(strcmp(word,"output")==0 && sscanf(line,"%*s %2047[^\n]",value)==1)
+	  {
+	     // the partial output is next to the manifest
+	     strcpy(m->output,name);
+	     slash = strrchr(m->output,'/');
+	     if(slash == NULL) strcpy(m->output,value);
+	     else strcpy(slash+1,value);
+	  }
+	if(strcmp(word,"segment")==0 && sscanf(line,"%*s %d %lld %lld %lld %lld",&file,&a,&b,&c,&d)==5)
+	  {
+	     if((m->nsegments & (m->nsegments-1)) == 0)
+	       m->segments = (struct lvis_shard_segment *)
+		 realloc(m->segments,sizeof(struct lvis_shard_segment) * (m->nsegments ? m->nsegments*2 : 1));
+	     m->segments[m->nsegments].file   = file;
+	     m->segments[m->nsegments].first  = a;
+	     m->segments[m->nsegments].count  = b;
+	     m->segments[m->nsegments].offset = c;
+	     m->segments[m->nsegments].length = d;
+	     m->nsegments++;
+	  }
+	if(strcmp(word,"end")==0 && sscanf(line,"%*s %lld",&a)==1)
+	  {
+	     m->total = a;
+	     m->complete = 1;
+	  }
+     }
+   fclose(fp);
+   return 0;
+}
+
+// check that the manifests are one complete, consistent set and put them in shard order
+static int lvis_shard_check(struct lvis_shard_manifest * m, int n, struct lvis_shard_manifest ** order)
+{
+   struct stat st;
+   int         i,j,k,errors=0,lastFile=-1;
+   int64_t     sum,* next;
+
+   for(i=0;i<n;i++) order[i] = NULL;
+   for(i=0;i<n;i++)
+     {
+	if(m[i].nshards != n)
+	  {
+	     fprintf(stderr,"%s: belongs to a run of %d shards, %d manifests given\n",m[i].name,m[i].nshards,n);
+	     errors++;
+	     continue;
+	  }
+	if(m[i].ninputs != m[0].ninputs)
+	  {
+	     fprintf(stderr,"%s: was run over %d inputs, %s over %d\n",m[i].name,m[i].ninputs,m[0].name,m[0].ninputs);
+	     errors++;
+	  }
+	else if(m[i].records == NULL || m[0].records == NULL)
+	  {
+	     fprintf(stderr,"%s: does not list the records of its inputs\n",(m[i].records == NULL) ? m[i].name : m[0].name);
+	     errors++;
+	  }
+	else
+	  for(k=0;k<m[i].ninputs;k++)
+	    if(m[i].records[k] != m[0].records[k] || m[i].records[k] < 0)
+	      {
+		 fprintf(stderr,"%s: input %d has %lld records to convert, %lld in %s\n",m[i].name,k,
+			 (long long) m[i].records[k],(long long) m[0].records[k],m[0].name);
+		 errors++;
+		 break;
+	      }
+	if(m[i].shard < 0 || m[i].shard >= n || order[m[i].shard] != NULL)
+	  {
+	     fprintf(stderr,"%s: shard %d is missing or given twice\n",m[i].name,m[i].shard);
+	     errors++;
+	     continue;
+	  }
+	order[m[i].shard] = &m[i];
+	if(m[i].complete == 0)
+	  {
+	     fprintf(stderr,"%s: shard %d did not finish\n",m[i].name,m[i].shard);
+	     errors++;
+	  }
+	for(j=0,sum=0;j<m[i].nsegments;j++) sum += m[i].segments[j].length;
+	if(sum != m[i].total || stat(m[i].output,&st)!=0 || (int64_t) st.st_size != m[i].total)
+	  {
+	     fprintf(stderr,"%s: partial output %s is missing or does not match its manifest\n",
+		     m[i].name,m[i].output);
+	     errors++;
+	  }
+     }
+   if(errors) return errors;
+
+   // the segments must follow on from each other in file / record order
+   // and cover every record of every input, from the first to the last
+   if((next = (int64_t *) malloc(m[0].ninputs * sizeof(int64_t))) == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the manifest table\n");
+	exit(-1);
+     }
+   for(k=0;k<m[0].ninputs;k++) next[k] = -1;
+   for(i=0;i<n;i++)
+     for(j=0;j<order[i]->nsegments;j++)
+       {
+	  struct lvis_shard_segment * s = &order[i]->segments[j];
+	  if(s->file < 0 || s->file >= m[0].ninputs || s->file < lastFile ||
+	     s->first != ((s->file == lastFile) ? next[s->file] : 0))
+	    {
+	       fprintf(stderr,"%s: segment for input %d at record %lld does not follow on from the previous shard\n",
+		       order[i]->name,s->file,(long long) s->first);
+	       errors++;
+	       continue;
+	    }
+	  lastFile = s->file;
+	  next[s->file] = s->first + s->count;
+       }
+   for(k=0;k<m[0].ninputs;k++)
+     {
+	if(next[k] < 0)
+	  {
+	     fprintf(stderr,"input %d is in none of the shards\n",k);
+	     errors++;
+	  }
+	else if(next[k] != m[0].records[k])
+	  {
+	     fprintf(stderr,"input %d: the shards end at record %lld of %lld\n",k,(long long) next[k],
+		     (long long) m[0].records[k]);
+	     errors++;
+	  }
+     }
+   free(next);
+   return errors;
+}
+
+int lvis_shard_merge(char ** manifests, int nmanifests, struct lvis_release_options * opt)
+{
+   struct lvis_shard_manifest  * m;
+   struct lvis_shard_manifest ** order;
+   FILE                        * in,* out;
+   char                        * buf;
+   size_t                        got;
+   int                           i,errors=0;
+
+   m = (struct lvis_shard_manifest *) calloc(nmanifests,sizeof(struct lvis_shard_manifest));
+   order = (struct lvis_shard_manifest **) calloc(nmanifests,sizeof(struct lvis_shard_manifest *));
+   buf = (char *) malloc(1 << 20);
+   if(m == NULL || order == NULL || buf == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the manifest table\n");
+	exit(-1);
+     }
+   for(i=0;i<nmanifests;i++)
+     if(lvis_shard_read_manifest(manifests[i],&m[i])!=0) errors++;
+   if(errors == 0) errors = lvis_shard_check(m,nmanifests,order);
+   if(errors)
+     {
+	fprintf(stderr,"Not merging, %d problem(s) with the shard manifests\n",errors);
+	return -1;
+     }
+
+   out = stdout;
+   if(opt->outfile[0] != 0 && (out = fopen(opt->outfile,"w"))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	exit(-1);
+     }
+   for(i=0;i<nmanifests;i++)
+     {
+	if((in = fopen(order[i]->output,"rb"))==NULL)
+	  {
+	     fprintf(stderr,"Error opening the partial output: %s\n",order[i]->output);
+	     exit(-1);
+	  }
+	while((got = fread(buf,1,1 << 20,in)) > 0) fwrite(buf,1,got,out);
+	fclose(in);
+     }
+   if(out != stdout) fclose(out);
+   else fflush(stdout);
+
+   for(i=0;i<nmanifests;i++) { free(m[i].segments); free(m[i].records); }
+   free(m);
+   free(order);
+   free(buf);
+   return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef __LVIS_RELEASE_SHARD_H
+#define __LVIS_RELEASE_SHARD_H
+
+// lvis_release_shard.h
+//
+// Sharded execution: --shard i/N splits the input list, and the record
+// ranges inside the files, into N contiguous pieces of (nearly) equal byte
+// size.  The split only depends on the inputs and the options, so N
+// independent processes (on one machine or many sharing a filesystem) each
+// convert their own piece without talking to each other.  Every shard
+// writes its partial output plus a manifest; the merge mode checks the
+// manifests and joins the partial outputs back in file / record order.
+
+#include <stdio.h>
+#include <stdint.h>
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+
+#define LVIS_SHARD_MANIFEST_MAGIC "# lvis_release_reader shard manifest"
+
+// record range [lo[k],hi[k]) of every input k that belongs to shard
+// (0 .. nshards-1).  nrecords[k] is the number of records of input k to
+// convert, inputs with status[k] != 0 are skipped
+void lvis_shard_ranges(struct lvis_release_file * files, int * status, int64_t * nrecords, int ninputs,
+		       int shard, int nshards, int64_t * lo, int64_t * hi);
+
+// names of the partial output and manifest of one shard
+void lvis_shard_names(char * prefix, int shard, int nshards, char * output, char * manifest, int size);
+
+// manifest writing: the records of every input (nrecords[k], -1 when
+// status[k] != 0), one segment per input piece, then the closing line
+FILE * lvis_shard_manifest_open(char * manifest, char * output, int shard, int nshards, int ninputs,
+				char ** inputs, int * status, int64_t * nrecords);
+void   lvis_shard_manifest_segment(FILE * fp, int file, int64_t first, int64_t count,
+				   int64_t offset, int64_t length, char * filename);
+void   lvis_shard_manifest_close(FILE * fp, int64_t total);
+
+// is this file a shard manifest?
+int    lvis_shard_is_manifest(char * filename);
+
+// join the partial outputs of a complete set of manifests, in order, to
+// opt->outfile (or stdout).  returns 0 on success
+int    lvis_shard_merge(char ** manifests, int nmanifests, struct lvis_release_options * opt);
+
+#endif
@@ -294,7 +294,7 @@ struct lvis_lgw_v1_04 // LVIS Geolocated Waveforms v1.04
 typedef struct lgw_v1_04 * ptr_lgw_v1_04;
 
 #define LVIS_LCE_V1_00_ELEMENTS 3
-static char * lvis_lce_v1_00_header[3] =
+static char * const lvis_lce_v1_00_header[3] =
 {
      "tlon",
      "tlat",
@@ -302,7 +302,7 @@ static char * lvis_lce_v1_00_header[3] =
 };
 
 #define LVIS_LCE_V1_01_ELEMENTS 5
-static char * lvis_lce_v1_01_header[5] =
+static char * const lvis_lce_v1_01_header[5] =
 {
      "lfid",
      "shotnumber",
@@ -312,7 +312,7 @@ static char * lvis_lce_v1_01_header[5] =
 };
 
 #define LVIS_LCE_V1_02_ELEMENTS 6
-static char * lvis_lce_v1_02_header[6] =
+static char * const lvis_lce_v1_02_header[6] =
 {
      "lfid",
      "shotnumber",
@@ -323,7 +323,7 @@ static char * lvis_lce_v1_02_header[6] =
 };
 
 #define LVIS_LCE_V1_03_ELEMENTS 9
-static char * lvis_lce_v1_03_header[9] =
+static char * const lvis_lce_v1_03_header[9] =
 {
      "lfid",
      "shotnumber",
@@ -337,7 +337,7 @@ static char * lvis_lce_v1_03_header[9] =
 };
 
 #define LVIS_LCE_V1_04_ELEMENTS 9
-static char * lvis_lce_v1_04_header[9] =
+static char * const lvis_lce_v1_04_header[9] =
 {
      "lfid",
      "shotnumber",
@@ -351,7 +351,7 @@ static char * lvis_lce_v1_04_header[9] =
 };
 
 #define LVIS_LGE_V1_00_ELEMENTS 7
-static char * lvis_lge_v1_00_header[7] =
+static char * const lvis_lge_v1_00_header[7] =
 {
      "glon",
      "glat",
@@ -363,7 +363,7 @@ static char * lvis_lge_v1_00_header[7] =
 };
 
 #define LVIS_LGE_V1_01_ELEMENTS 9
-static char * lvis_lge_v1_01_header[9] =
+static char * const lvis_lge_v1_01_header[9] =
 {
      "lfid",
      "shotnumber",
@@ -377,7 +377,7 @@ static char * lvis_lge_v1_01_header[9] =
 };
 
 #define LVIS_LGE_V1_02_ELEMENTS 10
-static char * lvis_lge_v1_02_header[10] =
+static char * const lvis_lge_v1_02_header[10] =
 {
      "lfid",
      "shotnumber",
@@ -392,7 +392,7 @@ static char * lvis_lge_v1_02_header[10] =
 };
 
 #define LVIS_LGE_V1_03_ELEMENTS 13
-static char * lvis_lge_v1_03_header[13] =
+static char * const lvis_lge_v1_03_header[13] =
 {
      "lfid",
      "shotnumber",
@@ -410,7 +410,7 @@ static char * lvis_lge_v1_03_header[13] =
 };
 
 #define LVIS_LGE_V1_04_ELEMENTS 13
-static char * lvis_lge_v1_04_header[13] =
+static char * const lvis_lge_v1_04_header[13] =
 {
      "lfid",
      "shotnumber",
@@ -428,7 +428,7 @@ static char * lvis_lge_v1_04_header[13] =
 };
 
 #define LVIS_LGW_V1_00_ELEMENTS 7
-static char * lvis_lgw_v1_00_header[7] =
+static char * const lvis_lgw_v1_00_header[7] =
 {
      "lon0",
      "lat0",
@@ -440,7 +440,7 @@ static char * lvis_lgw_v1_00_header[7] =
 };
 
 #define LVIS_LGW_V1_01_ELEMENTS 9
-static char * lvis_lgw_v1_01_header[9] =
+static char * const lvis_lgw_v1_01_header[9] =
 {
      "lfid",
      "shotnumber",
@@ -454,7 +454,7 @@ static char * lvis_lgw_v1_01_header[9] =
 };
 
 #define LVIS_LGW_V1_02_ELEMENTS 10
-static char * lvis_lgw_v1_02_header[10] =
+static char * const lvis_lgw_v1_02_header[10] =
 {
      "lfid",
      "shotnumber",
@@ -469,7 +469,7 @@ static char * lvis_lgw_v1_02_header[10] =
 };
 
 #define LVIS_LGW_V1_03_ELEMENTS 13
-static char * lvis_lgw_v1_03_header[13] =
+static char * const lvis_lgw_v1_03_header[13] =
 {
      "lfid",
      "shotnumber",
@@ -487,7 +487,7 @@ static char * lvis_lgw_v1_03_header[13] =
 };
 
 #define LVIS_LGW_V1_04_ELEMENTS 13
-static char * lvis_lgw_v1_04_header[13] =
+static char * const lvis_lgw_v1_04_header[13] =
 {
      "lfid",
      "shotnumber",
@@ -504,6 +504,6 @@ static char * lvis_lgw_v1_04_header[13] =
      "sigmean"
 };
 
-static char * lvis_index_header_string = "index";
+static char * const lvis_index_header_string = "index";
 
 #endif
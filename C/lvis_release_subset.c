@@ -0,0 +1,214 @@
+// lvis_release_subset.c
+//
+// Binary subset extraction (see lvis_release_subset.h).
+//
+// Each input is scanned in large blocks; only a scratch copy of a record is
+// swapped to test its position, the block itself is left as it was read.
+// Consecutive matching records are gathered into runs and every run is
+// handed to the kernel to copy straight from the input file to the output
+// (copy_file_range, else sendfile), so the bytes that are kept never make
+// a second trip through user space.  Where neither call is available the
+// run is written from the block in memory instead.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_subset.h"
+#include "lvis_release_canon.h"
+
+// which kernel copy still works for this output (they may refuse, e.g.
+// across filesystems on old kernels, and then we stop trying)
+static int lvis_subset_use_copy_range = 1;
+static int lvis_subset_use_sendfile   = 1;
+
+static int lvis_subset_write(int out, unsigned char * data, int64_t length)
+{
+   ssize_t status;
+
+   while(length > 0)
+     {
+	status = write(out,data,(size_t) length);
+	if(status < 0 && errno == EINTR) continue;
+	if(status <= 0) return -1;
+	data += status;
+	length -= status;
+     }
+   return 0;
+}
+
+// copy length bytes at offset of in to the end of out.  data holds the same
+// bytes (already read while scanning) for when the kernel will not copy
+static int lvis_subset_copy(int in, int64_t offset, int out, int64_t length, unsigned char * data)
+{
+   ssize_t status=0;
+   off_t   from;
+
+#ifdef __linux__
+   while(length > 0 && lvis_subset_use_copy_range)
+     {
+	from = (off_t) offset;
+	status = copy_file_range(in,&from,out,NULL,(size_t) length,0);
+	if(status < 0 && errno == EINTR) continue;
+	if(status <= 0) { lvis_subset_use_copy_range = 0; break; }
+	offset += status; data += status; length -= status;
+     }
+   while(length > 0 && lvis_subset_use_sendfile)
+     {
+	from = (off_t) offset;
+	status = sendfile(out,in,&from,(size_t) length);
+	if(status < 0 && errno == EINTR) continue;
+	if(status <= 0) { lvis_subset_use_sendfile = 0; break; }
+	offset += status; data += status; length -= status;
+     }
+#endif
+   if(length > 0) return lvis_subset_write(out,data,length);
+   return 0;
+}
+
+// scan one input, returns the number of records written (-1 on error)
+static int64_t lvis_subset_file(struct lvis_release_file * f, int out, struct lvis_release_options * opt)
+{
+   unsigned char * block,record[LVIS_MAX_RECORD_SIZE];
+   int64_t         n,first,count,got,i,runStart,kept=0;
+   long            perBlock;
+   double          lon,lat;
+
+   n = f->recordCount;
+   if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+
+   perBlock = LVIS_SUBSET_CHUNK_BYTES / f->recordSize;
+   if(perBlock < 1) perBlock = 1;
+   if((block = (unsigned char *) malloc((size_t) perBlock * f->recordSize))==NULL)
+     {
+	fprintf(stderr,"Unable to allocate the subset read buffer\n");
+	exit(-1);
+     }
+
+   for(first=0;first<n;first+=count)
+     {
+	count = (n - first < perBlock) ? n - first : perBlock;
+	got = lvis_file_read(f,first,count,block);
+	if(got != count)
+	  {
+	     fprintf(stderr,"Short read in %s at record %lld\n",f->filename,(long long) (first+got));
+	     free(block);
+	     return -1;
+	  }
+
+	// runs are kept within a block, so the fallback always has the bytes at hand
+	runStart = -1;
+	for(i=0;i<=count;i++)
+	  {
+	     int inside = 0;
+	     if(i < count)
+	       {
+		  memcpy(record,block+i*f->recordSize,f->recordSize);
+		  swap_release_data(record,f->fileType,f->fileVersion,f->myendian);
+		  release_data_position(record,f->fileType,f->fileVersion,&lon,&lat);
+		  inside = lvis_release_keep(opt,lon,lat);
+	       }
+	     if(inside && runStart < 0) runStart = i;
+	     if(!inside && runStart >= 0)
+	       {
+		  if(lvis_subset_copy(f->fd,f->dataOffset + (first+runStart) * f->recordSize,out,
+				      (i-runStart) * f->recordSize,block+runStart*f->recordSize)!=0)
+		    {
+		       fprintf(stderr,"Error writing the subset output: %s\n",strerror(errno));
+		       free(block);
+		       return -1;
+		    }
+		  kept += i - runStart;
+		  runStart = -1;
+	       }
+	  }
+     }
+   free(block);
+   return kept;
+}
+
+int lvis_subset_extract(char ** inputs, int ninputs, struct lvis_release_options * opt)
+{
+   struct lvis_release_file f;
+   struct lvis_canon_header hdr,ordered;
+   int                      i,out,fileType=-1,canonical=0,endian=0,errors=0;
+   float                    fileVersion=-1.0;
+   int64_t                  kept,total=0;
+
+   if((out = open(opt->outfile,O_WRONLY|O_CREAT|O_TRUNC,0644))<0)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	exit(-1);
+     }
+
+   for(i=0;i<ninputs;i++)
+     {
+	if(lvis_file_open(&f,inputs[i],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	// the output is one release file, it can only hold one layout (and a
+	// canonical output only records of one byte order)
+	if(fileType >= 0 && (f.fileType != fileType || f.fileVersion != fileVersion ||
+			     f.canonical != canonical || (canonical && f.myendian != endian)))
+	  {
+	     fprintf(stderr,"Skipping %s: it is %s v%4.2f, the output is %s v%4.2f\n",f.filename,
+		     lvis_file_type_name(f.fileType),f.fileVersion,lvis_file_type_name(fileType),fileVersion);
+	     lvis_file_close(&f);
+	     errors++;
+	     continue;
+	  }
+	// a canonical input gives a canonical output, the count is filled in at the end
+	if(fileType < 0 && f.canonical)
+	  {
+	     lvis_canon_make_header(&hdr,f.fileType,f.sourceVersion,0);
+	     hdr.txSamples = f.txSamples;
+	     hdr.rxSamples = f.rxSamples;
+	     // the records are copied as they are, the header must be in their byte order
+	     lvis_canon_order_header(&hdr,f.myendian,&ordered);
+	     if(lvis_subset_write(out,(unsigned char *) &ordered,sizeof(ordered))!=0)
+	       {
+		  fprintf(stderr,"Error writing the subset output: %s\n",strerror(errno));
+		  exit(-1);
+	       }
+	  }
+	fileType = f.fileType;
+	fileVersion = f.fileVersion;
+	canonical = f.canonical;
+	endian = f.myendian;
+	if((kept = lvis_subset_file(&f,out,opt)) < 0) errors++;
+	else total += kept;
+	lvis_file_close(&f);
+     }
+
+   if(canonical)
+     {
+	hdr.recordCount = (uint64_t) total;
+	lvis_canon_order_header(&hdr,endian,&ordered);
+	if(pwrite(out,&ordered,sizeof(ordered),0) != sizeof(ordered))
+	  {
+	     fprintf(stderr,"Error writing the subset header: %s\n",strerror(errno));
+	     errors++;
+	  }
+     }
+
+   if(close(out)!=0)
+     {
+	fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	errors++;
+     }
+   if(canonical && errors == 0 && lvis_canon_check_header(opt->outfile,&hdr,endian)!=0) errors++;
+   return errors;
+}
@@ -0,0 +1,20 @@
+#ifndef __LVIS_RELEASE_SUBSET_H
+#define __LVIS_RELEASE_SUBSET_H
+
+// lvis_release_subset.h
+//
+// Binary subset extraction (-o out.bin): the records that fall inside the
+// -lat / -lon cut are written unchanged, in their original byte order, so
+// the result is still a release file every reader (IDL included) can open.
+
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_SUBSET_CHUNK_BYTES
+#define  LVIS_SUBSET_CHUNK_BYTES (4 * 1024 * 1024) // bytes scanned per read
+#endif
+
+// write every record of the inputs inside the cut to opt->outfile, all the
+// inputs must share one type and release version.  returns 0 on success
+int lvis_subset_extract(char ** inputs, int ninputs, struct lvis_release_options * opt);
+
+#endif
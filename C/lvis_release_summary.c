@@ -0,0 +1,659 @@
+// lvis_release_summary.c
+//
+// What is in a file (-summary), see lvis_release_summary.h.
+//
+// The inputs are split into tasks of LVIS_SUMMARY_CHUNK shots which the
+// pool reads (as canonical records) into accumulators of their own; like
+// the metrics mode the tasks run in waves of a few per thread, the calling
+// thread merging wave N into the inputs' totals while wave N+1 is worked
+// on.  The waveform samples are summed as integers within a task, the
+// scalars by Welford's update, and the partial means and variances are
+// joined with the pairwise formula of Chan et al.
+//
+// Under -sample the tasks cover the records of the sample instead and do
+// not straddle its blocks, so the calling thread can also keep the mean of
+// each block: the standard error of a field's mean is then that of the
+// block means (the blocks are clusters), or the usual one for a strided
+// sample, with the finite population correction.
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_sample.h"
+#include "lvis_release_summary.h"
+
+struct lvis_summary_field
+{
+   int64_t count;          // values in the figures below
+   int64_t nan;
+   int64_t missing;        // ids holding LVIS_CANON_NO_ID
+   int64_t range;          // lon / lat out of range
+   double  min,max,mean,m2;
+};
+
+struct lvis_summary_acc
+{
+   int64_t records;        // read
+   int64_t outside;        // outside -lat / -lon / -poly
+   int64_t noPosition;     // position nan or out of range
+   int64_t saturated;      // rxwave samples at the digitiser maximum
+   double  minlon,maxlon,minlat,maxlat;
+   struct lvis_summary_field fields[LVIS_SUMMARY_MAX_FIELDS];
+   int64_t * zhist;
+   int64_t   zbelow,zabove;
+   int64_t   amp[LVIS_SUMMARY_AMP_BINS];
+};
+
+struct lvis_summary_input
+{
+   struct lvis_canon_column * columns;
+   int                        ncolumns;
+   int                        elevation;    // column of the elevation histogram
+   int                        txSamples,rxSamples,saturation;
+   int64_t                    trailing;     // bytes past the last whole record
+   int64_t                    samples;      // records of the -sample (all of them without)
+   struct lvis_summary_acc    acc;
+   // -sample NxB: the block being merged and the mean of each block so far
+   int64_t                    block;
+   struct lvis_summary_field  blockFields[LVIS_SUMMARY_MAX_FIELDS];
+   struct lvis_summary_field  blockMeans[LVIS_SUMMARY_MAX_FIELDS];
+};
+
+struct lvis_summary_task
+{
+   int                     file;
+   int64_t                 first,count;       // of the -sample's records
+   struct lvis_summary_acc acc;
+   int                     status;   // 0, -1 on a read error
+};
+
+struct lvis_summary_job
+{
+   struct lvis_release_options * opt;
+   struct lvis_summary_options * s;
+   struct lvis_release_file    * files;
+   struct lvis_summary_input   * inputs;
+   int                           nz;          // elevation histogram bins
+   struct lvis_summary_task    * tasks;
+   unsigned char              ** raw;         // per worker
+   unsigned char              ** canon;       // per worker
+   int                           errors;      // of the join
+};
+
+void lvis_summary_defaults(struct lvis_summary_options * s)
+{
+   s->enabled = 0;
+   s->json = 0;
+   s->zbin = LVIS_SUMMARY_ZBIN;
+   s->field[0] = 0;
+}
+
+int lvis_summary_parse_option(int argc, char * argv[], int i, struct lvis_summary_options * s)
+{
+   if(strcmp(argv[i],"-summary")==0)
+     {
+	s->enabled = 1;
+	return 1;
+     }
+   if(strcmp(argv[i],"-json")==0)
+     {
+	s->enabled = 1;
+	s->json = 1;
+	return 1;
+     }
+   if(strcmp(argv[i],"-zbin")==0 && i+1<argc)
+     {
+	s->zbin = atof(argv[i+1]);
+	if(!(s->zbin >= 0.1))
+	  {
+	     fprintf(stderr,"-zbin must be at least 0.1 m\n");
+	     exit(-1);
+	  }
+	return 2;
+     }
+   return 0;
+}
+
+static void lvis_summary_clear(struct lvis_summary_acc * a, int nz)
+{
+   int64_t * zhist = a->zhist;
+   int       k;
+
+   memset(a,0,sizeof(*a));
+   a->minlon = a->minlat = HUGE_VAL;
+   a->maxlon = a->maxlat = -HUGE_VAL;
+   for(k=0;k<LVIS_SUMMARY_MAX_FIELDS;k++)
+     {
+	a->fields[k].min = HUGE_VAL;
+	a->fields[k].max = -HUGE_VAL;
+     }
+   if(zhist == NULL && (zhist = (int64_t *) malloc(nz * sizeof(int64_t))) == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the summary histograms\n");
+	exit(-1);
+     }
+   memset(zhist,0,nz * sizeof(int64_t));
+   a->zhist = zhist;
+}
+
+static void lvis_summary_add(struct lvis_summary_field * f, double v)
+{
+   double d;
+
+   f->count++;
+   d = v - f->mean;
+   f->mean += d / f->count;
+   f->m2 += d * (v - f->mean);
+   if(v < f->min) f->min = v;
+   if(v > f->max) f->max = v;
+}
+
+// join b into a (the pairwise update of the mean and variance)
+static void lvis_summary_join(struct lvis_summary_field * a, struct lvis_summary_field * b)
+{
+   double n,d;
+
+   a->nan += b->nan;
+   a->missing += b->missing;
+   a->range += b->range;
+   if(b->count == 0) return;
+   n = (double) a->count + b->count;
+   d = b->mean - a->mean;
+   a->mean += d * b->count / n;
+   a->m2 += b->m2 + d * d * ((double) a->count * b->count / n);
+   a->count += b->count;
+   if(b->min < a->min) a->min = b->min;
+   if(b->max > a->max) a->max = b->max;
+}
+
+static void lvis_summary_merge(struct lvis_summary_acc * a, struct lvis_summary_acc * b, int ncolumns, int nz)
+{
+   int k;
+
+   a->records += b->records;
+   a->outside += b->outside;
+   a->noPosition += b->noPosition;
+   a->saturated += b->saturated;
+   if(b->minlon < a->minlon) a->minlon = b->minlon;
+   if(b->maxlon > a->maxlon) a->maxlon = b->maxlon;
+   if(b->minlat < a->minlat) a->minlat = b->minlat;
+   if(b->maxlat > a->maxlat) a->maxlat = b->maxlat;
+   for(k=0;k<ncolumns;k++) lvis_summary_join(&a->fields[k],&b->fields[k]);
+   for(k=0;k<nz;k++) a->zhist[k] += b->zhist[k];
+   a->zbelow += b->zbelow;
+   a->zabove += b->zabove;
+   for(k=0;k<LVIS_SUMMARY_AMP_BINS;k++) a->amp[k] += b->amp[k];
+}
+
+// the block of a -sample NxB merged: its mean of each field into blockMeans
+static void lvis_summary_block(struct lvis_summary_input * in)
+{
+   int k;
+
+   for(k=0;k<in->ncolumns;k++)
+     {
+	if(in->blockFields[k].count > 0) lvis_summary_add(&in->blockMeans[k],in->blockFields[k].mean);
+	memset(&in->blockFields[k],0,sizeof(struct lvis_summary_field));
+     }
+}
+
+// the standard error of the mean of field k of the -sample, nan without two clusters
+static double lvis_summary_stderr(struct lvis_summary_input * in, int k, struct lvis_sample_options * sample,
+				  int64_t records)
+{
+   struct lvis_summary_field * d = (sample->blocks > 0) ? &in->blockMeans[k] : &in->acc.fields[k];
+   double                      fpc = 1.0 - (double) in->acc.records / records;
+
+   if(d->count < 2) return NAN;
+   return sqrt(d->m2 / (d->count - 1) / d->count * ((fpc > 0.0) ? fpc : 0.0));
+}
+
+static void lvis_summary_run(void * context, long t, int worker)
+{
+   struct lvis_summary_job   * job = (struct lvis_summary_job *) context;
+   struct lvis_summary_task  * task = &job->tasks[t];
+   struct lvis_summary_input * in = &job->inputs[task->file];
+   struct lvis_release_options * opt = job->opt;
+   struct lvis_summary_acc   * a = &task->acc;
+   struct lvis_canon_column  * c;
+   int                         fileType = job->files[task->file].fileType;
+   size_t                      size = lvis_record_size(fileType,(float)1.04);
+   unsigned char             * rec;
+   int64_t                     i,got,z,sum[LVIS_SUMMARY_MAX_FIELDS],sumsq[LVIS_SUMMARY_MAX_FIELDS];
+   int64_t                     nsamples[LVIS_SUMMARY_MAX_FIELDS];
+   double                      lon,lat,v,mean;
+   uint32_t                    u;
+   float                       f;
+   uint16_t                    w;
+   int                         k,j,n,bin;
+
+   lvis_summary_clear(a,job->nz);
+   memset(sum,0,sizeof(sum));
+   memset(sumsq,0,sizeof(sumsq));
+   memset(nsamples,0,sizeof(nsamples));
+   got = lvis_sample_read(&job->files[task->file],opt->sample,task->first,task->count,job->raw[worker],job->canon[worker]);
+   if(got != task->count) task->status = -1;
+   for(i=0;i<got;i++)
+     {
+	rec = job->canon[worker] + i * size;
+	a->records++;
+	release_data_position(rec,fileType,(float)1.04,&lon,&lat);
+	if(!(lon >= -180.0 && lon <= 360.0 && lat >= -90.0 && lat <= 90.0)) a->noPosition++;
+	if(!lvis_release_keep(opt,lon,lat))
+	  { a->outside++; continue; }
+	if(lon < a->minlon) a->minlon = lon;
+	if(lon > a->maxlon) a->maxlon = lon;
+	if(lat < a->minlat) a->minlat = lat;
+	if(lat > a->maxlat) a->maxlat = lat;
+
+	for(k=0,c=in->columns;k<in->ncolumns;k++,c++)
+	  {
+	     if(c->kind == LVIS_CANON_UINT16)
+	       {
+		  // a waveform, over its valid samples
+		  n = (strcmp(c->name,"rxwave")==0) ? in->rxSamples : in->txSamples;
+		  for(j=0;j<n;j++)
+		    {
+		       memcpy(&w,rec + c->offset + j * sizeof(uint16_t),sizeof(w));
+		       sum[k] += w;
+		       sumsq[k] += (int64_t) w * w;
+		       if(w < a->fields[k].min) a->fields[k].min = w;
+		       if(w > a->fields[k].max) a->fields[k].max = w;
+		       if(c->name[0] != 'r') continue;
+		       bin = w / LVIS_SUMMARY_AMP_BIN;
+		       a->amp[(bin < LVIS_SUMMARY_AMP_BINS) ? bin : LVIS_SUMMARY_AMP_BINS-1]++;
+		       if(w >= in->saturation) a->saturated++;
+		    }
+		  nsamples[k] += n;
+		  continue;
+	       }
+	     if(c->kind == LVIS_CANON_UINT32)
+	       {
+		  memcpy(&u,rec + c->offset,sizeof(u));
+		  if(u == LVIS_CANON_NO_ID) { a->fields[k].missing++; continue; }
+		  v = u;
+	       }
+	     else if(c->kind == LVIS_CANON_FLOAT32)
+	       {
+		  memcpy(&f,rec + c->offset,sizeof(f));
+		  v = f;
+	       }
+	     else memcpy(&v,rec + c->offset,sizeof(v));
+	     if(v != v) { a->fields[k].nan++; continue; }
+	     if(strstr(c->name,"lon") != NULL && !(v >= -180.0 && v <= 360.0)) a->fields[k].range++;
+	     if(strstr(c->name,"lat") != NULL && !(v >= -90.0 && v <= 90.0)) a->fields[k].range++;
+	     lvis_summary_add(&a->fields[k],v);
+	     if(k != in->elevation) continue;
+	     z = (int64_t) floor((v - LVIS_SUMMARY_ZMIN) / job->s->zbin);
+	     if(z < 0) a->zbelow++;
+	     else if(z >= job->nz) a->zabove++;
+	     else a->zhist[z]++;
+	  }
+     }
+
+   // the waveform sums as a mean and the squared deviations from it
+   for(k=0;k<in->ncolumns;k++)
+     if(nsamples[k] > 0)
+       {
+	  mean = (double) sum[k] / nsamples[k];
+	  a->fields[k].count = nsamples[k];
+	  a->fields[k].mean = mean;
+	  a->fields[k].m2 = (double) sumsq[k] - mean * (double) sum[k];
+	  if(a->fields[k].m2 < 0.0) a->fields[k].m2 = 0.0;
+       }
+}
+
+// a number, or null (json) / nan for none
+static void lvis_summary_number(FILE * out, char * format, double v, int json)
+{
+   if(json && !(v == v && v != HUGE_VAL && v != -HUGE_VAL)) { fprintf(out,"null"); return; }
+   fprintf(out,format,v);
+}
+
+// the first and last bin of a histogram that are not empty, -1 if none is
+static long lvis_summary_span(int64_t * h, long n, long * last)
+{
+   long first;
+
+   for(first=0;first<n && h[first]==0;first++);
+   if(first == n) return -1;
+   for(*last=n-1;h[*last]==0;(*last)--);
+   return first;
+}
+
+static void lvis_summary_print_text(FILE * out, struct lvis_release_file * f, struct lvis_summary_input * in,
+				    struct lvis_summary_options * s, int nz, struct lvis_sample_options * sample)
+{
+   struct lvis_summary_acc  * a = &in->acc;
+   struct lvis_summary_field * d;
+   struct lvis_canon_column * c;
+   double                     tmin,tmax,sd;
+   long                       k,first,last=0;
+   int                        timed=-1;
+   char                       method[64];
+
+   fprintf(out,"file          %s\n",f->filename);
+   fprintf(out,"type          %s %.2f",lvis_file_type_name(f->fileType),
+	   f->canonical ? f->sourceVersion : f->fileVersion);
+   if(f->canonical) fprintf(out," (canonical)");
+   fprintf(out,"\n");
+   fprintf(out,"records       %lld, %lld summarised, %lld outside -lat / -lon / -poly, %lld bytes past the last\n",
+	   (long long) a->records,(long long) (a->records - a->outside),(long long) a->outside,
+	   (long long) in->trailing);
+   if(sample != NULL)
+     {
+	lvis_sample_describe(sample,method,sizeof(method));
+	fprintf(out,"sample        %s: %lld of %lld records (%.3f%%), counts are of the sample\n",method,
+		(long long) a->records,(long long) f->recordCount,
+		(f->recordCount > 0) ? 100.0 * a->records / f->recordCount : 0.0);
+     }
+   if(a->records > a->outside)
+     {
+	fprintf(out,"lon           %.10f .. %.10f\n",a->minlon,a->maxlon);
+	fprintf(out,"lat           %.10f .. %.10f\n",a->minlat,a->maxlat);
+     }
+   for(k=0,c=in->columns;k<in->ncolumns;k++,c++) if(strcmp(c->name,"lvistime")==0) timed = k;
+   if(timed >= 0 && a->fields[timed].count > 0)
+     {
+	tmin = a->fields[timed].min;
+	tmax = a->fields[timed].max;
+	fprintf(out,"lvistime      %.6f .. %.6f (%.3f s)\n",tmin,tmax,tmax - tmin);
+     }
+   fprintf(out,"quality       %lld shots without a position",(long long) a->noPosition);
+   if(f->fileType == LVIS_RELEASE_FILETYPE_LGW)
+     fprintf(out,", %lld saturated rxwave samples",(long long) a->saturated);
+   fprintf(out,"\n");
+   fprintf(out,"%-14s %10s %10s %10s %10s %18s %18s %18s %18s","field","count","nan","missing","range",
+	   "min","max","mean","stddev");
+   fprintf(out,(sample != NULL) ? " %18s\n" : "\n","stderr");
+   for(k=0,c=in->columns;k<in->ncolumns;k++,c++)
+     {
+	d = &a->fields[k];
+	sd = (d->count > 1) ? sqrt(d->m2 / (d->count - 1)) : 0.0;
+	fprintf(out,"%-14s %10lld %10lld %10lld %10lld ",c->name,(long long) d->count,(long long) d->nan,
+		(long long) d->missing,(long long) d->range);
+	if(d->count == 0)
+	  {
+	     fprintf(out,"%18s %18s %18s %18s","-","-","-","-");
+	     fprintf(out,(sample != NULL) ? " %18s\n" : "\n","-");
+	     continue;
+	  }
+	fprintf(out,"%18.10g %18.10g %18.10g %18.10g",d->min,d->max,d->mean,sd);
+	if(sample != NULL) fprintf(out," %18.10g",lvis_summary_stderr(in,k,sample,f->recordCount));
+	fprintf(out,"\n");
+     }
+
+   if(in->elevation >= 0)
+     {
+	fprintf(out,"%s histogram (%g m bins, %lld below %g m, %lld above %g m)\n",
+		in->columns[in->elevation].name,s->zbin,(long long) a->zbelow,LVIS_SUMMARY_ZMIN,
+		(long long) a->zabove,LVIS_SUMMARY_ZMAX);
+	if((first = lvis_summary_span(a->zhist,nz,&last)) >= 0)
+	  for(k=first;k<=last;k++)
+	    fprintf(out,"  %10.2f .. %10.2f %12lld\n",LVIS_SUMMARY_ZMIN + k * s->zbin,
+		    LVIS_SUMMARY_ZMIN + (k+1) * s->zbin,(long long) a->zhist[k]);
+     }
+   if(f->fileType == LVIS_RELEASE_FILETYPE_LGW)
+     {
+	fprintf(out,"rxwave histogram (%d counts a bin)\n",LVIS_SUMMARY_AMP_BIN);
+	if((first = lvis_summary_span(a->amp,LVIS_SUMMARY_AMP_BINS,&last)) >= 0)
+	  for(k=first;k<=last;k++)
+	    fprintf(out,"  %10ld .. %10ld %12lld\n",k * LVIS_SUMMARY_AMP_BIN,(k+1) * LVIS_SUMMARY_AMP_BIN - 1,
+		    (long long) a->amp[k]);
+     }
+}
+
+static void lvis_summary_print_json(FILE * out, struct lvis_release_file * f, struct lvis_summary_input * in,
+				    struct lvis_summary_options * s, int nz, struct lvis_sample_options * sample)
+{
+   struct lvis_summary_acc  * a = &in->acc;
+   struct lvis_summary_field * d;
+   struct lvis_canon_column * c;
+   char                     * p;
+   long                       k,first,last=0;
+   int                        none = (a->records == a->outside);
+   char                       method[64];
+
+   fprintf(out,"{\"file\": \"");
+   for(p=f->filename;*p;p++)
+     {
+	if(*p == '"' || *p == '\\') fputc('\\',out);
+	fputc(*p,out);
+     }
+   fprintf(out,"\", \"type\": \"%s\", \"version\": %.2f, \"canonical\": %s,\n",lvis_file_type_name(f->fileType),
+	   f->canonical ? f->sourceVersion : f->fileVersion,f->canonical ? "true" : "false");
+   fprintf(out," \"records\": %lld, \"summarised\": %lld, \"outside\": %lld, \"trailingBytes\": %lld,\n",
+	   (long long) a->records,(long long) (a->records - a->outside),(long long) a->outside,
+	   (long long) in->trailing);
+   if(sample != NULL)
+     {
+	lvis_sample_describe(sample,method,sizeof(method));
+	fprintf(out," \"sample\": {\"method\": \"%s\", \"records\": %lld, \"sampled\": %lld},\n",method,
+		(long long) f->recordCount,(long long) a->records);
+     }
+   fprintf(out," \"bbox\": {\"minlon\": ");
+   lvis_summary_number(out,"%.10f",none ? NAN : a->minlon,1);
+   fprintf(out,", \"maxlon\": ");
+   lvis_summary_number(out,"%.10f",none ? NAN : a->maxlon,1);
+   fprintf(out,", \"minlat\": ");
+   lvis_summary_number(out,"%.10f",none ? NAN : a->minlat,1);
+   fprintf(out,", \"maxlat\": ");
+   lvis_summary_number(out,"%.10f",none ? NAN : a->maxlat,1);
+   fprintf(out,"},\n \"quality\": {\"noPosition\": %lld, \"saturated\": %lld},\n \"fields\": {",
+	   (long long) a->noPosition,(long long) a->saturated);
+   for(k=0,c=in->columns;k<in->ncolumns;k++,c++)
+     {
+	d = &a->fields[k];
+	fprintf(out,"%s\n  \"%s\": {\"count\": %lld, \"nan\": %lld, \"missing\": %lld, \"range\": %lld, \"min\": ",
+		(k > 0) ? "," : "",c->name,(long long) d->count,(long long) d->nan,(long long) d->missing,
+		(long long) d->range);
+	lvis_summary_number(out,"%.10g",d->count > 0 ? d->min : NAN,1);
+	fprintf(out,", \"max\": ");
+	lvis_summary_number(out,"%.10g",d->count > 0 ? d->max : NAN,1);
+	fprintf(out,", \"mean\": ");
+	lvis_summary_number(out,"%.10g",d->count > 0 ? d->mean : NAN,1);
+	fprintf(out,", \"stddev\": ");
+	lvis_summary_number(out,"%.10g",d->count > 1 ? sqrt(d->m2 / (d->count - 1)) : (d->count > 0 ? 0.0 : NAN),1);
+	if(sample != NULL)
+	  {
+	     fprintf(out,", \"stderr\": ");
+	     lvis_summary_number(out,"%.10g",lvis_summary_stderr(in,k,sample,f->recordCount),1);
+	  }
+	fprintf(out,"}");
+     }
+   fprintf(out,"}");
+
+   if(in->elevation >= 0)
+     {
+	first = lvis_summary_span(a->zhist,nz,&last);
+	fprintf(out,",\n \"elevation\": {\"field\": \"%s\", \"bin\": %g, \"start\": %g, \"below\": %lld, \"above\": %lld, \"counts\": [",
+		in->columns[in->elevation].name,s->zbin,
+		LVIS_SUMMARY_ZMIN + ((first >= 0) ? first : 0) * s->zbin,(long long) a->zbelow,(long long) a->zabove);
+	if(first >= 0)
+	  for(k=first;k<=last;k++) fprintf(out,"%s%lld",(k > first) ? ", " : "",(long long) a->zhist[k]);
+	fprintf(out,"]}");
+     }
+   if(f->fileType == LVIS_RELEASE_FILETYPE_LGW)
+     {
+	fprintf(out,",\n \"rxwave\": {\"bin\": %d, \"start\": 0, \"counts\": [",LVIS_SUMMARY_AMP_BIN);
+	if(lvis_summary_span(a->amp,LVIS_SUMMARY_AMP_BINS,&last) >= 0)
+	  for(k=0;k<=last;k++) fprintf(out,"%s%lld",(k > 0) ? ", " : "",(long long) a->amp[k]);
+	fprintf(out,"]}");
+     }
+   fprintf(out,"}");
+}
+
+static int lvis_summary_task_input(void * context, long t)
+{
+   return ((struct lvis_summary_job *) context)->tasks[t].file;
+}
+
+// a task's accumulators into its input's, in order
+static void lvis_summary_task_join(void * context, long t)
+{
+   struct lvis_summary_job    * job = (struct lvis_summary_job *) context;
+   struct lvis_sample_options * sample = job->opt->sample;
+   struct lvis_summary_task   * task = &job->tasks[t];
+   struct lvis_summary_input  * in = &job->inputs[task->file];
+   int                          k;
+
+   if(task->status != 0)
+     {
+	fprintf(stderr,"Short read in %s at record %lld\n",job->files[task->file].filename,(long long) task->first);
+	job->errors++;
+     }
+   lvis_summary_merge(&in->acc,&task->acc,in->ncolumns,job->nz);
+   if(sample != NULL && sample->blocks > 0)
+     {
+	if(lvis_sample_cluster(sample,task->first) != in->block) lvis_summary_block(in);
+	in->block = lvis_sample_cluster(sample,task->first);
+	for(k=0;k<in->ncolumns;k++) lvis_summary_join(&in->blockFields[k],&task->acc.fields[k]);
+     }
+   free(task->acc.zhist);
+   task->acc.zhist = NULL;
+}
+
+int lvis_summary_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			 struct lvis_batch_options * b, struct lvis_summary_options * s)
+{
+   struct lvis_summary_job    job;
+   struct lvis_summary_input * in;
+   struct lvis_pool         * pool;
+   struct lvis_canon_column * c;
+   FILE                     * out;
+   long                       ntasks=0,maxtasks=0;
+   int64_t                    n,first;
+   float                      version;
+   char                     * field;
+   int                        k,threads,errors=0;
+
+   memset(&job,0,sizeof(job));
+   job.opt = opt;
+   job.s = s;
+   job.nz = (int) ceil((LVIS_SUMMARY_ZMAX - LVIS_SUMMARY_ZMIN) / s->zbin);
+   job.files = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file));
+   job.inputs = (struct lvis_summary_input *) calloc(ninputs,sizeof(struct lvis_summary_input));
+   if(job.files == NULL || job.inputs == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     {
+	in = &job.inputs[k];
+	if(lvis_file_open(&job.files[k],inputs[k],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	lvis_file_close(&job.files[k]);
+	in->columns = lvis_canon_columns(job.files[k].fileType);
+	for(in->ncolumns=0;in->columns[in->ncolumns].name!=NULL;in->ncolumns++);
+	field = s->field;
+	if(field[0] == 0 && job.files[k].fileType == LVIS_RELEASE_FILETYPE_LGE) field = "zg";
+	if(field[0] == 0 && job.files[k].fileType == LVIS_RELEASE_FILETYPE_LCE) field = "zt";
+	if(field[0] == 0 && job.files[k].fileType == LVIS_RELEASE_FILETYPE_LGW) field = "z0";
+	c = lvis_canon_find_column(job.files[k].fileType,field);
+	in->elevation = (c != NULL) ? c - in->columns : -1;
+	if(in->elevation < 0)
+	  {
+	     fprintf(stderr,"%s (%s) has no numeric field '%s' to summarise, see -field\n",inputs[k],
+		     lvis_file_type_name(job.files[k].fileType),field);
+	     errors++;
+	     continue;
+	  }
+	version = job.files[k].canonical ? job.files[k].sourceVersion : job.files[k].fileVersion;
+	in->rxSamples = (version == ((float)1.04)) ? 528 : 432;
+	in->txSamples = 0;
+	if(version == ((float)1.03)) in->txSamples = 80;
+	if(version == ((float)1.04)) in->txSamples = 120;
+	if(job.files[k].canonical) { in->rxSamples = job.files[k].rxSamples; in->txSamples = job.files[k].txSamples; }
+	in->saturation = (version == ((float)1.04)) ? 1023 : 255;
+	in->trailing = job.files[k].fileSize - job.files[k].dataOffset -
+	  job.files[k].recordCount * job.files[k].recordSize;
+	lvis_summary_clear(&in->acc,job.nz);
+	n = job.files[k].recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+	job.files[k].recordCount = n;
+	in->samples = lvis_sample_count(opt->sample,n);
+	in->block = -1;
+	// a task a block at most, each block at most one task more
+	maxtasks += (long) ((in->samples + LVIS_SUMMARY_CHUNK - 1) / LVIS_SUMMARY_CHUNK);
+	if(opt->sample != NULL && opt->sample->blocks > 0) maxtasks += (long) opt->sample->blocks;
+     }
+   if(errors > 0)
+     {
+	for(k=0;k<ninputs;k++) free(job.inputs[k].acc.zhist);
+	free(job.inputs);
+	free(job.files);
+	return errors;
+     }
+
+   job.tasks = (struct lvis_summary_task *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_summary_task));
+   if(job.tasks == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the task table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     for(first=0;first<job.inputs[k].samples;first+=job.tasks[ntasks++].count)
+       {
+	  job.tasks[ntasks].file  = k;
+	  job.tasks[ntasks].first = first;
+	  job.tasks[ntasks].count = (job.inputs[k].samples - first < LVIS_SUMMARY_CHUNK) ?
+	    job.inputs[k].samples - first : LVIS_SUMMARY_CHUNK;
+	  if(opt->sample != NULL && opt->sample->blocks > 0 &&
+	     opt->sample->blockRecords - first % opt->sample->blockRecords < job.tasks[ntasks].count)
+	    job.tasks[ntasks].count = opt->sample->blockRecords - first % opt->sample->blockRecords;
+       }
+
+   pool = lvis_pool_create(b->nthreads);
+   threads = lvis_pool_threads(pool);
+   lvis_batch_buffers(threads,LVIS_SUMMARY_CHUNK,sizeof(union lvis_canon_record),&job.raw,&job.canon);
+
+   // run the waves, merging wave N while wave N+1 is worked on
+   lvis_batch_waves(pool,0,ntasks,job.files,lvis_summary_task_input,lvis_summary_run,lvis_summary_task_join,&job);
+   errors += job.errors;
+   lvis_pool_destroy(pool);
+   for(k=0;k<ninputs;k++) lvis_summary_block(&job.inputs[k]);
+
+   out = stdout;
+   if(opt->outfile[0] != 0 && (out = fopen(opt->outfile,"w"))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	exit(-1);
+     }
+   if(s->json && ninputs > 1) fprintf(out,"[\n");
+   for(k=0;k<ninputs;k++)
+     {
+	if(s->json)
+	  {
+	     lvis_summary_print_json(out,&job.files[k],&job.inputs[k],s,job.nz,opt->sample);
+	     fprintf(out,"%s\n",(k+1 < ninputs) ? "," : "");
+	     continue;
+	  }
+	if(k > 0) fprintf(out,"\n");
+	lvis_summary_print_text(out,&job.files[k],&job.inputs[k],s,job.nz,opt->sample);
+     }
+   if(s->json && ninputs > 1) fprintf(out,"]\n");
+   if(out != stdout && fclose(out)!=0)
+     {
+	fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	errors++;
+     }
+   fflush(stdout);
+
+   lvis_batch_free_buffers(threads,job.raw,job.canon);
+   for(k=0;k<ninputs;k++) free(job.inputs[k].acc.zhist);
+   free(job.tasks);
+   free(job.inputs);
+   free(job.files);
+   return errors;
+}
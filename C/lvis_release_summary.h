@@ -0,0 +1,57 @@
+#ifndef __LVIS_RELEASE_SUMMARY_H
+#define __LVIS_RELEASE_SUMMARY_H
+
+// lvis_release_summary.h
+//
+// -summary: what is in a file, without converting it.  For every input
+// the detected type and version, the record count (and any bytes past the
+// last whole record), the lon / lat box and lvistime range of the shots,
+// the count, min, max, mean and standard deviation of every numeric field
+// (txwave / rxwave over their valid samples), a histogram of the elevation
+// (-field: zg for LGE, zt for LCE, z0 for LGW) in -zbin metre bins and,
+// for LGW, of the rxwave counts, and data quality counts: nan values,
+// missing ids (the canonical sentinel), lon / lat fields out of range,
+// shots without a usable position and saturated samples.  -json writes
+// the same as one JSON object per input (an array of them for several
+// inputs), nan as null.  Shots outside -lat / -lon / -poly are only
+// counted.
+//
+// The inputs are read once, a chunk of shots a task on the pool, each
+// task into its own accumulators (means and variances by Welford's update)
+// which the calling thread merges in input order, so the figures do not
+// depend on -threads; nothing is formatted until the summary is printed.
+
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_SUMMARY_CHUNK
+#define  LVIS_SUMMARY_CHUNK 4096      // shots per task
+#endif
+
+#define  LVIS_SUMMARY_ZBIN       10.0     // default -zbin (m)
+#define  LVIS_SUMMARY_ZMIN       -1000.0  // elevation histogram range (m), the rest
+#define  LVIS_SUMMARY_ZMAX       9000.0   // counted below / above it
+#define  LVIS_SUMMARY_AMP_BIN    16       // rxwave counts a histogram bin
+#define  LVIS_SUMMARY_AMP_BINS   64       // up to 1023 counts
+#define  LVIS_SUMMARY_MAX_FIELDS 16
+
+struct lvis_summary_options
+{
+   int    enabled;       // -summary
+   int    json;          // -json
+   double zbin;          // -zbin M
+   char   field[64];     // the elevation field (-field, empty = the type's default)
+};
+
+void lvis_summary_defaults(struct lvis_summary_options * s);
+
+// handle the summary options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a summary option)
+int  lvis_summary_parse_option(int argc, char * argv[], int i, struct lvis_summary_options * s);
+
+// summarise the inputs to stdout (or opt->outfile), returns 0 on success
+struct lvis_batch_options;
+int  lvis_summary_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			  struct lvis_batch_options * b, struct lvis_summary_options * s);
+
+#endif
@@ -0,0 +1,466 @@
+// lvis_release_windows.c
+//
+// Instrument health a window of time or shots at a time (-windows), see
+// lvis_release_windows.h.
+//
+// The inputs are split into tasks of LVIS_WINDOWS_CHUNK shots which the
+// pool reads (as canonical records), each task into the runs of shots of
+// the windows it covers; like the metrics mode the tasks run in waves of
+// a few per thread, the calling thread joining wave N onto the window it
+// has open while wave N+1 is worked on.  The delta between the last shot
+// of one task and the first of the next is added by the calling thread,
+// so the rows do not depend on -threads.
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+#include "lvis_release_file.h"
+#include "lvis_release_pool.h"
+#include "lvis_release_batch.h"
+#include "lvis_release_canon.h"
+#include "lvis_release_poly.h"
+#include "lvis_release_windows.h"
+
+static char * lvis_windows_names[LVIS_WINDOWS_FIELDS] = { "range", "incidentangle", "azimuth", "sigmean" };
+
+#define LVIS_WINDOWS_AZIMUTH 2
+
+// the aggregates of a window (or of the run of it one task saw)
+struct lvis_windows_acc
+{
+   int64_t  window;
+   int64_t  shots;
+   double   t0,t1;                          // lvistime of the first and last shot
+   uint32_t sn0,sn1;                        // shotnumber of the first and last shot
+   int64_t  missed,gaps;
+   int64_t  n[LVIS_WINDOWS_FIELDS];
+   double   sum[LVIS_WINDOWS_FIELDS],min[LVIS_WINDOWS_FIELDS],max[LVIS_WINDOWS_FIELDS];
+   double   azsin,azcos;                    // the azimuth as a unit vector
+   int64_t  waves,saturated;
+   double   peaks,peakmax;
+};
+
+struct lvis_windows_input
+{
+   int     field[LVIS_WINDOWS_FIELDS];      // offsets in the record, -1 if none
+   int     shotnumber,lvistime,rxwave;
+   int     rxSamples,saturation;
+   int64_t ordinal;                         // records of the inputs before this one
+};
+
+struct lvis_windows_task
+{
+   int                       file;
+   int64_t                   first,count;
+   struct lvis_windows_acc * runs;
+   long                      nruns,alloc;
+   int                       status;        // 0, -1 on a read error
+};
+
+struct lvis_windows_job
+{
+   struct lvis_release_options * opt;
+   struct lvis_windows_options * w;
+   struct lvis_release_file    * files;
+   struct lvis_windows_input   * inputs;
+   struct lvis_windows_task    * tasks;
+   unsigned char              ** raw;       // per worker
+   unsigned char              ** canon;     // per worker
+   // the join: the window open across the tasks and the totals
+   FILE                        * out;
+   struct lvis_windows_acc       open;
+   int                           opened;
+   int64_t                       windows,shots,missed,gaps;
+   int                           errors;
+};
+
+void lvis_windows_defaults(struct lvis_windows_options * w)
+{
+   w->seconds = 0.0;
+   w->shots = 0;
+   w->gap = LVIS_WINDOWS_GAP;
+}
+
+int lvis_windows_parse_option(int argc, char * argv[], int i, struct lvis_windows_options * w)
+{
+   if(strcmp(argv[i],"-windows")==0 && i+1<argc)
+     {
+	w->seconds = atof(argv[i+1]);
+	if(!(w->seconds > 0.0))
+	  {
+	     fprintf(stderr,"-windows must be a positive number of seconds\n");
+	     exit(-1);
+	  }
+	return 2;
+     }
+   if(strcmp(argv[i],"-windowshots")==0 && i+1<argc)
+     {
+	w->shots = atol(argv[i+1]);
+	if(w->shots < 1)
+	  {
+	     fprintf(stderr,"-windowshots must be at least 1\n");
+	     exit(-1);
+	  }
+	return 2;
+     }
+   if(strcmp(argv[i],"-wingap")==0 && i+1<argc)
+     {
+	w->gap = atof(argv[i+1]);
+	if(!(w->gap > 0.0))
+	  {
+	     fprintf(stderr,"-wingap must be a positive number of seconds\n");
+	     exit(-1);
+	  }
+	return 2;
+     }
+   return 0;
+}
+
+static void lvis_windows_clear(struct lvis_windows_acc * a, int64_t window)
+{
+   int k;
+
+   memset(a,0,sizeof(*a));
+   a->window = window;
+   a->t0 = a->t1 = NAN;
+   a->sn0 = a->sn1 = LVIS_CANON_NO_ID;
+   a->peakmax = NAN;
+   for(k=0;k<LVIS_WINDOWS_FIELDS;k++)
+     {
+	a->min[k] = HUGE_VAL;
+	a->max[k] = -HUGE_VAL;
+     }
+}
+
+// count the step from the shot (psn, pt) to the shot (sn, t) in a
+static void lvis_windows_step(struct lvis_windows_acc * a, uint32_t psn, double pt, uint32_t sn, double t, double gap)
+{
+   int jump = 0;
+
+   if(psn != LVIS_CANON_NO_ID && sn != LVIS_CANON_NO_ID)
+     {
+	if(sn > psn + 1) a->missed += sn - psn - 1;
+	if(sn != psn + 1) jump = 1;
+     }
+   if(t - pt > gap || t < pt) jump = 1;
+   a->gaps += jump;
+}
+
+// join b, the run of shots that follows a in the same window, into a
+static void lvis_windows_join(struct lvis_windows_acc * a, struct lvis_windows_acc * b)
+{
+   int k;
+
+   if(a->shots == 0) { a->t0 = b->t0; a->sn0 = b->sn0; }
+   a->t1 = b->t1;
+   a->sn1 = b->sn1;
+   a->shots += b->shots;
+   a->missed += b->missed;
+   a->gaps += b->gaps;
+   for(k=0;k<LVIS_WINDOWS_FIELDS;k++)
+     {
+	a->n[k] += b->n[k];
+	a->sum[k] += b->sum[k];
+	if(b->min[k] < a->min[k]) a->min[k] = b->min[k];
+	if(b->max[k] > a->max[k]) a->max[k] = b->max[k];
+     }
+   a->azsin += b->azsin;
+   a->azcos += b->azcos;
+   a->waves += b->waves;
+   a->saturated += b->saturated;
+   a->peaks += b->peaks;
+   if(!(b->peakmax <= a->peakmax)) a->peakmax = b->peakmax;
+}
+
+static struct lvis_windows_acc * lvis_windows_open(struct lvis_windows_task * task, int64_t window)
+{
+   if(task->nruns == task->alloc)
+     {
+	task->alloc = (task->alloc > 0) ? 2 * task->alloc : 16;
+	task->runs = (struct lvis_windows_acc *) realloc(task->runs,task->alloc * sizeof(struct lvis_windows_acc));
+	if(task->runs == NULL)
+	  {
+	     fprintf(stderr,"Unable to allocate the windows\n");
+	     exit(-1);
+	  }
+     }
+   lvis_windows_clear(&task->runs[task->nruns],window);
+   return &task->runs[task->nruns++];
+}
+
+static void lvis_windows_run(void * context, long t, int worker)
+{
+   struct lvis_windows_job   * job = (struct lvis_windows_job *) context;
+   struct lvis_windows_task  * task = &job->tasks[t];
+   struct lvis_windows_input * in = &job->inputs[task->file];
+   struct lvis_release_options * opt = job->opt;
+   struct lvis_windows_acc   * a = NULL;
+   int                         fileType = job->files[task->file].fileType;
+   size_t                      size = lvis_record_size(fileType,(float)1.04);
+   unsigned char             * rec;
+   int64_t                     i,got,window;
+   double                      lon,lat,time,v;
+   uint32_t                    sn;
+   float                       f;
+   uint16_t                    s,peak;
+   int                         k,j,saturated;
+
+   task->nruns = 0;
+   got = lvis_canon_read(&job->files[task->file],task->first,task->count,job->raw[worker],job->canon[worker]);
+   if(got != task->count) task->status = -1;
+   for(i=0;i<got;i++)
+     {
+	rec = job->canon[worker] + i * size;
+	release_data_position(rec,fileType,(float)1.04,&lon,&lat);
+	if(!lvis_release_keep(opt,lon,lat))
+	  continue;
+	memcpy(&time,rec + in->lvistime,sizeof(time));
+	memcpy(&sn,rec + in->shotnumber,sizeof(sn));
+	if(job->w->shots > 0) window = (in->ordinal + task->first + i) / job->w->shots;
+	else if(time == time) window = (int64_t) floor(time / job->w->seconds);
+	else continue;   // no time to place it by
+
+	if(a == NULL || window != a->window)
+	  {
+	     a = lvis_windows_open(task,window);
+	     if(task->nruns > 1) lvis_windows_step(a,a[-1].sn1,a[-1].t1,sn,time,job->w->gap);
+	     a->t0 = time;
+	     a->sn0 = sn;
+	  }
+	else lvis_windows_step(a,a->sn1,a->t1,sn,time,job->w->gap);
+	a->t1 = time;
+	a->sn1 = sn;
+	a->shots++;
+
+	for(k=0;k<LVIS_WINDOWS_FIELDS;k++)
+	  {
+	     if(in->field[k] < 0) continue;
+	     memcpy(&f,rec + in->field[k],sizeof(f));
+	     if(f != f) continue;
+	     v = f;
+	     a->n[k]++;
+	     a->sum[k] += v;
+	     if(v < a->min[k]) a->min[k] = v;
+	     if(v > a->max[k]) a->max[k] = v;
+	     if(k != LVIS_WINDOWS_AZIMUTH) continue;
+	     a->azsin += sin(v * M_PI / 180.0);
+	     a->azcos += cos(v * M_PI / 180.0);
+	  }
+
+	if(in->rxwave < 0) continue;
+	peak = 0;
+	saturated = 0;
+	for(j=0;j<in->rxSamples;j++)
+	  {
+	     memcpy(&s,rec + in->rxwave + j * sizeof(uint16_t),sizeof(s));
+	     if(s > peak) peak = s;
+	     if(s >= in->saturation) saturated = 1;
+	  }
+	a->waves++;
+	a->peaks += peak;
+	if(!(peak <= a->peakmax)) a->peakmax = peak;
+	a->saturated += saturated;
+     }
+}
+
+static void lvis_windows_print(FILE * out, struct lvis_windows_acc * a, char * delim)
+{
+   double rate = NAN,dt = a->t1 - a->t0,az;
+   int    k;
+
+   if(dt > 0.0)
+     rate = (a->sn0 != LVIS_CANON_NO_ID && a->sn1 != LVIS_CANON_NO_ID && a->sn1 >= a->sn0) ?
+       (a->sn1 - a->sn0) / dt : (a->shots - 1) / dt;
+   fprintf(out,"%lld%s%.6f%s%.6f%s%lld%s%.3f%s%lld%s%lld",(long long) a->window,delim,a->t0,delim,a->t1,delim,
+	   (long long) a->shots,delim,rate,delim,(long long) a->missed,delim,(long long) a->gaps);
+   for(k=0;k<LVIS_WINDOWS_FIELDS;k++)
+     {
+	if(a->n[k] == 0) { fprintf(out,"%snan%snan%snan",delim,delim,delim); continue; }
+	if(k == LVIS_WINDOWS_AZIMUTH)
+	  {
+	     az = atan2(a->azsin,a->azcos) * 180.0 / M_PI;
+	     if(az < 0.0) az += 360.0;
+	  }
+	else az = a->sum[k] / a->n[k];
+	fprintf(out,"%s%.4f%s%.4f%s%.4f",delim,az,delim,a->min[k],delim,a->max[k]);
+     }
+   if(a->waves == 0) fprintf(out,"%snan%snan%s0\n",delim,delim,delim);
+   else fprintf(out,"%s%.2f%s%.0f%s%lld\n",delim,a->peaks / a->waves,delim,a->peakmax,delim,(long long) a->saturated);
+}
+
+// print the open window and count it in the totals
+static void lvis_windows_emit(struct lvis_windows_job * job)
+{
+   lvis_windows_print(job->out,&job->open,job->opt->delim);
+   job->windows++;
+   job->shots += job->open.shots;
+   job->missed += job->open.missed;
+   job->gaps += job->open.gaps;
+}
+
+static int lvis_windows_task_input(void * context, long t)
+{
+   return ((struct lvis_windows_job *) context)->tasks[t].file;
+}
+
+// a task's runs onto the open window, in order, printing the ones it closes
+static void lvis_windows_task_join(void * context, long t)
+{
+   struct lvis_windows_job  * job = (struct lvis_windows_job *) context;
+   struct lvis_windows_task * task = &job->tasks[t];
+   long                       r;
+
+   if(task->status != 0)
+     {
+	fprintf(stderr,"Short read in %s at record %lld\n",job->files[task->file].filename,(long long) task->first);
+	job->errors++;
+     }
+   for(r=0;r<task->nruns;r++)
+     {
+	if(job->opened && r == 0)
+	  lvis_windows_step(&task->runs[0],job->open.sn1,job->open.t1,task->runs[0].sn0,task->runs[0].t0,job->w->gap);
+	if(job->opened && task->runs[r].window == job->open.window)
+	  {
+	     lvis_windows_join(&job->open,&task->runs[r]);
+	     continue;
+	  }
+	if(job->opened) lvis_windows_emit(job);
+	job->open = task->runs[r];
+	job->opened = 1;
+     }
+   free(task->runs);
+   task->runs = NULL;
+}
+
+int lvis_windows_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			 struct lvis_batch_options * b, struct lvis_windows_options * w)
+{
+   struct lvis_windows_job    job;
+   struct lvis_windows_input * in;
+   struct lvis_pool         * pool;
+   struct lvis_canon_column * c;
+   FILE                     * out;
+   long                       ntasks=0,maxtasks=0;
+   int64_t                    n,first,ordinal=0;
+   float                      version;
+   int                        k,j,threads,errors=0;
+
+   if(w->shots > 0 && w->seconds > 0.0)
+     {
+	fprintf(stderr,"Give one of -windows and -windowshots\n");
+	exit(-1);
+     }
+   memset(&job,0,sizeof(job));
+   job.opt = opt;
+   job.w = w;
+   job.files = (struct lvis_release_file *) calloc(ninputs,sizeof(struct lvis_release_file));
+   job.inputs = (struct lvis_windows_input *) calloc(ninputs,sizeof(struct lvis_windows_input));
+   if(job.files == NULL || job.inputs == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the input table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     {
+	in = &job.inputs[k];
+	if(lvis_file_open(&job.files[k],inputs[k],opt->filetype,opt->dataReleaseVersion,opt->myendian)!=0)
+	  { errors++; continue; }
+	lvis_file_close(&job.files[k]);
+	version = job.files[k].canonical ? job.files[k].sourceVersion : job.files[k].fileVersion;
+	if(w->seconds > 0.0 && version < ((float)1.02))
+	  {
+	     fprintf(stderr,"%s (%s %.2f) has no lvistime to cut -windows by, see -windowshots\n",inputs[k],
+		     lvis_file_type_name(job.files[k].fileType),version);
+	     errors++;
+	     continue;
+	  }
+	for(j=0;j<LVIS_WINDOWS_FIELDS;j++) in->field[j] = -1;
+	in->rxwave = -1;
+	for(c=lvis_canon_columns(job.files[k].fileType);c->name!=NULL;c++)
+	  {
+	     for(j=0;j<LVIS_WINDOWS_FIELDS;j++)
+	       if(strcmp(c->name,lvis_windows_names[j])==0) in->field[j] = c->offset;
+	     if(strcmp(c->name,"shotnumber")==0) in->shotnumber = c->offset;
+	     if(strcmp(c->name,"lvistime")==0) in->lvistime = c->offset;
+	     if(strcmp(c->name,"rxwave")==0) in->rxwave = c->offset;
+	  }
+	in->rxSamples = (version == ((float)1.04)) ? 528 : 432;
+	if(job.files[k].canonical) in->rxSamples = job.files[k].rxSamples;
+	in->saturation = (version == ((float)1.04)) ? 1023 : 255;
+	n = job.files[k].recordCount;
+	if(opt->maxSampleNumber > 0 && opt->maxSampleNumber < n) n = opt->maxSampleNumber;
+	job.files[k].recordCount = n;
+	in->ordinal = ordinal;
+	ordinal += n;
+	maxtasks += (long) ((n + LVIS_WINDOWS_CHUNK - 1) / LVIS_WINDOWS_CHUNK);
+     }
+   if(errors > 0)
+     {
+	free(job.inputs);
+	free(job.files);
+	return errors;
+     }
+
+   job.tasks = (struct lvis_windows_task *) calloc(maxtasks > 0 ? maxtasks : 1,sizeof(struct lvis_windows_task));
+   if(job.tasks == NULL)
+     {
+	fprintf(stderr,"Unable to allocate the task table\n");
+	exit(-1);
+     }
+   for(k=0;k<ninputs;k++)
+     for(first=0;first<job.files[k].recordCount;first+=LVIS_WINDOWS_CHUNK)
+       {
+	  job.tasks[ntasks].file  = k;
+	  job.tasks[ntasks].first = first;
+	  job.tasks[ntasks].count = (job.files[k].recordCount - first < LVIS_WINDOWS_CHUNK) ?
+	    job.files[k].recordCount - first : LVIS_WINDOWS_CHUNK;
+	  ntasks++;
+       }
+
+   out = stdout;
+   if(opt->outfile[0] != 0 && (out = fopen(opt->outfile,"w"))==NULL)
+     {
+	fprintf(stderr,"Error opening the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	exit(-1);
+     }
+   if(opt->topcol == 1)
+     {
+	fprintf(out,"window%sstart%send%sshots%srate%smissed%sgaps",opt->delim,opt->delim,opt->delim,opt->delim,
+		opt->delim,opt->delim);
+	for(k=0;k<LVIS_WINDOWS_FIELDS;k++)
+	  fprintf(out,"%s%s_mean%s%s_min%s%s_max",opt->delim,lvis_windows_names[k],opt->delim,lvis_windows_names[k],
+		  opt->delim,lvis_windows_names[k]);
+	fprintf(out,"%speak_mean%speak_max%ssaturated\n",opt->delim,opt->delim,opt->delim);
+     }
+
+   pool = lvis_pool_create(b->nthreads);
+   threads = lvis_pool_threads(pool);
+   lvis_batch_buffers(threads,LVIS_WINDOWS_CHUNK,sizeof(union lvis_canon_record),&job.raw,&job.canon);
+
+   // run the waves, joining wave N while wave N+1 is worked on
+   job.out = out;
+   lvis_batch_waves(pool,0,ntasks,job.files,lvis_windows_task_input,lvis_windows_run,lvis_windows_task_join,&job);
+   errors += job.errors;
+   lvis_pool_destroy(pool);
+   if(job.opened) lvis_windows_emit(&job);
+
+   if(out != stdout && fclose(out)!=0)
+     {
+	fprintf(stderr,"Error closing the output file: %s (%s)\n",opt->outfile,strerror(errno));
+	errors++;
+     }
+   fflush(stdout);
+   fprintf(stderr,"%lld windows of %lld shots, %lld shotnumbers missing, %lld gaps\n",(long long) job.windows,
+	   (long long) job.shots,(long long) job.missed,(long long) job.gaps);
+
+   lvis_batch_free_buffers(threads,job.raw,job.canon);
+   free(job.tasks);
+   free(job.inputs);
+   free(job.files);
+   return errors;
+}
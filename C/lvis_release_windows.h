@@ -0,0 +1,53 @@
+#ifndef __LVIS_RELEASE_WINDOWS_H
+#define __LVIS_RELEASE_WINDOWS_H
+
+// lvis_release_windows.h
+//
+// -windows: instrument health over time.  The shots of the inputs (one
+// flight, in input order) are cut into windows of -windows S seconds of
+// lvistime or of -windowshots N records, and each window is one text row:
+// its index, first and last lvistime, shots, the shot rate (shotnumbers
+// fired a second), the shotnumbers missing and the gaps (a shotnumber
+// jump or more than -wingap seconds between two shots), then the mean,
+// min and max of range, incidentangle, azimuth (a circular mean) and
+// sigmean, and for LGW the mean and max rxwave peak and the shots with a
+// saturated sample.  Fields a release does not have are nan.  A window is
+// a run of shots falling in it, so a flight that goes back in time opens
+// a new one.  -lat / -lon / -poly drop shots first (they show as gaps).
+//
+// A window keeps sums, mins and maxes only, whatever its length.  The
+// inputs are read a chunk of shots a task on the pool, each task
+// aggregating its shots into the windows it covers; the calling thread
+// joins the windows two tasks share (and the gap between them) in input
+// order and writes each window as soon as it is closed.
+
+#include "lvis_release_structures.h"
+#include "lvis_release_reader.h"
+
+#ifndef  LVIS_WINDOWS_CHUNK
+#define  LVIS_WINDOWS_CHUNK 16384     // shots per task
+#endif
+
+#define  LVIS_WINDOWS_GAP    0.1      // default -wingap (s)
+#define  LVIS_WINDOWS_FIELDS 4        // range, incidentangle, azimuth, sigmean
+
+struct lvis_windows_options
+{
+   double seconds;       // -windows S (0 = not given)
+   long   shots;         // -windowshots N (0 = not given)
+   double gap;           // -wingap S
+};
+
+void lvis_windows_defaults(struct lvis_windows_options * w);
+
+// handle the window options at argv[i], returns the number of arguments
+// consumed (0 if argv[i] is not a window option)
+int  lvis_windows_parse_option(int argc, char * argv[], int i, struct lvis_windows_options * w);
+
+// write the windows of the inputs to stdout (or opt->outfile), returns 0
+// on success
+struct lvis_batch_options;
+int  lvis_windows_convert(char ** inputs, int ninputs, struct lvis_release_options * opt,
+			  struct lvis_batch_options * b, struct lvis_windows_options * w);
+
+#endif